@@ -0,0 +1,53 @@
+/**
+ * codec.h
+ *
+ * BRIEF:
+ * Compact encodings of tensors, used by the model files. Values are encoded as row-major
+ * matrices, so that the per-column encodings map onto the output channels of a layer's
+ * weights.
+ *
+ * NOTE:
+ * Encoded data is little-endian, like the rest of the model files. Decoders check the
+ * data against its expected size and never read or write out of bounds, but do not
+ * detect corruption that keeps it well-formed: the files' checksums do.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "core/tensor.h"
+
+typedef enum {
+  CODEC_RAW,         // tnsr_type_t values as they are.
+  CODEC_FP16,        // IEEE 754 half precision. Values out of its range fail to encode.
+  CODEC_BF16,        // bfloat16, fp32's exponent range with 7 significand bits.
+  CODEC_INT8,        // Symmetric 8-bit integers, one tnsr_type_t scale per column. Finite only.
+  CODEC_SHUFFLE_LZ,  // Lossless. The values' bytes grouped by significance, then LZ77 coded.
+  CODEC_COUNT
+} codec_t;
+
+// Largest encoded size of a rows x cols matrix, in bytes.
+size_t codec_bound(codec_t codec, tnsr_size_t rows, tnsr_size_t cols);
+
+// Encodes a rows x cols matrix into out, which holds at least codec_bound bytes.
+// Size of the encoded data, 0 upon failure.
+size_t codec_encode(
+    codec_t codec,
+    const tnsr_type_t *values,
+    tnsr_size_t rows,
+    tnsr_size_t cols,
+    void *out
+);
+
+// Decodes size bytes of encoded data into the rows x cols matrix values.
+// false if the data does not decode to exactly rows x cols values.
+bool codec_decode(
+    codec_t codec,
+    const void *data,
+    size_t size,
+    tnsr_size_t rows,
+    tnsr_size_t cols,
+    tnsr_type_t *values
+);
@@ -0,0 +1,72 @@
+/**
+ * distributed.h
+ *
+ * BRIEF:
+ * Multi-process data parallelism. Declares the transport interface
+ * processes exchange data through, and the collectives built on top of it.
+ *
+ * NOTE:
+ * Collectives only rely on the transport's exchange and barrier operations,
+ * so other transports (e.g. sockets) can be plugged in without changes.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "core/tensor.h"
+
+typedef struct dist_transport dist_transport_t;
+
+// Transport interface. Implementations embed it as their first member.
+struct dist_transport {
+  size_t rank;
+  size_t world_size;
+
+  // Sends send_count values to peer `to` while receiving recv_count values from peer `from`.
+  // Either count may be 0. Must make progress on both directions at once, as ring
+  // collectives have every rank send and receive simultaneously.
+  bool (*exchange)(
+      dist_transport_t *t,
+      size_t to,
+      const tnsr_type_t *send,
+      size_t send_count,
+      size_t from,
+      tnsr_type_t *recv,
+      size_t recv_count
+  );
+
+  // Blocks until every rank has reached the barrier.
+  bool (*barrier)(dist_transport_t *t);
+
+  // Detaches from the communicator and deallocates the transport.
+  void (*destroy)(dist_transport_t *t);
+
+  // Scratch space used by the collectives.
+  tnsr_type_t *scratch;
+  size_t scratch_count;
+};
+
+// Joins (or creates) the shared-memory communicator `name` of world_size processes.
+// Ranks are assigned in joining order. Only ring neighbours exchange data.
+// NULL upon failure.
+dist_transport_t *dist_shm_create(const char *name, size_t world_size);
+
+// Detaches from the communicator, and sets the pointer to NULL.
+// Passing NULL is a no-op.
+void dist_transport_destroy(dist_transport_t **t);
+
+// Forks world_size - 1 copies of the calling process, which then join the same
+// communicator through dist_shm_create. Returns true in every process.
+// POSIX only, processes have to be launched externally otherwise.
+bool dist_spawn(size_t world_size);
+
+// Blocks until every rank has reached the barrier.
+bool dist_barrier(dist_transport_t *t);
+
+// Replaces data on every rank with its mean across ranks, through a ring all-reduce.
+bool dist_allreduce_mean(dist_transport_t *t, tnsr_type_t *data, size_t count);
+
+// Replaces data on every rank with the data of the root rank.
+bool dist_broadcast(dist_transport_t *t, tnsr_type_t *data, size_t count, size_t root);
@@ -2,39 +2,55 @@
  * graph.h
  *
  * BRIEF:
- * Declaration for grph_t and node_t structs,
+ * Declaration for the grph_t struct,
  * as well as related functions.
+ *
+ * NOTE:
+ * Nodes are stored as a struct-of-arrays inside the graph.
+ * Dependencies are stored as a CSR edge list, where the dependencies
+ * of node i are edges[edge_offsets[i] .. edge_offsets[i + 1]).
  */
 
 #pragma once
 
+#include <omp.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include "core/tensor.h"
 
+// Graph ids are 32-bit by default. Define GRPH_NARROW_IDS for 16-bit ids.
+#ifdef GRPH_NARROW_IDS
 typedef uint16_t grph_size_t;
+  #define GRPH_MAX_SIZE UINT16_MAX
+#else
+typedef uint32_t grph_size_t;
+  #define GRPH_MAX_SIZE UINT32_MAX
+#endif
 
 #define GRPH_INITCPCTY 64
-#define GRPH_MAX_SIZE UINT16_MAX
-#define GRPH_ERR_ID UINT16_MAX
-#define GRPH_NO_INPUT_ID UINT16_MAX
-#define NODE_INIT_DEP_CPCTY 2
+#define GRPH_ERR_ID GRPH_MAX_SIZE
+#define GRPH_NO_INPUT_ID GRPH_MAX_SIZE
+#define GRPH_MAX_DEPS 2  // Of fixed-arity nodes.
+#define GRPH_VARIADIC GRPH_MAX_SIZE  // Input requirement of nodes taking any number of inputs.
+#define GRPH_GRAD_LOCKS 64  // Stripes of the locks serializing gradient accumulation.
 
 /* -------------------------------- Accessors ------------------------------- */
 
-#define GRPH_NODE(g, i) ((g)->adj_list[i])
-#define GRPH_NODE_TRANSIENT(g, i) ((g)->adj_list[i]->transient)
-#define GRPH_NODE_DATA(g, i) ((g)->adj_list[i]->data)
-#define GRPH_NODE_GRAD(g, i) ((g)->adj_list[i]->grad)
-#define GRPH_NODE_TYPE(g, i) ((g)->adj_list[i]->type)
-#define GRPH_NODE_NDEP(g, i) ((g)->adj_list[i]->n_dependencies)
-#define GRPH_NODE_NDEP_CPCTY(g, i) ((g)->adj_list[i]->n_deps_capacity)
-#define GRPH_NODE_DEPS(g, i) ((g)->adj_list[i]->dependencies)
+#define GRPH_NODE_TRANSIENT(g, i) ((g)->transient[i])
+#define GRPH_NODE_DATA(g, i) ((g)->data[i])
+#define GRPH_NODE_GRAD(g, i) ((g)->grad[i])
+#define GRPH_NODE_TYPE(g, i) ((g)->types[i])
+#define GRPH_NODE_ATTR(g, i) ((g)->attrs[i])
+#define GRPH_NODE_AUX(g, i) ((g)->aux[i])
+#define GRPH_NODE_CONSUMERS(g, i) ((g)->consumers[i])
+#define GRPH_NODE_NDEP(g, i) ((grph_size_t)((g)->edge_offsets[(i) + 1] - (g)->edge_offsets[i]))
+#define GRPH_NODE_DEPS(g, i) (&(g)->edges[(g)->edge_offsets[i]])
 
 #define GRPH_CPCTY(g) ((g)->capacity)
 #define GRPH_NODES(g) ((g)->nodes)
-#define GRPH_LIST(g) ((g)->adj_list)
+#define GRPH_EDGES(g) ((g)->edge_offsets[(g)->nodes])
 
 /* ----------------------------------- API ---------------------------------- */
 
@@ -54,6 +70,10 @@ typedef enum {
   NDTYPE_CATEGORICAL_CROSS_ENTROPY_LOSS,
   NDTYPE_BINARY_CROSS_ENTROPY_LOSS,
   NDTYPE_SOFTMAX,
+  NDTYPE_SHARDED_AFFINE,   // X * [W0 | W1 ..] + [B0 | B1 ..], inputs X, W0, B0, W1, B1...
+  NDTYPE_SHARDED_SOFTMAX,  // Softmax of NDTYPE_SHARDED_AFFINE, normalized shard by shard.
+  NDTYPE_CONV,             // Convolution of the images in the rows of X, inputs X, W, B.
+  NDTYPE_EMBED,            // [W[X0] + B | W[X1] + B ..], rows gathered by id, input X.
 } node_type_t;
 
 #define _GRPH_INPUT_TBLE                                                               \
@@ -61,7 +81,8 @@ typedef enum {
   [NDTYPE_ESUB] = 2, [NDTYPE_EMUL] = 2, [NDTYPE_EDIV] = 2, [NDTYPE_ESIGMOID] = 1,      \
   [NDTYPE_ERELU] = 1, [NDTYPE_ELEAKYRELU] = 1, [NDTYPE_ETANH] = 1, [NDTYPE_MSE] = 2,    \
   [NDTYPE_CATEGORICAL_CROSS_ENTROPY_LOSS] = 2, [NDTYPE_BINARY_CROSS_ENTROPY_LOSS] = 2, \
-  [NDTYPE_SOFTMAX] = 1,
+  [NDTYPE_SOFTMAX] = 1, [NDTYPE_SHARDED_AFFINE] = GRPH_VARIADIC,                       \
+  [NDTYPE_SHARDED_SOFTMAX] = GRPH_VARIADIC, [NDTYPE_CONV] = 3, [NDTYPE_EMBED] = 1,
 
 typedef enum {
   OUTSIZE_DEP_ON_A0 = 1,
@@ -72,19 +93,109 @@ typedef enum {
   OUTSIZE_TRANSPOSED = (1 << 5),
   OUTSIZE_SCALAR = (1 << 6),
   OUTSIZE_INDEPENDENT = (1 << 7),
+  OUTSIZE_SHARDED = (1 << 8),  // Rows of the first input, summed columns of the shards.
+  OUTSIZE_CONV = (1 << 9),     // Rows of the first input, columns of the (pooled) feature maps.
+  OUTSIZE_GATHERED = (1 << 10),  // Rows of the first input, its columns times the table's.
 } grph_outsize_t;
 
-typedef struct node node_t;
+// Attributes of NDTYPE_CONV nodes. Images are stored one per row, as height x width x
+// channels values. The weights hold one filter per column, of kernel_height x kernel_width x
+// channels values in the same order, and the output holds the feature maps of every filter in
+// the same layout, each position's filters being consecutive.
+typedef struct {
+  tnsr_size_t height;
+  tnsr_size_t width;
+  tnsr_size_t channels;
+  tnsr_size_t kernel_height;
+  tnsr_size_t kernel_width;
+  tnsr_size_t filters;
+  tnsr_size_t stride;   // 0 is treated as 1.
+  tnsr_size_t padding;  // Zeroes around each side of the images.
+  tnsr_size_t pool;     // Window and stride of a fused max-pooling, 0 or 1 to disable.
+} grph_conv_t;
+
+#define GRPH_EMBED_UNLISTED TNSR_MAX_SIZE  // Slot of the rows without a gradient.
+
+// Attributes of NDTYPE_EMBED nodes, the table W rows are gathered from and its biases B.
+// Their gradient is sparse. The backward pass lists the rows it reaches, and adds up their
+// gradients side by side after those of the biases, under the lock, so that nodes sharing
+// the attributes may run concurrently. Listed rows stay so until the owner clears them.
+typedef struct {
+  const tnsr_t *table;
+  const tnsr_t *biases;
+  tnsr_size_t *rows;      // Listed rows, in the order they were reached.
+  tnsr_size_t row_count;
+  tnsr_size_t capacity;   // Rows that rows and grads have room for.
+  tnsr_size_t *slots;     // Index in rows of every row of the table.
+  tnsr_type_t *grads;     // Of the biases, then of the listed rows.
+  omp_lock_t lock;
+} grph_embed_t;
+
+typedef enum {
+  GRPH_MODE_EAGER,
+  GRPH_MODE_DEFERRED,
+} grph_mode_t;
+
+typedef enum {
+  GRPH_STEP_NODE,         // Evaluates a single node.
+  GRPH_STEP_FUSED_AFFINE, // Evaluates X * W + B into the addition node, skipping the contraction.
+} grph_step_type_t;
+
+typedef struct {
+  grph_step_type_t type;
+  grph_size_t node;
+} grph_step_t;
+
+typedef struct {
+  grph_size_t output;
+  grph_size_t steps_count;
+  bool executed;
+  grph_step_t steps[];
+} grph_plan_t;
+
 typedef struct {
   grph_size_t nodes;
   grph_size_t capacity;
-  node_t *adj_list[];
+  size_t edge_capacity;
+  grph_mode_t mode;
+  bool forward_only;  // Nodes have no gradients, the graph is run but never traced.
+  // Precision the values of operation nodes are rounded to in place once computed, in an
+  // extra pass. They are still stored as tnsr_type_t. Losses and the probabilities they
+  // read, and data nodes, are not rounded.
+  tnsr_precision_t precision;
+  tnsr_type_t loss_scale;  // Gradient loss nodes seed the backward pass with.
+
+  // Serialize the accumulations into the gradient of node i, through stripe
+  // i % GRPH_GRAD_LOCKS, when several concurrently traced consumers may push into it.
+  omp_lock_t grad_locks[GRPH_GRAD_LOCKS];
+
+  // Node fields, each array holds `capacity` entries.
+  // All arrays are carved out of a single allocation starting at `data`.
+  tnsr_t **data;
+  tnsr_t **grad;
+  node_type_t *types;
+  bool *transient;
+  const void **attrs;  // Attributes of parameterized operations, not owned.
+  tnsr_t **aux;        // Kept from an operation's forward to its backward pass, or scratch.
+  grph_size_t *consumers;  // Edges into each node, once per dependency of its consumers.
+
+  // CSR edge list. edge_offsets holds `capacity + 1` entries.
+  size_t *edge_offsets;
+  grph_size_t *edges;
 } grph_t;
 
 // Initializes a graph with a set capacity.
 // Passing 0 defaults to GRPH_INITCPCTY.
 grph_t *grph_create(grph_size_t cpcty);
 
+// Initializes a graph in deferred mode, where grph_execute only records
+// operations and their shapes. Evaluate the graph through grph_compile and grph_run.
+grph_t *grph_create_deferred(grph_size_t cpcty);
+
+// Initializes a deferred graph for inference only. Its nodes have no gradients, the
+// gradients of parameters appended to it are left unbound, and it cannot be traced.
+grph_t *grph_create_forward(grph_size_t cpcty);
+
 // Deallocates the graph and sets its pointer to NULL.
 // Passing NULL is a no-op.
 void grph_destroy(grph_t **g);
@@ -95,12 +206,47 @@ void grph_destroy(grph_t **g);
 // can reallocate should it exceed capacity.
 grph_size_t grph_append_data(grph_t **g, tnsr_t *node);
 
+// Adds a parameter node whose gradient accumulates into the externally owned grad tensor.
+// The graph does not take ownership of either tensor. grad may be NULL in forward-only graphs.
+grph_size_t grph_append_param(grph_t **g, tnsr_t *data, tnsr_t *grad);
+
 // Eagerly executes the operation specified by ntype on A and B. Unary operations must
 // set A and set B to GRPH_NO_INPUT. The operation is then appended to the graph afterwards,
 // and returns its index in the adjacency list. This operation INVALIDATES existing pointers.
 // As the graph can reallocate should it exceed its current capacity.
+// Deferred graphs only record the operation.
 grph_size_t grph_execute(grph_t **g, grph_size_t a, grph_size_t b, node_type_t ntype);
 
+// Same as grph_execute, for operations on any number of inputs. The count must match the
+// operation's requirement unless it is GRPH_VARIADIC.
+grph_size_t grph_execute_n(
+    grph_t **g, const grph_size_t *deps, grph_size_t ndeps, node_type_t ntype
+);
+
+// Same as grph_execute_n, for operations parameterized by attributes, which must outlive
+// the graph. Those of NDTYPE_EMBED hold its parameters' gradient, and are written to.
+grph_size_t grph_execute_attr(
+    grph_t **g, const grph_size_t *deps, grph_size_t ndeps, node_type_t ntype, const void *attr
+);
+
+// Output rows and columns of the feature maps of a convolution, before pooling. Returns the
+// values per image of its output, after pooling. 0 when the kernel does not fit the images.
+tnsr_size_t grph_conv_output(const grph_conv_t *conv, tnsr_size_t *height, tnsr_size_t *width);
+
+// Builds an execution plan for the nodes that OUTPUT depends on.
+// Runs dead-node elimination and operator fusion, and releases the buffers
+// of fused intermediates. No operations may be appended afterwards.
+grph_plan_t *grph_compile(grph_t *g, grph_size_t output);
+
+// Evaluates a compiled plan. Gradients are reset when a plan is re-run, except in
+// forward-only graphs, which have none.
+bool grph_run(grph_t *g, grph_plan_t *plan);
+
+// Deallocates the plan and sets its pointer to NULL.
+// Passing NULL is a no-op.
+void grph_plan_destroy(grph_plan_t **plan);
+
 // Traces the graph backwards and fills in the gradient fields for each node.
-// Does a Topological sort of the graph and returns the order of execution.
+// Nodes are scheduled as soon as all of their consumers have pushed their gradients,
+// such that independent branches of the graph run concurrently.
 bool grph_trace(grph_t *g);
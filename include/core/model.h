@@ -9,28 +9,58 @@
 #pragma once
 
 #include <stddef.h>
+#include "core/codec.h"
+#include "core/distributed.h"
 #include "core/graph.h"
 #include "core/network.h"
 
 typedef struct {
-  grph_size_t neuron_count;
+  tnsr_size_t neuron_count;  // Ignored by convolution layers, sized by their geometry.
   initialization_t initialization_function;
   node_type_t activation_function;
+  size_t shard_count;  // Column shards evaluated by separate workers, 0 or 1 to disable.
+  // Geometry of a convolution layer, 0 filters for a fully connected layer. Its images are
+  // the previous layer's output, or the input. Not supported with shards.
+  grph_conv_t conv;
 } layer_config_t;
 
 typedef struct model model_t;
 
+// Background writer of a running fit's checkpoints.
+typedef struct model_checkpointer model_checkpointer_t;
+
+// Inference workspace of a model, see model_session_create.
+typedef struct model_session model_session_t;
+
+typedef enum {
+  FIT_SYNC,     // Workers split each batch, gradients are reduced before every update.
+  FIT_HOGWILD,  // Workers pull their own batches and update the shared weights lock-free.
+  FIT_PIPELINE, // Stages of consecutive layers pass micro-batches along in a 1F1B schedule.
+} fit_mode_t;
+
 typedef struct {
   size_t epoch_count;
   size_t pass_count;
   tnsr_type_t training_loss;
+  size_t update_count;    // Optimizer steps applied to the shared weights.
+  size_t max_staleness;   // Most updates applied by other workers during a single step.
+  double mean_staleness;  // Always 0 in synchronous mode.
+  double elapsed_seconds;  // Wall-clock duration of the last model_fit.
+  double time_to_target;   // Seconds until training_loss first reached target_loss, or NAN.
+  tnsr_type_t loss_scale;  // Dynamic loss scale of reduced precisions, 1 in TNSR_FP32.
+  size_t skipped_steps;    // Optimizer steps skipped as their gradients overflowed.
+  size_t stable_steps;     // Steps since the loss scale last changed.
+  // Position model_fit starts from, advanced as batches complete. Set by model_resume, and
+  // reset once a fit completes.
+  size_t next_epoch;
+  size_t next_pass;
 } model_state_t;
 
 typedef struct {
   bool show_dashboard;
   size_t passes_interval;
   void (*dashboard_callback)(
-      const grph_t *graph,
+      const grph_t *graph,  // NULL in FIT_PIPELINE mode, where no single graph spans the model.
       const model_t *model,
       const tnsr_t *input,
       const tnsr_t *output,
@@ -38,15 +68,59 @@ typedef struct {
   );
 } dashboard_config_t;
 
+// Iterative prune and fine-tune schedule of model_fit. Pruned parameters stay zero.
+typedef struct {
+  tnsr_type_t sparsity;     // Of every layer's weights after the last round, 0 to disable.
+  tnsr_type_t neuron_norm;  // Neurons of at most this outgoing L2 norm are removed, 0 to disable.
+  size_t rounds;       // Rounds of the schedule, over which the sparsity ramps up cubically.
+  size_t interval;     // Epochs of fine-tuning between rounds. 0 is treated as 1.
+  size_t first_epoch;  // Epoch at the end of which the first round runs.
+} pruning_config_t;
+
+// Checkpoints model_fit writes for model_resume. Only written by rank 0 of a transport.
+typedef struct {
+  char *location;   // Overwritten by every checkpoint, NULL to disable.
+  size_t interval;  // Optimizer steps between checkpoints, 0 for one per epoch.
+  // Checkpoints retained, the newest at location and the older ones at location.1 ...
+  // 0 or 1 keeps only the newest.
+  size_t keep;
+  // Written by a background thread from a snapshot of the training state, while training
+  // continues. A snapshot still waiting for the writer is replaced by the next one.
+  bool background;
+  // Bytes saved and restored along with the checkpoints, NULL if none. Typically the state
+  // of the data callback's RNG, so that a resumed fit draws the batches it would have.
+  void *data_state;
+  size_t data_state_size;
+} checkpoint_config_t;
+
 typedef struct {
   size_t epochs;                   
   size_t network_depth;          
   size_t batch_size;              
   size_t data_size;            
+  size_t worker_count;  // Data-parallel worker threads, fixed at creation. 0 or 1 to disable.
+  fit_mode_t fit_mode;
+  size_t pipeline_stages;    // Stages of FIT_PIPELINE, capped to network_depth.
+  size_t micro_batch_count;  // Micro-batches per batch in FIT_PIPELINE, 0 for one per stage.
+  // Batches whose mean gradient makes up one optimizer step, 0 or 1 to disable.
+  // The optimizer batch grows to accumulation_steps * batch_size, graph memory does not.
+  // Not supported in FIT_HOGWILD mode.
+  size_t accumulation_steps;
+  // Precision activations and their gradients are rounded to once computed. Their storage,
+  // the weights, gradients and optimizer state stay in tnsr_type_t, so memory is not reduced.
+  // Reduced precisions scale the loss dynamically, and skip the steps whose gradients
+  // overflow. Not supported in FIT_HOGWILD mode.
+  tnsr_precision_t precision;
+  pruning_config_t pruning;
+  dist_transport_t *transport;  // Multi-process data parallelism, NULL to disable. Not owned.
+  tnsr_type_t target_loss;  // Loss time_to_target is measured against, 0 to disable.
+  // Written at step boundaries in FIT_SYNC and FIT_PIPELINE modes, between epochs in
+  // FIT_HOGWILD mode, where updates are always in flight.
+  checkpoint_config_t checkpoint;
   layer_config_t *network;     
   dashboard_config_t dashboard;    
-  grph_size_t input_size;         
-  grph_size_t output_size;         
+  tnsr_size_t input_size;         
+  tnsr_size_t output_size;         
   optimizer_t optimizer_method;   
   tnsr_type_t learning_rate;       
   node_type_t loss_function_type;  
@@ -59,9 +133,28 @@ typedef struct {
   void *context;
 } model_config_t;
 
+// Flat, aligned storage for the whole model. Layers hold views into these buffers
+// and are laid out back to back as L0[W, B] -> L1[W, B].
+typedef struct {
+  tnsr_type_t *params;
+  tnsr_type_t *grads;
+  tnsr_type_t *state;       // Optimizer state, NULL when the optimizer is stateless.
+  tnsr_size_t param_count;  // Length of params and grads.
+  tnsr_size_t state_count;  // Length of state.
+  tnsr_type_t *replica_grads;  // Gradients of data-parallel workers 1.., replica_stride apart.
+  tnsr_size_t replica_stride;  // param_count rounded up to whole cache lines.
+  tnsr_type_t *accum_grads;    // Gradient sum of the pending batches, NULL unless accumulating.
+  tnsr_type_t *mask;           // Pruning mask of the parameters, NULL unless pruning.
+  void *mapping;        // Read-only file mapping params points into, NULL when params is owned.
+  size_t mapping_size;  // Length of mapping.
+} model_arena_t;
+
 typedef struct model {
   model_config_t config;    
   model_state_t state;     
+  model_arena_t arena;
+  dense_layer_t **replicas;  // Layer replicas of workers 1.., network_depth per worker.
+  model_checkpointer_t *checkpointer;  // Of the running fit, NULL unless writing in background.
   dense_layer_t *layers[];  
 } model_t;
 
@@ -72,22 +165,77 @@ model_t *model_create(model_config_t *config);
 // Passing NULL is a no-op.
 void model_destroy(model_t **m);
 
-// Saves the model weights to disk.
+// Saves the model weights to disk, streaming them from the layers into a versioned file of
+// checksummed sections with cache-line aligned payloads.
 // DOES NOT save:
 // dashboard_callback,
 // context,
 // data_callback.
 bool model_save(model_t *m, char *location);
 
-// Loads a model from disk.
+// Saves the model like model_save, with the layers' weights and biases encoded by codec.
+// CODEC_INT8 keeps the biases in full precision. model_load decodes the layers in parallel,
+// model_load_mapped cannot load encoded files.
+bool model_save_encoded(model_t *m, char *location, codec_t codec);
+
+// Loads a model from disk, checking every section against its checksum.
+// Also reads files of the legacy unversioned format.
 model_t *model_load(char *location);
 
-// Trains a model.
+// Loads a model from disk, viewing its parameters in place in a read-only, shared mapping
+// of the file instead of reading them. Nothing is copied or initialized, pages are read on
+// first use, and processes mapping the same file share their physical pages.
+// The model can infer, sparsify and be saved to another location, but not be trained or
+// pruned. The file must not be modified until the model is destroyed. Parameters are not
+// checked against their checksum, which would read them all up front.
+model_t *model_load_mapped(char *location);
+
+// Saves the model along with its training state: optimizer state, pruning mask, step counters,
+// loss scale, the position model_fit continues from, and the configured data state.
+// Checkpoints are model files, model_load reads their weights. The file is replaced
+// atomically and flushed to disk, so that a crash leaves either checkpoint intact.
+bool model_checkpoint(model_t *m, char *location);
+
+// Restores a checkpoint into a model created from the configuration it was written with, so
+// that model_fit continues where the checkpointed fit stopped, mid-epoch if need be.
+// The model is left untouched upon failure.
+bool model_resume(model_t *m, char *location);
+
+// Trains a model, using the configured fit mode.
 bool model_fit(model_t *m);
 
+// Prunes every layer's weights by magnitude to the given sparsity, then removes the neurons
+// whose outgoing weights have an L2 norm of at most neuron_norm, 0 to skip. Pruned
+// parameters stay zero through further training if the model was configured for pruning.
+bool model_prune(model_t *m, tnsr_type_t sparsity, tnsr_type_t neuron_norm);
+
+// Builds the block-sparse form of every layer sparse enough to benefit from it, which
+// model_infer then evaluates. Further training drops them.
+bool model_sparsify(model_t *m);
+
 // Does a forward-pass on the given model with the given data.
+// Binds the model's layers to its graph, so calls on the same model must not overlap.
+// Concurrent callers use a session each.
 tnsr_t *model_infer(model_t *m, tnsr_t *data);
 
+// Creates an inference session of the model for batches of up to max_batch rows. The graph
+// and every activation buffer are allocated and planned once, so that inferring through the
+// session does not allocate, except for the scratch of convolution and sharded layers.
+// Evaluates the dense weights, also of sparsified layers. Must not outlive the model, which
+// must not be trained while the session infers. NULL upon failure.
+// Creating and using a session only reads the model: any number of threads may create and
+// infer through sessions of the same model concurrently, as long as each session is used
+// by one thread at a time.
+model_session_t *model_session_create(const model_t *m, tnsr_size_t max_batch);
+
+// Deallocates the session and sets the pointer to NULL.
+// Passing NULL is a no-op.
+void model_session_destroy(model_session_t **s);
+
+// Infers the rows of input, at most the session's max_batch, into the caller's output tensor
+// of as many rows and output_size columns.
+bool model_session_infer(model_session_t *s, const tnsr_t *input, tnsr_t *output);
+
 // Generic training debugging dashboard.
 void model_generic_dashboard(
     const grph_t *graph,
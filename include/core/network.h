@@ -4,9 +4,6 @@
  * BRIEF:
  * Declarations for layer type
  * structs and their functions.
- *
- * TODO:
- * Implement optimizers.
  */
 
 #pragma once
@@ -18,42 +15,136 @@ typedef enum {
   OPT_SGD_MOMENTUM,
   OPT_SGD_RMS_PROP,
   OPT_SGD_ADAM,
+  OPT_LARS,
+  OPT_LAMB,
 } optimizer_t;
 
 typedef enum {
   INIT_HE,
   INIT_GLOROT,
-  INIT_RANDOM_UNIFORM
+  INIT_RANDOM_UNIFORM,
+  INIT_NONE  // Keeps the values already held by the storage, such as loaded parameters.
 } initialization_t;
 
-typedef struct dense_layer {
+// Externally owned, flat storage a layer's tensors are viewed from.
+// Parameters and gradients are laid out as [W | B], optimizer state as consecutive
+// parameter-sized moment blocks.
+typedef struct {
+  tnsr_type_t *params;
+  tnsr_type_t *grads;
+  tnsr_type_t *state;
+  tnsr_type_t *mask;  // Pruning mask in the parameter layout, 1 keeps a value. NULL to disable.
+} dense_layer_storage_t;
+
+// A column slice of a dense layer, stored as its own [W | B] block in the layer's storage.
+// Unsharded layers consist of a single shard.
+typedef struct {
   tnsr_t *weights;
   tnsr_t *biases;
-  tnsr_type_t learning_rate;
+  tnsr_t *weights_grad;
+  tnsr_t *biases_grad;
+  tnsr_size_t offset;  // Of the shard's block in the layer's storage.
+  tnsr_size_t count;   // Parameters in the shard's block.
   grph_size_t weights_id;
   grph_size_t biases_id;
+} dense_layer_shard_t;
+
+typedef struct dense_layer {
+  tnsr_type_t *params;
+  tnsr_type_t *grads;
+  tnsr_type_t *state;
+  tnsr_type_t *mask;  // Pruned parameters are kept at zero through updates, NULL if unpruned.
+  tnsr_size_t param_count;
+  tnsr_size_t fan_in;
+  tnsr_size_t fan_out;
+  tnsr_type_t learning_rate;
+  size_t step_count;
   node_type_t function_type;
-  void *optimizer_data;
-  bool (*optimizer)(grph_t **g, struct dense_layer *);
-  void (*opt_dtor)(void **);
+  bool (*optimizer)(struct dense_layer *);
+  tnsr_bsr_t *sparse_weights;  // Unsharded weights in block-sparse form, NULL unless sparsified.
+  tnsr_t *sparse_biases;       // Unsharded biases accompanying sparse_weights.
+  const tnsr_size_t *rows;     // Weight rows the running update is restricted to, if any.
+  const tnsr_type_t *row_grads;  // Of the biases then of rows, see dense_layer_update_rows.
+  tnsr_size_t row_count;
+  size_t shard_count;
+  dense_layer_shard_t shards[];
 } dense_layer_t;
 
-// Creates a dense layer with the specified characteristics,
+// Convolution layer. Its filters are the weights of a dense layer of fan_in
+// kernel_height * kernel_width * channels and fan_out filters, applied to the patch below every
+// output position. The dense layer provides its storage, initialization and optimizer.
+typedef struct {
+  const grph_conv_t *geometry;  // Not owned, must outlive the graphs the layer is added to.
+  dense_layer_t *filters;
+} conv_layer_t;
+
+// Embedding layer. Gathers the rows of its table by integer id, in place of the product of
+// one-hot vectors with the weights of a dense layer of fan_in vocabulary and fan_out width.
+// Rows of several ids per input row are stored side by side, each added the biases.
+// The dense layer provides its parameters, initialization and optimizer, whose updates are
+// lazy, and only touch the rows gathered since the previous update. Its gradient is sparse,
+// listing those rows only, see grph_embed_t. Not part of model_t, which takes features.
+typedef struct {
+  dense_layer_t *table;  // Without gradients.
+  grph_embed_t embed;
+} embedding_layer_t;
+
+// Number of parameters of a dense layer, weights and biases included.
+tnsr_size_t dense_layer_param_count(tnsr_size_t fan_in, tnsr_size_t fan_out);
+
+// Number of optimizer state values required by a dense layer with param_count parameters.
+tnsr_size_t dense_layer_state_count(optimizer_t optimizer, tnsr_size_t param_count);
+
+// Creates a dense layer with the specified characteristics over the given storage,
 // then initializes it depending on the function.
 // Falls back to He initialization otherwise.
+// The storage must outlive the layer and is not freed by it. Gradients and optimizer state
+// must be zeroed before the layer is trained, see dense_layer_zero. Gradients may be NULL
+// for layers only updated through dense_layer_update_rows.
+// Layers with several shards split their output columns between shards, each stored as its
+// own [W | B] block and processed by its own thread. 0 is treated as 1.
 dense_layer_t *dense_layer_create(
-    grph_size_t fan_in,
-    grph_size_t fan_out,
+    tnsr_size_t fan_in,
+    tnsr_size_t fan_out,
     initialization_t init,
     node_type_t function,
     optimizer_t optimizer,
-    tnsr_type_t learning_rate
+    tnsr_type_t learning_rate,
+    size_t shard_count,
+    dense_layer_storage_t storage
 );
 
-// Deallocates the dense layer.
+// Creates a replica of the layer that shares its parameters and optimizer state, but
+// accumulates gradients into its own buffer. Replicas bind to their own graph, letting
+// several workers pass data through the same layer concurrently.
+// Updating a replica applies its own gradients to the shared parameters without
+// synchronization, which is only intended for asynchronous (Hogwild) training.
+// Replicas of NULL grads only read the layer, for forward-only graphs, and must not be
+// updated.
+dense_layer_t *dense_layer_replicate(const dense_layer_t *dl, tnsr_type_t *grads);
+
+// Zeroes the layer's gradients and optimizer state, split between the workers like its
+// updates, so that their pages are first touched by the workers updating them.
+void dense_layer_zero(dense_layer_t *dl);
+
+// Deallocates the dense layer. Its storage is left untouched.
 void dense_layer_destroy(dense_layer_t **dl);
 
-// Adds the layer to the graph.
+// Writes the layer's parameters to dst in the unsharded [W | B] layout.
+void dense_layer_export(const dense_layer_t *dl, tnsr_type_t *dst);
+
+// Visits values, held in the layout of the layer's storage like its parameters, a moment of
+// its optimizer state or its mask, in runs of consecutive values following the unsharded
+// [W | B] layout. visit may read or write the runs. Stops at the first run visit fails on.
+// false upon failure.
+bool dense_layer_stream(
+    const dense_layer_t *dl,
+    tnsr_type_t *values,
+    bool (*visit)(tnsr_type_t *run, tnsr_size_t count, void *ctx),
+    void *ctx
+);
+
+// Adds the layer to the graph. Gradients accumulate into the layer's storage.
 bool dense_layer_add_to_graph(grph_t **g, dense_layer_t *dl);
 
 // Resets the layer's graph IDs. Must be called before adding to another instance
@@ -63,45 +154,110 @@ void dense_layer_remove_from_graph(dense_layer_t *dl);
 // Passes the input through the layer and returns the operation index on the graph.
 grph_size_t dense_layer_passthrough(grph_t **g, dense_layer_t *dl, grph_size_t input);
 
-// Updates the layer through the gradients of its nodes
-// as well as running any optimizers. Modifes node gradients.
-bool dense_layer_update(grph_t **g, dense_layer_t *dl);
+// Prunes the weights of smallest magnitude, until a sparsity fraction of the layer's weights
+// is pruned. Previously pruned weights count towards it. Biases are kept.
+bool dense_layer_prune_magnitude(dense_layer_t *dl, tnsr_type_t sparsity);
 
-// Default stochastic gradient descent data creator.
-bool dense_layer_sgd_create(tnsr_size_t tnsr_shape[TNSR_MAX_RANK], void **dataptr);
+// Removes the neurons of dl whose outgoing weights, held by next, have an L2 norm of at most
+// threshold. Their incoming weights, bias and outgoing weights are pruned.
+bool dense_layer_prune_neurons(dense_layer_t *dl, dense_layer_t *next, tnsr_type_t threshold);
 
-// Stochastic gradient descent with momentum, data creator.
-bool dense_layer_sgd_momentum_create(tnsr_size_t tnsr_shape[TNSR_MAX_RANK], void **dataptr);
+// Builds the block-sparse form of the layer's weights, which eager graphs evaluate in
+// place of the dense weights. Gradients do not flow through it, and deferred graphs keep
+// using the dense weights. Dropped by the next update, as it would be stale.
+bool dense_layer_sparsify(dense_layer_t *dl);
 
-// Stochastic gradient descent with Root Mean Square Propagation data creator.
-bool dense_layer_sgd_rms_prop_create(tnsr_size_t tnsr_shape[TNSR_MAX_RANK], void **dataptr);
+// Drops the layer's block-sparse form, if any.
+void dense_layer_densify(dense_layer_t *dl);
 
-// Stochastic gradient descent with Adaptive Moment Estimation data creator.
-bool dense_layer_sgd_adam_create(tnsr_size_t tnsr_shape[TNSR_MAX_RANK], void **dataptr);
+// Updates the layer through the gradients in its storage
+// as well as running any optimizers. Gradients are left untouched.
+bool dense_layer_update(dense_layer_t *dl);
+
+// Lazy variant of dense_layer_update, restricted to the given rows of the unsharded weights
+// and to the biases. grads holds the gradients of the biases, then those of the rows side by
+// side, in place of the storage's. Other rows keep their parameters and optimizer state as if
+// they had no gradient, rather than decaying their moments. Rows must be distinct, and the
+// layer must have a single shard. LARS and LAMB scale updates by layer-wide norms, so the
+// gradient is scattered into a temporary dense one and every row is updated.
+bool dense_layer_update_rows(
+    dense_layer_t *dl, const tnsr_size_t *rows, const tnsr_type_t *grads, tnsr_size_t count
+);
 
 // Default stochastic gradient descent.
-bool dense_layer_sgd(grph_t **g, dense_layer_t *dl);
+bool dense_layer_sgd(dense_layer_t *dl);
 
 // Stochastic gradient descent with momentum.
-bool dense_layer_sgd_momentum(grph_t **g, dense_layer_t *dl);
+bool dense_layer_sgd_momentum(dense_layer_t *dl);
 
 // Stochastic gradient descent with Root Mean Square Propagation.
-bool dense_layer_sgd_rms_prop(grph_t **g, dense_layer_t *dl);
+bool dense_layer_sgd_rms_prop(dense_layer_t *dl);
 
 // Stochastic gradient descent with Adaptive Moment Estimation.
-bool dense_layer_sgd_adam(grph_t **g, dense_layer_t *dl);
+bool dense_layer_sgd_adam(dense_layer_t *dl);
 
-// Default stochastic gradient descent destructor.
-void dense_layer_sgd_dtor(void **dataptr);
+// Layer-wise Adaptive Rate Scaling, momentum scaled by a per-layer trust ratio.
+bool dense_layer_lars(dense_layer_t *dl);
+
+// Layer-wise Adaptive Moments for Batch training, Adam scaled by a per-layer trust ratio.
+bool dense_layer_lamb(dense_layer_t *dl);
+
+// Number of parameters of a convolution layer, filters and biases included.
+tnsr_size_t conv_layer_param_count(const grph_conv_t *geometry);
+
+// Creates a convolution layer with the given geometry over the given storage, laid out as
+// the [W | B] block of its filters. See dense_layer_create. NULL upon failure, or when the
+// kernel does not fit the images.
+conv_layer_t *conv_layer_create(
+    const grph_conv_t *geometry,
+    initialization_t init,
+    node_type_t function,
+    optimizer_t optimizer,
+    tnsr_type_t learning_rate,
+    dense_layer_storage_t storage
+);
+
+// Deallocates the layer and its filters. Its storage is left untouched.
+void conv_layer_destroy(conv_layer_t **cl);
+
+// Adds the layer's filters to the graph. Gradients accumulate into the layer's storage.
+bool conv_layer_add_to_graph(grph_t **g, conv_layer_t *cl);
+
+// Resets the layer's graph IDs, see dense_layer_remove_from_graph.
+void conv_layer_remove_from_graph(conv_layer_t *cl);
+
+// Passes the images in the input's rows through the layer and returns the operation index
+// on the graph. Its output holds the pooled feature maps of every image, see grph_conv_t.
+grph_size_t conv_layer_passthrough(grph_t **g, conv_layer_t *cl, grph_size_t input);
+
+// Updates the layer's filters, see dense_layer_update.
+bool conv_layer_update(conv_layer_t *cl);
+
+// Creates an embedding layer of the given vocabulary and width over the given storage, laid
+// out as the [W | B] block of its table. See dense_layer_create. Its gradients are not
+// taken from the storage, whose grads may be NULL.
+embedding_layer_t *embedding_layer_create(
+    tnsr_size_t vocabulary,
+    tnsr_size_t width,
+    initialization_t init,
+    node_type_t function,
+    optimizer_t optimizer,
+    tnsr_type_t learning_rate,
+    dense_layer_storage_t storage
+);
 
-// Stochastic gradient descent with momentum destructor.
-void dense_layer_sgd_momentum_dtor(void **dataptr);
+// Deallocates the layer and its table. Its storage is left untouched.
+void embedding_layer_destroy(embedding_layer_t **el);
 
-// Stochastic gradient descent with Root Mean Square Propagation destructor.
-void dense_layer_sgd_rms_prop_dtor(void **dataptr);
+// Passes the ids in the rows of the input through the layer and returns the operation index
+// on the graph. The table and biases are attributes of the node rather than nodes of the
+// graph, which accumulates their gradient into the layer. Ids that do not index a row of
+// the table fail the node's evaluation.
+grph_size_t embedding_layer_passthrough(grph_t **g, embedding_layer_t *el, grph_size_t input);
 
-// Stochastic gradient descent with Adaptive Moment Estimation destructor.
-void dense_layer_sgd_adam_dtor(void **dataptr);
+// Lazily updates the rows gathered since the previous update, see dense_layer_update_rows,
+// then clears the layer's gradient.
+bool embedding_layer_update(embedding_layer_t *el);
 
 // Prints the layer's weights and biases to stdout.
 void dense_layer_dbgprint(dense_layer_t *dl);
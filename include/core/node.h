@@ -10,73 +10,87 @@
 
 #include "core/graph.h"
 
-typedef struct node {
-  bool transient;
-  tnsr_t *data;
-  tnsr_t *grad;
-  node_type_t type;
+// Appends a node of the given type into the next free slot of the graph, and allocates
+// its data and gradient fields based on its type. Returns its index in the graph.
+// The graph must have room for the node and its dependencies.
+// Only allocates the node's fields, its data is computed by the node's function.
+// Data nodes may be given an externally owned gradient, which the node then views.
+grph_size_t node_create(
+    grph_t *g, tnsr_t *data, tnsr_t *grad, grph_size_t a, grph_size_t b, node_type_t type
+);
 
-  grph_size_t n_dependencies;
-  grph_size_t n_deps_capacity;
-  grph_size_t dependencies[];
-} node_t;
+// Appends an operation node on the given dependencies, see node_create. Parameterized
+// operations are given their attributes, NULL otherwise.
+grph_size_t node_create_n(
+    grph_t *g, const grph_size_t *deps, grph_size_t ndeps, node_type_t type, const void *attr
+);
 
-// Creates the appropriate node based on the node type.
-node_t *node_create(grph_t *g, tnsr_t *data, grph_size_t a, grph_size_t b, node_type_t type);
+// Deallocates the fields owned by the given node.
+void node_destroy(grph_t *g, grph_size_t n);
 
-// Deallocates a given node. Passing NULL is a no-op.
-void node_destroy(node_t **n);
+// Transposes the data of A's dependency into A's data field.
+bool node_transpose(grph_t *g, grph_size_t a);
 
-// Applies a transposition on A and returns the result
-// in a new node. B must be set to GRPH_NO_INPUT_ID.
-node_t *node_transpose(grph_t *g, grph_size_t a, grph_size_t b);
+// Computes the tensor contraction of A's dependencies into A's data field.
+bool node_contract(grph_t *g, grph_size_t a);
 
-// Applies a tensor contraction on A and B and returns the result in a new node.
-node_t *node_contract(grph_t *g, grph_size_t a, grph_size_t b);
+// Computes the element-wise addition of A's dependencies into A's data field.
+bool node_eadd(grph_t *g, grph_size_t a);
 
-// Applies element-wise addition on A and B and returns the result in a new node.
-node_t *node_eadd(grph_t *g, grph_size_t a, grph_size_t b);
+// Computes the element-wise subtraction of A's dependencies into A's data field.
+bool node_esub(grph_t *g, grph_size_t a);
 
-// Applies element-wise subtraction on A and B and returns the result in a new node.
-node_t *node_esub(grph_t *g, grph_size_t a, grph_size_t b);
+// Computes the element-wise multiplication of A's dependencies into A's data field.
+bool node_emul(grph_t *g, grph_size_t a);
 
-// Applies element-wise multiplication on A and B and returns the result in a new node.
-node_t *node_emul(grph_t *g, grph_size_t a, grph_size_t b);
+// Computes the element-wise division of A's dependencies into A's data field.
+bool node_ediv(grph_t *g, grph_size_t a);
 
-// Applies element-wise division on A and B and returns the result in a new node.
-node_t *node_ediv(grph_t *g, grph_size_t a, grph_size_t b);
+// Applies the sigmoid function on A's dependency and stores the result in A's data field.
+bool node_esigmoid(grph_t *g, grph_size_t a);
 
-// Applies the sigmoid function on A and returns the result
-// in a new node. B must be set to GRPH_NO_INPUT_ID.
-node_t *node_esigmoid(grph_t *g, grph_size_t a, grph_size_t b);
+// Applies ReLU on A's dependency and stores the result in A's data field.
+bool node_erelu(grph_t *g, grph_size_t a);
 
-// Applies ReLU on A and returns the result
-// in a new node. B must be set to GRPH_NO_INPUT_ID.
-node_t *node_erelu(grph_t *g, grph_size_t a, grph_size_t b);
+// Applies Leaky ReLU on A's dependency and stores the result in A's data field.
+bool node_eleakyrelu(grph_t *g, grph_size_t a);
 
-// Applies Leaky ReLU on A and returns the result
-// in a new node. B must be set to GRPH_NO_INPUT_ID.
-node_t *node_eleakyrelu(grph_t *g, grph_size_t a, grph_size_t b);
+// Computes the Mean-Squared-Error of A's dependencies into A's data field.
+bool node_mse(grph_t *g, grph_size_t a);
 
-// Applies Mean-Squared-Error on A and B and returns the
-// result in a new node.
-node_t *node_mse(grph_t *g, grph_size_t a, grph_size_t b);
+// Computes the Categorical Cross-Entropy-Loss of A's dependencies
+// into A's data field.
+bool node_categorical_cross_entropy_loss(grph_t *g, grph_size_t a);
 
-// Applies Categorical Cross-Entropy-Loss on A and B and 
-// returns the result in a new node.
-node_t *node_categorical_cross_entropy_loss(grph_t *g, grph_size_t a, grph_size_t b);
+// Computes the Binary Cross-Entropy-Loss of A's dependencies
+// into A's data field.
+bool node_binary_cross_entropy_loss(grph_t *g, grph_size_t a);
 
-// Applies  Binary Cross-Entropy-Loss on A and B and 
-// returns the result in a new node.
-node_t *node_binary_cross_entropy_loss(grph_t *g, grph_size_t a, grph_size_t b);
+// Applies softmax on A's dependency and stores the result in A's data field.
+bool node_softmax(grph_t *g, grph_size_t a);
 
-// Applies softmax on A and returns the result in a new node.
-// B must e set to GRPH_NO_INPUT_ID.
-node_t *node_softmax(grph_t *g, grph_size_t a, grph_size_t b);
+// Applies tanh on A's dependency and stores the result in A's data field.
+bool node_etanh(grph_t *g, grph_size_t a);
 
-// Applies tanh on A and returns the result
-// in a new node. B must be set to GRPH_NO_INPUT_ID.
-node_t *node_etanh(grph_t *g, grph_size_t a, grph_size_t b);
+// Computes the product of A's first dependency with each shard's weights plus its biases,
+// into the shard's columns of A's data field. Shards are evaluated concurrently.
+bool node_sharded_affine(grph_t *g, grph_size_t a);
+
+// Same as node_sharded_affine, followed by a softmax over each row. Row maxima and sums
+// are reduced from per-shard partials, so each shard only reads its own columns.
+bool node_sharded_softmax(grph_t *g, grph_size_t a);
+
+// Convolves the images of A's first dependency with the filters of its second, adds the
+// biases of its third and max-pools the feature maps if required, into A's data field.
+// Lowered to a single tensor contraction of the image patches (im2col) with the filters.
+bool node_conv(grph_t *g, grph_size_t a);
+
+// Gathers the rows of A's table selected by the ids in A's dependency, adds the biases, and
+// stores them side by side in A's data field. Fails on ids out of range. See grph_embed_t.
+bool node_embed(grph_t *g, grph_size_t a);
+
+// Whether every value of ids is an integer in [0, rows), indexing a row of a table.
+bool node_embed_valid(const tnsr_t *ids, tnsr_size_t rows);
 
 // Pushes the gradient from a transpose node to its dependencies and multiplies it
 // with the upstream gradient stored in A's grad field.
@@ -133,3 +147,19 @@ bool node_softmax_dx(grph_t *g, grph_size_t a);
 // Pushes the gradient from a tanh node to its dependencies and multiplies it with the 
 // upstream gradient stored in A's grad field.
 bool node_etanh_dx(grph_t *g, grph_size_t a);
+
+// Pushes the gradient from a sharded affine node to its dependencies and multiplies it
+// with the upstream gradient stored in A's grad field.
+bool node_sharded_affine_dx(grph_t *g, grph_size_t a);
+
+// Pushes the gradient from a sharded softmax node to its dependencies and multiplies it
+// with the upstream gradient stored in A's grad field.
+bool node_sharded_softmax_dx(grph_t *g, grph_size_t a);
+
+// Pushes the gradient from a convolution node to its dependencies and multiplies it
+// with the upstream gradient stored in A's grad field.
+bool node_conv_dx(grph_t *g, grph_size_t a);
+
+// Adds the gradient of an embedding node to the sparse gradient of its attributes, listing
+// the rows of the table it gathered. Ids have no gradient.
+bool node_embed_dx(grph_t *g, grph_size_t a);
@@ -15,11 +15,24 @@
 #include <stdint.h>
 #include <stdlib.h>  // IWYU pragma: export
 
+// Tensor sizes are 64-bit by default. Define TNSR_NARROW_SIZE for 32-bit sizes.
+#ifdef TNSR_NARROW_SIZE
 typedef uint32_t tnsr_size_t;
+  #define TNSR_MAX_SIZE UINT32_MAX
+#else
+typedef uint64_t tnsr_size_t;
+  #define TNSR_MAX_SIZE UINT64_MAX
+#endif
 typedef float tnsr_type_t;
 
 #define TNSR_MAX_RANK 2
-#define TNSR_MAX_SIZE UINT32_MAX
+
+// Precisions values can be rounded to. Values are stored and computed in tnsr_type_t.
+typedef enum {
+  TNSR_FP32,
+  TNSR_FP16,  // IEEE 754 half precision, 5 exponent and 10 significand bits.
+  TNSR_BF16,  // bfloat16, fp32's exponent range with 7 significand bits.
+} tnsr_precision_t;
 
 /* -------------------------------- Accessors ------------------------------- */
 
@@ -27,6 +40,8 @@ typedef float tnsr_type_t;
 #define TNSR_SHPE(tensor, n) (tensor->shape[n])
 #define TNSR_DATA(tensor, i, j) (tensor->data[i * tensor->stride[0] + j * tensor->stride[1]])
 #define TNSR_DSTR(tensor) (tnsr_destroy(&tensor))
+#define TNSR_SIZE(tensor) (tensor->shape[0] * tensor->shape[1])
+#define TNSR_IS_CONTIGUOUS(tensor) (tensor->stride[0] == tensor->shape[1] && tensor->stride[1] == 1)
 
 /* ----------------------------------- API ---------------------------------- */
 
@@ -38,15 +53,32 @@ typedef float tnsr_type_t;
 #define TNSR_FROM_ARRAY(t, a) memcpy(t->data, a, sizeof(tnsr_type_t[t->shape[0] * t->shape[1]]));
 
 // Generic tensor type.
+// Data either follows the header in the same allocation, or is externally owned (views).
 typedef struct {
   tnsr_size_t shape[TNSR_MAX_RANK];
   tnsr_size_t stride[TNSR_MAX_RANK];
-  tnsr_type_t data[];
+  tnsr_type_t *data;
 } tnsr_t;
 
+// Block-sparse row (BSR) matrix, made of dense blocks of block[0] x block[1] values. Only
+// blocks holding a non-zero value are stored. Blocks of block row r are the entries
+// [row_offsets[r], row_offsets[r + 1]) of columns and values, in increasing column order.
+// Blocks past the matrix' edge are zero-padded.
+typedef struct {
+  tnsr_size_t shape[TNSR_MAX_RANK];
+  tnsr_size_t block[TNSR_MAX_RANK];
+  tnsr_size_t *row_offsets;  // One entry per block row, plus one.
+  tnsr_size_t *columns;      // First column of every stored block.
+  tnsr_type_t *values;       // Row-major blocks, back to back.
+} tnsr_bsr_t;
+
 // Creates a zero-initialized tensor with the specified dimensions. NULL upon failure.
 tnsr_t *tnsr_create(tnsr_size_t n, tnsr_size_t m);
 
+// Creates a row-major m x n tensor over externally owned data. NULL upon failure.
+// Destroying the view does not free the underlying data.
+tnsr_t *tnsr_view(tnsr_type_t *data, tnsr_size_t m, tnsr_size_t n);
+
 // Deallocates the given tensor, and sets its pointer to NULL.
 // Passing NULL is a no-op.
 void tnsr_destroy(tnsr_t **t);
@@ -57,9 +89,26 @@ void tnsr_set(tnsr_t *t, tnsr_type_t x);
 // Resets the tensor's values to zero. Equivalent to `tnsr_set(0)`.
 void tnsr_reset(tnsr_t *t);
 
+// Rounds the tensor's values to the nearest ones representable in the given precision,
+// ties to even. Values beyond the precision's range become infinite.
+tnsr_t *tnsr_round(tnsr_t *t, tnsr_precision_t precision);
+
 // Tensor contraction.
 tnsr_t *tnsr_contract(tnsr_t *restrict dst, const tnsr_t *restrict a, const tnsr_t *restrict b);
 
+// Creates the BSR form of t with blocks of the given dimensions. NULL upon failure.
+tnsr_bsr_t *tnsr_bsr_create(const tnsr_t *t, tnsr_size_t block_rows, tnsr_size_t block_cols);
+
+// Deallocates the BSR matrix, and sets its pointer to NULL.
+// Passing NULL is a no-op.
+void tnsr_bsr_destroy(tnsr_bsr_t **t);
+
+// Stored blocks of the BSR matrix.
+tnsr_size_t tnsr_bsr_blocks(const tnsr_bsr_t *t);
+
+// Tensor contraction with a BSR matrix. Accumulates into dst, like tnsr_contract.
+tnsr_t *tnsr_contract_bsr(tnsr_t *restrict dst, const tnsr_t *restrict a, const tnsr_bsr_t *b);
+
 // Tensor element-wise addition.
 tnsr_t *tnsr_eadd(tnsr_t *dst, const tnsr_t *a, const tnsr_t *restrict b);
 
@@ -89,5 +138,15 @@ tnsr_t *tnsr_max_over_axis(tnsr_t *restrict dst, tnsr_t *restrict t, tnsr_size_t
 // Take the mean of the tensor's fields.
 tnsr_t *tnsr_mean(tnsr_t *restrict dst, tnsr_t *restrict t);
 
+// Converts x to IEEE 754 half precision, rounding to nearest, ties to even.
+uint16_t tnsr_to_half(tnsr_type_t x);
+
+tnsr_type_t tnsr_from_half(uint16_t h);
+
+// Converts x to bfloat16, rounding to nearest, ties to even.
+uint16_t tnsr_to_bfloat(tnsr_type_t x);
+
+tnsr_type_t tnsr_from_bfloat(uint16_t h);
+
 // Prints the tensor to stdout.
 void tnsr_dbgprint(const tnsr_t *t);
@@ -0,0 +1,74 @@
+/**
+ * thread_pool.h
+ *
+ * BRIEF:
+ * Persistent pool of worker threads the tensor kernels, the graph executor and the
+ * optimizers run on. Provides parallel loops and groups of tasks.
+ *
+ * NOTE:
+ * Workers are pinned to one core each and ordered by NUMA node, so that the chunks of
+ * a parallel loop over a range land on the same cores (and memory node) every time the
+ * range is processed. Idle workers spin for a while before parking.
+ */
+
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct tpool tpool_t;
+
+// Body of a parallel loop, processes the iterations [begin, end).
+typedef void (*tpool_range_t)(size_t begin, size_t end, void *ctx);
+
+// Body of a task.
+typedef void (*tpool_task_t)(void *ctx);
+
+// Tasks waited on together. Must be initialized through tpool_group_init.
+typedef struct {
+  atomic_size_t pending;
+} tpool_group_t;
+
+// Environment variable overriding the thread count of the global pool.
+#define TPOOL_THREADS_ENV "NN_C_THREADS"
+
+// Returned by tpool_worker_id on threads foreign to the pool.
+#define TPOOL_EXTERNAL ((size_t)-1)
+
+// Creates a pool of thread_count workers. 0 uses one worker per available core.
+// Workers are pinned to their core when pin is set.
+// NULL upon failure.
+tpool_t *tpool_create(size_t thread_count, bool pin);
+
+// Joins the workers, deallocates the pool, and sets the pointer to NULL.
+// Every task must have completed. Passing NULL is a no-op.
+void tpool_destroy(tpool_t **pool);
+
+// Process-wide pool, created with pinned workers upon first use.
+// Its thread count is read from TPOOL_THREADS_ENV, when set.
+// Aborts when the pool cannot be created.
+tpool_t *tpool_global(void);
+
+size_t tpool_thread_count(const tpool_t *pool);
+
+// Index of the calling worker in the pool, TPOOL_EXTERNAL for other threads.
+size_t tpool_worker_id(const tpool_t *pool);
+
+// Runs body over [0, n), split in at most one contiguous chunk per worker, each of at
+// least grain iterations. Chunks are statically assigned to the workers, so two loops
+// of equal n and grain process the same chunk on the same worker. Blocks until done,
+// running chunks on the calling thread meanwhile. Ranges of a single chunk run inline.
+void tpool_parallel_for(tpool_t *pool, size_t n, size_t grain, tpool_range_t body, void *ctx);
+
+void tpool_group_init(tpool_group_t *group);
+
+// Queues task(ctx) as part of group. Tasks may spawn further tasks and loops.
+// false upon failure, the task is not queued.
+bool tpool_spawn(tpool_t *pool, tpool_group_t *group, tpool_task_t task, void *ctx);
+
+// Blocks until every task of group has completed, running them on the calling thread
+// meanwhile. Only runs tasks of the same group, so waiting while holding a lock is safe
+// as long as the group's own tasks do not take it.
+// Threads foreign to the pool park once no task of the group is left to them.
+void tpool_wait(tpool_t *pool, tpool_group_t *group);
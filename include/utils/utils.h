@@ -37,6 +37,20 @@
   #define ASSERT(cond)
 #endif
 
+// Alignment of bulk allocations, one cache line.
+#define ALIGNMENT 64
+
+#if defined(_MSC_VER)
+  #include <malloc.h>
+  #define ALIGNED_ALLOC(size) _aligned_malloc(size, ALIGNMENT)
+  #define ALIGNED_FREE(ptr) _aligned_free(ptr)
+#else
+  // aligned_alloc requires the size to be a multiple of the alignment.
+  #define ALIGNED_ALLOC(size) \
+    aligned_alloc(ALIGNMENT, ((size) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT)
+  #define ALIGNED_FREE(ptr) free(ptr)
+#endif
+
 #if defined(__GNUC__) || defined(__clang__)
   #define FRCINL __attribute__((always_inline)) inline
 #elif defined(_MSC_VER)
@@ -0,0 +1,315 @@
+/**
+ * codec.c
+ *
+ * BRIEF:
+ * Implementation for codec.h
+ *
+ * NOTE:
+ * The LZ77 stream is a sequence of literal runs, each but the last followed by a match.
+ * A sequence starts with a token byte holding the run length in its high nibble and the
+ * match length minus CODEC_LZ_MIN_MATCH in its low one. Nibbles of 15 continue into bytes
+ * added to them, as long as they are 255. The run's bytes follow, then the match's 16-bit
+ * offset back into the decoded data and its remaining length bytes.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/codec.h"
+#include "core/tensor.h"
+#include "utils/utils.h"
+
+#define CODEC_LZ_MIN_MATCH 4
+#define CODEC_LZ_WINDOW 65535  // Farthest match offset.
+#define CODEC_LZ_HASH_BITS 16  // Of the table of previous positions matches are looked up in.
+#define CODEC_INT8_LIMIT 127   // Symmetric, -128 is never used.
+
+static uint32_t codec_read32(const uint8_t *p) {
+  uint32_t word = 0;
+  memcpy(&word, p, sizeof(word));
+  return word;
+}
+
+static size_t codec_lz_bound(size_t n) {
+  return n + n / 255 + 16;
+}
+
+// Writes the continuation bytes of a length whose nibble is 15.
+static uint8_t *codec_lz_length(uint8_t *out, size_t length) {
+  for (; length >= 255; length -= 255) {
+    *out++ = 255;
+  }
+  *out++ = (uint8_t)length;
+  return out;
+}
+
+// Writes a run of literals, followed by a match of length bytes offset back, if length.
+static uint8_t *codec_lz_sequence(
+    uint8_t *out,
+    const uint8_t *literals,
+    size_t run,
+    size_t offset,
+    size_t length
+) {
+  const size_t match = length ? length - CODEC_LZ_MIN_MATCH : 0;
+  *out++ = (uint8_t)(min(run, 15) << 4 | min(match, 15));
+  if (run >= 15) {
+    out = codec_lz_length(out, run - 15);
+  }
+  memcpy(out, literals, run);
+  out += run;
+  if (length) {
+    *out++ = (uint8_t)(offset & 0xff);
+    *out++ = (uint8_t)(offset >> 8);
+    if (match >= 15) {
+      out = codec_lz_length(out, match - 15);
+    }
+  }
+  return out;
+}
+
+/**
+ * Greedy: takes the match found at the last position of equal hash, if any.
+ * NOTE:
+ * Positions are stored plus one, so that the zeroed table holds none.
+ */
+static size_t codec_lz_compress(const uint8_t *in, size_t n, uint8_t *out) {
+  ASSERT(in && out);
+  uint32_t *table = calloc((size_t)1 << CODEC_LZ_HASH_BITS, sizeof(uint32_t));
+  REQUIRE(table, return 0);
+  uint8_t *o = out;
+  size_t anchor = 0;
+  size_t i = 0;
+  while (i + CODEC_LZ_MIN_MATCH <= n) {
+    const uint32_t word = codec_read32(in + i);
+    const uint32_t hash = (word * 2654435761u) >> (32 - CODEC_LZ_HASH_BITS);
+    const size_t candidate = table[hash];
+    table[hash] = (uint32_t)(i + 1);
+    if (!candidate || i - (candidate - 1) > CODEC_LZ_WINDOW ||
+        codec_read32(in + candidate - 1) != word) {
+      ++i;
+      continue;
+    }
+    const size_t match = candidate - 1;
+    size_t length = CODEC_LZ_MIN_MATCH;
+    while (i + length < n && in[match + length] == in[i + length]) {
+      ++length;
+    }
+    o = codec_lz_sequence(o, in + anchor, i - anchor, i - match, length);
+    i += length;
+    anchor = i;
+  }
+  o = codec_lz_sequence(o, in + anchor, n - anchor, 0, 0);
+  free(table);
+  return (size_t)(o - out);
+}
+
+// Reads the continuation bytes of a length whose nibble is 15. false past the end.
+static bool codec_lz_read_length(const uint8_t **p, const uint8_t *end, size_t *length) {
+  for (;;) {
+    REQUIRE(*p < end, return false);
+    const uint8_t byte = *(*p)++;
+    *length += byte;
+    if (byte != 255) {
+      return true;
+    }
+  }
+}
+
+static bool codec_lz_decompress(const uint8_t *in, size_t size, uint8_t *out, size_t n) {
+  ASSERT(in && out);
+  const uint8_t *p = in;
+  const uint8_t *end = in + size;
+  size_t o = 0;
+  while (p < end) {
+    const uint8_t token = *p++;
+    size_t run = token >> 4;
+    if (run == 15) {
+      REQUIRE(codec_lz_read_length(&p, end, &run), return false);
+    }
+    REQUIRE(run <= (size_t)(end - p) && run <= n - o, return false);
+    memcpy(out + o, p, run);
+    p += run;
+    o += run;
+    if (p == end) {
+      break;  // The last sequence has no match.
+    }
+    REQUIRE(end - p >= 2, return false);
+    const size_t offset = (size_t)p[0] | (size_t)p[1] << 8;
+    p += 2;
+    size_t length = token & 15;
+    if (length == 15) {
+      REQUIRE(codec_lz_read_length(&p, end, &length), return false);
+    }
+    length += CODEC_LZ_MIN_MATCH;
+    REQUIRE(offset && offset <= o && length <= n - o, return false);
+    for (size_t k = 0; k < length; ++k, ++o) {
+      out[o] = out[o - offset];  // Byte by byte, matches may overlap what they produce.
+    }
+  }
+  return o == n;
+}
+
+size_t codec_bound(codec_t codec, tnsr_size_t rows, tnsr_size_t cols) {
+  const size_t count = (size_t)rows * cols;
+  switch (codec) {
+    case CODEC_RAW:
+      return sizeof(tnsr_type_t[count]);
+    case CODEC_FP16:
+    case CODEC_BF16:
+      return sizeof(uint16_t[count]);
+    case CODEC_INT8:
+      return sizeof(tnsr_type_t[cols]) + sizeof(int8_t[count]);
+    case CODEC_SHUFFLE_LZ:
+      return codec_lz_bound(sizeof(tnsr_type_t[count]));
+    default:
+      return 0;
+  }
+}
+
+// Column scales, then the values row by row. Non-finite values fail to encode, fmaxf
+// would skip NaNs otherwise.
+static size_t codec_encode_int8(
+    const tnsr_type_t *values,
+    tnsr_size_t rows,
+    tnsr_size_t cols,
+    unsigned char *out
+) {
+  tnsr_type_t *scales = calloc(max(cols, 1), sizeof(tnsr_type_t));
+  REQUIRE(scales, return 0);
+  for (tnsr_size_t i = 0; i < rows; ++i) {
+    for (tnsr_size_t j = 0; j < cols; ++j) {
+      const tnsr_type_t value = values[(size_t)i * cols + j];
+      REQUIRE(isfinite(value), goto error);
+      scales[j] = fmaxf(scales[j], fabsf(value));
+    }
+  }
+  for (tnsr_size_t j = 0; j < cols; ++j) {
+    scales[j] /= CODEC_INT8_LIMIT;
+  }
+  memcpy(out, scales, sizeof(tnsr_type_t[cols]));
+  int8_t *q = (int8_t *)(out + sizeof(tnsr_type_t[cols]));
+  for (tnsr_size_t i = 0; i < rows; ++i) {
+    for (tnsr_size_t j = 0; j < cols; ++j) {
+      const size_t k = (size_t)i * cols + j;
+      const tnsr_type_t level = scales[j] > 0 ? roundf(values[k] / scales[j]) : 0;
+      q[k] = (int8_t)fminf(fmaxf(level, -CODEC_INT8_LIMIT), CODEC_INT8_LIMIT);
+    }
+  }
+  free(scales);
+  return codec_bound(CODEC_INT8, rows, cols);
+error:
+  free(scales);
+  return 0;
+}
+
+// Byte k of every value goes to the k-th plane, and back when unshuffling.
+static void codec_shuffle(const uint8_t *in, size_t count, uint8_t *out, bool unshuffle) {
+  for (size_t i = 0; i < count; ++i) {
+    for (size_t k = 0; k < sizeof(tnsr_type_t); ++k) {
+      const size_t value = i * sizeof(tnsr_type_t) + k;
+      const size_t plane = k * count + i;
+      if (unshuffle) {
+        out[value] = in[plane];
+      } else {
+        out[plane] = in[value];
+      }
+    }
+  }
+}
+
+size_t codec_encode(
+    codec_t codec,
+    const tnsr_type_t *values,
+    tnsr_size_t rows,
+    tnsr_size_t cols,
+    void *out
+) {
+  ASSERT(values && out);
+  const size_t count = (size_t)rows * cols;
+  uint8_t *bytes = out;
+  switch (codec) {
+    case CODEC_RAW:
+      memcpy(out, values, sizeof(tnsr_type_t[count]));
+      return sizeof(tnsr_type_t[count]);
+    case CODEC_FP16:
+    case CODEC_BF16: {
+      const uint16_t infinity = codec == CODEC_FP16 ? 0x7c00 : 0x7f80;
+      for (size_t i = 0; i < count; ++i) {
+        const uint16_t h =
+            codec == CODEC_FP16 ? tnsr_to_half(values[i]) : tnsr_to_bfloat(values[i]);
+        // Finite values rounding to infinity are out of range.
+        REQUIRE(!isfinite(values[i]) || (h & 0x7fff) != infinity, return 0);
+        memcpy(bytes + sizeof(uint16_t[i]), &h, sizeof(h));
+      }
+      return sizeof(uint16_t[count]);
+    }
+    case CODEC_INT8:
+      return codec_encode_int8(values, rows, cols, out);
+    case CODEC_SHUFFLE_LZ: {
+      uint8_t *planes = malloc(max(sizeof(tnsr_type_t[count]), 1));
+      REQUIRE(planes, return 0);
+      codec_shuffle((const uint8_t *)values, count, planes, false);
+      const size_t size = codec_lz_compress(planes, sizeof(tnsr_type_t[count]), out);
+      free(planes);
+      return size;
+    }
+    default:
+      return 0;
+  }
+}
+
+bool codec_decode(
+    codec_t codec,
+    const void *data,
+    size_t size,
+    tnsr_size_t rows,
+    tnsr_size_t cols,
+    tnsr_type_t *values
+) {
+  ASSERT(data && values);
+  const size_t count = (size_t)rows * cols;
+  const uint8_t *bytes = data;
+  switch (codec) {
+    case CODEC_RAW:
+      REQUIRE(size == sizeof(tnsr_type_t[count]), return false);
+      memcpy(values, data, size);
+      return true;
+    case CODEC_FP16:
+    case CODEC_BF16:
+      REQUIRE(size == sizeof(uint16_t[count]), return false);
+      for (size_t i = 0; i < count; ++i) {
+        uint16_t h = 0;
+        memcpy(&h, bytes + sizeof(uint16_t[i]), sizeof(h));
+        values[i] = codec == CODEC_FP16 ? tnsr_from_half(h) : tnsr_from_bfloat(h);
+      }
+      return true;
+    case CODEC_INT8: {
+      REQUIRE(size == codec_bound(CODEC_INT8, rows, cols), return false);
+      const int8_t *q = (const int8_t *)(bytes + sizeof(tnsr_type_t[cols]));
+      for (tnsr_size_t i = 0; i < rows; ++i) {
+        for (tnsr_size_t j = 0; j < cols; ++j) {
+          tnsr_type_t scale = 0;
+          memcpy(&scale, bytes + sizeof(tnsr_type_t[j]), sizeof(scale));
+          const size_t k = (size_t)i * cols + j;
+          values[k] = q[k] * scale;
+        }
+      }
+      return true;
+    }
+    case CODEC_SHUFFLE_LZ: {
+      uint8_t *planes = malloc(max(sizeof(tnsr_type_t[count]), 1));
+      REQUIRE(planes, return false);
+      const bool decoded = codec_lz_decompress(data, size, planes, sizeof(tnsr_type_t[count]));
+      if (decoded) {
+        codec_shuffle(planes, count, (uint8_t *)values, true);
+      }
+      free(planes);
+      return decoded;
+    }
+    default:
+      return false;
+  }
+}
@@ -0,0 +1,415 @@
+/**
+ * distributed.c
+ *
+ * BRIEF:
+ * Implementation for distributed.h
+ *
+ * NOTE:
+ * The shared-memory transport maps one segment per communicator. It holds
+ * a barrier, and one single-slot channel per rank carrying data to the next
+ * rank of the ring. Channels are lock-free single-producer single-consumer
+ * queues synchronized through acquire/release counters.
+ */
+
+#ifndef _WIN32
+  #define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef _WIN32
+  #include <Windows.h>
+#else
+  #include <fcntl.h>
+  #include <sched.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <sys/wait.h>
+  #include <unistd.h>
+#endif
+
+#include "core/distributed.h"
+#include "core/tensor.h"
+#include "utils/utils.h"
+
+#define DIST_SHM_MAGIC 0x314D485354534944ull  // "DISTSHM1"
+#define DIST_SHM_SLOT_COUNT (64 * 1024)       // Values per channel slot.
+#define DIST_SHM_NAME_LENGTH 256
+#define DIST_MAX_CHILDREN 256
+#define DIST_SEGMENT_COUNT (64 * 1024)  // Values forwarded at once by broadcasts.
+
+typedef struct {
+  alignas(ALIGNMENT) _Atomic uint64_t written;  // Slots published by the producer.
+  alignas(ALIGNMENT) _Atomic uint64_t read;     // Slots released by the consumer.
+  alignas(ALIGNMENT) uint64_t count;            // Values held by the current slot.
+  tnsr_type_t data[DIST_SHM_SLOT_COUNT];
+} dist_shm_channel_t;
+
+typedef struct {
+  _Atomic uint64_t magic;  // Set last by the creator, once the segment is initialized.
+  uint64_t world_size;
+  _Atomic uint64_t joined;
+  _Atomic uint64_t left;
+  alignas(ALIGNMENT) _Atomic uint64_t barrier_count;
+  _Atomic uint64_t barrier_generation;
+  alignas(ALIGNMENT) dist_shm_channel_t channels[];  // channels[r] carries rank r -> r + 1.
+} dist_shm_segment_t;
+
+typedef struct {
+  dist_transport_t base;
+  dist_shm_segment_t *segment;
+  size_t segment_size;
+  char name[DIST_SHM_NAME_LENGTH];
+#ifdef _WIN32
+  HANDLE mapping;
+#endif
+} dist_shm_t;
+
+#ifndef _WIN32
+static pid_t dist_children[DIST_MAX_CHILDREN];
+static size_t dist_children_count = 0;
+#endif
+
+static void dist_yield(void) {
+#ifdef _WIN32
+  SwitchToThread();
+#else
+  sched_yield();
+#endif
+}
+
+// Start of the i-th of n near-equal chunks of count values.
+static size_t dist_chunk_begin(size_t count, size_t n, size_t i) {
+  return count / n * i + min(i, count % n);
+}
+
+static bool dist_reserve_scratch(dist_transport_t *t, size_t count) {
+  ASSERT(t);
+  if (t->scratch_count >= count) {
+    return true;
+  }
+  tnsr_type_t *scratch = realloc(t->scratch, sizeof(tnsr_type_t[max(count, 1)]));
+  REQUIRE(scratch, goto error);
+  t->scratch = scratch;
+  t->scratch_count = count;
+  return true;
+error:
+  return false;
+}
+
+static bool dist_shm_exchange(
+    dist_transport_t *t,
+    size_t to,
+    const tnsr_type_t *send,
+    size_t send_count,
+    size_t from,
+    tnsr_type_t *recv,
+    size_t recv_count
+) {
+  ASSERT(t);
+  dist_shm_t *shm = (dist_shm_t *)t;
+  const size_t next = (t->rank + 1) % t->world_size;
+  const size_t prev = (t->rank + t->world_size - 1) % t->world_size;
+  REQUIRE(!send_count || to == next, goto error);  // Only ring neighbours are connected.
+  REQUIRE(!recv_count || from == prev, goto error);
+
+  dist_shm_channel_t *out = &shm->segment->channels[t->rank];
+  dist_shm_channel_t *in = &shm->segment->channels[prev];
+  size_t sent = 0;
+  size_t received = 0;
+  while (sent < send_count || received < recv_count) {
+    bool progress = false;
+    const uint64_t out_written = atomic_load_explicit(&out->written, memory_order_relaxed);
+    const bool out_free = atomic_load_explicit(&out->read, memory_order_acquire) == out_written;
+    if (sent < send_count && out_free) {
+      const size_t n = min(send_count - sent, (size_t)DIST_SHM_SLOT_COUNT);
+      memcpy(out->data, send + sent, sizeof(tnsr_type_t[n]));
+      out->count = n;
+      atomic_store_explicit(&out->written, out_written + 1, memory_order_release);
+      sent += n;
+      progress = true;
+    }
+    const uint64_t in_read = atomic_load_explicit(&in->read, memory_order_relaxed);
+    const bool in_ready = atomic_load_explicit(&in->written, memory_order_acquire) > in_read;
+    if (received < recv_count && in_ready) {
+      const size_t n = in->count;
+      REQUIRE(received + n <= recv_count, goto error);  // Mismatched exchange.
+      memcpy(recv + received, in->data, sizeof(tnsr_type_t[n]));
+      atomic_store_explicit(&in->read, in_read + 1, memory_order_release);
+      received += n;
+      progress = true;
+    }
+    if (!progress) {
+      dist_yield();
+    }
+  }
+  return true;
+error:
+  return false;
+}
+
+// Sense-reversing barrier, the last rank to arrive starts the next generation.
+static bool dist_shm_barrier(dist_transport_t *t) {
+  ASSERT(t);
+  dist_shm_segment_t *segment = ((dist_shm_t *)t)->segment;
+  _Atomic uint64_t *generation_ptr = &segment->barrier_generation;
+  const uint64_t generation = atomic_load_explicit(generation_ptr, memory_order_acquire);
+  const uint64_t arrived =
+      atomic_fetch_add_explicit(&segment->barrier_count, 1, memory_order_acq_rel) + 1;
+  if (arrived == t->world_size) {
+    atomic_store_explicit(&segment->barrier_count, 0, memory_order_relaxed);
+    atomic_fetch_add_explicit(generation_ptr, 1, memory_order_release);
+    return true;
+  }
+  while (atomic_load_explicit(generation_ptr, memory_order_acquire) == generation) {
+    dist_yield();
+  }
+  return true;
+}
+
+static void dist_shm_unmap(dist_shm_t *shm, bool unlink) {
+  ASSERT(shm);
+#ifdef _WIN32
+  (void)unlink;  // The mapping is released along with its last handle.
+  if (shm->segment) {
+    UnmapViewOfFile(shm->segment);
+  }
+  if (shm->mapping) {
+    CloseHandle(shm->mapping);
+  }
+#else
+  if (shm->segment) {
+    munmap(shm->segment, shm->segment_size);
+  }
+  if (unlink) {
+    shm_unlink(shm->name);
+  }
+#endif
+  shm->segment = NULL;
+}
+
+static void dist_shm_destroy(dist_transport_t *t) {
+  ASSERT(t);
+  dist_shm_t *shm = (dist_shm_t *)t;
+  bool last = false;
+  if (shm->segment) {
+    dist_shm_barrier(t);  // Peers may still be reading from this rank's channel.
+    const uint64_t left = atomic_fetch_add(&shm->segment->left, 1) + 1;
+    last = left == t->world_size;
+  }
+  dist_shm_unmap(shm, last);
+#ifndef _WIN32
+  for (size_t i = 0; i < dist_children_count; ++i) {
+    waitpid(dist_children[i], NULL, 0);
+  }
+  dist_children_count = 0;
+#endif
+  free(t->scratch);
+  free(shm);
+}
+
+/**
+ * Opens the named segment, creating and initializing it if it does not exist yet.
+ * NOTE:
+ * Joiners wait until the creator has sized the segment and published its magic number.
+ */
+static bool dist_shm_map(dist_shm_t *shm, size_t world_size) {
+  ASSERT(shm);
+  bool creator = false;
+#ifdef _WIN32
+  const uint64_t size = shm->segment_size;
+  shm->mapping = CreateFileMappingA(
+      INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)(size >> 32), (DWORD)size, shm->name
+  );
+  REQUIRE(shm->mapping, goto error);
+  creator = GetLastError() != ERROR_ALREADY_EXISTS;
+  shm->segment = MapViewOfFile(shm->mapping, FILE_MAP_ALL_ACCESS, 0, 0, shm->segment_size);
+  REQUIRE(shm->segment, goto error);
+#else
+  int fd = shm_open(shm->name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd >= 0) {
+    creator = true;
+    REQUIRE(ftruncate(fd, (off_t)shm->segment_size) == 0, close(fd); goto error);
+  } else {
+    fd = shm_open(shm->name, O_RDWR, 0600);
+    REQUIRE(fd >= 0, goto error);
+    struct stat st = {};
+    do {
+      REQUIRE(fstat(fd, &st) == 0, close(fd); goto error);
+      if ((size_t)st.st_size < shm->segment_size) {
+        dist_yield();
+      }
+    } while ((size_t)st.st_size < shm->segment_size);
+  }
+  void *segment = mmap(NULL, shm->segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  REQUIRE(segment != MAP_FAILED, goto error);
+  shm->segment = segment;
+#endif
+
+  dist_shm_segment_t *s = shm->segment;
+  if (creator) {  // Fresh segments are zero-filled.
+    s->world_size = world_size;
+    atomic_store_explicit(&s->magic, DIST_SHM_MAGIC, memory_order_release);
+  }
+  while (atomic_load_explicit(&s->magic, memory_order_acquire) != DIST_SHM_MAGIC) {
+    dist_yield();
+  }
+  REQUIRE(s->world_size == world_size, goto error);
+  return true;
+error:
+  return false;
+}
+
+dist_transport_t *dist_shm_create(const char *name, size_t world_size) {
+  ASSERT(name && world_size > 0);
+  dist_shm_t *shm = calloc(1, sizeof(dist_shm_t));
+  REQUIRE(shm, goto error);
+#ifdef _WIN32
+  int written = snprintf(shm->name, sizeof(shm->name), "Local\\%s", name);
+#else
+  int written = snprintf(shm->name, sizeof(shm->name), name[0] == '/' ? "%s" : "/%s", name);
+#endif
+  REQUIRE(written > 0 && (size_t)written < sizeof(shm->name), goto error);
+  shm->segment_size = sizeof(dist_shm_segment_t) + sizeof(dist_shm_channel_t[world_size]);
+  REQUIRE(dist_shm_map(shm, world_size), goto error);
+
+  const uint64_t rank = atomic_fetch_add(&shm->segment->joined, 1);
+  REQUIRE(rank < world_size, goto error);  // Stale segment from a previous run, or too many ranks.
+  shm->base.rank = rank;
+  shm->base.world_size = world_size;
+  shm->base.exchange = dist_shm_exchange;
+  shm->base.barrier = dist_shm_barrier;
+  shm->base.destroy = dist_shm_destroy;
+  REQUIRE(dist_shm_barrier(&shm->base), goto error);  // Waits for every rank to join.
+  return &shm->base;
+error:
+  if (shm) {
+    dist_shm_unmap(shm, false);
+  }
+  free(shm);
+  return NULL;
+}
+
+void dist_transport_destroy(dist_transport_t **t) {
+  if (!t || !*t) {
+    return;
+  }
+  (*t)->destroy(*t);
+  *t = NULL;
+}
+
+bool dist_spawn(size_t world_size) {
+  ASSERT(world_size > 0);
+#ifdef _WIN32
+  (void)world_size;
+  REQUIRE(false, goto error);  // Launch the processes externally.
+#else
+  REQUIRE(world_size - 1 <= DIST_MAX_CHILDREN, goto error);
+  fflush(NULL);  // Prevents children from flushing the parent's buffered output.
+  for (size_t i = 1; i < world_size; ++i) {
+    const pid_t pid = fork();
+    REQUIRE(pid >= 0, goto error);
+    if (pid == 0) {
+      dist_children_count = 0;
+      return true;
+    }
+    dist_children[dist_children_count++] = pid;
+  }
+  return true;
+#endif
+error:
+  return false;
+}
+
+bool dist_barrier(dist_transport_t *t) {
+  ASSERT(t);
+  return t->barrier(t);
+}
+
+/**
+ * NOTE:
+ * Reduce-scatter followed by an all-gather. Each rank sends and receives
+ * 2 * (n - 1) / n of the data in total, regardless of the world size.
+ */
+bool dist_allreduce_mean(dist_transport_t *t, tnsr_type_t *data, size_t count) {
+  ASSERT(t && (data || !count));
+  const size_t n = t->world_size;
+  const size_t r = t->rank;
+  if (n == 1) {
+    return true;
+  }
+  const size_t next = (r + 1) % n;
+  const size_t prev = (r + n - 1) % n;
+  REQUIRE(dist_reserve_scratch(t, count / n + 1), goto error);
+
+  // Reduce-scatter, after which rank r holds the full sum of chunk r + 1.
+  for (size_t s = 0; s < n - 1; ++s) {
+    const size_t send_chunk = (r + n - s) % n;
+    const size_t recv_chunk = (r + 2 * n - s - 1) % n;
+    const size_t send_begin = dist_chunk_begin(count, n, send_chunk);
+    const size_t send_count = dist_chunk_begin(count, n, send_chunk + 1) - send_begin;
+    const size_t recv_begin = dist_chunk_begin(count, n, recv_chunk);
+    const size_t recv_count = dist_chunk_begin(count, n, recv_chunk + 1) - recv_begin;
+    REQUIRE(
+        t->exchange(t, next, data + send_begin, send_count, prev, t->scratch, recv_count),
+        goto error
+    );
+    tnsr_type_t *restrict dst = data + recv_begin;
+    const tnsr_type_t *restrict src = t->scratch;
+#pragma omp simd
+    for (size_t i = 0; i < recv_count; ++i) {
+      dst[i] += src[i];
+    }
+  }
+
+  const size_t owned = (r + 1) % n;
+  const size_t owned_begin = dist_chunk_begin(count, n, owned);
+  const size_t owned_count = dist_chunk_begin(count, n, owned + 1) - owned_begin;
+  const tnsr_type_t scale = 1.0f / n;
+#pragma omp simd
+  for (size_t i = 0; i < owned_count; ++i) {
+    data[owned_begin + i] *= scale;
+  }
+
+  // All-gather, circulating the reduced chunks.
+  for (size_t s = 0; s < n - 1; ++s) {
+    const size_t send_chunk = (r + 1 + n - s) % n;
+    const size_t recv_chunk = (r + n - s) % n;
+    const size_t send_begin = dist_chunk_begin(count, n, send_chunk);
+    const size_t send_count = dist_chunk_begin(count, n, send_chunk + 1) - send_begin;
+    const size_t recv_begin = dist_chunk_begin(count, n, recv_chunk);
+    const size_t recv_count = dist_chunk_begin(count, n, recv_chunk + 1) - recv_begin;
+    REQUIRE(
+        t->exchange(t, next, data + send_begin, send_count, prev, data + recv_begin, recv_count),
+        goto error
+    );
+  }
+  return true;
+error:
+  return false;
+}
+
+// Pipelined along the ring starting at the root, one segment at a time.
+bool dist_broadcast(dist_transport_t *t, tnsr_type_t *data, size_t count, size_t root) {
+  ASSERT(t && (data || !count) && root < t->world_size);
+  const size_t n = t->world_size;
+  const size_t position = (t->rank + n - root) % n;
+  const size_t next = (t->rank + 1) % n;
+  const size_t prev = (t->rank + n - 1) % n;
+  for (size_t begin = 0; begin < count; begin += DIST_SEGMENT_COUNT) {
+    const size_t segment = min(count - begin, (size_t)DIST_SEGMENT_COUNT);
+    if (position != 0) {
+      REQUIRE(t->exchange(t, next, NULL, 0, prev, data + begin, segment), goto error);
+    }
+    if (position != n - 1) {
+      REQUIRE(t->exchange(t, next, data + begin, segment, prev, NULL, 0), goto error);
+    }
+  }
+  return true;
+error:
+  return false;
+}
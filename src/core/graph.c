@@ -5,16 +5,18 @@
  * Implementation for graph.h
  */
 
+#include <omp.h>
 #include <string.h>
 
 #include "core/graph.h"
 #include "core/node.h"
+#include "core/thread_pool.h"
 #include "utils/utils.h"
 
 
 static grph_size_t input_req[] = {_GRPH_INPUT_TBLE};
 
-static node_t *(*node_functions[])(grph_t *, grph_size_t, grph_size_t) = {
+static bool (*node_functions[])(grph_t *, grph_size_t) = {
     [NDTYPE_TRANSPOSE] = node_transpose,
     [NDTYPE_CONTRACT] = node_contract,
     [NDTYPE_EADD] = node_eadd,
@@ -29,6 +31,10 @@ static node_t *(*node_functions[])(grph_t *, grph_size_t, grph_size_t) = {
     [NDTYPE_CATEGORICAL_CROSS_ENTROPY_LOSS] = node_categorical_cross_entropy_loss,
     [NDTYPE_BINARY_CROSS_ENTROPY_LOSS] = node_binary_cross_entropy_loss,
     [NDTYPE_SOFTMAX] = node_softmax,
+    [NDTYPE_SHARDED_AFFINE] = node_sharded_affine,
+    [NDTYPE_SHARDED_SOFTMAX] = node_sharded_softmax,
+    [NDTYPE_CONV] = node_conv,
+    [NDTYPE_EMBED] = node_embed,
 };
 
 static bool (*node_functions_dx[])(grph_t *, grph_size_t) = {
@@ -46,32 +52,60 @@ static bool (*node_functions_dx[])(grph_t *, grph_size_t) = {
     [NDTYPE_CATEGORICAL_CROSS_ENTROPY_LOSS] = node_categorical_cross_entropy_loss_dx,
     [NDTYPE_BINARY_CROSS_ENTROPY_LOSS] = node_binary_cross_entropy_loss_dx,
     [NDTYPE_SOFTMAX] = node_softmax_dx,
+    [NDTYPE_SHARDED_AFFINE] = node_sharded_affine_dx,
+    [NDTYPE_SHARDED_SOFTMAX] = node_sharded_softmax_dx,
+    [NDTYPE_CONV] = node_conv_dx,
+    [NDTYPE_EMBED] = node_embed_dx,
 }; 
 
 typedef enum {
   ND_NOT_VISITED,
   ND_VISITING,
   ND_VISITED,
+  ND_FUSED,  // Visited, evaluated by its consumer.
 } node_visited_t;
 
+/**
+ * Depth-first topological sort starting from node n.
+ * NOTE:
+ * Uses an explicit stack, as recursion would overflow the call stack on long graphs.
+ */
 static bool topological_sort(
     grph_t *g, grph_size_t n, grph_size_t *topological, node_visited_t *visited, grph_size_t *count
 ) {
   ASSERT(g && topological && visited && count);
+  grph_size_t *stack = malloc(sizeof(grph_size_t[GRPH_NODES(g)]));
+  grph_size_t *next_dep = malloc(sizeof(grph_size_t[GRPH_NODES(g)]));
+  REQUIRE(stack && next_dep, goto error);
+
+  grph_size_t depth = 1;
+  stack[0] = n;
+  next_dep[0] = 0;
   visited[n] = ND_VISITING;
-  for (grph_size_t i = 0; i < GRPH_NODE_NDEP(g, n); ++i) {
-    const grph_size_t node_id = GRPH_NODE_DEPS(g, n)[i];
-    ASSERT(visited[node_id] != ND_VISITING);
-    if (visited[node_id] == ND_VISITED) {
+  while (depth) {
+    const grph_size_t top = stack[depth - 1];
+    if (next_dep[depth - 1] < GRPH_NODE_NDEP(g, top)) {
+      const grph_size_t node_id = GRPH_NODE_DEPS(g, top)[next_dep[depth - 1]++];
+      ASSERT(visited[node_id] != ND_VISITING);
+      if (visited[node_id] == ND_NOT_VISITED) {
+        visited[node_id] = ND_VISITING;
+        stack[depth] = node_id;
+        next_dep[depth] = 0;
+        ++depth;
+      }
       continue;
     }
-    REQUIRE(topological_sort(g, node_id, topological, visited, count), goto error);
+    visited[top] = ND_VISITED;
+    topological[*count] = top;
+    ++(*count);
+    --depth;
   }
-  visited[n] = ND_VISITED;
-  topological[*count] = n;
-  ++(*count);
+  free(stack);
+  free(next_dep);
   return true;
 error:
+  free(stack);
+  free(next_dep);
   return false;
 }
 
@@ -101,19 +135,118 @@ error:
   return GRPH_ERR_ID;
 }
 
-static grph_t *grph_resize(grph_t *g) {
-  ASSERT(g);
+static size_t grph_storage_size(grph_size_t cpcty, size_t edge_cpcty) {
+  return sizeof(tnsr_t *[cpcty]) +  // Data.
+         sizeof(tnsr_t *[cpcty]) +  // Gradients.
+         sizeof(void *[cpcty]) +    // Attributes.
+         sizeof(tnsr_t *[cpcty]) +  // Auxiliary values.
+         sizeof(node_type_t[cpcty]) + sizeof(size_t[cpcty + 1]) + sizeof(grph_size_t[edge_cpcty]) +
+         sizeof(grph_size_t[cpcty]) +  // Consumers.
+         sizeof(bool[cpcty]);
+}
 
-  grph_t *rg = NULL;
-  REQUIRE(GRPH_CPCTY(g) < GRPH_MAX_SIZE / 2, goto error);
-  rg = realloc(g, sizeof(grph_t) + sizeof(node_t * [2 * GRPH_CPCTY(g)]));
-  REQUIRE(rg, goto error);
-  memset(&rg->adj_list[GRPH_CPCTY(rg)], 0, sizeof(node_t * [GRPH_CPCTY(rg)]));
-  rg->capacity = 2 * GRPH_CPCTY(rg);
+/**
+ * Moves the node arrays into a single allocation that fits the given capacities.
+ * NOTE:
+ * Arrays are laid out by decreasing alignment such that no padding is needed.
+ */
+static bool grph_reserve(grph_t *g, grph_size_t cpcty, size_t edge_cpcty) {
+  ASSERT(g && cpcty >= GRPH_NODES(g));
+  char *storage = calloc(1, grph_storage_size(cpcty, edge_cpcty));
+  REQUIRE(storage, goto error);
 
-  return rg;
+  tnsr_t **data = (tnsr_t **)storage;
+  tnsr_t **grad = data + cpcty;
+  const void **attrs = (const void **)(grad + cpcty);
+  tnsr_t **aux = (tnsr_t **)(attrs + cpcty);
+  size_t *edge_offsets = (size_t *)(aux + cpcty);
+  node_type_t *types = (node_type_t *)(edge_offsets + cpcty + 1);
+  grph_size_t *edges = (grph_size_t *)(types + cpcty);
+  grph_size_t *consumers = edges + edge_cpcty;
+  bool *transient = (bool *)(consumers + cpcty);
+
+  if (g->data) {
+    const grph_size_t n = GRPH_NODES(g);
+    memcpy(data, g->data, sizeof(tnsr_t *[n]));
+    memcpy(grad, g->grad, sizeof(tnsr_t *[n]));
+    memcpy(attrs, g->attrs, sizeof(void *[n]));
+    memcpy(aux, g->aux, sizeof(tnsr_t *[n]));
+    memcpy(edge_offsets, g->edge_offsets, sizeof(size_t[n + 1]));
+    memcpy(types, g->types, sizeof(node_type_t[n]));
+    memcpy(edges, g->edges, sizeof(grph_size_t[GRPH_EDGES(g)]));
+    memcpy(consumers, g->consumers, sizeof(grph_size_t[n]));
+    memcpy(transient, g->transient, sizeof(bool[n]));
+    free(g->data);
+  }
+  g->data = data;
+  g->grad = grad;
+  g->attrs = attrs;
+  g->aux = aux;
+  g->edge_offsets = edge_offsets;
+  g->types = types;
+  g->edges = edges;
+  g->consumers = consumers;
+  g->transient = transient;
+  g->capacity = cpcty;
+  g->edge_capacity = edge_cpcty;
+  return true;
 error:
-  return NULL;
+  return false;
+}
+
+/**
+ * Ensures room for one more node with ndeps dependencies.
+ * NOTE:
+ * Capacity grows geometrically up to the largest valid id, so appends are amortized O(1).
+ */
+static bool grph_grow(grph_t *g, grph_size_t ndeps) {
+  ASSERT(g);
+  const bool node_room = GRPH_NODES(g) < GRPH_CPCTY(g);
+  const bool edge_room = GRPH_EDGES(g) + ndeps <= g->edge_capacity;
+  if (node_room && edge_room) {
+    return true;
+  }
+  const grph_size_t max_cpcty = GRPH_MAX_SIZE - 1;  // GRPH_MAX_SIZE is reserved for GRPH_ERR_ID.
+  grph_size_t cpcty = GRPH_CPCTY(g);
+  if (!node_room) {
+    REQUIRE(cpcty < max_cpcty, goto error);
+    cpcty = cpcty < max_cpcty / 2 ? 2 * cpcty : max_cpcty;
+  }
+  size_t edge_cpcty = g->edge_capacity;
+  while (GRPH_EDGES(g) + ndeps > edge_cpcty) {
+    edge_cpcty *= 2;
+  }
+  REQUIRE(grph_reserve(g, cpcty, max(edge_cpcty, (size_t)GRPH_MAX_DEPS * cpcty)), goto error);
+  return true;
+error:
+  return false;
+}
+
+// Whether the node keeps full precision in graphs of reduced precision. Losses take the
+// logarithm of probabilities, which would round to 0 or 1 otherwise.
+static bool grph_full_precision(node_type_t ntype) {
+  switch (ntype) {
+    case NDTYPE_MSE:
+    case NDTYPE_CATEGORICAL_CROSS_ENTROPY_LOSS:
+    case NDTYPE_BINARY_CROSS_ENTROPY_LOSS:
+    case NDTYPE_SOFTMAX:
+    case NDTYPE_SHARDED_SOFTMAX:
+    case NDTYPE_ESIGMOID:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Rounds a computed field of node n to the graph's precision.
+static void grph_round(grph_t *g, grph_size_t n, tnsr_t *field) {
+  ASSERT(g && n < GRPH_NODES(g));
+  if (g->precision == TNSR_FP32 || !field || !GRPH_NODE_TRANSIENT(g, n)) {
+    return;
+  }
+  if (!grph_full_precision(GRPH_NODE_TYPE(g, n))) {
+    tnsr_round(field, g->precision);
+  }
 }
 
 grph_t *grph_create(grph_size_t cpcty) {
@@ -121,10 +254,38 @@ grph_t *grph_create(grph_size_t cpcty) {
   if (!cpcty) {
     cpcty = GRPH_INITCPCTY;
   }
-  grph_t *graph = calloc(1, sizeof(grph_t) + sizeof(node_t *[cpcty]));
+  grph_t *graph = calloc(1, sizeof(grph_t));
+  REQUIRE(graph, goto error);
+  REQUIRE(grph_reserve(graph, cpcty, (size_t)GRPH_MAX_DEPS * cpcty), goto error);
+  graph->mode = GRPH_MODE_EAGER;
+  graph->precision = TNSR_FP32;
+  graph->loss_scale = 1;
+  for (size_t i = 0; i < GRPH_GRAD_LOCKS; ++i) {
+    omp_init_lock(&graph->grad_locks[i]);
+  }
+
+  return graph;
+error:
+  if (graph) {
+    free(graph->data);
+  }
+  free(graph);
+  return NULL;
+}
+
+grph_t *grph_create_deferred(grph_size_t cpcty) {
+  grph_t *graph = grph_create(cpcty);
   REQUIRE(graph, goto error);
-  graph->capacity = cpcty;
+  graph->mode = GRPH_MODE_DEFERRED;
+  return graph;
+error:
+  return NULL;
+}
 
+grph_t *grph_create_forward(grph_size_t cpcty) {
+  grph_t *graph = grph_create_deferred(cpcty);
+  REQUIRE(graph, goto error);
+  graph->forward_only = true;
   return graph;
 error:
   return NULL;
@@ -136,90 +297,350 @@ void grph_destroy(grph_t **g) {
   }
   grph_t *graph = *g;
   for (grph_size_t i = 0; i < GRPH_NODES(graph); ++i) {
-    if (GRPH_NODE_TRANSIENT(graph, i)) {
-      node_destroy(&GRPH_NODE(graph, i));
-    } else {
-      tnsr_destroy(&GRPH_NODE(graph, i)->grad);
-      free(GRPH_NODE(graph, i));
-      GRPH_NODE(graph, i) = NULL;
-    }
+    node_destroy(graph, i);
+  }
+  for (size_t i = 0; i < GRPH_GRAD_LOCKS; ++i) {
+    omp_destroy_lock(&graph->grad_locks[i]);
   }
+  free(graph->data);
   free(*g);
   *g = NULL;
 }
 
 grph_size_t grph_append_data(grph_t **g, tnsr_t *data) {
   ASSERT(g && *g && data);
-
-  if (GRPH_NODES(*g) == GRPH_CPCTY(*g)) {
-    grph_t *rg = grph_resize(*g);
-    REQUIRE(rg, goto error);
-    *g = rg;
-  }
   grph_t *graph = *g;
-  node_t *node = node_create(graph, data, GRPH_NO_INPUT_ID, GRPH_NO_INPUT_ID, NDTYPE_DATA);
-  REQUIRE(node, goto error);
+  REQUIRE(grph_grow(graph, 0), goto error);
+  return node_create(graph, data, NULL, GRPH_NO_INPUT_ID, GRPH_NO_INPUT_ID, NDTYPE_DATA);
+error:
+  return GRPH_ERR_ID;
+}
 
-  GRPH_LIST(graph)[GRPH_NODES(graph)] = node;
-  ++GRPH_NODES(graph);
-  return GRPH_NODES(graph) - 1;
+grph_size_t grph_append_param(grph_t **g, tnsr_t *data, tnsr_t *grad) {
+  ASSERT(g && *g && data && (grad || (*g)->forward_only));
+  grph_t *graph = *g;
+  REQUIRE(grph_grow(graph, 0), goto error);
+  return node_create(graph, data, grad, GRPH_NO_INPUT_ID, GRPH_NO_INPUT_ID, NDTYPE_DATA);
 error:
   return GRPH_ERR_ID;
 }
 
 grph_size_t grph_execute(grph_t **g, grph_size_t a, grph_size_t b, node_type_t ntype) {
   ASSERT(g && *g && ntype != NDTYPE_DATA);
-  (void)input_req;
-  ASSERT((a != GRPH_NO_INPUT_ID) + (b != GRPH_NO_INPUT_ID) == input_req[ntype]);
+  ASSERT((grph_size_t)((a != GRPH_NO_INPUT_ID) + (b != GRPH_NO_INPUT_ID)) == input_req[ntype]);
   ASSERT((input_req[ntype] == 1 ? a != GRPH_NO_INPUT_ID : true));
+  const grph_size_t deps[GRPH_MAX_DEPS] = {a, b};
+  return grph_execute_n(g, deps, input_req[ntype], ntype);
+}
+
+grph_size_t grph_execute_n(
+    grph_t **g, const grph_size_t *deps, grph_size_t ndeps, node_type_t ntype
+) {
+  return grph_execute_attr(g, deps, ndeps, ntype, NULL);
+}
+
+grph_size_t grph_execute_attr(
+    grph_t **g, const grph_size_t *deps, grph_size_t ndeps, node_type_t ntype, const void *attr
+) {
+  ASSERT(g && *g && deps && ntype != NDTYPE_DATA);
+  ASSERT(input_req[ntype] == GRPH_VARIADIC || input_req[ntype] == ndeps);
 
-  if (GRPH_NODES(*g) == GRPH_CPCTY(*g)) {
-    grph_t *rg = grph_resize(*g);
-    REQUIRE(rg, goto error);
-    *g = rg;
-  }
   grph_t *graph = *g;
-  node_t *node = node_functions[ntype](graph, a, b);
-  REQUIRE(node, goto error);
+  REQUIRE(grph_grow(graph, ndeps), goto error);
+  const grph_size_t id = node_create_n(graph, deps, ndeps, ntype, attr);
+  REQUIRE(id != GRPH_ERR_ID, goto error);
 
-  GRPH_LIST(graph)[GRPH_NODES(graph)] = node;
-  ++GRPH_NODES(graph);
-  return GRPH_NODES(graph) - 1;
+  if (graph->mode == GRPH_MODE_EAGER && !node_functions[ntype](graph, id)) {
+    node_destroy(graph, id);
+    --GRPH_NODES(graph);
+    REQUIRE(false, goto error);
+  }
+  if (graph->mode == GRPH_MODE_EAGER) {
+    grph_round(graph, id, GRPH_NODE_DATA(graph, id));
+  }
+  return id;
 
 error:
   return GRPH_ERR_ID;
 }
 
+tnsr_size_t grph_conv_output(const grph_conv_t *conv, tnsr_size_t *height, tnsr_size_t *width) {
+  ASSERT(conv && height && width);
+  const tnsr_size_t stride = max(conv->stride, (tnsr_size_t)1);
+  const tnsr_size_t pool = max(conv->pool, (tnsr_size_t)1);
+  const tnsr_size_t padded_height = conv->height + 2 * conv->padding;
+  const tnsr_size_t padded_width = conv->width + 2 * conv->padding;
+  *height = 0;
+  *width = 0;
+  if (conv->kernel_height > padded_height || conv->kernel_width > padded_width) {
+    return 0;
+  }
+  *height = (padded_height - conv->kernel_height) / stride + 1;
+  *width = (padded_width - conv->kernel_width) / stride + 1;
+  return (*height / pool) * (*width / pool) * conv->filters;  // Partial windows are dropped.
+}
+
+/**
+ * Whether an addition node can be evaluated together with the contraction it consumes.
+ * NOTE:
+ * Requires the contraction to have no other consumer, and the addend to be a row
+ * vector such that it can be broadcast into the destination before contracting into it.
+ */
+static bool grph_fusable_affine(grph_t *g, grph_size_t n, const grph_size_t *consumers) {
+  ASSERT(g && consumers);
+  if (GRPH_NODE_TYPE(g, n) != NDTYPE_EADD) {
+    return false;
+  }
+  const grph_size_t contraction = GRPH_NODE_DEPS(g, n)[0];
+  const grph_size_t addend = GRPH_NODE_DEPS(g, n)[1];
+  return GRPH_NODE_TYPE(g, contraction) == NDTYPE_CONTRACT && consumers[contraction] == 1 &&
+         contraction != addend && TNSR_SHPE(GRPH_NODE_DATA(g, addend), 0) == 1;
+}
+
+static bool grph_run_fused_affine(grph_t *g, grph_size_t n) {
+  ASSERT(g && GRPH_NODE_TYPE(g, n) == NDTYPE_EADD);
+  const grph_size_t contraction = GRPH_NODE_DEPS(g, n)[0];
+  tnsr_t *data = GRPH_NODE_DATA(g, n);
+  tnsr_t *x = GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, contraction)[0]);
+  tnsr_t *w = GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, contraction)[1]);
+
+  tnsr_reset(data);
+  REQUIRE(tnsr_eadd(data, data, GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, n)[1])), goto error);
+  REQUIRE(tnsr_contract(data, x, w), goto error);
+  return true;
+error:
+  return false;
+}
+
+grph_plan_t *grph_compile(grph_t *g, grph_size_t output) {
+  ASSERT(g && output < GRPH_NODES(g));
+  grph_plan_t *plan = NULL;
+  grph_size_t *topological = malloc(sizeof(grph_size_t[GRPH_NODES(g)]));
+  grph_size_t *consumers = calloc(1, sizeof(grph_size_t[GRPH_NODES(g)]));
+  node_visited_t *visited = calloc(1, sizeof(node_visited_t[GRPH_NODES(g)]));
+  REQUIRE(topological && consumers && visited, goto error);
+
+  // Dead-node elimination. Only nodes reachable from the output are planned.
+  grph_size_t found = 0;
+  REQUIRE(topological_sort(g, output, topological, visited, &found), goto error);
+  for (grph_size_t i = 0; i < found; ++i) {
+    const grph_size_t node_id = topological[i];
+    for (grph_size_t j = 0; j < GRPH_NODE_NDEP(g, node_id); ++j) {
+      ++consumers[GRPH_NODE_DEPS(g, node_id)[j]];
+    }
+  }
+  consumers[output] += 1;  // The output is consumed by the caller.
+
+  plan = malloc(sizeof(grph_plan_t) + sizeof(grph_step_t[found]));
+  REQUIRE(plan, goto error);
+  plan->output = output;
+  plan->steps_count = 0;
+  plan->executed = false;
+
+  // Operator fusion. Marks contractions that are evaluated by their consumer.
+  for (grph_size_t i = 0; i < found; ++i) {
+    const grph_size_t node_id = topological[i];
+    if (grph_fusable_affine(g, node_id, consumers)) {
+      visited[GRPH_NODE_DEPS(g, node_id)[0]] = ND_FUSED;
+    }
+  }
+  for (grph_size_t i = 0; i < found; ++i) {
+    const grph_size_t node_id = topological[i];
+    if (GRPH_NODE_TYPE(g, node_id) == NDTYPE_DATA) {
+      continue;
+    }
+    if (visited[node_id] == ND_FUSED) {
+      // Buffer planning. The fused intermediate is never written, its gradient is kept
+      // as the backward pass still flows through it.
+      tnsr_destroy(&GRPH_NODE_DATA(g, node_id));
+      continue;
+    }
+    const bool fused = grph_fusable_affine(g, node_id, consumers);
+    plan->steps[plan->steps_count++] = (grph_step_t){
+        .type = fused ? GRPH_STEP_FUSED_AFFINE : GRPH_STEP_NODE,
+        .node = node_id,
+    };
+  }
+
+  free(topological);
+  free(consumers);
+  free(visited);
+  return plan;
+error:
+  free(topological);
+  free(consumers);
+  free(visited);
+  free(plan);
+  return NULL;
+}
+
+bool grph_run(grph_t *g, grph_plan_t *plan) {
+  ASSERT(g && plan);
+  if (plan->executed && !g->forward_only) {
+    for (grph_size_t i = 0; i < GRPH_NODES(g); ++i) {
+      tnsr_reset(GRPH_NODE_GRAD(g, i));
+    }
+  }
+  for (grph_size_t i = 0; i < plan->steps_count; ++i) {
+    const grph_step_t step = plan->steps[i];
+    switch (step.type) {
+      case GRPH_STEP_NODE:
+        REQUIRE(node_functions[GRPH_NODE_TYPE(g, step.node)](g, step.node), goto error);
+        break;
+      case GRPH_STEP_FUSED_AFFINE:
+        REQUIRE(grph_run_fused_affine(g, step.node), goto error);
+        break;
+      default:
+        ASSERT(false);  // Unreachable.
+        break;
+    }
+    grph_round(g, step.node, GRPH_NODE_DATA(g, step.node));
+  }
+  plan->executed = true;
+  return true;
+error:
+  return false;
+}
+
+void grph_plan_destroy(grph_plan_t **plan) {
+  if (!plan || !*plan) {
+    return;
+  }
+  free(*plan);
+  *plan = NULL;
+}
+
+/**
+ * Shared state of a single backward pass.
+ * NOTE:
+ * pending[n] counts the consumers of n that have yet to push their gradient into it,
+ * a node becomes ready once it drops to zero.
+ */
+typedef struct grph_trace_ctx grph_trace_ctx_t;
+
+// Argument of the task tracing node n, every node is spawned at most once.
+typedef struct {
+  grph_trace_ctx_t *ctx;
+  grph_size_t n;
+} grph_trace_task_t;
+
+struct grph_trace_ctx {
+  grph_t *g;
+  grph_size_t *pending;
+  grph_trace_task_t *tasks;
+  tpool_t *pool;
+  tpool_group_t group;
+  bool status;
+};
+
+/**
+ * Runs a node's local derivative, then releases every dependency whose consumers have
+ * all finished. Released nodes are spawned as tasks of the pass, which idle workers
+ * balance through work-stealing, except the last one which the task continues with.
+ * Kernels inside a task split their own loops over the pool.
+ */
+static void grph_trace_node(void *arg) {
+  ASSERT(arg);
+  const grph_trace_task_t *task = arg;
+  grph_trace_ctx_t *ctx = task->ctx;
+  grph_t *g = ctx->g;
+  grph_size_t n = task->n;
+  bool has_next = true;
+
+  while (has_next) {
+    bool status = true;
+#pragma omp atomic read
+    status = ctx->status;
+    if (!status) {
+      return;  // Another branch has failed, drain the remaining tasks.
+    }
+
+    const node_type_t ntype = GRPH_NODE_TYPE(g, n);
+    if (ntype != NDTYPE_DATA) {
+      grph_round(g, n, GRPH_NODE_GRAD(g, n));  // Every consumer has pushed into it.
+      status = node_functions_dx[ntype](g, n);
+    }
+    if (!status) {
+#pragma omp atomic write
+      ctx->status = false;
+      return;
+    }
+
+    grph_size_t next = 0;
+    has_next = false;
+    for (grph_size_t i = 0; i < GRPH_NODE_NDEP(g, n); ++i) {
+      const grph_size_t dep = GRPH_NODE_DEPS(g, n)[i];
+      grph_size_t remaining = 0;
+#pragma omp atomic capture
+      remaining = --ctx->pending[dep];
+      if (remaining) {
+        continue;
+      }
+      if (has_next) {
+        ctx->tasks[next] = (grph_trace_task_t){.ctx = ctx, .n = next};
+        if (!tpool_spawn(ctx->pool, &ctx->group, grph_trace_node, &ctx->tasks[next])) {
+          grph_trace_node(&ctx->tasks[next]);  // Runs inline instead.
+        }
+      }
+      next = dep;
+      has_next = true;
+    }
+    n = next;
+  }
+}
+
 bool grph_trace(grph_t *g) {
   ASSERT(g);
+  REQUIRE(!g->forward_only, return false);
   grph_size_t tail = grph_tail(g);
   grph_size_t *topological = NULL;
+  grph_size_t *pending = NULL;
+  grph_trace_task_t *tasks = NULL;
   node_visited_t *visited = NULL;
   REQUIRE(tail != GRPH_ERR_ID, goto error);
 
   topological = malloc(sizeof(grph_size_t[GRPH_NODES(g)]));
+  pending = calloc(1, sizeof(grph_size_t[GRPH_NODES(g)]));
+  tasks = malloc(sizeof(grph_trace_task_t[GRPH_NODES(g)]));
   visited = calloc(1, sizeof(node_visited_t[GRPH_NODES(g)]));
 
-  REQUIRE(topological && visited, goto error);
+  REQUIRE(topological && pending && tasks && visited, goto error);
 
   grph_size_t found = 0;
   REQUIRE(topological_sort(g, tail, topological, visited, &found), goto error);
 
-  for (int i = GRPH_NODES(g); i-- > 0;) {
+  // Only consumers reachable from the tail contribute to a node's gradient.
+  for (grph_size_t i = 0; i < found; ++i) {
     const grph_size_t node_id = topological[i];
-    const node_type_t ntype = GRPH_NODE_TYPE(g, node_id);
-    if (ntype == NDTYPE_DATA) {
-      continue;
+    for (grph_size_t j = 0; j < GRPH_NODE_NDEP(g, node_id); ++j) {
+      ++pending[GRPH_NODE_DEPS(g, node_id)[j]];
     }
-    REQUIRE(node_functions_dx[ntype](g, node_id), goto error);
   }
 
+  grph_trace_ctx_t ctx = {
+      .g = g,
+      .pending = pending,
+      .tasks = tasks,
+      .pool = tpool_global(),
+      .status = true,
+  };
+  tpool_group_init(&ctx.group);
+  tasks[tail] = (grph_trace_task_t){.ctx = &ctx, .n = tail};
+  grph_trace_node(&tasks[tail]);
+  tpool_wait(ctx.pool, &ctx.group);
+
+  REQUIRE(ctx.status, goto error);
+
   free(topological);
+  free(pending);
+  free(tasks);
   free(visited);
   return true;
 
 error:
   free(topological);
+  free(pending);
+  free(tasks);
   free(visited);
   return false;
-}
\ No newline at end of file
+}
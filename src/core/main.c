@@ -9,11 +9,14 @@
 #define _CRT_SECURE_NO_WARNINGS
 
 #include <Windows.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <threads.h>
+#include <time.h>
 #include <x86intrin.h>
 
 #include "core/graph.h"
@@ -70,10 +73,105 @@ bool mnist_data(size_t batch_size, tnsr_t **in, tnsr_t **expected, void *ctx) {
   return true;
 }
 
+#define BENCH_MAX_THREADS 8
+#define BENCH_INFERENCES 10000  // Per thread.
+#define BENCH_IMAGES 64         // Test images each thread cycles through.
+
+typedef struct {
+  model_session_t *session;
+  const callback_ctx_t *data;
+  const atomic_bool *go;  // Set once every thread is ready.
+  size_t first;           // Test image the thread starts from.
+  double end;             // When the thread was done inferring.
+  bool ok;
+} bench_ctx_t;
+
+double bench_seconds(void) {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Infers BENCH_INFERENCES test images one by one through its session, once released.
+// Only the inferences are timed, the inputs are prepared beforehand.
+int bench_worker(void *arg) {
+  bench_ctx_t *bench = arg;
+  tnsr_t *in[BENCH_IMAGES] = {};
+  tnsr_t *out = TNSR_MATRIX(1, 10);
+  bench->ok = out != NULL;
+  for (size_t i = 0; bench->ok && i < BENCH_IMAGES; ++i) {
+    const size_t idx = (bench->first + i) % bench->data->ne_test_img;
+    in[i] = TNSR_MATRIX(1, 28 * 28);
+    bench->ok = in[i] != NULL;
+    for (size_t j = 0; bench->ok && j < 28 * 28; ++j) {
+      TNSR_DATA(in[i], 0, j) = bench->data->test_images[idx * 28 * 28 + j] / 255.0f;
+    }
+  }
+  while (!atomic_load_explicit(bench->go, memory_order_acquire)) {
+    thrd_yield();
+  }
+  for (size_t i = 0; bench->ok && i < BENCH_INFERENCES; ++i) {
+    bench->ok = model_session_infer(bench->session, in[i % BENCH_IMAGES], out);
+  }
+  bench->end = bench_seconds();
+  for (size_t i = 0; i < BENCH_IMAGES; ++i) {
+    tnsr_destroy(&in[i]);
+  }
+  tnsr_destroy(&out);
+  return 0;
+}
+
+/**
+ * Throughput of 1, 2, 4... threads inferring concurrently on the same model.
+ * NOTE:
+ * Sessions and threads are created before the clock starts, then released together.
+ */
+bool bench_scaling(const model_t *model, const callback_ctx_t *data) {
+  double base = 0.0;
+  for (size_t threads = 1; threads <= BENCH_MAX_THREADS; threads *= 2) {
+    thrd_t workers[BENCH_MAX_THREADS];
+    bench_ctx_t benches[BENCH_MAX_THREADS] = {};
+    atomic_bool go = false;
+    bool ok = true;
+    for (size_t t = 0; t < threads; ++t) {
+      benches[t] = (bench_ctx_t){.data = data, .go = &go, .first = t * BENCH_IMAGES};
+      benches[t].session = model_session_create(model, 1);
+      ok = ok && benches[t].session;
+    }
+    size_t started = 0;
+    for (; ok && started < threads; ++started) {
+      if (thrd_create(&workers[started], bench_worker, &benches[started]) != thrd_success) {
+        ok = false;
+        break;
+      }
+    }
+    const double start = bench_seconds();
+    atomic_store_explicit(&go, true, memory_order_release);
+    double end = start;
+    for (size_t t = 0; t < started; ++t) {
+      thrd_join(workers[t], NULL);
+      ok = ok && benches[t].ok;
+      end = benches[t].end > end ? benches[t].end : end;
+    }
+    for (size_t t = 0; t < threads; ++t) {
+      model_session_destroy(&benches[t].session);
+    }
+    if (!ok) {
+      return false;
+    }
+    const double rate = threads * BENCH_INFERENCES / (end - start);
+    base = threads == 1 ? rate : base;
+    printf("THREADS: %2zu | %9.0f INFERENCES/S | SPEEDUP %5.2fx\n", threads, rate, rate / base);
+  }
+  return true;
+}
+
 int main() {
   /* ---------------------------------- Setup --------------------------------- */
   system("cls");
   callback_ctx_t ctx = {};
+  model_session_t *session = NULL;
+  tnsr_t *out = NULL;  // Prediction of the session.
   FILE *tr_imgstream = fopen("C:/dev/repositories/nn-c/data/train-images.idx3-ubyte", "rb");
   FILE *tr_lblstream = fopen("C:/dev/repositories/nn-c/data/train-labels.idx1-ubyte", "rb");
   FILE *tst_imgstream = fopen("C:/dev/repositories/nn-c/data/t10k-images.idx3-ubyte", "rb");
@@ -120,9 +218,21 @@ int main() {
       .dashboard_callback = mnist_dash
   };
   layer_config_t layers[] = {
-      (layer_config_t){128, INIT_HE, NDTYPE_ELEAKYRELU},
-      (layer_config_t){128, INIT_HE, NDTYPE_ELEAKYRELU},
-      (layer_config_t){10, INIT_GLOROT, NDTYPE_SOFTMAX}
+      (layer_config_t){
+          .neuron_count = 128,
+          .initialization_function = INIT_HE,
+          .activation_function = NDTYPE_ELEAKYRELU,
+      },
+      (layer_config_t){
+          .neuron_count = 128,
+          .initialization_function = INIT_HE,
+          .activation_function = NDTYPE_ELEAKYRELU,
+      },
+      (layer_config_t){
+          .neuron_count = 10,
+          .initialization_function = INIT_GLOROT,
+          .activation_function = NDTYPE_SOFTMAX,
+      },
   };
   size_t lsize = sizeof(layers) / sizeof(layer_config_t);
   model_config_t config = {
@@ -157,6 +267,11 @@ int main() {
   if (!model_inf) {
     goto error;
   }
+  session = model_session_create(model_inf, 1);
+  out = TNSR_MATRIX(1, 10);
+  if (!session || !out) {
+    goto error;
+  }
   ctx.use_testing = true;
 
   tnsr_type_t accuracy = 0.0f;
@@ -167,8 +282,7 @@ int main() {
     if (!mnist_data(1, &in, &expected, &ctx)) {
       goto end;
     }
-    tnsr_t *out = model_infer(model_inf, in);
-    if (!out) {
+    if (!model_session_infer(session, in, out)) {
       goto end;
     }
     tnsr_type_t expconf = 0.0f;
@@ -190,12 +304,17 @@ int main() {
   end:
     tnsr_destroy(&in);
     tnsr_destroy(&expected);
-    tnsr_destroy(&out);
     if (!rt) {
       goto error;
     }
   }
-  printf("MEAN ACCURACY: %.2f%%", (accuracy / 10000) * 100);
+  printf("MEAN ACCURACY: %.2f%%\n\n", (accuracy / 10000) * 100);
+
+  /* --------------------------- Concurrent inference ------------------------- */
+
+  if (!bench_scaling(model_inf, &ctx)) {
+    goto error;
+  }
   fclose(tr_imgstream);
   fclose(tr_lblstream);
   fclose(tst_imgstream);
@@ -204,6 +323,8 @@ int main() {
   free(ctx.train_labels);
   free(ctx.test_images);
   free(ctx.test_labels);
+  model_session_destroy(&session);
+  tnsr_destroy(&out);
   model_destroy(&model);
   model_destroy(&model_inf);
   return EXIT_SUCCESS;
@@ -223,6 +344,8 @@ error:
   free(ctx.train_labels);
   free(ctx.test_images);
   free(ctx.test_labels);
+  model_session_destroy(&session);
+  tnsr_destroy(&out);
   model_destroy(&model);
   model_destroy(&model_inf);
   return EXIT_FAILURE;
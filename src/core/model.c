@@ -6,22 +6,52 @@
  */
 
 #define _CRT_SECURE_NO_WARNINGS
+#ifndef _WIN32
+  #define _POSIX_C_SOURCE 200809L
+#endif
 
 #include <float.h>
 #include <math.h>
+#include <omp.h>
 #include <string.h>
 #include <threads.h>
 
+#ifdef _WIN32
+  #include <Windows.h>
+  #include <io.h>
+#else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+#include "core/codec.h"
 #include "core/graph.h"
 #include "core/model.h"
 #include "core/network.h"
 #include "core/node.h"  // IWYU pragma: export
 #include "core/tensor.h"
 #include "core/tensor_functions.h"
+#include "core/thread_pool.h"
 #include "utils/utils.h"
 
 #define MODEL_LOSS_HISTORY_LENGTH 60
 #define MODEL_LOSS_BINS 12
+#define MODEL_GRAIN 4096  // Parameters per chunk of the loops over the gradient arena.
+#define MODEL_LOSS_SCALE_INIT 65536.0f  // 2^16, of reduced precisions.
+#define MODEL_LOSS_SCALE_MAX 16777216.0f  // 2^24.
+#define MODEL_LOSS_SCALE_INTERVAL 2000  // Steps without overflow before the scale doubles.
+#define MODEL_SPARSE_DENSITY 0.5  // Stored block fraction past which dense products are faster.
+#define MODEL_LEGACY_MAGIC 0x4004
+#define MODEL_FILE_MAGIC 0x314C444F4D434E4Eull  // "NNCMODL1"
+#define MODEL_FILE_VERSION 1
+#define MODEL_FILE_ALIGNMENT 64  // Of section payloads, one cache line.
+#define MODEL_FILE_SECTIONS 16   // Most sections a file may list.
+#define MODEL_CHECKSUM_BLOCK 16384  // Words summed between reductions, keeps the sums in range.
+#define MODEL_VERIFY_CHUNK (64 * 1024)  // Bytes read at once while verifying a section.
+#define MODEL_PATH_SUFFIX_LENGTH 24  // Room for the ".tmp" and ".<n>" suffixes of checkpoints.
+#define MODEL_TENSOR_ALIGNMENT 8  // Of the encoded tensors within their section.
 
 typedef struct {
   uint64_t magicn;
@@ -50,28 +80,226 @@ typedef struct {
   layer_serial_config_t network[];
 } model_serial_layer_config_t;
 
+// Legacy format: the header is followed by the layer configs, then by the parameter dump,
+// arranged in L0[W, B] -> L1[W, B].
+// Refer to serial_layer_config to find out sizes which are just
+// (previous neuron count or input_size) * neuron_count (weights) + neuron_count (bias)
+
+// Sectioned format: a model_file_header_t is followed by its section table, then by the
+// sections' payloads, each starting at a multiple of MODEL_FILE_ALIGNMENT. Parameters are
+// thus aligned like allocated ones when the file is mapped. Sections of unknown types are
+// skipped, so that later ones can be added without breaking older readers.
+typedef enum {
+  MODEL_SECTION_CONFIG = 1,  // model_serial_header_config_t, magicn holds MODEL_LEGACY_MAGIC.
+  MODEL_SECTION_LAYERS,      // layer_serial_record_t per layer.
+  MODEL_SECTION_PARAMS,      // Parameter arena, L0[W, B] -> L1[W, B].
+  // Checkpoint sections, in the unsharded layout like the parameters.
+  MODEL_SECTION_STATE,     // Moments of the optimizer state in turn, per layer.
+  MODEL_SECTION_MASK,      // Pruning mask, if pruning.
+  MODEL_SECTION_TRAINING,  // model_serial_training_t.
+  MODEL_SECTION_DATA,      // The configured data state, if any.
+  // Parameters as encoded tensors, replacing MODEL_SECTION_PARAMS. model_serial_tensor_t
+  // headed, the weights then the biases of each layer in turn.
+  MODEL_SECTION_ENCODED_PARAMS,
+  MODEL_SECTION_TYPE_COUNT
+} model_section_type_t;
+
+typedef struct {
+  uint64_t magic;  // MODEL_FILE_MAGIC.
+  uint32_t version;
+  uint32_t section_count;
+  uint64_t reserved[6];  // Pads the header to MODEL_FILE_ALIGNMENT.
+} model_file_header_t;
+
+typedef struct {
+  uint32_t type;
+  uint32_t reserved;
+  uint64_t offset;    // Of the payload from the start of the file.
+  uint64_t size;      // Of the payload in bytes.
+  uint64_t checksum;  // Fletcher-64 of the payload.
+} model_file_section_t;
+
+typedef struct {
+  layer_serial_config_t layer;
+  uint64_t height;  // Convolution geometry, all 0 for fully connected layers.
+  uint64_t width;
+  uint64_t channels;
+  uint64_t kernel_height;
+  uint64_t kernel_width;
+  uint64_t filters;
+  uint64_t stride;
+  uint64_t padding;
+  uint64_t pool;
+} layer_serial_record_t;
+
+// Followed by size bytes of encoded values, zero-padded to MODEL_TENSOR_ALIGNMENT.
+typedef struct {
+  uint32_t codec;  // codec_t.
+  uint32_t reserved;
+  uint64_t rows;
+  uint64_t cols;
+  uint64_t size;
+} model_serial_tensor_t;
+
+typedef struct {
+  uint64_t next_epoch;
+  uint64_t next_pass;
+  uint64_t update_count;
+  uint64_t max_staleness;
+  double mean_staleness;
+  double loss_scale;
+  uint64_t skipped_steps;
+  uint64_t stable_steps;
+  uint64_t step_counts[];  // Optimizer steps taken by each layer.
+} model_serial_training_t;
+
+// Training state a checkpoint is written from. Values are laid out like the arena, and are
+// either the arena itself or copies of it taken between two steps.
+typedef struct {
+  tnsr_type_t *params;
+  tnsr_type_t *state;
+  tnsr_type_t *mask;
+  model_state_t progress;
+  uint64_t *step_counts;  // Of each layer, NULL to read them from the layers.
+  void *data;             // Configured data state, NULL if none.
+} model_snapshot_t;
+
+/**
+ * Background writer of the checkpoints of a running fit. Snapshots are double-buffered: the
+ * trainer fills whichever buffer is not being written, replacing a snapshot still waiting
+ * for the writer, so that taking one never waits for the disk.
+ */
+struct model_checkpointer {
+  thrd_t thread;
+  mtx_t lock;
+  cnd_t ready;  // Signalled when a snapshot is pending, or when stopping.
+  const model_t *model;
+  model_snapshot_t buffers[2];
+  int pending;  // Buffer waiting to be written, -1 if none.
+  int writing;  // Buffer being written, -1 if none.
+  bool stopping;
+  bool failed;  // Reported by the next snapshot, or once the writer stops.
+};
+
+// Defined along with the serialization, used by the fit loops.
+static model_snapshot_t model_snapshot_view(model_t *m);
+static bool model_commit_checkpoint(
+    const model_t *m,
+    const model_snapshot_t *snapshot,
+    const char *location,
+    size_t keep
+);
+static bool model_checkpointer_submit(model_checkpointer_t *c, const model_t *m);
+
+// Sequential writer of a sectioned file, summing the current section as it goes.
+typedef struct {
+  FILE *stream;
+  uint64_t offset;  // Bytes written so far.
+  uint64_t sum[2];  // Fletcher-64 sums of the current section.
+} model_writer_t;
+
+/**
+ * A data-parallel worker. Each worker passes its shard of the batch through its own graph,
+ * using its own layer bindings and gradient buffer.
+ * NOTE:
+ * Worker 0 binds to the model's own layers and gradient arena.
+ */
 typedef struct {
-  // Parameter dump. Arranged in L0[W, B] -> L1[W, B].
-  // Refer to serial_layer_config to find out sizes which are just
-  // (previous neuron count or input_size) * neuron_count (weights) + neuron_count (bias)
-  tnsr_type_t paremeters[];
-} model_serial_parameters_t;
+  dense_layer_t **layers;
+  tnsr_type_t *grads;
+  grph_t *graph;
+  tnsr_t *input;     // View of the worker's rows of the batch.
+  tnsr_t *expected;  // View of the worker's rows of the batch.
+  grph_size_t loss_node;
+  tnsr_type_t weight;  // Share of the batch processed by the worker.
+} model_worker_t;
 
+/**
+ * Records a completed update. staleness is the number of updates other workers applied
+ * between the step reading the weights and applying its own update.
+ */
 static bool model_update_status(
-    model_t *model, grph_t **grph, grph_size_t loss_node, size_t epoch_count, size_t pass_count
+    model_t *model,
+    tnsr_type_t loss,
+    size_t epoch_count,
+    size_t pass_count,
+    size_t staleness,
+    double start
 ) {
-  ASSERT(model && grph && *grph);
-  model->state.epoch_count = epoch_count;
-  model->state.pass_count = pass_count;
-  model->state.training_loss = TNSR_DATA(GRPH_NODE_DATA(*grph, loss_node), 0, 0);
+  ASSERT(model);
+  model_state_t *state = &model->state;
+  state->epoch_count = epoch_count;
+  state->pass_count = pass_count;
+  state->training_loss = loss;
+  ++state->update_count;
+  state->max_staleness = max(state->max_staleness, staleness);
+  state->mean_staleness += (staleness - state->mean_staleness) / state->update_count;
+  const bool reached = model->config.target_loss > 0 && loss <= model->config.target_loss;
+  if (reached && isnan(state->time_to_target)) {
+    state->time_to_target = omp_get_wtime() - start;
+  }
   return true;
 }
 
-static grph_size_t model_forward_pass(model_t *model, grph_t **grph, tnsr_t *input) {
-  ASSERT(model && grph && *grph && input);
+// Creates a deferred graph rounding its values to the configured precision.
+static grph_t *model_graph_create(model_t *m) {
+  ASSERT(m);
+  grph_t *graph = grph_create_deferred(0);
+  REQUIRE(graph, goto error);
+  graph->precision = m->config.precision;
+  graph->loss_scale = m->state.loss_scale;
+  return graph;
+error:
+  return NULL;
+}
+
+/**
+ * Shape of layer i's parameters given the width of its input, which convolution layers
+ * require to match their images. Returns the width of its output, 0 upon mismatch.
+ */
+static tnsr_size_t model_layer_shape(
+    const model_config_t *config,
+    size_t i,
+    tnsr_size_t input,
+    tnsr_size_t *fan_in,
+    tnsr_size_t *fan_out
+) {
+  ASSERT(config && i < config->network_depth && fan_in && fan_out);
+  const layer_config_t *layer = &config->network[i];
+  const grph_conv_t *conv = &layer->conv;
+  if (!conv->filters) {
+    *fan_in = input;
+    *fan_out = layer->neuron_count;
+    return layer->neuron_count;
+  }
+  *fan_in = conv->kernel_height * conv->kernel_width * conv->channels;
+  *fan_out = conv->filters;
+  tnsr_size_t height = 0;
+  tnsr_size_t width = 0;
+  const tnsr_size_t output = grph_conv_output(conv, &height, &width);
+  return input == conv->height * conv->width * conv->channels ? output : 0;
+}
+
+// Passes n through layer i, bound to the given dense layer or replica.
+static grph_size_t model_layer_passthrough(
+    const model_t *model, grph_t **grph, dense_layer_t *layer, size_t i, grph_size_t n
+) {
+  ASSERT(model && i < model->config.network_depth);
+  const grph_conv_t *conv = &model->config.network[i].conv;
+  if (!conv->filters) {
+    return dense_layer_passthrough(grph, layer, n);
+  }
+  conv_layer_t binding = {.geometry = conv, .filters = layer};
+  return conv_layer_passthrough(grph, &binding, n);
+}
+
+static grph_size_t model_forward_pass(
+    const model_t *model, dense_layer_t **layers, grph_t **grph, tnsr_t *input
+) {
+  ASSERT(model && layers && grph && *grph && input);
   grph_size_t n = grph_append_data(grph, input);
   for (size_t i = 0; i < model->config.network_depth; ++i) {
-    n = dense_layer_passthrough(grph, model->layers[i], n);
+    n = model_layer_passthrough(model, grph, layers[i], i, n);
     REQUIRE(n != GRPH_ERR_ID, goto error);
   }
   return n;
@@ -83,299 +311,2563 @@ static grph_size_t model_backward_pass(
     model_t *model, grph_size_t lnode, grph_t **grph, tnsr_t *expected
 ) {
   ASSERT(grph && *grph && expected && model && lnode != GRPH_ERR_ID);
+  grph_plan_t *plan = NULL;
   grph_size_t expg = grph_append_data(grph, expected);
   REQUIRE(expg != GRPH_ERR_ID, goto error);
 
   grph_size_t loss = grph_execute(grph, lnode, expg, model->config.loss_function_type);
   REQUIRE(loss != GRPH_ERR_ID, goto error);
+  if ((*grph)->mode == GRPH_MODE_DEFERRED) {
+    plan = grph_compile(*grph, loss);
+    REQUIRE(plan, goto error);
+    REQUIRE(grph_run(*grph, plan), goto error);
+  }
   REQUIRE(grph_trace(*grph), goto error);
+  grph_plan_destroy(&plan);
   return loss;
 error:
+  grph_plan_destroy(&plan);
   return GRPH_ERR_ID;
 }
 
-static bool model_optimize(model_t *model, grph_t **grph) {
-  ASSERT(model && grph && *grph);
+static bool model_optimize(model_t *model, dense_layer_t **layers) {
+  ASSERT(model && layers);
   for (size_t i = 0; i < model->config.network_depth; ++i) {
-    REQUIRE(dense_layer_update(grph, model->layers[i]), goto error);
+    REQUIRE(dense_layer_update(layers[i]), goto error);
+  }
+  return true;
+error:
+  return false;
+}
+
+// Builds the worker's graph, then runs its forward and backward passes.
+static bool model_worker_pass(model_t *m, model_worker_t *w) {
+  ASSERT(m && w && !w->graph);
+  w->graph = model_graph_create(m);
+  REQUIRE(w->graph, goto error);
+  for (size_t j = 0; j < m->config.network_depth; ++j) {
+    REQUIRE(dense_layer_add_to_graph(&w->graph, w->layers[j]), goto error);
+  }
+  memset(w->grads, 0, sizeof(tnsr_type_t[m->arena.param_count]));
+  grph_size_t node = model_forward_pass(m, w->layers, &w->graph, w->input);
+  REQUIRE(node != GRPH_ERR_ID, goto error);
+  w->loss_node = model_backward_pass(m, node, &w->graph, w->expected);
+  REQUIRE(w->loss_node != GRPH_ERR_ID, goto error);
+  return true;
+error:
+  return false;
+}
+
+// Releases the worker's graph and batch views.
+static void model_worker_reset(model_t *m, model_worker_t *w) {
+  ASSERT(m && w);
+  for (size_t j = 0; j < m->config.network_depth; ++j) {
+    dense_layer_remove_from_graph(w->layers[j]);
+  }
+  grph_destroy(&w->graph);
+  tnsr_destroy(&w->input);
+  tnsr_destroy(&w->expected);
+}
+
+/**
+ * Sums the weighted worker gradients into worker 0's buffer, which the optimizer reads.
+ * NOTE:
+ * Must be called by every thread of the enclosing team. Each thread reduces its own
+ * slice of the gradient vector across all workers, so the reduction is a single parallel
+ * pass. Replicas share the model's parameters, so no broadcast is needed afterwards.
+ */
+static void model_reduce_grads(model_worker_t *workers, size_t nworkers, tnsr_size_t n) {
+  ASSERT(workers && nworkers > 1);
+  tnsr_type_t *restrict dst = workers[0].grads;
+#pragma omp for simd schedule(static)
+  for (tnsr_size_t i = 0; i < n; ++i) {
+    tnsr_type_t sum = workers[0].weight * dst[i];
+    for (size_t r = 1; r < nworkers; ++r) {
+      sum += workers[r].weight * workers[r].grads[i];
+    }
+    dst[i] = sum;
+  }
+}
+
+// Processes train on their own data shard, gradients and loss are averaged across all of them.
+static bool model_reduce_processes(model_t *m, tnsr_type_t *loss) {
+  ASSERT(m && loss);
+  dist_transport_t *transport = m->config.transport;
+  if (transport) {
+    REQUIRE(dist_allreduce_mean(transport, m->arena.grads, m->arena.param_count), goto error);
+    REQUIRE(dist_allreduce_mean(transport, loss, 1), goto error);
+  }
+  return true;
+error:
+  return false;
+}
+
+// Gradient accumulation state of an epoch.
+typedef struct {
+  size_t count;      // Batches folded into the accumulated gradients.
+  tnsr_type_t loss;  // Sum of their losses.
+} model_accumulation_t;
+
+typedef struct {
+  tnsr_type_t *grads;
+  tnsr_type_t *accum;
+  tnsr_type_t scale;
+  bool flush;
+} model_accumulate_ctx_t;
+
+// accum += grads, or grads = (grads + accum) * scale and accum = 0 when flushing.
+// Flushing without pending batches, accum is NULL and grads are only scaled.
+static void model_accumulate_range(size_t begin, size_t end, void *ctx) {
+  const model_accumulate_ctx_t *c = ctx;
+  tnsr_type_t *restrict grads = c->grads;
+  tnsr_type_t *restrict accum = c->accum;
+  if (!c->flush) {
+#pragma omp simd
+    for (size_t i = begin; i < end; ++i) {
+      accum[i] += grads[i];
+    }
+    return;
+  }
+  if (!accum) {
+#pragma omp simd
+    for (size_t i = begin; i < end; ++i) {
+      grads[i] *= c->scale;
+    }
+    return;
+  }
+#pragma omp simd
+  for (size_t i = begin; i < end; ++i) {
+    grads[i] = (grads[i] + accum[i]) * c->scale;
+    accum[i] = 0;
+  }
+}
+
+typedef struct {
+  const tnsr_type_t *grads;
+  bool finite;
+} model_finite_ctx_t;
+
+static void model_finite_range(size_t begin, size_t end, void *ctx) {
+  model_finite_ctx_t *c = ctx;
+  const tnsr_type_t *restrict grads = c->grads;
+  tnsr_type_t probe = 0;  // NAN as soon as a gradient is infinite or NAN.
+#pragma omp simd reduction(+ : probe)
+  for (size_t i = begin; i < end; ++i) {
+    probe += 0 * grads[i];
+  }
+  if (probe != 0) {
+#pragma omp atomic write
+    c->finite = false;
+  }
+}
+
+/**
+ * Checks the step's gradients for overflow, and adjusts the loss scale. Returns whether
+ * the step can be applied.
+ * NOTE:
+ * Gradients are checked once reduced across processes, so that every process takes the
+ * same decision. The scale is halved upon overflow, and doubled after
+ * MODEL_LOSS_SCALE_INTERVAL steps without any.
+ */
+static bool model_scale_loss(model_t *m) {
+  ASSERT(m && m->config.precision != TNSR_FP32);
+  model_state_t *state = &m->state;
+  model_finite_ctx_t ctx = {.grads = m->arena.grads, .finite = true};
+  tpool_parallel_for(
+      tpool_global(), m->arena.param_count, MODEL_GRAIN, model_finite_range, &ctx
+  );
+  if (!ctx.finite) {
+    state->loss_scale = max(state->loss_scale / 2, 1);
+    state->stable_steps = 0;
+    ++state->skipped_steps;
+    return false;
+  }
+  if (++state->stable_steps == MODEL_LOSS_SCALE_INTERVAL) {
+    state->loss_scale = min(state->loss_scale * 2, MODEL_LOSS_SCALE_MAX);
+    state->stable_steps = 0;
+  }
+  return true;
+}
+
+/**
+ * Folds the gradients of the last batch, held by the gradient arena, into the accumulated
+ * ones. Once accumulation_steps batches have been folded, or on the epoch's last batch,
+ * their mean gradient and loss are averaged across processes and the optimizer runs.
+ * NOTE:
+ * The pending sum lives in its own buffer, as every batch overwrites the arena. The last
+ * batch of a step is folded in place, so the optimizer reads the arena as usual.
+ * Gradients are unscaled by the loss scale in the same pass, and steps whose gradients
+ * overflowed are skipped.
+ */
+static bool model_accumulate_step(
+    model_t *m,
+    model_accumulation_t *acc,
+    tnsr_type_t loss,
+    size_t epoch_n,
+    size_t pass,
+    bool last,
+    double start
+) {
+  ASSERT(m && acc);
+  const size_t steps = max(1, m->config.accumulation_steps);
+  model_accumulate_ctx_t ctx = {.grads = m->arena.grads, .accum = m->arena.accum_grads};
+  acc->loss += loss;
+  ++acc->count;
+  if (acc->count < steps && !last) {
+    tpool_parallel_for(
+        tpool_global(), m->arena.param_count, MODEL_GRAIN, model_accumulate_range, &ctx
+    );
+    return true;
   }
+  if (acc->count > 1 || m->state.loss_scale != 1) {
+    ctx.accum = acc->count > 1 ? ctx.accum : NULL;
+    ctx.scale = 1 / (acc->count * m->state.loss_scale);
+    ctx.flush = true;
+    tpool_parallel_for(
+        tpool_global(), m->arena.param_count, MODEL_GRAIN, model_accumulate_range, &ctx
+    );
+  }
+  tnsr_type_t mean_loss = acc->loss / acc->count;
+  acc->count = 0;
+  acc->loss = 0;
+
+  REQUIRE(model_reduce_processes(m, &mean_loss), goto error);
+  if (m->config.precision != TNSR_FP32 && !model_scale_loss(m)) {
+    return true;
+  }
+  REQUIRE(model_optimize(m, m->layers), goto error);
+  REQUIRE(model_update_status(m, mean_loss, epoch_n, pass, 0, start), goto error);
   return true;
 error:
   return false;
 }
 
-static bool model_fit_one_epoch(model_t *m, size_t epoch_n) {
+/**
+ * Splits the batch between the workers, then runs their passes concurrently and
+ * reduces their gradients into the model's gradient arena. Returns the process' batch loss,
+ * NAN upon failure.
+ * NOTE:
+ * Workers run on their own threads, while the kernels of every worker share the global
+ * thread pool.
+ */
+static tnsr_type_t model_fit_step(
+    model_t *m, model_worker_t *workers, size_t nworkers, tnsr_t *input, tnsr_t *expected
+) {
+  ASSERT(m && workers && nworkers && input && expected);
+  const tnsr_size_t rows = TNSR_SHPE(input, 0);
+  nworkers = min(nworkers, rows);
+  REQUIRE(TNSR_IS_CONTIGUOUS(input) && TNSR_IS_CONTIGUOUS(expected), goto error);
+  REQUIRE(TNSR_SHPE(expected, 0) == rows, goto error);
+
+  tnsr_size_t start = 0;
+  for (size_t r = 0; r < nworkers; ++r) {
+    const tnsr_size_t count = rows / nworkers + (r < rows % nworkers);
+    model_worker_t *w = &workers[r];
+    w->input = tnsr_view(&TNSR_DATA(input, start, 0), count, TNSR_SHPE(input, 1));
+    w->expected = tnsr_view(&TNSR_DATA(expected, start, 0), count, TNSR_SHPE(expected, 1));
+    w->weight = (tnsr_type_t)count / rows;
+    REQUIRE(w->input && w->expected, goto error);
+    start += count;
+  }
+
+  bool status = true;
+  if (nworkers == 1) {
+    status = model_worker_pass(m, &workers[0]);
+  } else {
+#pragma omp parallel num_threads(nworkers)
+    {
+      // The runtime may provide fewer threads than requested.
+      const size_t tid = omp_get_thread_num();
+      const size_t team = omp_get_num_threads();
+      for (size_t r = tid; r < nworkers; r += team) {
+        if (!model_worker_pass(m, &workers[r])) {
+#pragma omp atomic write
+          status = false;
+        }
+      }
+#pragma omp barrier
+      if (status) {
+        model_reduce_grads(workers, nworkers, m->arena.param_count);
+      }
+    }
+  }
+  REQUIRE(status, goto error);
+
+  tnsr_type_t loss = 0;
+  for (size_t r = 0; r < nworkers; ++r) {
+    const tnsr_t *shard_loss = GRPH_NODE_DATA(workers[r].graph, workers[r].loss_node);
+    loss += workers[r].weight * TNSR_DATA(shard_loss, 0, 0);
+  }
+  return loss;
+error:
+  return NAN;
+}
+
+// Binds every worker to its layers and gradient buffer. NULL upon failure.
+static model_worker_t *model_workers_create(model_t *m, size_t nworkers) {
+  ASSERT(m && nworkers);
+  model_worker_t *workers = calloc(nworkers, sizeof(model_worker_t));
+  REQUIRE(workers, goto error);
+  for (size_t r = 0; r < nworkers; ++r) {
+    const bool primary = r == 0;
+    const tnsr_size_t grads_offset = (r - 1) * m->arena.replica_stride;
+    workers[r].layers = primary ? m->layers : m->replicas + (r - 1) * m->config.network_depth;
+    workers[r].grads = primary ? m->arena.grads : m->arena.replica_grads + grads_offset;
+  }
+  return workers;
+error:
+  return NULL;
+}
+
+/**
+ * Writes the configured checkpoint if one is due. epoch_end is set between epochs, once the
+ * epoch's pruning round has run.
+ * NOTE:
+ * Steps are counted whether or not their update was skipped, so that every step boundary
+ * is a candidate.
+ */
+static bool model_checkpoint_scheduled(model_t *m, bool epoch_end) {
+  ASSERT(m);
+  const checkpoint_config_t *checkpoint = &m->config.checkpoint;
+  const dist_transport_t *transport = m->config.transport;
+  if (!checkpoint->location || (transport && transport->rank != 0)) {
+    return true;
+  }
+  const size_t steps = m->state.update_count + m->state.skipped_steps;
+  const bool by_step = checkpoint->interval && m->config.fit_mode != FIT_HOGWILD;
+  const bool due = by_step ? steps % checkpoint->interval == 0 : epoch_end;
+  if (!due) {
+    return true;
+  }
+  if (m->checkpointer) {
+    return model_checkpointer_submit(m->checkpointer, m);
+  }
+  const model_snapshot_t snapshot = model_snapshot_view(m);
+  return model_commit_checkpoint(m, &snapshot, checkpoint->location, checkpoint->keep);
+}
+
+/**
+ * Advances the fit's position past pass, and writes a checkpoint if one is due at this step
+ * boundary. Checkpoints are only written between the accumulated batches of two steps, and
+ * not after an epoch's last pass, which model_fit covers once the epoch is complete.
+ */
+static bool model_checkpoint_pass(
+    model_t *m,
+    const model_accumulation_t *acc,
+    size_t pass,
+    size_t iters
+) {
+  ASSERT(m && acc);
+  m->state.next_pass = pass + 1;
+  if (acc->count || pass + 1 == iters) {
+    return true;
+  }
+  return model_checkpoint_scheduled(m, false);
+}
+
+static bool model_fit_one_epoch(model_t *m, size_t epoch_n, double start) {
   ASSERT(m);
-  grph_t *graph = NULL;
   tnsr_t *input = NULL;
   tnsr_t *expected = NULL;
   dashboard_config_t dconfig = m->config.dashboard;
+  const size_t nworkers = max(1, m->config.worker_count);
+  model_accumulation_t acc = {};
+  model_worker_t *workers = model_workers_create(m, nworkers);
+  REQUIRE(workers, goto error);
+
   size_t iters = m->config.data_size / m->config.batch_size;
-  for (size_t i = 0; i < iters; ++i) {
+  for (size_t i = m->state.next_pass; i < iters; ++i) {
     bool data_status = m->config.data_callback(
         m->config.batch_size,
         &input,
         &expected,
         m->config.context  // Context pointer.
     );
-    REQUIRE(data_status, goto error);
-    graph = grph_create(0);
-    REQUIRE(graph, goto error);
-    for (size_t j = 0; j < m->config.network_depth; ++j) {
-      dense_layer_add_to_graph(&graph, m->layers[j]);
-    }
-    grph_size_t node = model_forward_pass(m, &graph, input);
-    REQUIRE(node != GRPH_ERR_ID, goto error);
-    grph_size_t loss_node = model_backward_pass(m, node, &graph, expected);
-    REQUIRE(loss_node, goto error);
-    REQUIRE(model_update_status(m, &graph, loss_node, epoch_n, i), goto error);
-    REQUIRE(model_optimize(m, &graph), goto error);
-    if (dconfig.show_dashboard && i % dconfig.passes_interval == 0) {
-      dconfig.dashboard_callback(
-          graph, m, input, GRPH_NODE_DATA(graph, GRPH_NODE_DEPS(graph, loss_node)[0]), expected
-      );
-    }
-    for (size_t j = 0; j < m->config.network_depth; ++j) {
-      dense_layer_remove_from_graph(m->layers[j]);
+    REQUIRE(data_status, goto error);
+    const tnsr_type_t loss = model_fit_step(m, workers, nworkers, input, expected);
+    REQUIRE(!isnan(loss), goto error);
+    REQUIRE(model_accumulate_step(m, &acc, loss, epoch_n, i, i + 1 == iters, start), goto error);
+    REQUIRE(model_checkpoint_pass(m, &acc, i, iters), goto error);
+    const bool dashboard_rank = !m->config.transport || m->config.transport->rank == 0;
+    if (dconfig.show_dashboard && dashboard_rank && i % dconfig.passes_interval == 0) {
+      grph_t *graph = workers[0].graph;
+      grph_size_t output = GRPH_NODE_DEPS(graph, workers[0].loss_node)[0];
+      dconfig.dashboard_callback(
+          graph, m, workers[0].input, GRPH_NODE_DATA(graph, output), workers[0].expected
+      );
+    }
+    for (size_t r = 0; r < nworkers; ++r) {
+      model_worker_reset(m, &workers[r]);
+    }
+    tnsr_destroy(&expected);
+    tnsr_destroy(&input);
+  }
+  free(workers);
+  return true;
+error:
+  for (size_t r = 0; workers && r < nworkers; ++r) {
+    model_worker_reset(m, &workers[r]);
+  }
+  free(workers);
+  tnsr_destroy(&expected);
+  tnsr_destroy(&input);
+  return false;
+}
+
+/**
+ * Asynchronous (Hogwild) epoch. Every worker pulls its own batches and applies its
+ * updates straight to the shared weights through its layer replicas, without locking.
+ * NOTE:
+ * data_callback calls are serialized, as callbacks are not required to be thread-safe.
+ * Only the first worker drives the dashboard.
+ */
+static bool model_fit_one_epoch_hogwild(model_t *m, size_t epoch_n, double start) {
+  ASSERT(m);
+  dashboard_config_t dconfig = m->config.dashboard;
+  const size_t nworkers = max(1, m->config.worker_count);
+  const size_t iters = m->config.data_size / m->config.batch_size;
+  size_t next_pass = m->state.next_pass;  // Only advanced between epochs.
+  bool status = true;
+  model_worker_t *workers = model_workers_create(m, nworkers);
+  REQUIRE(workers, goto error);
+
+#pragma omp parallel num_threads(nworkers)
+  {
+    const size_t tid = omp_get_thread_num();
+    model_worker_t *w = &workers[tid];
+    for (;;) {
+      size_t pass = 0;
+      bool running = true;
+#pragma omp atomic capture
+      pass = next_pass++;
+#pragma omp atomic read
+      running = status;
+      if (pass >= iters || !running) {
+        break;
+      }
+
+      bool ok = true;
+#pragma omp critical(model_data_callback)
+      ok = m->config.data_callback(
+          m->config.batch_size,
+          &w->input,
+          &w->expected,
+          m->config.context  // Context pointer.
+      );
+
+      size_t read_version = 0;
+      size_t write_version = 0;
+#pragma omp atomic read
+      read_version = m->state.update_count;
+      ok = ok && model_worker_pass(m, w);
+      ok = ok && model_optimize(m, w->layers);
+      if (ok) {
+        const tnsr_t *loss = GRPH_NODE_DATA(w->graph, w->loss_node);
+#pragma omp critical(model_fit_status)
+        {
+          write_version = m->state.update_count;
+          const size_t staleness = write_version - read_version;
+          model_update_status(m, TNSR_DATA(loss, 0, 0), epoch_n, pass, staleness, start);
+          if (tid == 0 && dconfig.show_dashboard && pass % dconfig.passes_interval == 0) {
+            grph_t *graph = w->graph;
+            grph_size_t output = GRPH_NODE_DEPS(graph, w->loss_node)[0];
+            dconfig.dashboard_callback(
+                graph, m, w->input, GRPH_NODE_DATA(graph, output), w->expected
+            );
+          }
+        }
+      }
+      model_worker_reset(m, w);
+      if (!ok) {
+#pragma omp atomic write
+        status = false;
+      }
+    }
+  }
+
+  REQUIRE(status, goto error);
+  free(workers);
+  return true;
+error:
+  free(workers);
+  return false;
+}
+
+/* -------------------------------- Pipeline -------------------------------- */
+
+// Bounded queue of tensors passed between two neighbouring pipeline stages.
+typedef struct {
+  mtx_t lock;
+  cnd_t ready;
+  cnd_t space;
+  bool closed;  // Set when the step is aborted, fails every pending and later operation.
+  size_t head;
+  size_t count;
+  size_t capacity;
+  tnsr_t **items;
+} model_queue_t;
+
+/**
+ * The in-flight state of one micro-batch on one stage. Kept between the micro-batch's
+ * forward and backward passes.
+ */
+typedef struct {
+  grph_t *graph;
+  grph_plan_t *plan;
+  grph_size_t output;   // The stage's output activation, or the loss on the last stage.
+  tnsr_t *input;        // View of the micro-batch's rows of the batch, first stage only.
+  tnsr_t *expected;     // View of the micro-batch's rows of the batch, last stage only.
+  tnsr_t *input_grad;   // Gradient of the input activation, handed to the previous stage.
+} model_stage_slot_t;
+
+// A contiguous range of layers run by a single thread.
+typedef struct {
+  size_t first_layer;
+  size_t last_layer;       // Exclusive.
+  tnsr_size_t grads_offset;  // Offset of the stage's parameters in the arena.
+  tnsr_size_t grads_count;
+  model_stage_slot_t *slots;  // Indexed by micro-batch modulo the stage count.
+} model_stage_t;
+
+/**
+ * Pipeline-parallel executor. Stage s sends its activations to stage s + 1 through
+ * activations[s], and receives the matching gradients back through gradients[s].
+ * NOTE:
+ * Stages accumulate the gradients of a micro-batch into their own scratch buffer, then
+ * add them into the model's arena weighted by the micro-batch's share of the batch.
+ */
+typedef struct {
+  size_t stage_count;
+  model_stage_t *stages;
+  model_queue_t *activations;
+  model_queue_t *gradients;
+  dense_layer_t **layers;  // Layer bindings writing into grads.
+  tnsr_type_t *grads;      // Scratch gradients, laid out like the arena.
+
+  // Per step.
+  tnsr_t *input;
+  tnsr_t *expected;
+  tnsr_t *output;  // Last stage's outputs, gathered for the dashboard.
+  size_t micro_batch_count;
+  tnsr_type_t loss;
+  bool status;
+} model_pipeline_t;
+
+static bool model_queue_init(model_queue_t *q, size_t capacity) {
+  ASSERT(q && capacity);
+  q->items = calloc(capacity, sizeof(tnsr_t *));
+  REQUIRE(q->items, goto error);
+  REQUIRE(mtx_init(&q->lock, mtx_plain) == thrd_success, goto error);
+  REQUIRE(cnd_init(&q->ready) == thrd_success, goto error_lock);
+  REQUIRE(cnd_init(&q->space) == thrd_success, goto error_ready);
+  q->capacity = capacity;
+  return true;
+error_ready:
+  cnd_destroy(&q->ready);
+error_lock:
+  mtx_destroy(&q->lock);
+error:
+  free(q->items);
+  q->items = NULL;
+  return false;
+}
+
+static void model_queue_destroy(model_queue_t *q) {
+  ASSERT(q);
+  if (q->items) {
+    cnd_destroy(&q->space);
+    cnd_destroy(&q->ready);
+    mtx_destroy(&q->lock);
+    free(q->items);
+    q->items = NULL;
+  }
+}
+
+// Blocks while the queue is full. False if the queue was closed.
+static bool model_queue_push(model_queue_t *q, tnsr_t *item) {
+  ASSERT(q && item);
+  mtx_lock(&q->lock);
+  while (q->count == q->capacity && !q->closed) {
+    cnd_wait(&q->space, &q->lock);
+  }
+  const bool open = !q->closed;
+  if (open) {
+    q->items[(q->head + q->count++) % q->capacity] = item;
+    cnd_signal(&q->ready);
+  }
+  mtx_unlock(&q->lock);
+  return open;
+}
+
+// Blocks while the queue is empty. False if the queue was closed.
+static bool model_queue_pop(model_queue_t *q, tnsr_t **item) {
+  ASSERT(q && item);
+  mtx_lock(&q->lock);
+  while (!q->count && !q->closed) {
+    cnd_wait(&q->ready, &q->lock);
+  }
+  const bool open = !q->closed;
+  if (open) {
+    *item = q->items[q->head];
+    q->head = (q->head + 1) % q->capacity;
+    --q->count;
+    cnd_signal(&q->space);
+  }
+  mtx_unlock(&q->lock);
+  return open;
+}
+
+// Wakes up every blocked stage. Items left in the queue are not released.
+static void model_queue_close(model_queue_t *q) {
+  ASSERT(q);
+  mtx_lock(&q->lock);
+  q->closed = true;
+  cnd_broadcast(&q->ready);
+  cnd_broadcast(&q->space);
+  mtx_unlock(&q->lock);
+}
+
+/**
+ * Splits the layers into contiguous stages of roughly equal parameter counts, which
+ * their matrix products scale with. Every stage gets at least one layer.
+ */
+static void model_pipeline_partition(model_t *m, model_pipeline_t *p) {
+  ASSERT(m && p && p->stage_count <= m->config.network_depth);
+  const size_t depth = m->config.network_depth;
+  tnsr_size_t assigned = 0;
+  size_t layer = 0;
+  for (size_t s = 0; s < p->stage_count; ++s) {
+    model_stage_t *stage = &p->stages[s];
+    const size_t layers_left = p->stage_count - s - 1;  // Reserved for the next stages.
+    const double target = (double)m->arena.param_count * (s + 1) / p->stage_count;
+    stage->first_layer = layer;
+    stage->grads_offset = assigned;
+    // Takes the next layer while the cumulative target lies past its midpoint.
+    do {
+      assigned += m->layers[layer]->param_count;
+      ++layer;
+    } while (layer < depth - layers_left &&
+             assigned + m->layers[layer]->param_count / 2.0 < target);
+    if (s + 1 == p->stage_count) {
+      layer = depth;
+      assigned = m->arena.param_count;
+    }
+    stage->last_layer = layer;
+    stage->grads_count = assigned - stage->grads_offset;
+  }
+}
+
+static void model_pipeline_slot_reset(model_stage_slot_t *slot) {
+  ASSERT(slot);
+  grph_plan_destroy(&slot->plan);
+  grph_destroy(&slot->graph);
+  tnsr_destroy(&slot->input);
+  tnsr_destroy(&slot->expected);
+  tnsr_destroy(&slot->input_grad);
+}
+
+static void model_pipeline_destroy(model_pipeline_t **pipe) {
+  REQUIRE(pipe && *pipe, return);
+  model_pipeline_t *p = *pipe;
+  for (size_t s = 0; p->stages && s < p->stage_count; ++s) {
+    for (size_t k = 0; p->stages[s].slots && k < p->stage_count; ++k) {
+      model_pipeline_slot_reset(&p->stages[s].slots[k]);
+    }
+    free(p->stages[s].slots);
+  }
+  for (size_t s = 0; s + 1 < p->stage_count; ++s) {
+    if (p->activations) {
+      model_queue_destroy(&p->activations[s]);
+    }
+    if (p->gradients) {
+      model_queue_destroy(&p->gradients[s]);
+    }
+  }
+  for (size_t i = 0; p->layers && p->layers[i]; ++i) {
+    dense_layer_destroy(&p->layers[i]);
+  }
+  free(p->stages);
+  free(p->activations);
+  free(p->gradients);
+  free(p->layers);
+  ALIGNED_FREE(p->grads);
+  tnsr_destroy(&p->output);
+  free(p);
+  *pipe = NULL;
+}
+
+static model_pipeline_t *model_pipeline_create(model_t *m) {
+  ASSERT(m);
+  const size_t depth = m->config.network_depth;
+  model_pipeline_t *p = calloc(1, sizeof(model_pipeline_t));
+  REQUIRE(p, goto error);
+  p->stage_count = min(max(1, m->config.pipeline_stages), depth);
+  p->stages = calloc(p->stage_count, sizeof(model_stage_t));
+  p->activations = calloc(p->stage_count, sizeof(model_queue_t));
+  p->gradients = calloc(p->stage_count, sizeof(model_queue_t));
+  p->layers = calloc(depth + 1, sizeof(dense_layer_t *));  // NULL terminated.
+  p->grads = ALIGNED_ALLOC(sizeof(tnsr_type_t[m->arena.param_count]));
+  REQUIRE(p->stages && p->activations && p->gradients && p->layers && p->grads, goto error);
+
+  // A stage has at most stage_count - s micro-batches in flight under 1F1B.
+  for (size_t s = 0; s < p->stage_count; ++s) {
+    p->stages[s].slots = calloc(p->stage_count, sizeof(model_stage_slot_t));
+    REQUIRE(p->stages[s].slots, goto error);
+  }
+  for (size_t s = 0; s + 1 < p->stage_count; ++s) {
+    REQUIRE(model_queue_init(&p->activations[s], p->stage_count), goto error);
+    REQUIRE(model_queue_init(&p->gradients[s], p->stage_count), goto error);
+  }
+  for (size_t i = 0; i < depth; ++i) {
+    dense_layer_t *layer = m->layers[i];
+    p->layers[i] = dense_layer_replicate(layer, p->grads + (layer->grads - m->arena.grads));
+    REQUIRE(p->layers[i], goto error);
+  }
+  model_pipeline_partition(m, p);
+  return p;
+error:
+  model_pipeline_destroy(&p);
+  return NULL;
+}
+
+// Fails the step, and releases every stage blocked on a queue.
+static void model_pipeline_abort(model_pipeline_t *p) {
+  ASSERT(p);
+#pragma omp atomic write
+  p->status = false;
+  for (size_t s = 0; s + 1 < p->stage_count; ++s) {
+    model_queue_close(&p->activations[s]);
+    model_queue_close(&p->gradients[s]);
+  }
+}
+
+// Rows of the batch that make up micro-batch k.
+static void model_micro_batch_rows(
+    tnsr_size_t rows, size_t count, size_t k, tnsr_size_t *first, tnsr_size_t *size
+) {
+  ASSERT(first && size && k < count && count <= rows);
+  *first = k * (rows / count) + min(k, rows % count);
+  *size = rows / count + (k < rows % count);
+}
+
+/**
+ * Forward pass of micro-batch k through the stage's layers. The last stage runs the loss
+ * as well, and gathers its outputs.
+ */
+static bool model_stage_forward(model_t *m, model_pipeline_t *p, size_t s, size_t k) {
+  ASSERT(m && p && s < p->stage_count);
+  model_stage_t *stage = &p->stages[s];
+  model_stage_slot_t *slot = &stage->slots[k % p->stage_count];
+  const bool last = s + 1 == p->stage_count;
+  ASSERT(!slot->graph);
+
+  tnsr_size_t first = 0;
+  tnsr_size_t rows = 0;
+  model_micro_batch_rows(TNSR_SHPE(p->input, 0), p->micro_batch_count, k, &first, &rows);
+  slot->graph = model_graph_create(m);
+  REQUIRE(slot->graph, goto error);
+  for (size_t i = stage->first_layer; i < stage->last_layer; ++i) {
+    REQUIRE(dense_layer_add_to_graph(&slot->graph, p->layers[i]), goto error);
+  }
+
+  grph_size_t n = GRPH_ERR_ID;
+  if (s == 0) {
+    slot->input = tnsr_view(&TNSR_DATA(p->input, first, 0), rows, TNSR_SHPE(p->input, 1));
+    REQUIRE(slot->input, goto error);
+    n = grph_append_data(&slot->graph, slot->input);
+  } else {
+    // The activation stays owned by the previous stage until this micro-batch's backward.
+    tnsr_t *activation = NULL;
+    REQUIRE(model_queue_pop(&p->activations[s - 1], &activation), goto error);
+    slot->input_grad = tnsr_create(TNSR_SHPE(activation, 0), TNSR_SHPE(activation, 1));
+    REQUIRE(slot->input_grad, goto error);
+    n = grph_append_param(&slot->graph, activation, slot->input_grad);
+  }
+  REQUIRE(n != GRPH_ERR_ID, goto error);
+  for (size_t i = stage->first_layer; i < stage->last_layer; ++i) {
+    n = model_layer_passthrough(m, &slot->graph, p->layers[i], i, n);
+    REQUIRE(n != GRPH_ERR_ID, goto error);
+    dense_layer_remove_from_graph(p->layers[i]);
+  }
+
+  grph_size_t output = n;
+  if (last) {
+    const tnsr_size_t width = TNSR_SHPE(p->expected, 1);
+    slot->expected = tnsr_view(&TNSR_DATA(p->expected, first, 0), rows, width);
+    REQUIRE(slot->expected, goto error);
+    const grph_size_t expg = grph_append_data(&slot->graph, slot->expected);
+    REQUIRE(expg != GRPH_ERR_ID, goto error);
+    output = grph_execute(&slot->graph, n, expg, m->config.loss_function_type);
+    REQUIRE(output != GRPH_ERR_ID, goto error);
+  }
+  slot->output = output;
+  slot->plan = grph_compile(slot->graph, output);
+  REQUIRE(slot->plan, goto error);
+  REQUIRE(grph_run(slot->graph, slot->plan), goto error);
+
+  if (last) {
+    const tnsr_t *result = GRPH_NODE_DATA(slot->graph, n);
+    const tnsr_type_t weight = (tnsr_type_t)rows / TNSR_SHPE(p->input, 0);
+    p->loss += weight * TNSR_DATA(GRPH_NODE_DATA(slot->graph, output), 0, 0);
+    memcpy(&TNSR_DATA(p->output, first, 0), result->data, sizeof(tnsr_type_t[TNSR_SIZE(result)]));
+  } else {
+    REQUIRE(model_queue_push(&p->activations[s], GRPH_NODE_DATA(slot->graph, n)), goto error);
+  }
+  return true;
+error:
+  return false;
+}
+
+/**
+ * Backward pass of micro-batch k through the stage's layers. Hands the gradient of the
+ * stage's input to the previous stage, then releases the micro-batch.
+ */
+static bool model_stage_backward(model_t *m, model_pipeline_t *p, size_t s, size_t k) {
+  ASSERT(m && p && s < p->stage_count);
+  model_stage_t *stage = &p->stages[s];
+  model_stage_slot_t *slot = &stage->slots[k % p->stage_count];
+  ASSERT(slot->graph);
+
+  tnsr_t *output_grad = NULL;
+  if (s + 1 < p->stage_count) {
+    REQUIRE(model_queue_pop(&p->gradients[s], &output_grad), goto error);
+    tnsr_t *seed = GRPH_NODE_GRAD(slot->graph, slot->output);
+    REQUIRE(tnsr_emap(seed, output_grad, tnsr_cpy, NULL), goto error);
+    tnsr_destroy(&output_grad);
+  }
+  tnsr_type_t *restrict grads = p->grads + stage->grads_offset;
+  memset(grads, 0, sizeof(tnsr_type_t[stage->grads_count]));
+  REQUIRE(grph_trace(slot->graph), goto error);
+
+  tnsr_size_t first = 0;
+  tnsr_size_t rows = 0;
+  model_micro_batch_rows(TNSR_SHPE(p->input, 0), p->micro_batch_count, k, &first, &rows);
+  const tnsr_type_t weight = (tnsr_type_t)rows / TNSR_SHPE(p->input, 0);
+  tnsr_type_t *restrict dst = m->arena.grads + stage->grads_offset;
+#pragma omp simd
+  for (tnsr_size_t i = 0; i < stage->grads_count; ++i) {
+    dst[i] += weight * grads[i];
+  }
+
+  if (s > 0) {
+    REQUIRE(model_queue_push(&p->gradients[s - 1], slot->input_grad), goto error);
+    slot->input_grad = NULL;  // Released by the previous stage.
+  }
+  model_pipeline_slot_reset(slot);
+  return true;
+error:
+  tnsr_destroy(&output_grad);
+  return false;
+}
+
+/**
+ * Runs the stage's share of the step under a one-forward-one-backward (1F1B) schedule:
+ * stage s runs stage_count - s - 1 warm-up forward passes, then alternates forward and
+ * backward passes, then drains the remaining backward passes. This bounds the
+ * micro-batches a stage keeps in flight by the stage count.
+ */
+static bool model_stage_run(model_t *m, model_pipeline_t *p, size_t s) {
+  ASSERT(m && p && s < p->stage_count);
+  const size_t count = p->micro_batch_count;
+  const size_t warmup = min(p->stage_count - s - 1, count);
+  size_t forward = 0;
+  size_t backward = 0;
+  for (; forward < warmup; ++forward) {
+    REQUIRE(model_stage_forward(m, p, s, forward), goto error);
+  }
+  for (; forward < count; ++forward, ++backward) {
+    REQUIRE(model_stage_forward(m, p, s, forward), goto error);
+    REQUIRE(model_stage_backward(m, p, s, backward), goto error);
+  }
+  for (; backward < count; ++backward) {
+    REQUIRE(model_stage_backward(m, p, s, backward), goto error);
+  }
+  return true;
+error:
+  return false;
+}
+
+/**
+ * Passes the batch through the pipeline as micro-batches, and accumulates their gradients
+ * into the model's gradient arena. Returns the batch loss, NAN upon failure.
+ * NOTE:
+ * Every stage drives its own thread, spread over the available places (see OMP_PLACES),
+ * while the kernels of every stage share the global thread pool.
+ */
+static tnsr_type_t model_pipeline_step(
+    model_t *m, model_pipeline_t *p, tnsr_t *input, tnsr_t *expected
+) {
+  ASSERT(m && p && input && expected);
+  const tnsr_size_t rows = TNSR_SHPE(input, 0);
+  REQUIRE(TNSR_IS_CONTIGUOUS(input) && TNSR_IS_CONTIGUOUS(expected), goto error);
+  REQUIRE(TNSR_SHPE(expected, 0) == rows, goto error);
+
+  const size_t requested = m->config.micro_batch_count;
+  p->micro_batch_count = min(requested ? requested : p->stage_count, rows);
+  p->input = input;
+  p->expected = expected;
+  p->loss = 0;
+  p->status = true;
+  tnsr_destroy(&p->output);
+  p->output = tnsr_create(rows, m->config.output_size);
+  REQUIRE(p->output, goto error);
+  for (size_t s = 0; s + 1 < p->stage_count; ++s) {
+    p->activations[s].closed = false;
+    p->gradients[s].closed = false;
+  }
+  memset(m->arena.grads, 0, sizeof(tnsr_type_t[m->arena.param_count]));
+
+#pragma omp parallel num_threads(p->stage_count) proc_bind(spread)
+  {
+    // Every stage needs its own thread, as stages block on each other.
+    const size_t team = omp_get_num_threads();
+    const size_t s = omp_get_thread_num();
+    if (team != p->stage_count || !model_stage_run(m, p, s)) {
+      model_pipeline_abort(p);
+    }
+  }
+
+  if (!p->status) {
+    for (size_t s = 0; s < p->stage_count; ++s) {
+      for (size_t k = 0; k < p->stage_count; ++k) {
+        model_pipeline_slot_reset(&p->stages[s].slots[k]);
+      }
+    }
+    for (size_t s = 0; s + 1 < p->stage_count; ++s) {
+      // Activations belong to the stages' graphs, gradients to the queues.
+      model_queue_t *q = &p->gradients[s];
+      for (; q->count; --q->count, q->head = (q->head + 1) % q->capacity) {
+        tnsr_destroy(&q->items[q->head]);
+      }
+      p->activations[s].count = 0;
+    }
+  }
+  REQUIRE(p->status, goto error);
+
+  return p->loss;
+error:
+  return NAN;
+}
+
+/**
+ * Pipeline-parallel epoch. Each batch is split into micro-batches, which flow through
+ * the stages while the optimizer waits for the whole batch.
+ */
+static bool model_fit_one_epoch_pipeline(model_t *m, size_t epoch_n, double start) {
+  ASSERT(m);
+  tnsr_t *input = NULL;
+  tnsr_t *expected = NULL;
+  dashboard_config_t dconfig = m->config.dashboard;
+  model_accumulation_t acc = {};
+  model_pipeline_t *pipe = model_pipeline_create(m);
+  REQUIRE(pipe, goto error);
+
+  size_t iters = m->config.data_size / m->config.batch_size;
+  for (size_t i = m->state.next_pass; i < iters; ++i) {
+    bool data_status = m->config.data_callback(
+        m->config.batch_size,
+        &input,
+        &expected,
+        m->config.context  // Context pointer.
+    );
+    REQUIRE(data_status, goto error);
+    const tnsr_type_t loss = model_pipeline_step(m, pipe, input, expected);
+    REQUIRE(!isnan(loss), goto error);
+    REQUIRE(model_accumulate_step(m, &acc, loss, epoch_n, i, i + 1 == iters, start), goto error);
+    REQUIRE(model_checkpoint_pass(m, &acc, i, iters), goto error);
+    const bool dashboard_rank = !m->config.transport || m->config.transport->rank == 0;
+    if (dconfig.show_dashboard && dashboard_rank && i % dconfig.passes_interval == 0) {
+      dconfig.dashboard_callback(NULL, m, input, pipe->output, expected);
+    }
+    tnsr_destroy(&expected);
+    tnsr_destroy(&input);
+  }
+  model_pipeline_destroy(&pipe);
+  return true;
+error:
+  model_pipeline_destroy(&pipe);
+  tnsr_destroy(&expected);
+  tnsr_destroy(&input);
+  return false;
+}
+
+// Zeroes the values [begin, end) of ctx, first touching their pages from the calling worker.
+static void model_zero_range(size_t begin, size_t end, void *ctx) {
+  tnsr_type_t *values = ctx;
+  memset(values + begin, 0, sizeof(tnsr_type_t[end - begin]));
+}
+
+// Total parameter count of the configured layers, 0 if their shapes do not chain.
+static tnsr_size_t model_param_count(const model_config_t *config) {
+  ASSERT(config);
+  tnsr_size_t count = 0;
+  tnsr_size_t input = config->input_size;
+  for (size_t i = 0; i < config->network_depth; ++i) {
+    tnsr_size_t fan_in = 0;
+    tnsr_size_t fan_out = 0;
+    input = model_layer_shape(config, i, input, &fan_in, &fan_out);
+    REQUIRE(input, return 0);
+    REQUIRE(!config->network[i].conv.filters || config->network[i].shard_count <= 1, return 0);
+    // Weights and biases are (fan_in + 1) * fan_out, fan_out being nonzero.
+    REQUIRE(fan_in < TNSR_MAX_SIZE && fan_in + 1 <= TNSR_MAX_SIZE / fan_out, return 0);
+    const tnsr_size_t layer_count = dense_layer_param_count(fan_in, fan_out);
+    REQUIRE(layer_count <= TNSR_MAX_SIZE - count, return 0);
+    count += layer_count;
+  }
+  REQUIRE(count <= SIZE_MAX / sizeof(tnsr_type_t), return 0);
+  return count;
+}
+
+/**
+ * Allocates the model's arenas from its configuration and creates its layers over them.
+ * params holds the loaded parameters in arena order, owned by the arena unless it was
+ * mapped, or NULL to allocate them.
+ * NOTE:
+ * Allocated parameters are initialized by the layers, loaded ones are kept as is.
+ * Gradients and optimizer state are zeroed, unless the parameters are mapped.
+ */
+static bool model_create_layers(model_t *model, tnsr_type_t *params) {
+  ASSERT(model);
+  const model_config_t *config = &model->config;
+  model_arena_t *arena = &model->arena;
+  arena->params = params;
+  arena->param_count = model_param_count(config);
+  REQUIRE(arena->param_count, goto error);
+  arena->state_count = dense_layer_state_count(config->optimizer_method, arena->param_count);
+
+  if (!params) {
+    arena->params = ALIGNED_ALLOC(sizeof(tnsr_type_t[arena->param_count]));
+  }
+  arena->grads = ALIGNED_ALLOC(sizeof(tnsr_type_t[arena->param_count]));
+  REQUIRE(arena->params && arena->grads, goto error);
+  if (arena->state_count) {
+    arena->state = ALIGNED_ALLOC(sizeof(tnsr_type_t[arena->state_count]));
+    REQUIRE(arena->state, goto error);
+  }
+
+  const pruning_config_t *pruning = &config->pruning;
+  if (pruning->sparsity > 0 || pruning->neuron_norm > 0) {
+    arena->mask = ALIGNED_ALLOC(sizeof(tnsr_type_t[arena->param_count]));
+    REQUIRE(arena->mask, goto error);
+    for (tnsr_size_t i = 0; i < arena->param_count; ++i) {
+      arena->mask[i] = 1;
+    }
+  }
+
+  // Each layer's optimizer state mirrors the parameter layout, one block per moment.
+  tnsr_size_t offset = 0;
+  tnsr_size_t input = config->input_size;
+  for (size_t i = 0; i < config->network_depth; ++i) {
+    // Convolution layers are created as the dense layer holding their filters.
+    tnsr_size_t fan_in = 0;
+    tnsr_size_t fan_out = 0;
+    const tnsr_size_t output = model_layer_shape(config, i, input, &fan_in, &fan_out);
+    const tnsr_size_t count = dense_layer_param_count(fan_in, fan_out);
+    const tnsr_size_t state_offset = dense_layer_state_count(config->optimizer_method, offset);
+    REQUIRE(!params || config->network[i].shard_count <= 1, goto error);  // Stored unsharded.
+    dense_layer_storage_t storage = {
+        .params = arena->params + offset,
+        .grads = arena->grads + offset,
+        .state = arena->state ? arena->state + state_offset : NULL,
+        .mask = arena->mask ? arena->mask + offset : NULL,
+    };
+    model->layers[i] = dense_layer_create(
+        fan_in,
+        fan_out,
+        params ? INIT_NONE : config->network[i].initialization_function,
+        config->network[i].activation_function,
+        config->optimizer_method,
+        config->learning_rate,
+        config->network[i].shard_count,
+        storage
+    );
+    REQUIRE(model->layers[i], goto error);
+    // Mapped models are never trained, leaving their pages untouched keeps them uncommitted.
+    if (!arena->mapping) {
+      dense_layer_zero(model->layers[i]);
+    }
+    offset += count;
+    input = output;
+  }
+
+  // Accumulated gradients are only read by the loops over the whole arena.
+  if (config->accumulation_steps > 1) {
+    arena->accum_grads = ALIGNED_ALLOC(sizeof(tnsr_type_t[arena->param_count]));
+    REQUIRE(arena->accum_grads, goto error);
+    tpool_parallel_for(
+        tpool_global(), arena->param_count, MODEL_GRAIN, model_zero_range, arena->accum_grads
+    );
+  }
+
+  // Data-parallel workers past the first get their own gradients and layer bindings.
+  if (config->worker_count > 1) {
+    const size_t replicas = config->worker_count - 1;
+    const tnsr_size_t line = ALIGNMENT / sizeof(tnsr_type_t);
+    arena->replica_stride = (arena->param_count + line - 1) / line * line;
+    REQUIRE(arena->replica_stride <= SIZE_MAX / sizeof(tnsr_type_t) / replicas, goto error);
+    arena->replica_grads = ALIGNED_ALLOC(sizeof(tnsr_type_t[replicas * arena->replica_stride]));
+    model->replicas = calloc(replicas * config->network_depth, sizeof(dense_layer_t *));
+    REQUIRE(arena->replica_grads && model->replicas, goto error);
+    for (size_t r = 0; r < replicas; ++r) {
+      tnsr_type_t *grads = arena->replica_grads + r * arena->replica_stride;
+      for (size_t i = 0; i < config->network_depth; ++i) {
+        dense_layer_t *layer = model->layers[i];
+        dense_layer_t **replica = &model->replicas[r * config->network_depth + i];
+        *replica = dense_layer_replicate(layer, grads + (layer->grads - arena->grads));
+        REQUIRE(*replica, goto error);
+      }
+    }
+  }
+  return true;
+error:
+  return false;
+}
+
+// Maps the whole file read-only and shared. NULL upon failure.
+static void *model_map(const char *location, size_t *size) {
+  ASSERT(location && size);
+#ifdef _WIN32
+  HANDLE file = CreateFileA(
+      location, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL
+  );
+  REQUIRE(file != INVALID_HANDLE_VALUE, goto error);
+  LARGE_INTEGER length = {};
+  REQUIRE(GetFileSizeEx(file, &length) && length.QuadPart > 0, CloseHandle(file); goto error);
+  HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  CloseHandle(file);
+  REQUIRE(mapping, goto error);
+  void *base = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(mapping);  // The view keeps the mapping alive.
+  REQUIRE(base, goto error);
+  *size = (size_t)length.QuadPart;
+  return base;
+#else
+  int fd = open(location, O_RDONLY);
+  REQUIRE(fd >= 0, goto error);
+  struct stat st = {};
+  REQUIRE(fstat(fd, &st) == 0 && st.st_size > 0, close(fd); goto error);
+  void *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);  // The mapping keeps the file referenced.
+  REQUIRE(base != MAP_FAILED, goto error);
+  *size = (size_t)st.st_size;
+  return base;
+#endif
+error:
+  return NULL;
+}
+
+static void model_unmap(void *base, size_t size) {
+  ASSERT(base);
+#ifdef _WIN32
+  (void)size;
+  UnmapViewOfFile(base);
+#else
+  munmap(base, size);
+#endif
+}
+
+model_t *model_create(model_config_t *config) {
+  ASSERT(config);
+  model_t *model = calloc(1, sizeof(model_t) + sizeof(dense_layer_t *[config->network_depth]));
+  REQUIRE(model, goto error);
+  memcpy(&model->config, config, sizeof(model_config_t));
+  model->state.epoch_count = 0;
+  model->state.pass_count = 0;
+  model->state.training_loss = NAN;
+  model->state.time_to_target = NAN;
+  REQUIRE(model_create_layers(model, NULL), goto error);
+  return model;
+error:
+  model_destroy(&model);
+  return NULL;
+}
+
+void model_destroy(model_t **m) {
+  REQUIRE(m && *m, return);
+  model_t *model = *m;
+  for (size_t i = 0; i < model->config.network_depth; ++i) {
+    if (model->layers[i]) {
+      dense_layer_destroy(&model->layers[i]);
+    }
+  }
+  if (model->replicas) {
+    const size_t replicas = model->config.worker_count - 1;
+    for (size_t i = 0; i < replicas * model->config.network_depth; ++i) {
+      if (model->replicas[i]) {
+        dense_layer_destroy(&model->replicas[i]);
+      }
+    }
+    free(model->replicas);
+  }
+  ALIGNED_FREE(model->arena.replica_grads);
+  ALIGNED_FREE(model->arena.accum_grads);
+  ALIGNED_FREE(model->arena.mask);
+  if (model->arena.mapping) {
+    model_unmap(model->arena.mapping, model->arena.mapping_size);
+  } else {
+    ALIGNED_FREE(model->arena.params);
+  }
+  ALIGNED_FREE(model->arena.grads);
+  ALIGNED_FREE(model->arena.state);
+  free(model);
+  *m = NULL;
+}
+
+// Adds size bytes to the Fletcher-64 sums, 32-bit words at a time. A trailing partial word
+// is zero-padded, so only the last chunk of a payload may end in one.
+static void model_checksum(uint64_t sum[2], const void *data, size_t size) {
+  const unsigned char *bytes = data;
+  const size_t n = size / sizeof(uint32_t);
+  uint64_t a = sum[0];
+  uint64_t b = sum[1];
+  for (size_t i = 0; i < n;) {
+    const size_t end = min(n, i + MODEL_CHECKSUM_BLOCK);
+    for (; i < end; ++i) {
+      uint32_t word;
+      memcpy(&word, bytes + i * sizeof(uint32_t), sizeof(word));
+      a += word;
+      b += a;
+    }
+    a %= UINT32_MAX;
+    b %= UINT32_MAX;
+  }
+  if (size % sizeof(uint32_t)) {
+    uint32_t word = 0;
+    memcpy(&word, bytes + n * sizeof(uint32_t), size % sizeof(uint32_t));
+    a = (a + word) % UINT32_MAX;
+    b = (b + a) % UINT32_MAX;
+  }
+  sum[0] = a;
+  sum[1] = b;
+}
+
+static uint64_t model_checksum_value(const uint64_t sum[2]) {
+  return sum[1] << 32 | sum[0];
+}
+
+static bool model_section_valid(const model_file_section_t *section, const void *payload) {
+  ASSERT(section && payload);
+  uint64_t sum[2] = {0};
+  model_checksum(sum, payload, section->size);
+  return model_checksum_value(sum) == section->checksum;
+}
+
+static bool model_write(model_writer_t *w, const void *data, size_t size) {
+  ASSERT(w && data);
+  REQUIRE(!size || fwrite(data, size, 1, w->stream) == 1, return false);
+  model_checksum(w->sum, data, size);
+  w->offset += size;
+  return true;
+}
+
+// Adapts model_write to dense_layer_stream.
+static bool model_write_run(tnsr_type_t *run, tnsr_size_t count, void *ctx) {
+  return model_write(ctx, run, sizeof(tnsr_type_t[count]));
+}
+
+// Reads a run of a dense_layer_stream from the stream ctx.
+static bool model_read_run(tnsr_type_t *run, tnsr_size_t count, void *ctx) {
+  return fread(run, sizeof(tnsr_type_t[count]), 1, ctx) == 1;
+}
+
+// Pads the file up to the next section boundary, and starts the section there.
+static bool model_section_begin(
+    model_writer_t *w,
+    model_file_section_t *section,
+    model_section_type_t type
+) {
+  ASSERT(w && section);
+  static const unsigned char zeros[MODEL_FILE_ALIGNMENT] = {0};
+  const size_t padding = (MODEL_FILE_ALIGNMENT - w->offset % MODEL_FILE_ALIGNMENT) %
+                         MODEL_FILE_ALIGNMENT;
+  REQUIRE(!padding || fwrite(zeros, padding, 1, w->stream) == 1, return false);
+  w->offset += padding;
+  w->sum[0] = 0;
+  w->sum[1] = 0;
+  *section = (model_file_section_t){.type = type, .offset = w->offset};
+  return true;
+}
+
+static void model_section_end(model_writer_t *w, model_file_section_t *section) {
+  ASSERT(w && section);
+  section->size = w->offset - section->offset;
+  section->checksum = model_checksum_value(w->sum);
+}
+
+// Flushes the stream and waits for its file to be on disk.
+static bool model_sync_file(FILE *stream) {
+  ASSERT(stream);
+  REQUIRE(fflush(stream) == 0, return false);
+#ifdef _WIN32
+  return _commit(_fileno(stream)) == 0;
+#else
+  return fsync(fileno(stream)) == 0;
+#endif
+}
+
+// Replaces to, if it exists.
+static bool model_rename(const char *from, const char *to) {
+  ASSERT(from && to);
+#ifdef _WIN32
+  return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+  return rename(from, to) == 0;
+#endif
+}
+
+// Syncs the directory holding location, making the renames into it durable.
+static bool model_sync_directory(const char *location) {
+  ASSERT(location);
+#ifdef _WIN32
+  (void)location;  // MOVEFILE_WRITE_THROUGH already waits for renames to be on disk.
+  return true;
+#else
+  const char *slash = strrchr(location, '/');
+  char *directory = slash ? strndup(location, max(slash - location, 1)) : strdup(".");
+  REQUIRE(directory, return false);
+  const int fd = open(directory, O_RDONLY);
+  free(directory);
+  REQUIRE(fd >= 0, return false);
+  const bool synced = fsync(fd) == 0;
+  close(fd);
+  return synced;
+#endif
+}
+
+static bool model_seek(FILE *stream, uint64_t offset) {
+  ASSERT(stream);
+  REQUIRE(offset <= INT64_MAX, return false);
+#ifdef _WIN32
+  return _fseeki64(stream, (__int64)offset, SEEK_SET) == 0;
+#else
+  return fseeko(stream, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+/**
+ * Visits the layers' values of a section, in the unsharded layout. values is laid out like
+ * the arena's optimizer state for MODEL_SECTION_STATE, moment selecting the moment to visit,
+ * and like its parameters otherwise. See dense_layer_stream.
+ */
+static bool model_stream_values(
+    const model_t *m,
+    tnsr_type_t *values,
+    model_section_type_t type,
+    size_t moment,
+    bool (*visit)(tnsr_type_t *run, tnsr_size_t count, void *ctx),
+    void *ctx
+) {
+  ASSERT(m && values && visit);
+  for (size_t i = 0; i < m->config.network_depth; ++i) {
+    const dense_layer_t *layer = m->layers[i];
+    tnsr_type_t *layer_values = values + (layer->params - m->arena.params);
+    if (type == MODEL_SECTION_STATE) {
+      layer_values = values + (layer->state - m->arena.state) + moment * layer->param_count;
+    }
+    REQUIRE(dense_layer_stream(layer, layer_values, visit, ctx), goto error);
+  }
+  return true;
+error:
+  return false;
+}
+
+// Copies a run of a dense_layer_stream to the buffer *ctx points into, and advances it.
+static bool model_gather_run(tnsr_type_t *run, tnsr_size_t count, void *ctx) {
+  tnsr_type_t **next = ctx;
+  memcpy(*next, run, sizeof(tnsr_type_t[count]));
+  *next += count;
+  return true;
+}
+
+/**
+ * Encodes a rows x cols tensor through buffer, holding at least codec_bound bytes plus
+ * MODEL_TENSOR_ALIGNMENT.
+ * NOTE:
+ * The padding is written along with the data, as only the last write of a section may end
+ * in a partial checksum word.
+ */
+static bool model_write_tensor(
+    model_writer_t *w,
+    codec_t codec,
+    const tnsr_type_t *values,
+    tnsr_size_t rows,
+    tnsr_size_t cols,
+    unsigned char *buffer
+) {
+  ASSERT(w && values && buffer);
+  const size_t size = codec_encode(codec, values, rows, cols, buffer);
+  REQUIRE(size, return false);
+  const size_t padding = (MODEL_TENSOR_ALIGNMENT - size % MODEL_TENSOR_ALIGNMENT) %
+                         MODEL_TENSOR_ALIGNMENT;
+  memset(buffer + size, 0, padding);
+  const model_serial_tensor_t tensor = {.codec = codec, .rows = rows, .cols = cols, .size = size};
+  REQUIRE(model_write(w, &tensor, sizeof(tensor)), return false);
+  return model_write(w, buffer, size + padding);
+}
+
+/**
+ * Writes the payload of MODEL_SECTION_ENCODED_PARAMS, one layer at a time.
+ * NOTE:
+ * Biases are few, and skew the outputs of a whole channel when quantized, so int8 models
+ * keep them in full precision.
+ */
+static bool model_write_encoded(
+    model_writer_t *w,
+    const model_t *m,
+    const tnsr_type_t *params,
+    codec_t codec
+) {
+  ASSERT(w && m && params);
+  const codec_t bias_codec = codec == CODEC_INT8 ? CODEC_RAW : codec;
+  tnsr_type_t *values = NULL;
+  unsigned char *buffer = NULL;
+  size_t largest = 1;
+  size_t bound = 1;
+  for (size_t i = 0; i < m->config.network_depth; ++i) {
+    const dense_layer_t *layer = m->layers[i];
+    largest = max(largest, layer->param_count);
+    bound = max(bound, codec_bound(codec, layer->fan_in, layer->fan_out));
+    bound = max(bound, codec_bound(bias_codec, 1, layer->fan_out));
+  }
+  values = malloc(sizeof(tnsr_type_t[largest]));
+  buffer = malloc(bound + MODEL_TENSOR_ALIGNMENT);
+  REQUIRE(values && buffer, goto error);
+  for (size_t i = 0; i < m->config.network_depth; ++i) {
+    const dense_layer_t *layer = m->layers[i];
+    const tnsr_size_t weights = layer->fan_in * layer->fan_out;
+    ASSERT(weights + layer->fan_out == layer->param_count);
+    tnsr_type_t *next = values;
+    tnsr_type_t *layer_params = (tnsr_type_t *)params + (layer->params - m->arena.params);
+    REQUIRE(dense_layer_stream(layer, layer_params, model_gather_run, &next), goto error);
+    REQUIRE(
+        model_write_tensor(w, codec, values, layer->fan_in, layer->fan_out, buffer),
+        goto error
+    );
+    REQUIRE(
+        model_write_tensor(w, bias_codec, values + weights, 1, layer->fan_out, buffer),
+        goto error
+    );
+  }
+  free(values);
+  free(buffer);
+  return true;
+error:
+  free(values);
+  free(buffer);
+  return false;
+}
+
+// Views the model's own training state as a snapshot.
+static model_snapshot_t model_snapshot_view(model_t *m) {
+  ASSERT(m);
+  return (model_snapshot_t){
+      .params = m->arena.params,
+      .state = m->arena.state,
+      .mask = m->arena.mask,
+      .progress = m->state,
+      .data = m->config.checkpoint.data_state,
+  };
+}
+
+/**
+ * Writes the model's file from a snapshot, along with its training state when checkpointing.
+ * Checkpoints are synced to disk. Parameters are encoded unless codec is CODEC_RAW. Only
+ * reads the model's immutable layout, so that snapshots can be written while the model trains.
+ * NOTE:
+ * Values are streamed straight from the snapshot, sharded ones in the unsharded layout, so
+ * writing takes no memory besides the stream's buffer. The section table is rewritten last,
+ * once the sizes and checksums of the sections are known.
+ */
+static bool model_write_file(
+    const model_t *m,
+    const model_snapshot_t *snapshot,
+    const char *location,
+    bool checkpoint,
+    codec_t codec
+) {
+  ASSERT(m && snapshot && location && codec < CODEC_COUNT);
+  const model_state_t *progress = &snapshot->progress;
+  const model_serial_header_config_t scfg = {
+      .magicn = MODEL_LEGACY_MAGIC,
+      .epochs = m->config.epochs,
+      .network_depth = m->config.network_depth,
+      .batch_size = m->config.batch_size,
+      .data_size = m->config.data_size,
+      .input_size = m->config.input_size,
+      .output_size = m->config.output_size,
+      .epoch_count = progress->epoch_count,
+      .pass_count = progress->pass_count,
+      .training_loss = progress->training_loss,
+      .learning_rate = m->config.learning_rate,
+      .optimizer_method = m->config.optimizer_method,
+      .loss_function_type = m->config.loss_function_type
+  };
+  const model_serial_training_t training = {
+      .next_epoch = progress->next_epoch,
+      .next_pass = progress->next_pass,
+      .update_count = progress->update_count,
+      .max_staleness = progress->max_staleness,
+      .mean_staleness = progress->mean_staleness,
+      .loss_scale = progress->loss_scale,
+      .skipped_steps = progress->skipped_steps,
+      .stable_steps = progress->stable_steps,
+  };
+  const checkpoint_config_t *cconfig = &m->config.checkpoint;
+  const size_t moments = dense_layer_state_count(m->config.optimizer_method, 1);
+  const bool state = checkpoint && moments;
+  const bool mask = checkpoint && m->arena.mask;
+  const bool data = checkpoint && snapshot->data && cconfig->data_state_size;
+  model_file_section_t sections[MODEL_SECTION_TYPE_COUNT] = {};
+  model_file_header_t header = {
+      .magic = MODEL_FILE_MAGIC,
+      .version = MODEL_FILE_VERSION,
+      .section_count = 3 + state + mask + checkpoint + data,
+  };
+  const size_t table_size = sizeof(model_file_section_t[header.section_count]);
+  model_file_section_t *section = sections;
+  model_writer_t w = {.stream = fopen(location, "wb")};
+  REQUIRE(w.stream, goto error);
+  REQUIRE(model_write(&w, &header, sizeof(header)), goto error);
+  REQUIRE(model_write(&w, sections, table_size), goto error);  // Placeholder.
+
+  REQUIRE(model_section_begin(&w, section, MODEL_SECTION_CONFIG), goto error);
+  REQUIRE(model_write(&w, &scfg, sizeof(scfg)), goto error);
+  model_section_end(&w, section++);
+
+  REQUIRE(model_section_begin(&w, section, MODEL_SECTION_LAYERS), goto error);
+  for (size_t i = 0; i < m->config.network_depth; ++i) {
+    const layer_config_t *layer = &m->config.network[i];
+    const layer_serial_record_t record = {
+        .layer =
+            {
+                .activation_function = layer->activation_function,
+                .initialization_function = layer->initialization_function,
+                .neuron_count = layer->neuron_count,
+            },
+        .height = layer->conv.height,
+        .width = layer->conv.width,
+        .channels = layer->conv.channels,
+        .kernel_height = layer->conv.kernel_height,
+        .kernel_width = layer->conv.kernel_width,
+        .filters = layer->conv.filters,
+        .stride = layer->conv.stride,
+        .padding = layer->conv.padding,
+        .pool = layer->conv.pool,
+    };
+    REQUIRE(model_write(&w, &record, sizeof(record)), goto error);
+  }
+  model_section_end(&w, section++);
+
+  if (codec == CODEC_RAW) {
+    REQUIRE(model_section_begin(&w, section, MODEL_SECTION_PARAMS), goto error);
+    REQUIRE(
+        model_stream_values(m, snapshot->params, MODEL_SECTION_PARAMS, 0, model_write_run, &w),
+        goto error
+    );
+  } else {
+    REQUIRE(model_section_begin(&w, section, MODEL_SECTION_ENCODED_PARAMS), goto error);
+    REQUIRE(model_write_encoded(&w, m, snapshot->params, codec), goto error);
+  }
+  model_section_end(&w, section++);
+
+  if (state) {
+    REQUIRE(model_section_begin(&w, section, MODEL_SECTION_STATE), goto error);
+    for (size_t k = 0; k < moments; ++k) {
+      REQUIRE(
+          model_stream_values(m, snapshot->state, MODEL_SECTION_STATE, k, model_write_run, &w),
+          goto error
+      );
+    }
+    model_section_end(&w, section++);
+  }
+  if (mask) {
+    REQUIRE(model_section_begin(&w, section, MODEL_SECTION_MASK), goto error);
+    REQUIRE(
+        model_stream_values(m, snapshot->mask, MODEL_SECTION_MASK, 0, model_write_run, &w),
+        goto error
+    );
+    model_section_end(&w, section++);
+  }
+  if (checkpoint) {
+    REQUIRE(model_section_begin(&w, section, MODEL_SECTION_TRAINING), goto error);
+    REQUIRE(model_write(&w, &training, sizeof(training)), goto error);
+    for (size_t i = 0; i < m->config.network_depth; ++i) {
+      const uint64_t steps =
+          snapshot->step_counts ? snapshot->step_counts[i] : m->layers[i]->step_count;
+      REQUIRE(model_write(&w, &steps, sizeof(steps)), goto error);
+    }
+    model_section_end(&w, section++);
+  }
+  if (data) {
+    REQUIRE(model_section_begin(&w, section, MODEL_SECTION_DATA), goto error);
+    REQUIRE(model_write(&w, snapshot->data, cconfig->data_state_size), goto error);
+    model_section_end(&w, section++);
+  }
+  ASSERT(section - sections == header.section_count);
+
+  REQUIRE(model_seek(w.stream, 0), goto error);
+  REQUIRE(fwrite(&header, sizeof(header), 1, w.stream) == 1, goto error);
+  REQUIRE(fwrite(sections, table_size, 1, w.stream) == 1, goto error);
+  REQUIRE(!checkpoint || model_sync_file(w.stream), goto error);
+  FILE *stream = w.stream;
+  w.stream = NULL;
+  REQUIRE(fclose(stream) == 0, goto error);  // Flushes the buffered tail.
+  return true;
+error:
+  if (w.stream) {
+    fclose(w.stream);
+  }
+  return false;
+}
+
+// Will NOT preserve transposed data.
+bool model_save(model_t *m, char *location) {
+  return model_save_encoded(m, location, CODEC_RAW);
+}
+
+bool model_save_encoded(model_t *m, char *location, codec_t codec) {
+  ASSERT(m && location);
+  REQUIRE(codec < CODEC_COUNT, return false);
+  const model_snapshot_t snapshot = model_snapshot_view(m);
+  return model_write_file(m, &snapshot, location, false, codec);
+}
+
+/**
+ * Writes a checkpoint next to location, then moves it there once it is on disk. keep - 1
+ * previous checkpoints are shifted to location.1, location.2 and so on.
+ * NOTE:
+ * A crash never leaves a partial checkpoint at location. It may leave none there while the
+ * previous ones are shifted, in which case the newest one is location.1.
+ */
+static bool model_commit_checkpoint(
+    const model_t *m,
+    const model_snapshot_t *snapshot,
+    const char *location,
+    size_t keep
+) {
+  ASSERT(m && snapshot && location);
+  const size_t length = strlen(location) + MODEL_PATH_SUFFIX_LENGTH;
+  char *newer = malloc(length);
+  char *older = malloc(length);
+  REQUIRE(newer && older, goto error);
+  snprintf(newer, length, "%s.tmp", location);
+  REQUIRE(model_write_file(m, snapshot, newer, true, CODEC_RAW), goto error);
+  for (size_t k = max(keep, 1) - 1; k > 0; --k) {
+    snprintf(older, length, "%s.%zu", location, k);
+    if (k > 1) {
+      snprintf(newer, length, "%s.%zu", location, k - 1);
+    }
+    model_rename(k > 1 ? newer : location, older);  // Fails harmlessly until there are k.
+  }
+  snprintf(newer, length, "%s.tmp", location);
+  REQUIRE(model_rename(newer, location), goto error);
+  REQUIRE(model_sync_directory(location), goto error);
+  free(newer);
+  free(older);
+  return true;
+error:
+  free(newer);
+  free(older);
+  return false;
+}
+
+bool model_checkpoint(model_t *m, char *location) {
+  ASSERT(m && location);
+  REQUIRE(!m->arena.mapping, return false);  // Mapped models have no training state.
+  const model_snapshot_t snapshot = model_snapshot_view(m);
+  return model_commit_checkpoint(m, &snapshot, location, 1);
+}
+
+static void model_snapshot_release(model_snapshot_t *snapshot) {
+  ASSERT(snapshot);
+  ALIGNED_FREE(snapshot->params);
+  ALIGNED_FREE(snapshot->state);
+  ALIGNED_FREE(snapshot->mask);
+  free(snapshot->step_counts);
+  free(snapshot->data);
+  *snapshot = (model_snapshot_t){0};
+}
+
+// Allocates a snapshot holding copies of the model's training state.
+static bool model_snapshot_alloc(const model_t *m, model_snapshot_t *snapshot) {
+  ASSERT(m && snapshot);
+  const model_arena_t *arena = &m->arena;
+  const checkpoint_config_t *config = &m->config.checkpoint;
+  *snapshot = (model_snapshot_t){0};
+  snapshot->params = ALIGNED_ALLOC(sizeof(tnsr_type_t[arena->param_count]));
+  snapshot->step_counts = calloc(max(m->config.network_depth, 1), sizeof(uint64_t));
+  REQUIRE(snapshot->params && snapshot->step_counts, goto error);
+  if (arena->state) {
+    snapshot->state = ALIGNED_ALLOC(sizeof(tnsr_type_t[arena->state_count]));
+    REQUIRE(snapshot->state, goto error);
+  }
+  if (arena->mask) {
+    snapshot->mask = ALIGNED_ALLOC(sizeof(tnsr_type_t[arena->param_count]));
+    REQUIRE(snapshot->mask, goto error);
+  }
+  if (config->data_state && config->data_state_size) {
+    snapshot->data = malloc(config->data_state_size);
+    REQUIRE(snapshot->data, goto error);
+  }
+  return true;
+error:
+  model_snapshot_release(snapshot);
+  return false;
+}
+
+typedef struct {
+  tnsr_type_t *restrict dst;
+  const tnsr_type_t *restrict src;
+} model_copy_ctx_t;
+
+static void model_copy_range(size_t begin, size_t end, void *ctx) {
+  model_copy_ctx_t *copy = ctx;
+  memcpy(copy->dst + begin, copy->src + begin, sizeof(tnsr_type_t[end - begin]));
+}
+
+static void model_copy(tnsr_type_t *dst, const tnsr_type_t *src, tnsr_size_t count) {
+  model_copy_ctx_t ctx = {.dst = dst, .src = src};
+  tpool_parallel_for(tpool_global(), count, MODEL_GRAIN, model_copy_range, &ctx);
+}
+
+// Copies the model's training state into a snapshot allocated by model_snapshot_alloc.
+static void model_snapshot_take(const model_t *m, model_snapshot_t *snapshot) {
+  ASSERT(m && snapshot);
+  const model_arena_t *arena = &m->arena;
+  model_copy(snapshot->params, arena->params, arena->param_count);
+  if (snapshot->state) {
+    model_copy(snapshot->state, arena->state, arena->state_count);
+  }
+  if (snapshot->mask) {
+    model_copy(snapshot->mask, arena->mask, arena->param_count);
+  }
+  for (size_t i = 0; i < m->config.network_depth; ++i) {
+    snapshot->step_counts[i] = m->layers[i]->step_count;
+  }
+  if (snapshot->data) {
+    memcpy(snapshot->data, m->config.checkpoint.data_state, m->config.checkpoint.data_state_size);
+  }
+  snapshot->progress = m->state;
+}
+
+// Writes the pending snapshots until stopped, then drains the last one.
+static int model_checkpointer_run(void *ctx) {
+  model_checkpointer_t *c = ctx;
+  const checkpoint_config_t *config = &c->model->config.checkpoint;
+  mtx_lock(&c->lock);
+  for (;;) {
+    while (c->pending < 0 && !c->stopping) {
+      cnd_wait(&c->ready, &c->lock);
+    }
+    if (c->pending < 0) {
+      break;
+    }
+    const int b = c->pending;
+    c->writing = b;
+    c->pending = -1;
+    mtx_unlock(&c->lock);
+    const bool written =
+        model_commit_checkpoint(c->model, &c->buffers[b], config->location, config->keep);
+    mtx_lock(&c->lock);
+    c->failed = c->failed || !written;
+    c->writing = -1;
+  }
+  mtx_unlock(&c->lock);
+  return 0;
+}
+
+static model_checkpointer_t *model_checkpointer_create(const model_t *m) {
+  ASSERT(m);
+  model_checkpointer_t *c = calloc(1, sizeof(model_checkpointer_t));
+  REQUIRE(c, goto error);
+  c->model = m;
+  c->pending = -1;
+  c->writing = -1;
+  REQUIRE(model_snapshot_alloc(m, &c->buffers[0]), goto error);
+  REQUIRE(model_snapshot_alloc(m, &c->buffers[1]), goto error);
+  REQUIRE(mtx_init(&c->lock, mtx_plain) == thrd_success, goto error);
+  REQUIRE(cnd_init(&c->ready) == thrd_success, goto error_lock);
+  REQUIRE(thrd_create(&c->thread, model_checkpointer_run, c) == thrd_success, goto error_ready);
+  return c;
+error_ready:
+  cnd_destroy(&c->ready);
+error_lock:
+  mtx_destroy(&c->lock);
+error:
+  if (c) {
+    model_snapshot_release(&c->buffers[0]);
+    model_snapshot_release(&c->buffers[1]);
+  }
+  free(c);
+  return NULL;
+}
+
+/**
+ * Waits for the pending snapshot to be written, stops the writer, and deallocates it.
+ * Sets the pointer to NULL. false if any write failed.
+ */
+static bool model_checkpointer_destroy(model_checkpointer_t **checkpointer) {
+  ASSERT(checkpointer && *checkpointer);
+  model_checkpointer_t *c = *checkpointer;
+  mtx_lock(&c->lock);
+  c->stopping = true;
+  cnd_signal(&c->ready);
+  mtx_unlock(&c->lock);
+  thrd_join(c->thread, NULL);
+  const bool failed = c->failed;
+  cnd_destroy(&c->ready);
+  mtx_destroy(&c->lock);
+  model_snapshot_release(&c->buffers[0]);
+  model_snapshot_release(&c->buffers[1]);
+  free(c);
+  *checkpointer = NULL;
+  return !failed;
+}
+
+// Snapshots the model for the writer. Only waits for the copy. false if a write failed.
+static bool model_checkpointer_submit(model_checkpointer_t *c, const model_t *m) {
+  ASSERT(c && m);
+  mtx_lock(&c->lock);
+  const bool failed = c->failed;
+  const int b = c->writing == 0 ? 1 : 0;
+  if (c->pending == b) {
+    c->pending = -1;  // Replaced by the newer snapshot.
+  }
+  mtx_unlock(&c->lock);
+  REQUIRE(!failed, return false);
+  model_snapshot_take(m, &c->buffers[b]);
+  mtx_lock(&c->lock);
+  c->pending = b;
+  cnd_signal(&c->ready);
+  mtx_unlock(&c->lock);
+  return true;
+}
+
+// Creates the model described by a serialized header, without its layers.
+// Its layer configs are zeroed.
+static model_t *model_from_header(const model_serial_header_config_t *header) {
+  ASSERT(header);
+  REQUIRE(header->magicn == MODEL_LEGACY_MAGIC, return NULL);
+  model_t *model = calloc(1, sizeof(model_t) + sizeof(dense_layer_t *[header->network_depth]));
+  REQUIRE(model, goto error);
+  model->state.epoch_count = header->epoch_count;
+  model->state.pass_count = header->pass_count;
+  model->state.training_loss = header->training_loss;
+  model->state.time_to_target = NAN;
+  model->config.epochs = header->epochs;
+  model->config.network_depth = header->network_depth;
+  model->config.batch_size = header->batch_size;
+  model->config.data_size = header->data_size;
+  model->config.input_size = header->input_size;
+  model->config.output_size = header->output_size;
+  model->config.optimizer_method = header->optimizer_method;
+  model->config.learning_rate = header->learning_rate;
+  model->config.loss_function_type = header->loss_function_type;
+  model->config.data_callback = NULL;
+  model->config.context = NULL;
+  model->config.network = calloc(max(model->config.network_depth, 1), sizeof(layer_config_t));
+  REQUIRE(model->config.network, goto error);
+  model->config.dashboard.dashboard_callback = NULL;
+  model->config.dashboard.show_dashboard = false;
+  model->config.dashboard.passes_interval = 0;
+  return model;
+error:
+  free(model);
+  return NULL;
+}
+
+// Byte-for-byte memcpy not allowed due to standardized 64-bit size in serialization.
+static layer_config_t model_layer_config(const layer_serial_config_t *layer) {
+  ASSERT(layer);
+  return (layer_config_t){
+      .activation_function = layer->activation_function,
+      .initialization_function = layer->initialization_function,
+      .neuron_count = layer->neuron_count,
+  };
+}
+
+static layer_config_t model_layer_record(const layer_serial_record_t *record) {
+  ASSERT(record);
+  layer_config_t layer = model_layer_config(&record->layer);
+  layer.conv = (grph_conv_t){
+      .height = record->height,
+      .width = record->width,
+      .channels = record->channels,
+      .kernel_height = record->kernel_height,
+      .kernel_width = record->kernel_width,
+      .filters = record->filters,
+      .stride = record->stride,
+      .padding = record->padding,
+      .pool = record->pool,
+  };
+  return layer;
+}
+
+// Looks the required sections up by type, after checking every section lies within size bytes.
+static bool model_file_index(
+    const model_file_header_t *header,
+    const model_file_section_t *table,
+    uint64_t size,
+    const model_file_section_t *index[MODEL_SECTION_TYPE_COUNT]
+) {
+  ASSERT(header && table && index);
+  REQUIRE(header->version == MODEL_FILE_VERSION, goto error);
+  for (size_t t = 0; t < MODEL_SECTION_TYPE_COUNT; ++t) {
+    index[t] = NULL;
+  }
+  for (uint32_t i = 0; i < header->section_count; ++i) {
+    const model_file_section_t *section = &table[i];
+    REQUIRE(section->offset % MODEL_FILE_ALIGNMENT == 0, goto error);
+    REQUIRE(section->offset <= size && section->size <= size - section->offset, goto error);
+    if (section->type && section->type < MODEL_SECTION_TYPE_COUNT) {
+      REQUIRE(!index[section->type], goto error);
+      index[section->type] = section;
+    }
+  }
+  REQUIRE(index[MODEL_SECTION_CONFIG] && index[MODEL_SECTION_LAYERS], goto error);
+  REQUIRE(!index[MODEL_SECTION_PARAMS] != !index[MODEL_SECTION_ENCODED_PARAMS], goto error);
+  return true;
+error:
+  return false;
+}
+
+// Creates the model described by the config and layers sections, without its layers.
+// Checks the raw parameters section matches it, encoded ones are checked as they decode.
+static model_t *model_from_sections(
+    const model_file_section_t *index[MODEL_SECTION_TYPE_COUNT],
+    const model_serial_header_config_t *header,
+    const layer_serial_record_t *records
+) {
+  ASSERT(index && header && records);
+  const model_file_section_t *layers = index[MODEL_SECTION_LAYERS];
+  REQUIRE(index[MODEL_SECTION_CONFIG]->size == sizeof(*header), return NULL);
+  REQUIRE(layers->size % sizeof(*records) == 0, return NULL);
+  REQUIRE(header->network_depth == layers->size / sizeof(*records), return NULL);
+  model_t *model = model_from_header(header);
+  REQUIRE(model, goto error);
+  for (size_t i = 0; i < model->config.network_depth; ++i) {
+    model->config.network[i] = model_layer_record(&records[i]);
+  }
+  const tnsr_size_t count = model_param_count(&model->config);
+  REQUIRE(count, goto error);
+  const model_file_section_t *params = index[MODEL_SECTION_PARAMS];
+  REQUIRE(!params || params->size == sizeof(tnsr_type_t[count]), goto error);
+  return model;
+error:
+  if (model) {
+    free(model->config.network);
+    model_destroy(&model);
+  }
+  return NULL;
+}
+
+// Reads and checks a section's payload. NULL upon failure.
+static void *model_read_section(FILE *stream, const model_file_section_t *section) {
+  ASSERT(stream && section);
+  REQUIRE(section->size <= SIZE_MAX, return NULL);
+  void *payload = malloc(max(section->size, 1));
+  REQUIRE(payload, goto error);
+  REQUIRE(model_seek(stream, section->offset), goto error);
+  REQUIRE(!section->size || fread(payload, section->size, 1, stream) == 1, goto error);
+  REQUIRE(model_section_valid(section, payload), goto error);
+  return payload;
+error:
+  free(payload);
+  return NULL;
+}
+
+// Reads the section table following the header, and indexes it.
+static bool model_read_table(
+    FILE *stream,
+    const model_file_header_t *header,
+    model_file_section_t table[MODEL_FILE_SECTIONS],
+    const model_file_section_t *index[MODEL_SECTION_TYPE_COUNT]
+) {
+  ASSERT(stream && header && table && index);
+  REQUIRE(header->section_count && header->section_count <= MODEL_FILE_SECTIONS, return false);
+  const size_t table_size = sizeof(model_file_section_t[header->section_count]);
+  REQUIRE(fread(table, table_size, 1, stream) == 1, return false);
+  return model_file_index(header, table, UINT64_MAX, index);
+}
+
+// A tensor of an encoded parameters section, and where it decodes to.
+typedef struct {
+  const model_serial_tensor_t *tensor;
+  tnsr_type_t *values;
+  bool decoded;
+} model_tensor_entry_t;
+
+// Steps over the tensor at *offset in an encoded parameters section. NULL past its end.
+static const model_serial_tensor_t *model_next_tensor(
+    const unsigned char *payload,
+    uint64_t size,
+    uint64_t *offset
+) {
+  ASSERT(payload && offset);
+  const model_serial_tensor_t *tensor = (const void *)(payload + *offset);
+  REQUIRE(size - *offset >= sizeof(*tensor), return NULL);
+  const uint64_t rest = size - *offset - sizeof(*tensor);
+  REQUIRE(tensor->size <= rest && tensor->codec < CODEC_COUNT, return NULL);
+  const uint64_t padded = tensor->size + (MODEL_TENSOR_ALIGNMENT - tensor->size %
+                                          MODEL_TENSOR_ALIGNMENT) % MODEL_TENSOR_ALIGNMENT;
+  *offset += sizeof(*tensor) + min(padded, rest);
+  return tensor;
+}
+
+static void model_decode_range(size_t begin, size_t end, void *ctx) {
+  model_tensor_entry_t *entries = ctx;
+  for (size_t i = begin; i < end; ++i) {
+    const model_serial_tensor_t *tensor = entries[i].tensor;
+    entries[i].decoded = codec_decode(
+        tensor->codec, tensor + 1, tensor->size, tensor->rows, tensor->cols, entries[i].values
+    );
+  }
+}
+
+/**
+ * Decodes an encoded parameters section into the count values of params, those of the
+ * configured layers. Tensors are decoded in parallel, each into its place in params.
+ * NOTE:
+ * Tensors are laid out back to back like the parameters, so their place only depends on
+ * the sizes of the ones before them. Each layer has its weights, then its biases, and
+ * their shapes must match the layer's.
+ */
+static bool model_decode_params(
+    const unsigned char *payload,
+    uint64_t size,
+    const model_config_t *config,
+    tnsr_type_t *params,
+    tnsr_size_t count
+) {
+  ASSERT(payload && config && params);
+  model_tensor_entry_t *entries = NULL;
+  size_t tensor_count = 0;
+  for (uint64_t offset = 0; offset < size; ++tensor_count) {
+    REQUIRE(model_next_tensor(payload, size, &offset), goto error);
+  }
+  REQUIRE(tensor_count == 2 * config->network_depth, goto error);
+  entries = calloc(max(tensor_count, 1), sizeof(model_tensor_entry_t));
+  REQUIRE(entries, goto error);
+  uint64_t offset = 0;
+  tnsr_size_t filled = 0;
+  tnsr_size_t input = config->input_size;
+  tnsr_size_t fan_in = 0;
+  tnsr_size_t fan_out = 0;
+  for (size_t i = 0; i < tensor_count; ++i) {
+    const model_serial_tensor_t *tensor = model_next_tensor(payload, size, &offset);
+    if (i % 2 == 0) {
+      input = model_layer_shape(config, i / 2, input, &fan_in, &fan_out);
     }
-    tnsr_destroy(&expected);
-    tnsr_destroy(&input);
-    grph_destroy(&graph);
+    const tnsr_size_t rows = i % 2 ? 1 : fan_in;  // Biases are a single row.
+    REQUIRE(tensor->rows == rows && tensor->cols == fan_out, goto error);
+    entries[i] = (model_tensor_entry_t){.tensor = tensor, .values = params + filled};
+    filled += rows * fan_out;
   }
-  tnsr_destroy(&expected);
-  tnsr_destroy(&input);
-  grph_destroy(&graph);
+  REQUIRE(filled == count, goto error);
+  tpool_parallel_for(tpool_global(), tensor_count, 1, model_decode_range, entries);
+  for (size_t i = 0; i < tensor_count; ++i) {
+    REQUIRE(entries[i].decoded, goto error);
+  }
+  free(entries);
   return true;
 error:
-  tnsr_destroy(&expected);
-  tnsr_destroy(&input);
-  grph_destroy(&graph);
+  free(entries);
   return false;
 }
 
-model_t *model_create(model_config_t *config) {
-  ASSERT(config);
-  model_t *model = malloc(sizeof(model_t) + sizeof(dense_layer_t[config->network_depth]));
+static model_t *model_read_sections(FILE *stream, const model_file_header_t *header) {
+  ASSERT(stream && header);
+  model_t *model = NULL;
+  model_serial_header_config_t *config = NULL;
+  layer_serial_record_t *records = NULL;
+  unsigned char *payload = NULL;  // Of the encoded parameters.
+  model_file_section_t table[MODEL_FILE_SECTIONS];
+  const model_file_section_t *index[MODEL_SECTION_TYPE_COUNT];
+  REQUIRE(model_read_table(stream, header, table, index), goto error);
+  config = model_read_section(stream, index[MODEL_SECTION_CONFIG]);
+  records = model_read_section(stream, index[MODEL_SECTION_LAYERS]);
+  REQUIRE(config && records, goto error);
+  model = model_from_sections(index, config, records);
   REQUIRE(model, goto error);
-  memcpy(&model->config, config, sizeof(model_config_t));
-  model->state.epoch_count = 0;
-  model->state.pass_count = 0;
-  model->state.training_loss = NAN;
 
-  grph_size_t input = config->input_size;
-  for (size_t i = 0; i < model->config.network_depth; ++i) {
-    model->layers[i] = dense_layer_create(
-        input,
-        config->network[i].neuron_count,
-        config->network[i].initialization_function,
-        config->network[i].activation_function,
-        config->optimizer_method,
-        config->learning_rate
+  // Parameters are stored in arena order, and read or decoded straight into it.
+  const model_file_section_t *params = index[MODEL_SECTION_PARAMS];
+  const tnsr_size_t count = model_param_count(&model->config);
+  model->arena.params = ALIGNED_ALLOC(sizeof(tnsr_type_t[count]));
+  REQUIRE(model->arena.params, goto error);
+  if (params) {
+    REQUIRE(model_seek(stream, params->offset), goto error);
+    REQUIRE(fread(model->arena.params, params->size, 1, stream) == 1, goto error);
+    REQUIRE(model_section_valid(params, model->arena.params), goto error);
+  } else {
+    const model_file_section_t *encoded = index[MODEL_SECTION_ENCODED_PARAMS];
+    payload = model_read_section(stream, encoded);
+    REQUIRE(payload, goto error);
+    REQUIRE(
+        model_decode_params(payload, encoded->size, &model->config, model->arena.params, count),
+        goto error
     );
-    input = config->network[i].neuron_count;
-    REQUIRE(model->layers[i], goto error);
   }
+  REQUIRE(model_create_layers(model, model->arena.params), goto error);
+  free(config);
+  free(records);
+  free(payload);
   return model;
 error:
-  return NULL;
-}
-
-void model_destroy(model_t **m) {
-  REQUIRE(m && *m, return);
-  model_t *model = *m;
-  for (size_t i = 0; i < model->config.network_depth; ++i) {
-    dense_layer_destroy(&model->layers[i]);
+  free(config);
+  free(records);
+  free(payload);
+  if (model) {
+    free(model->config.network);
+    model_destroy(&model);
   }
-  free(model);
-  *m = NULL;
+  return NULL;
 }
 
-/**
- * Will NOT preserve transposed data.
- * Model weights must be placed in row-major contiguous order.
- * NOTE:
- * Uses twice as much RAM as needed. Ignored for now, not like
- * I'm running gigabyte-scale models on a CPU.
- */
-bool model_save(model_t *m, char *location) {
-  ASSERT(m && location);
-  FILE *stream = NULL;
-  model_serial_header_config_t scfg = {
-      .magicn = 0x4004,
-      .epochs = m->config.epochs,
-      .network_depth = m->config.network_depth,
-      .batch_size = m->config.batch_size,
-      .data_size = m->config.data_size,
-      .input_size = m->config.input_size,
-      .output_size = m->config.output_size,
-      .epoch_count = m->state.epoch_count,
-      .pass_count = m->state.pass_count,
-      .training_loss = m->state.training_loss,
-      .learning_rate = m->config.learning_rate,
-      .optimizer_method = m->config.optimizer_method,
-      .loss_function_type = m->config.loss_function_type
-  };
-  model_serial_parameters_t *params = NULL;
+static model_t *model_read_legacy(FILE *stream) {
+  ASSERT(stream);
+  model_t *model = NULL;
+  model_serial_layer_config_t *lcfg = NULL;
+  model_serial_header_config_t header = {};
+  REQUIRE(model_seek(stream, 0), goto error);
+  REQUIRE(fread(&header, sizeof(header), 1, stream), goto error);
   size_t lcfg_size = {
-      sizeof(model_serial_layer_config_t) + m->config.network_depth * sizeof(layer_serial_config_t)
+      sizeof(model_serial_layer_config_t) +  // Layer count.
+      sizeof(layer_serial_config_t) * header.network_depth
   };
-  model_serial_layer_config_t *lcfg = malloc(lcfg_size);
-  size_t tparam_size = 0;
+  lcfg = malloc(lcfg_size);
   REQUIRE(lcfg, goto error);
-  lcfg->layer_count = m->config.network_depth;
-  for (size_t i = 0; i < m->config.network_depth; ++i) {
-    layer_config_t layer = m->config.network[i];
-    lcfg->network[i] = (layer_serial_config_t){
-        .activation_function = layer.activation_function,
-        .initialization_function = layer.initialization_function,
-        .neuron_count = layer.neuron_count,
-    };
-    tnsr_t *w = m->layers[i]->weights;
-    tnsr_t *b = m->layers[i]->biases;
-    tparam_size += TNSR_SHPE(w, 0) * TNSR_SHPE(w, 1);
-    tparam_size += TNSR_SHPE(b, 0) * TNSR_SHPE(b, 1);
-  }
-  params = malloc(tparam_size * sizeof(tnsr_type_t));
-  REQUIRE(params, goto error);
-  size_t offset = 0;
-  for (size_t i = 0; i < m->config.network_depth; ++i) {
-    tnsr_t *w = m->layers[i]->weights;
-    tnsr_t *b = m->layers[i]->biases;
-    size_t cpy_size = TNSR_SHPE(w, 0) * TNSR_SHPE(w, 1) * sizeof(tnsr_type_t);
-    memcpy((char *)(params->paremeters) + offset, &TNSR_DATA(w, 0, 0), cpy_size);
-    offset += cpy_size;
-    cpy_size = TNSR_SHPE(b, 0) * TNSR_SHPE(b, 1) * sizeof(tnsr_type_t);
-    memcpy((char *)(params->paremeters) + offset, &TNSR_DATA(b, 0, 0), cpy_size);
-    offset += cpy_size;
+  REQUIRE(fread(lcfg, lcfg_size, 1, stream) == 1, goto error);
+  model = model_from_header(&header);
+  REQUIRE(model, goto error);
+  for (size_t i = 0; i < model->config.network_depth; ++i) {
+    model->config.network[i] = model_layer_config(&lcfg->network[i]);
   }
 
-  stream = fopen(location, "wb");
-  REQUIRE(stream, goto error);
-  size_t rw = fwrite(&scfg, sizeof(scfg), 1, stream);
-  REQUIRE(rw == 1, goto error);
-  rw = fwrite(lcfg, lcfg_size, 1, stream);
-  REQUIRE(rw == 1, goto error);
-  rw = fwrite(params, tparam_size * sizeof(tnsr_type_t), 1, stream);
-  REQUIRE(rw == 1, goto error);
+  // Parameters are stored in arena order, L0[W, B] -> L1[W, B], and read straight into it.
+  const tnsr_size_t count = model_param_count(&model->config);
+  REQUIRE(count, goto error);
+  model->arena.params = ALIGNED_ALLOC(sizeof(tnsr_type_t[count]));
+  REQUIRE(model->arena.params, goto error);
+  REQUIRE(fread(model->arena.params, sizeof(tnsr_type_t[count]), 1, stream) == 1, goto error);
+  REQUIRE(model_create_layers(model, model->arena.params), goto error);
   free(lcfg);
-  free(params);
-  fclose(stream);
-  return true;
+  return model;
 error:
   free(lcfg);
-  free(params);
-  if (stream) {
-    fclose(stream);
+  if (model) {
+    free(model->config.network);
+    model_destroy(&model);
   }
-  return false;
+  return NULL;
 }
 
 model_t *model_load(char *location) {
   ASSERT(location);
   model_t *model = NULL;
-  dense_layer_t **layers = NULL;
   FILE *stream = fopen(location, "rb");
   REQUIRE(stream, goto error);
-  model_serial_header_config_t header = {};
-  REQUIRE(fread(&header, sizeof(header), 1, stream), goto error);
-  REQUIRE(header.magicn == 0x4004, goto error);
-  size_t lcfg_size = {
-      sizeof(model_serial_layer_config_t) +  // Layer count.
-      sizeof(layer_serial_config_t) * header.network_depth
-  };
-  model_serial_layer_config_t *lcfg = malloc(lcfg_size);
-  REQUIRE(lcfg, goto error);
-  REQUIRE(fread(lcfg, lcfg_size, 1, stream) == 1, goto error);
-
-  layers = calloc(header.network_depth, sizeof(dense_layer_t *));
-  REQUIRE(layers, goto error);
-  size_t prev_nsize = header.input_size;
-  for (size_t i = 0; i < header.network_depth; ++i) {
-    layer_serial_config_t lc = lcfg->network[i];
-    layers[i] = dense_layer_create(
-        prev_nsize,
-        lc.neuron_count,
-        lc.initialization_function,
-        lc.activation_function,
-        header.optimizer_method,
-        header.learning_rate
-    );
-    REQUIRE(layers[i], goto error);
-    size_t sw = {
-        TNSR_SHPE(layers[i]->weights, 0) *
-        TNSR_SHPE(layers[i]->weights, 1) *  // Weights stored first.
-        sizeof(tnsr_type_t)
-    };
-    size_t sb = {
-        TNSR_SHPE(layers[i]->biases, 0) *
-        TNSR_SHPE(layers[i]->biases, 1) *  // Biases stored afterwards.
-        sizeof(tnsr_type_t)
-    };
-    REQUIRE(fread(layers[i]->weights->data, sw, 1, stream) == 1, goto error);
-    REQUIRE(fread(layers[i]->biases->data, sb, 1, stream) == 1, goto error);
-    prev_nsize = lc.neuron_count;
+  model_file_header_t header = {};
+  REQUIRE(fread(&header, sizeof(header), 1, stream) == 1, goto error);
+  if (header.magic == MODEL_FILE_MAGIC) {
+    model = model_read_sections(stream, &header);
+  } else {
+    model = model_read_legacy(stream);  // Starts with its own magic number.
   }
-  model = malloc(sizeof(model_t) + sizeof(dense_layer_t *) * header.network_depth);
   REQUIRE(model, goto error);
-  model->state.epoch_count = header.epoch_count;
-  model->state.pass_count = header.pass_count;
-  model->state.training_loss = header.training_loss;
-  memcpy(model->layers, layers, sizeof(dense_layer_t *) * header.network_depth);
-  model->config.epochs = header.epochs;
-  model->config.network_depth = header.network_depth;
-  model->config.batch_size = header.batch_size;
-  model->config.data_size = header.data_size;
-  model->config.input_size = header.input_size;
-  model->config.output_size = header.output_size;
-  model->config.optimizer_method = header.optimizer_method;
-  model->config.learning_rate = header.learning_rate;
-  model->config.loss_function_type = header.loss_function_type;
-  model->config.data_callback = NULL;
-  model->config.context = NULL;
+  fclose(stream);
+  return model;
+error:
+  if (stream) {
+    fclose(stream);
+  }
+  return NULL;
+}
 
-  // Byte-for-byte memcpy not allowed due to standardized 64-bit size in serialization.
-  model->config.network = malloc(sizeof(layer_config_t) * model->config.network_depth);
-  REQUIRE(model->config.network, goto error);
+/**
+ * NOTE:
+ * Only the metadata sections are checked against their checksums, checking the parameters
+ * would read every page of them up front. Encoded parameters cannot be viewed.
+ */
+static model_t *model_view_sections(
+    const unsigned char *base,
+    size_t size,
+    const tnsr_type_t **params
+) {
+  ASSERT(base && params);
+  const model_file_header_t *header = (const void *)base;
+  const model_file_section_t *table = (const void *)(base + sizeof(*header));
+  REQUIRE(header->section_count <= MODEL_FILE_SECTIONS, return NULL);
+  REQUIRE(size >= sizeof(*header) + sizeof(*table) * header->section_count, return NULL);
+  const model_file_section_t *index[MODEL_SECTION_TYPE_COUNT];
+  REQUIRE(model_file_index(header, table, size, index), return NULL);
+  const model_file_section_t *config = index[MODEL_SECTION_CONFIG];
+  const model_file_section_t *layers = index[MODEL_SECTION_LAYERS];
+  REQUIRE(index[MODEL_SECTION_PARAMS], return NULL);
+  REQUIRE(model_section_valid(config, base + config->offset), return NULL);
+  REQUIRE(model_section_valid(layers, base + layers->offset), return NULL);
+  *params = (const void *)(base + index[MODEL_SECTION_PARAMS]->offset);
+  return model_from_sections(index, (const void *)(base + config->offset),
+                             (const void *)(base + layers->offset));
+}
+
+/**
+ * NOTE:
+ * Legacy parameters start 8 bytes aligned within the mapping, which is enough for tensor views.
+ */
+static model_t *model_view_legacy(
+    const unsigned char *base,
+    size_t size,
+    const tnsr_type_t **params
+) {
+  ASSERT(base && params);
+  const size_t lcfg_offset = sizeof(model_serial_header_config_t);
+  REQUIRE(size >= lcfg_offset + sizeof(model_serial_layer_config_t), return NULL);
+  const model_serial_header_config_t *header = (const void *)base;
+  const model_serial_layer_config_t *lcfg = (const void *)(base + lcfg_offset);
+  const size_t layers = size - lcfg_offset - sizeof(model_serial_layer_config_t);
+  REQUIRE(header->network_depth <= layers / sizeof(layer_serial_config_t), return NULL);
+  const size_t params_offset = {
+      lcfg_offset + sizeof(model_serial_layer_config_t) +
+      sizeof(layer_serial_config_t) * header->network_depth
+  };
+  model_t *model = model_from_header(header);
+  REQUIRE(model, goto error);
   for (size_t i = 0; i < model->config.network_depth; ++i) {
-    model->config.network[i] =
-        (layer_config_t){.activation_function = lcfg->network[i].activation_function,
-                         .initialization_function = lcfg->network[i].initialization_function,
-                         .neuron_count = lcfg->network[i].neuron_count};
+    model->config.network[i] = model_layer_config(&lcfg->network[i]);
+  }
+  const tnsr_size_t count = model_param_count(&model->config);
+  REQUIRE(count && count <= (size - params_offset) / sizeof(tnsr_type_t), goto error);
+  *params = (const void *)(base + params_offset);
+  return model;
+error:
+  if (model) {
+    free(model->config.network);
+    model_destroy(&model);
   }
+  return NULL;
+}
 
-  model->config.dashboard.dashboard_callback = NULL;
-  model->config.dashboard.show_dashboard = false;
-  model->config.dashboard.passes_interval = 0;
-  free(lcfg);
-  fclose(stream);
+/**
+ * NOTE:
+ * Parameters are only faulted in as the layers first read them.
+ */
+model_t *model_load_mapped(char *location) {
+  ASSERT(location);
+  model_t *model = NULL;
+  size_t size = 0;
+  unsigned char *base = model_map(location, &size);
+  REQUIRE(base, goto error);
+  const tnsr_type_t *params = NULL;
+  const model_file_header_t *header = (const void *)base;
+  if (size >= sizeof(*header) && header->magic == MODEL_FILE_MAGIC) {
+    model = model_view_sections(base, size, &params);
+  } else {
+    model = model_view_legacy(base, size, &params);
+  }
+  REQUIRE(model, goto error);
+  model->arena.mapping = base;  // Unmapped along with the model from now on.
+  model->arena.mapping_size = size;
+  base = NULL;
+  // The mapping is read-only, which model_fit and model_prune check for.
+  REQUIRE(model_create_layers(model, (tnsr_type_t *)params), goto error);
   return model;
 error:
-  if (layers) {
-    for (size_t i = 0; i < header.network_depth; ++i) {
-      dense_layer_destroy(&layers[i]);
-    }
-    free(layers);
+  if (base) {
+    model_unmap(base, size);
   }
-  free(lcfg);
   if (model) {
     free(model->config.network);
-    free(model);
+    model_destroy(&model);
+  }
+  return NULL;
+}
+
+// Checks a section's payload against its checksum, reading it through a bounded buffer.
+static bool model_section_verify(FILE *stream, const model_file_section_t *section) {
+  ASSERT(stream && section);
+  uint64_t sum[2] = {0};
+  unsigned char *buffer = malloc(MODEL_VERIFY_CHUNK);
+  REQUIRE(buffer, goto error);
+  REQUIRE(model_seek(stream, section->offset), goto error);
+  for (uint64_t done = 0; done < section->size;) {
+    const size_t chunk = (size_t)min(section->size - done, (uint64_t)MODEL_VERIFY_CHUNK);
+    REQUIRE(fread(buffer, chunk, 1, stream) == 1, goto error);
+    model_checksum(sum, buffer, chunk);
+    done += chunk;
+  }
+  free(buffer);
+  return model_checksum_value(sum) == section->checksum;
+error:
+  free(buffer);
+  return false;
+}
+
+// Whether the serialized config and layers describe the model's layers and optimizer.
+static bool model_layers_match(
+    const model_t *m,
+    const model_serial_header_config_t *header,
+    const layer_serial_record_t *records
+) {
+  ASSERT(m && header && records);
+  REQUIRE(header->network_depth == m->config.network_depth, return false);
+  REQUIRE(header->input_size == m->config.input_size, return false);
+  REQUIRE(header->optimizer_method == m->config.optimizer_method, return false);
+  for (size_t i = 0; i < m->config.network_depth; ++i) {
+    const layer_config_t layer = model_layer_record(&records[i]);
+    const layer_config_t *own = &m->config.network[i];
+    REQUIRE(!memcmp(&layer.conv, &own->conv, sizeof(grph_conv_t)), return false);
+    REQUIRE(layer.conv.filters || layer.neuron_count == own->neuron_count, return false);
+  }
+  return true;
+}
+
+/**
+ * NOTE:
+ * Every section is checked before the model is first written to, large ones by reading them
+ * twice, so that a corrupt or mismatching checkpoint leaves the model untouched. The second
+ * read is typically served from the page cache.
+ */
+bool model_resume(model_t *m, char *location) {
+  ASSERT(m && location);
+  model_serial_header_config_t *config = NULL;
+  layer_serial_record_t *records = NULL;
+  model_serial_training_t *training = NULL;
+  void *data = NULL;
+  FILE *stream = NULL;
+  REQUIRE(!m->arena.mapping, goto error);
+  stream = fopen(location, "rb");
+  REQUIRE(stream, goto error);
+  model_file_header_t header = {};
+  REQUIRE(fread(&header, sizeof(header), 1, stream) == 1, goto error);
+  REQUIRE(header.magic == MODEL_FILE_MAGIC, goto error);
+  model_file_section_t table[MODEL_FILE_SECTIONS];
+  const model_file_section_t *index[MODEL_SECTION_TYPE_COUNT];
+  REQUIRE(model_read_table(stream, &header, table, index), goto error);
+  REQUIRE(index[MODEL_SECTION_TRAINING], goto error);  // Not a checkpoint otherwise.
+
+  const size_t depth = m->config.network_depth;
+  config = model_read_section(stream, index[MODEL_SECTION_CONFIG]);
+  records = model_read_section(stream, index[MODEL_SECTION_LAYERS]);
+  training = model_read_section(stream, index[MODEL_SECTION_TRAINING]);
+  REQUIRE(config && records && training, goto error);
+  REQUIRE(index[MODEL_SECTION_CONFIG]->size == sizeof(*config), goto error);
+  REQUIRE(config->network_depth == depth, goto error);
+  REQUIRE(index[MODEL_SECTION_LAYERS]->size == sizeof(layer_serial_record_t[depth]), goto error);
+  REQUIRE(model_layers_match(m, config, records), goto error);
+  const size_t training_size = sizeof(*training) + sizeof(uint64_t[depth]);
+  REQUIRE(index[MODEL_SECTION_TRAINING]->size == training_size, goto error);
+
+  const model_file_section_t *params = index[MODEL_SECTION_PARAMS];
+  const model_file_section_t *state = index[MODEL_SECTION_STATE];
+  const model_file_section_t *mask = index[MODEL_SECTION_MASK];
+  const size_t values = sizeof(tnsr_type_t[m->arena.param_count]);
+  REQUIRE(params && params->size == values, goto error);  // Checkpoints are never encoded.
+  REQUIRE(!state == !m->arena.state_count, goto error);
+  REQUIRE(!state || state->size == sizeof(tnsr_type_t[m->arena.state_count]), goto error);
+  REQUIRE(!mask == !m->arena.mask && (!mask || mask->size == values), goto error);
+  REQUIRE(model_section_verify(stream, params), goto error);
+  REQUIRE(!state || model_section_verify(stream, state), goto error);
+  REQUIRE(!mask || model_section_verify(stream, mask), goto error);
+  const checkpoint_config_t *cconfig = &m->config.checkpoint;
+  if (cconfig->data_state && cconfig->data_state_size) {
+    const model_file_section_t *section = index[MODEL_SECTION_DATA];
+    REQUIRE(section && section->size == cconfig->data_state_size, goto error);
+    data = model_read_section(stream, section);
+    REQUIRE(data, goto error);
+  }
+
+  // Values are read straight into the layers' storage.
+  REQUIRE(model_seek(stream, params->offset), goto error);
+  REQUIRE(
+      model_stream_values(m, m->arena.params, MODEL_SECTION_PARAMS, 0, model_read_run, stream),
+      goto error
+  );
+  if (state) {
+    REQUIRE(model_seek(stream, state->offset), goto error);
+    const size_t moments = dense_layer_state_count(m->config.optimizer_method, 1);
+    for (size_t k = 0; k < moments; ++k) {
+      REQUIRE(
+          model_stream_values(m, m->arena.state, MODEL_SECTION_STATE, k, model_read_run, stream),
+          goto error
+      );
+    }
+  }
+  if (mask) {
+    REQUIRE(model_seek(stream, mask->offset), goto error);
+    REQUIRE(
+        model_stream_values(m, m->arena.mask, MODEL_SECTION_MASK, 0, model_read_run, stream),
+        goto error
+    );
+  }
+  if (data) {
+    memcpy(cconfig->data_state, data, cconfig->data_state_size);
   }
 
+  const size_t replicas = m->replicas ? m->config.worker_count - 1 : 0;
+  for (size_t i = 0; i < depth; ++i) {
+    dense_layer_densify(m->layers[i]);  // Sparse forms of the previous weights are stale.
+    m->layers[i]->step_count = training->step_counts[i];
+    for (size_t r = 0; r < replicas; ++r) {
+      m->replicas[r * depth + i]->step_count = training->step_counts[i];
+    }
+  }
+  m->state = (model_state_t){
+      .epoch_count = config->epoch_count,
+      .pass_count = config->pass_count,
+      .training_loss = config->training_loss,
+      .update_count = training->update_count,
+      .max_staleness = training->max_staleness,
+      .mean_staleness = training->mean_staleness,
+      .time_to_target = NAN,
+      .loss_scale = training->loss_scale,
+      .skipped_steps = training->skipped_steps,
+      .stable_steps = training->stable_steps,
+      .next_epoch = training->next_epoch,
+      .next_pass = training->next_pass,
+  };
+  free(config);
+  free(records);
+  free(training);
+  free(data);
+  fclose(stream);
+  return true;
+error:
+  free(config);
+  free(records);
+  free(training);
+  free(data);
   if (stream) {
     fclose(stream);
   }
-  return NULL;
+  return false;
+}
+
+/**
+ * Runs the pruning round due at the end of epoch epoch_n, if any. Round r of n prunes
+ * to sparsity * (1 - (1 - (r + 1) / n)^3), pruning fast while the network still has
+ * redundant weights, and slowly as it nears the final sparsity.
+ */
+static bool model_prune_scheduled(model_t *m, size_t epoch_n) {
+  ASSERT(m);
+  const pruning_config_t *pruning = &m->config.pruning;
+  const size_t rounds = max(1, pruning->rounds);
+  const size_t interval = max(1, pruning->interval);
+  if (!m->arena.mask || epoch_n < pruning->first_epoch) {
+    return true;
+  }
+  const size_t elapsed = epoch_n - pruning->first_epoch;
+  if (elapsed % interval || elapsed / interval >= rounds) {
+    return true;
+  }
+  const double remaining = 1 - (double)(elapsed / interval + 1) / rounds;
+  const double sparsity = pruning->sparsity * (1 - remaining * remaining * remaining);
+  return model_prune(m, (tnsr_type_t)sparsity, pruning->neuron_norm);
+}
+
+bool model_prune(model_t *m, tnsr_type_t sparsity, tnsr_type_t neuron_norm) {
+  ASSERT(m && sparsity >= 0 && sparsity <= 1);
+  REQUIRE(!m->arena.mapping, goto error);  // Mapped parameters are read-only.
+  for (size_t i = 0; i < m->config.network_depth; ++i) {
+    REQUIRE(dense_layer_prune_magnitude(m->layers[i], sparsity), goto error);
+  }
+  for (size_t i = 0; neuron_norm > 0 && i + 1 < m->config.network_depth; ++i) {
+    // Outputs of convolution layers are not their filters, nor are inputs of the next one.
+    if (m->config.network[i].conv.filters || m->config.network[i + 1].conv.filters) {
+      continue;
+    }
+    REQUIRE(dense_layer_prune_neurons(m->layers[i], m->layers[i + 1], neuron_norm), goto error);
+  }
+  return true;
+error:
+  return false;
+}
+
+/**
+ * NOTE:
+ * Layers whose stored blocks exceed MODEL_SPARSE_DENSITY of their weights stay dense, as
+ * the block-sparse product would do about as much work with less regular accesses.
+ */
+bool model_sparsify(model_t *m) {
+  ASSERT(m);
+  for (size_t i = 0; i < m->config.network_depth; ++i) {
+    dense_layer_t *layer = m->layers[i];
+    if (m->config.network[i].conv.filters) {
+      continue;  // Convolutions contract their patches with the dense filters.
+    }
+    REQUIRE(dense_layer_sparsify(layer), goto error);
+    const tnsr_bsr_t *weights = layer->sparse_weights;
+    const double stored = (double)tnsr_bsr_blocks(weights) * weights->block[0] * weights->block[1];
+    if (stored > MODEL_SPARSE_DENSITY * layer->fan_in * layer->fan_out) {
+      dense_layer_densify(layer);
+    }
+  }
+  return true;
+error:
+  return false;
 }
 
 bool model_fit(model_t *m) {
   ASSERT(m);
-  REQUIRE(m, goto error);
-  for (size_t i = 0; i < m->config.epochs; ++i) {
-    REQUIRE(model_fit_one_epoch(m, i), goto error);
+  REQUIRE(m, return false);
+  const double start = omp_get_wtime();
+  m->state.time_to_target = NAN;
+  REQUIRE(!m->arena.mapping, goto error);  // Mapped parameters are read-only.
+  const bool accumulating = m->config.accumulation_steps > 1;
+  REQUIRE(!accumulating || m->config.fit_mode != FIT_HOGWILD, goto error);
+  REQUIRE(!accumulating || m->arena.accum_grads, goto error);  // Fixed at creation.
+  const bool mixed = m->config.precision != TNSR_FP32;
+  REQUIRE(!mixed || m->config.fit_mode != FIT_HOGWILD, goto error);
+  if (!mixed) {
+    m->state.loss_scale = 1;
+  } else if (m->state.loss_scale <= 1) {
+    m->state.loss_scale = MODEL_LOSS_SCALE_INIT;  // Unless resuming a previous fit.
+  }
+  dist_transport_t *transport = m->config.transport;
+  if (transport) {
+    // Every process starts from rank 0's weights.
+    REQUIRE(m->config.fit_mode != FIT_HOGWILD, goto error);
+    REQUIRE(dist_broadcast(transport, m->arena.params, m->arena.param_count, 0), goto error);
+  }
+  for (size_t i = 0; i < m->config.network_depth; ++i) {
+    // Sparse forms go stale, and Hogwild replicas update the weights without dropping them.
+    dense_layer_densify(m->layers[i]);
+  }
+  const checkpoint_config_t *checkpoint = &m->config.checkpoint;
+  if (checkpoint->location && checkpoint->background && !m->checkpointer) {
+    m->checkpointer = model_checkpointer_create(m);
+    REQUIRE(m->checkpointer, goto error);
+  }
+  for (size_t i = m->state.next_epoch; i < m->config.epochs; ++i) {
+    switch (m->config.fit_mode) {
+      case FIT_SYNC:
+        REQUIRE(model_fit_one_epoch(m, i, start), goto error);
+        break;
+      case FIT_HOGWILD:
+        REQUIRE(model_fit_one_epoch_hogwild(m, i, start), goto error);
+        break;
+      case FIT_PIPELINE:
+        REQUIRE(model_fit_one_epoch_pipeline(m, i, start), goto error);
+        break;
+      default:
+        ASSERT(false);  // Unreachable.
+        break;
+    }
+    REQUIRE(model_prune_scheduled(m, i), goto error);
+    m->state.next_epoch = i + 1;
+    m->state.next_pass = 0;
+    REQUIRE(model_checkpoint_scheduled(m, true), goto error);
   }
+  // Waits for the last checkpoint, a fit whose checkpoints were not all written fails.
+  REQUIRE(!m->checkpointer || model_checkpointer_destroy(&m->checkpointer), goto error);
+  m->state.next_epoch = 0;
+  m->state.elapsed_seconds = omp_get_wtime() - start;
   return true;
 error:
+  if (m->checkpointer) {
+    model_checkpointer_destroy(&m->checkpointer);
+  }
+  m->state.elapsed_seconds = omp_get_wtime() - start;
   return false;
 }
 
@@ -386,7 +2878,7 @@ tnsr_t *model_infer(model_t *m, tnsr_t *data) {
   for (size_t j = 0; j < m->config.network_depth; ++j) {
     dense_layer_add_to_graph(&grph, m->layers[j]);
   }
-  grph_size_t raw = model_forward_pass(m, &grph, data);
+  grph_size_t raw = model_forward_pass(m, m->layers, &grph, data);
   REQUIRE(raw, goto error);
   tnsr_t *raw_data = GRPH_NODE_DATA(grph, raw);
   tnsr_t *result = tnsr_emap(NULL, raw_data, tnsr_cpy, NULL);
@@ -399,6 +2891,143 @@ error:
   return NULL;
 }
 
+/**
+ * Preplanned inference of a model. Its graph is built and compiled once for max_batch rows,
+ * smaller batches run on the leading rows of the same buffers.
+ * NOTE:
+ * The graph binds replicas of the model's layers, so that sessions of the same model keep
+ * their node ids apart and never write to the model.
+ */
+struct model_session {
+  const model_t *model;
+  dense_layer_t **layers;  // Replicas of the model's layers.
+  grph_t *graph;
+  grph_plan_t *plan;
+  tnsr_t *input;       // The graph's input, max_batch rows.
+  grph_size_t output;  // Node of the network's output.
+  tnsr_t **batch_tensors;  // Values of the nodes holding a row per sample of the batch.
+  size_t batch_tensor_count;
+  tnsr_size_t max_batch;
+  tnsr_size_t rows;  // Rows the batch tensors currently span.
+};
+
+model_session_t *model_session_create(const model_t *m, tnsr_size_t max_batch) {
+  ASSERT(m);
+  REQUIRE(max_batch, return NULL);
+  model_session_t *s = calloc(1, sizeof(model_session_t));
+  REQUIRE(s, goto error);
+  s->model = m;
+  s->max_batch = max_batch;
+  s->rows = max_batch;
+  s->layers = calloc(m->config.network_depth, sizeof(dense_layer_t *));
+  s->input = tnsr_create(max_batch, m->config.input_size);
+  s->graph = grph_create_forward(0);
+  REQUIRE(s->layers && s->input && s->graph, goto error);
+  for (size_t j = 0; j < m->config.network_depth; ++j) {
+    s->layers[j] = dense_layer_replicate(m->layers[j], NULL);  // Never bound to gradients.
+    REQUIRE(s->layers[j], goto error);
+    REQUIRE(dense_layer_add_to_graph(&s->graph, s->layers[j]), goto error);
+  }
+  s->output = model_forward_pass(m, s->layers, &s->graph, s->input);
+  REQUIRE(s->output != GRPH_ERR_ID, goto error);
+  s->plan = grph_compile(s->graph, s->output);
+  REQUIRE(s->plan, goto error);
+
+  // Parameters are the only other data nodes.
+  const grph_t *g = s->graph;
+  s->batch_tensors = malloc(sizeof(tnsr_t *[2 * GRPH_NODES(g)]));
+  REQUIRE(s->batch_tensors, goto error);
+  for (grph_size_t i = 0; i < GRPH_NODES(g); ++i) {
+    if (GRPH_NODE_TYPE(g, i) == NDTYPE_DATA && GRPH_NODE_DATA(g, i) != s->input) {
+      continue;
+    }
+    if (GRPH_NODE_DATA(g, i)) {
+      s->batch_tensors[s->batch_tensor_count++] = GRPH_NODE_DATA(g, i);
+    }
+    if (GRPH_NODE_AUX(g, i)) {
+      s->batch_tensors[s->batch_tensor_count++] = GRPH_NODE_AUX(g, i);
+    }
+  }
+  return s;
+error:
+  model_session_destroy(&s);
+  return NULL;
+}
+
+void model_session_destroy(model_session_t **s) {
+  if (!s || !*s) {
+    return;
+  }
+  model_session_t *session = *s;
+  grph_plan_destroy(&session->plan);
+  grph_destroy(&session->graph);
+  for (size_t j = 0; session->layers && j < session->model->config.network_depth; ++j) {
+    dense_layer_destroy(&session->layers[j]);
+  }
+  free(session->layers);
+  tnsr_destroy(&session->input);
+  free(session->batch_tensors);
+  free(session);
+  *s = NULL;
+}
+
+/**
+ * NOTE:
+ * Rows of the batch tensors are contiguous, so narrowing their shape leaves the leading
+ * rows where they are. Their strides, and their buffers, never change.
+ */
+bool model_session_infer(model_session_t *s, const tnsr_t *input, tnsr_t *output) {
+  ASSERT(s && input && output);
+  const model_config_t *config = &s->model->config;
+  const tnsr_size_t rows = TNSR_SHPE(input, 0);
+  REQUIRE(rows && rows <= s->max_batch, return false);
+  REQUIRE(TNSR_SHPE(input, 1) == config->input_size, return false);
+  REQUIRE(TNSR_SHPE(output, 0) == rows, return false);
+  REQUIRE(TNSR_SHPE(output, 1) == config->output_size, return false);
+  if (rows != s->rows) {
+    for (size_t k = 0; k < s->batch_tensor_count; ++k) {
+      TNSR_SHPE(s->batch_tensors[k], 0) = rows;
+    }
+    s->rows = rows;
+  }
+  for (tnsr_size_t i = 0; i < rows; ++i) {
+    for (tnsr_size_t j = 0; j < config->input_size; ++j) {
+      TNSR_DATA(s->input, i, j) = TNSR_DATA(input, i, j);
+    }
+  }
+  REQUIRE(grph_run(s->graph, s->plan), return false);
+  const tnsr_t *result = GRPH_NODE_DATA(s->graph, s->output);
+  for (tnsr_size_t i = 0; i < rows; ++i) {
+    for (tnsr_size_t j = 0; j < config->output_size; ++j) {
+      TNSR_DATA(output, i, j) = TNSR_DATA(result, i, j);
+    }
+  }
+  return true;
+}
+
+// Squared L2 norms of a gradient and parameter slice, and the gradient's non-zero count.
+static void model_slice_stats(
+    const tnsr_type_t *restrict grads,
+    const tnsr_type_t *restrict params,
+    tnsr_size_t n,
+    tnsr_type_t *gsquared_sum,
+    tnsr_type_t *psquared_sum,
+    tnsr_type_t *gnonzero
+) {
+  tnsr_type_t gsum = 0.0f;
+  tnsr_type_t psum = 0.0f;
+  tnsr_type_t nonzero = 0.0f;
+#pragma omp simd reduction(+ : gsum, psum, nonzero)
+  for (tnsr_size_t i = 0; i < n; ++i) {
+    gsum += grads[i] * grads[i];
+    psum += params[i] * params[i];
+    nonzero += fabsf(grads[i]) > 1e-8f;
+  }
+  *gsquared_sum = gsum;
+  *psquared_sum = psum;
+  *gnonzero = nonzero;
+}
+
 /// NOTE: Needs refactoring to smaller helper functions.
 void model_generic_dashboard(
     const grph_t *graph,
@@ -423,6 +3052,7 @@ void model_generic_dashboard(
     }
     initialized = true;
   }
+  (void)graph;
   (void)input;
   (void)output;
   (void)expected;
@@ -431,6 +3061,10 @@ void model_generic_dashboard(
   printf("PASS COUNT: %6llu\n", model->state.pass_count);
   printf("LOSS: %+11.2f%% \n", model->state.training_loss * 100.0f);
   printf("ACCURACY: %+7.2f%% \n", (1.0f - model->state.training_loss) * 100.0f);
+  if (model->config.fit_mode == FIT_HOGWILD) {
+    const model_state_t *state = &model->state;
+    printf("STALENESS: %5.2f (MAX %zu)\n", state->mean_staleness, state->max_staleness);
+  }
 
   bool nmax = loss_boundary == max_loss_i;
   bool nmin = loss_boundary == min_loss_i;
@@ -498,33 +3132,36 @@ void model_generic_dashboard(
   printf("   +-----------------+------------------+-------------------+----------+\n");
   for (size_t i = 0; i < model->config.network_depth; ++i) {
     dense_layer_t *layer = model->layers[i];
-    tnsr_t *wgrad = GRPH_NODE_GRAD(graph, layer->weights_id);
-    tnsr_t *bgrad = GRPH_NODE_GRAD(graph, layer->biases_id);
-    tnsr_t *wlayer = GRPH_NODE_DATA(graph, layer->weights_id);
-    tnsr_t *blayer = GRPH_NODE_DATA(graph, layer->biases_id);
-
+    const tnsr_size_t wsize = layer->fan_in * layer->fan_out;
+    const tnsr_size_t bsize = layer->fan_out;
     tnsr_type_t gwsquared_sum = 0.0f;
     tnsr_type_t gwsparsity = 0.0f;
     tnsr_type_t wsquared_sum = 0.0f;
-    for (grph_size_t j = 0; j < TNSR_SHPE(wgrad, 0); ++j) {
-      for (grph_size_t k = 0; k < TNSR_SHPE(wgrad, 1); ++k) {
-        gwsquared_sum += TNSR_DATA(wgrad, j, k) * TNSR_DATA(wgrad, j, k);
-        gwsparsity += fabsf(TNSR_DATA(wgrad, j, k)) > 1e-8f;
-        wsquared_sum += TNSR_DATA(wlayer, j, k) * TNSR_DATA(wlayer, j, k);
-      }
-    }
     tnsr_type_t gbsquared_sum = 0.0f;
     tnsr_type_t gbsparsity = 0.0f;
     tnsr_type_t bsquared_sum = 0.0f;
-    for (grph_size_t j = 0; j < TNSR_SHPE(bgrad, 0); ++j) {
-      for (grph_size_t k = 0; k < TNSR_SHPE(bgrad, 1); ++k) {
-        gbsquared_sum += TNSR_DATA(bgrad, j, k) * TNSR_DATA(bgrad, j, k);
-        gbsparsity += fabsf(TNSR_DATA(bgrad, j, k)) > 1e-8f;
-        bsquared_sum += TNSR_DATA(blayer, j, k) * TNSR_DATA(blayer, j, k);
-      }
+    for (size_t s = 0; s < layer->shard_count; ++s) {
+      const dense_layer_shard_t *shard = &layer->shards[s];
+      const tnsr_size_t swsize = TNSR_SIZE(shard->weights);
+      const tnsr_size_t sbsize = TNSR_SIZE(shard->biases);
+      const tnsr_type_t *wgrad = layer->grads + shard->offset;
+      const tnsr_type_t *bgrad = wgrad + swsize;
+      const tnsr_type_t *wlayer = layer->params + shard->offset;
+      const tnsr_type_t *blayer = wlayer + swsize;
+      tnsr_type_t gsquared = 0.0f;
+      tnsr_type_t squared = 0.0f;
+      tnsr_type_t nonzero = 0.0f;
+      model_slice_stats(wgrad, wlayer, swsize, &gsquared, &squared, &nonzero);
+      gwsquared_sum += gsquared;
+      wsquared_sum += squared;
+      gwsparsity += nonzero;
+      model_slice_stats(bgrad, blayer, sbsize, &gsquared, &squared, &nonzero);
+      gbsquared_sum += gsquared;
+      bsquared_sum += squared;
+      gbsparsity += nonzero;
     }
-    gwsparsity /= TNSR_SHPE(wgrad, 0) * TNSR_SHPE(wgrad, 1);
-    gbsparsity /= TNSR_SHPE(bgrad, 0) * TNSR_SHPE(bgrad, 1);
+    gwsparsity /= wsize;
+    gbsparsity /= bsize;
     gwsparsity *= 100;
     gbsparsity *= 100;
     gwsparsity = 100 - gwsparsity;
@@ -555,9 +3192,9 @@ void model_generic_dashboard(
         break;
     }
     printf(
-        "   | #L%llu-N%04u-%-5s | %-16.4e | %-17.4e | %-7.2f%% |\n",
+        "   | #L%llu-N%04llu-%-5s | %-16.4e | %-17.4e | %-7.2f%% |\n",
         i,
-        TNSR_SHPE(blayer, 1),
+        (unsigned long long)layer->fan_out,
         fid,
         gmeanl2norm,
         pmeanl2norm,
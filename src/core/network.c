@@ -5,99 +5,190 @@
  * Implementation for network.h
  */
 
+#include <string.h>
+
 #include "core/network.h"
 #include "core/graph.h"
 #include "core/node.h"  // IWYU pragma: export
 #include "core/tensor.h"
 #include "core/tensor_functions.h"
+#include "core/thread_pool.h"
 #include "utils/utils.h"
 
-typedef struct {
-  tnsr_t *moment_w;
-  tnsr_t *moment_b;
-} momentum_data_t;
+tnsr_size_t dense_layer_param_count(tnsr_size_t fan_in, tnsr_size_t fan_out) {
+  return fan_in * fan_out + fan_out;
+}
 
-typedef struct {
-  tnsr_t *moment_w;
-  tnsr_t *moment_b;
-} rms_prop_data_t;
+tnsr_size_t dense_layer_state_count(optimizer_t optimizer, tnsr_size_t param_count) {
+  switch (optimizer) {
+    case OPT_SGD:
+      return 0;  // Stateless.
+    case OPT_SGD_MOMENTUM:
+    case OPT_SGD_RMS_PROP:
+    case OPT_LARS:
+      return param_count;  // One moment.
+    case OPT_SGD_ADAM:
+    case OPT_LAMB:
+      return 2 * param_count;  // First and second moments.
+    default:
+      ASSERT(false);  // Unreachable.
+      return 0;
+  }
+}
 
-typedef struct {
-  tnsr_t *moment1_w;
-  tnsr_t *moment1_b;
-  tnsr_t *moment2_w;
-  tnsr_t *moment2_b;
-  tnsr_type_t timestamp;
-} adam_data_t;
+// Output columns of shard s. The first fan_out % shard_count shards take one extra column.
+static tnsr_size_t dense_layer_shard_columns(tnsr_size_t fan_out, size_t shard_count, size_t s) {
+  return fan_out / shard_count + (s < fan_out % shard_count);
+}
+
+// Releases the views of every shard.
+static void dense_layer_release_shards(dense_layer_t *dl) {
+  ASSERT(dl);
+  for (size_t s = 0; s < dl->shard_count; ++s) {
+    dense_layer_shard_t *shard = &dl->shards[s];
+    tnsr_destroy(&shard->weights);
+    tnsr_destroy(&shard->biases);
+    tnsr_destroy(&shard->weights_grad);
+    tnsr_destroy(&shard->biases_grad);
+  }
+}
+
+// Creates the views of every shard over the layer's parameters and the given gradients,
+// if any.
+static bool dense_layer_bind_shards(dense_layer_t *dl, tnsr_type_t *grads) {
+  ASSERT(dl);
+  tnsr_size_t offset = 0;
+  for (size_t s = 0; s < dl->shard_count; ++s) {
+    dense_layer_shard_t *shard = &dl->shards[s];
+    const tnsr_size_t columns = dense_layer_shard_columns(dl->fan_out, dl->shard_count, s);
+    const tnsr_size_t wsize = dl->fan_in * columns;
+    shard->offset = offset;
+    shard->count = dense_layer_param_count(dl->fan_in, columns);
+    shard->weights = tnsr_view(dl->params + offset, dl->fan_in, columns);
+    shard->biases = tnsr_view(dl->params + offset + wsize, 1, columns);
+    shard->weights_id = GRPH_NO_INPUT_ID;
+    shard->biases_id = GRPH_NO_INPUT_ID;
+    REQUIRE(shard->weights && shard->biases, goto error);
+    if (grads) {
+      shard->weights_grad = tnsr_view(grads + offset, dl->fan_in, columns);
+      shard->biases_grad = tnsr_view(grads + offset + wsize, 1, columns);
+      REQUIRE(shard->weights_grad && shard->biases_grad, goto error);
+    }
+    offset += shard->count;
+  }
+  ASSERT(offset == dl->param_count);
+  return true;
+error:
+  return false;
+}
 
 dense_layer_t *dense_layer_create(
-    grph_size_t fan_in,
-    grph_size_t fan_out,
+    tnsr_size_t fan_in,
+    tnsr_size_t fan_out,
     initialization_t init,
     node_type_t function,
     optimizer_t optimizer,
-    tnsr_type_t learning_rate
+    tnsr_type_t learning_rate,
+    size_t shard_count,
+    dense_layer_storage_t storage
 ) {
-  dense_layer_t *layer = malloc(sizeof(dense_layer_t));
-  layer->weights = TNSR_MATRIX(fan_in, fan_out);  // X(b,f) * W(f,o) -> b,o
-  layer->biases = TNSR_ROWVEC(fan_out);           // B(1, o)
-  REQUIRE(layer->weights && layer->biases, goto error);
+  ASSERT(storage.params);
+  ASSERT(storage.state || !dense_layer_state_count(optimizer, 1));
+  shard_count = max(1, shard_count);
+  REQUIRE(shard_count <= fan_out, return NULL);
+  dense_layer_t *layer =
+      calloc(1, sizeof(dense_layer_t) + sizeof(dense_layer_shard_t[shard_count]));
+  REQUIRE(layer, goto error);
+
+  // Shard s holds X(b,f) * W_s(f,o_s) -> b,o_s, followed by B_s(1,o_s).
+  layer->params = storage.params;
+  layer->grads = storage.grads;
+  layer->state = storage.state;
+  layer->mask = storage.mask;
+  layer->param_count = dense_layer_param_count(fan_in, fan_out);
+  layer->fan_in = fan_in;
+  layer->fan_out = fan_out;
+  layer->shard_count = shard_count;
+  REQUIRE(dense_layer_bind_shards(layer, storage.grads), goto error);
 
   layer->function_type = function;
-  layer->weights_id = GRPH_NO_INPUT_ID;
-  layer->biases_id = GRPH_NO_INPUT_ID;
   layer->learning_rate = learning_rate;
+  layer->step_count = 0;
 
-  tnsr_size_t size[TNSR_MAX_RANK] = {fan_in, fan_out};
   switch (optimizer) {
     case OPT_SGD:
       layer->optimizer = dense_layer_sgd;
-      layer->opt_dtor = dense_layer_sgd_dtor;
-      REQUIRE(dense_layer_sgd_create(size, &layer->optimizer_data), goto error);
       break;
     case OPT_SGD_MOMENTUM:
       layer->optimizer = dense_layer_sgd_momentum;
-      layer->opt_dtor = dense_layer_sgd_momentum_dtor;
-      REQUIRE(dense_layer_sgd_momentum_create(size, &layer->optimizer_data), goto error);
       break;
     case OPT_SGD_RMS_PROP:
       layer->optimizer = dense_layer_sgd_rms_prop;
-      layer->opt_dtor = dense_layer_sgd_rms_prop_dtor;
-      REQUIRE(dense_layer_sgd_rms_prop_create(size, &layer->optimizer_data), goto error);
       break;
     case OPT_SGD_ADAM:
       layer->optimizer = dense_layer_sgd_adam;
-      layer->opt_dtor = dense_layer_sgd_adam_dtor;
-      REQUIRE(dense_layer_sgd_adam_create(size, &layer->optimizer_data), goto error);
+      break;
+    case OPT_LARS:
+      layer->optimizer = dense_layer_lars;
+      break;
+    case OPT_LAMB:
+      layer->optimizer = dense_layer_lamb;
       break;
     default:
       ASSERT(false);  // Unreachable.
       break;
   }
 
-  switch (init) {
-    case INIT_HE:
-      he_ctx_t he_ctx = (he_ctx_t){fan_in};
-      REQUIRE(tnsr_emap(layer->weights, layer->weights, tnsr_he, &he_ctx), goto error);
-      REQUIRE(tnsr_emap(layer->biases, layer->biases, tnsr_he, &he_ctx), goto error);
-      break;
-    case INIT_GLOROT:
-      glorot_ctx_t glorot_ctx = (glorot_ctx_t){fan_in, fan_out};
-      REQUIRE(tnsr_emap(layer->weights, layer->weights, tnsr_glorot, &glorot_ctx), goto error);
-      REQUIRE(tnsr_emap(layer->biases, layer->biases, tnsr_glorot, &glorot_ctx), goto error);
-      break;
-    case INIT_RANDOM_UNIFORM:
-      gen_ctx_t rand_ctx = {0};  // No offset.
-      REQUIRE(tnsr_emap(layer->weights, layer->weights, tnsr_rand_uniform, &rand_ctx), goto error);
-      REQUIRE(tnsr_emap(layer->biases, layer->biases, tnsr_rand_uniform, &rand_ctx), goto error);
-      break;
+  for (size_t s = 0; s < shard_count; ++s) {
+    tnsr_t *weights = layer->shards[s].weights;
+    tnsr_t *biases = layer->shards[s].biases;
+    switch (init) {
+      case INIT_HE:
+        he_ctx_t he_ctx = (he_ctx_t){fan_in};
+        REQUIRE(tnsr_emap(weights, weights, tnsr_he, &he_ctx), goto error);
+        REQUIRE(tnsr_emap(biases, biases, tnsr_he, &he_ctx), goto error);
+        break;
+      case INIT_GLOROT:
+        glorot_ctx_t glorot_ctx = (glorot_ctx_t){fan_in, fan_out};
+        REQUIRE(tnsr_emap(weights, weights, tnsr_glorot, &glorot_ctx), goto error);
+        REQUIRE(tnsr_emap(biases, biases, tnsr_glorot, &glorot_ctx), goto error);
+        break;
+      case INIT_RANDOM_UNIFORM:
+        gen_ctx_t rand_ctx = {0};  // No offset.
+        REQUIRE(tnsr_emap(weights, weights, tnsr_rand_uniform, &rand_ctx), goto error);
+        REQUIRE(tnsr_emap(biases, biases, tnsr_rand_uniform, &rand_ctx), goto error);
+        break;
+      case INIT_NONE:
+        break;
+    }
   }
 
   return layer;
 error:
   if (layer) {
-    tnsr_destroy(&layer->weights);
-    tnsr_destroy(&layer->biases);
+    dense_layer_release_shards(layer);
+  }
+  free(layer);
+  return NULL;
+}
+
+dense_layer_t *dense_layer_replicate(const dense_layer_t *dl, tnsr_type_t *grads) {
+  ASSERT(dl);
+  const size_t size = sizeof(dense_layer_t) + sizeof(dense_layer_shard_t[dl->shard_count]);
+  dense_layer_t *layer = malloc(size);
+  REQUIRE(layer, goto error);
+  memcpy(layer, dl, size);
+  layer->grads = grads;
+  layer->sparse_weights = NULL;  // Owned by dl.
+  layer->sparse_biases = NULL;
+  for (size_t s = 0; s < layer->shard_count; ++s) {
+    layer->shards[s] = (dense_layer_shard_t){0};
+  }
+  REQUIRE(dense_layer_bind_shards(layer, grads), goto error);
+  return layer;
+error:
+  if (layer) {
+    dense_layer_release_shards(layer);
   }
   free(layer);
   return NULL;
@@ -105,19 +196,67 @@ error:
 
 void dense_layer_destroy(dense_layer_t **dl) {
   REQUIRE(dl && *dl, return);
-  (*dl)->opt_dtor(&(*dl)->optimizer_data);
-  tnsr_destroy(&(*dl)->weights);
-  tnsr_destroy(&(*dl)->biases);
+  dense_layer_densify(*dl);
+  dense_layer_release_shards(*dl);
   free(*dl);
   *dl = NULL;
 }
 
+void dense_layer_export(const dense_layer_t *dl, tnsr_type_t *dst) {
+  ASSERT(dl && dst);
+  tnsr_type_t *biases = dst + dl->fan_in * dl->fan_out;
+  tnsr_size_t column = 0;
+  for (size_t s = 0; s < dl->shard_count; ++s) {
+    const tnsr_t *weights = dl->shards[s].weights;
+    const tnsr_size_t columns = TNSR_SHPE(weights, 1);
+    for (tnsr_size_t i = 0; i < dl->fan_in; ++i) {
+      memcpy(
+          dst + i * dl->fan_out + column,
+          &TNSR_DATA(weights, i, 0),
+          sizeof(tnsr_type_t[columns])
+      );
+    }
+    memcpy(biases + column, dl->shards[s].biases->data, sizeof(tnsr_type_t[columns]));
+    column += columns;
+  }
+}
+
+bool dense_layer_stream(
+    const dense_layer_t *dl,
+    tnsr_type_t *values,
+    bool (*visit)(tnsr_type_t *run, tnsr_size_t count, void *ctx),
+    void *ctx
+) {
+  ASSERT(dl && values && visit);
+  if (dl->shard_count == 1) {
+    return visit(values, dl->param_count, ctx);  // Already in the unsharded layout.
+  }
+  // Each row of the weights is spread over the shards' blocks, as are the biases.
+  for (tnsr_size_t i = 0; i < dl->fan_in; ++i) {
+    for (size_t s = 0; s < dl->shard_count; ++s) {
+      const dense_layer_shard_t *shard = &dl->shards[s];
+      const tnsr_size_t columns = TNSR_SHPE(shard->weights, 1);
+      REQUIRE(visit(values + shard->offset + i * columns, columns, ctx), goto error);
+    }
+  }
+  for (size_t s = 0; s < dl->shard_count; ++s) {
+    const dense_layer_shard_t *shard = &dl->shards[s];
+    const tnsr_size_t columns = TNSR_SHPE(shard->weights, 1);
+    REQUIRE(visit(values + shard->offset + dl->fan_in * columns, columns, ctx), goto error);
+  }
+  return true;
+error:
+  return false;
+}
+
 bool dense_layer_add_to_graph(grph_t **g, dense_layer_t *dl) {
   ASSERT(g && *g && dl);
-  // ASSERT(dl->weights_id == GRPH_NO_INPUT_ID && dl->biases_id == GRPH_NO_INPUT_ID);
-  dl->weights_id = grph_append_data(g, dl->weights);
-  dl->biases_id = grph_append_data(g, dl->biases);
-  REQUIRE(dl->weights_id != GRPH_ERR_ID && dl->biases_id != GRPH_ERR_ID, goto error);
+  for (size_t s = 0; s < dl->shard_count; ++s) {
+    dense_layer_shard_t *shard = &dl->shards[s];
+    shard->weights_id = grph_append_param(g, shard->weights, shard->weights_grad);
+    shard->biases_id = grph_append_param(g, shard->biases, shard->biases_grad);
+    REQUIRE(shard->weights_id != GRPH_ERR_ID && shard->biases_id != GRPH_ERR_ID, goto error);
+  }
   return true;
 error:
   return false;
@@ -125,18 +264,37 @@ error:
 
 void dense_layer_remove_from_graph(dense_layer_t *dl) {
   ASSERT(dl);
-  dl->weights_id = GRPH_NO_INPUT_ID;
-  dl->biases_id = GRPH_NO_INPUT_ID;
+  for (size_t s = 0; s < dl->shard_count; ++s) {
+    dl->shards[s].weights_id = GRPH_NO_INPUT_ID;
+    dl->shards[s].biases_id = GRPH_NO_INPUT_ID;
+  }
 }
 
-grph_size_t dense_layer_passthrough(grph_t **g, dense_layer_t *dl, grph_size_t input) {
-  ASSERT(g && *g && dl && input != GRPH_NO_INPUT_ID);
-  ASSERT(dl->weights_id != GRPH_NO_INPUT_ID && dl->biases_id != GRPH_NO_INPUT_ID);
-
-  grph_size_t nd = grph_execute(g, input, dl->weights_id, NDTYPE_CONTRACT);
-  REQUIRE(nd != GRPH_ERR_ID, goto error);
-  nd = grph_execute(g, nd, dl->biases_id, NDTYPE_EADD);
+// Evaluates X * W + B through the layer's block-sparse form, into a data node owned by the graph.
+static grph_size_t dense_layer_sparse_affine(grph_t **g, dense_layer_t *dl, grph_size_t input) {
+  ASSERT(g && *g && dl && dl->sparse_weights && dl->sparse_biases);
+  const tnsr_t *x = GRPH_NODE_DATA(*g, input);
+  tnsr_t *out = tnsr_create(TNSR_SHPE(x, 0), dl->fan_out);
+  REQUIRE(out, goto error);
+  REQUIRE(tnsr_eadd(out, out, dl->sparse_biases), goto error);
+  REQUIRE(tnsr_contract_bsr(out, x, dl->sparse_weights), goto error);
+  const grph_size_t nd = grph_append_data(g, out);
   REQUIRE(nd != GRPH_ERR_ID, goto error);
+  GRPH_NODE_TRANSIENT(*g, nd) = true;  // Released along with the graph.
+  return nd;
+error:
+  tnsr_destroy(&out);
+  return GRPH_ERR_ID;
+}
+
+/**
+ * Sharded layers evaluate every shard's product in a single node, each shard writing its
+ * own columns of the output. Softmax is folded into that node, and normalized from
+ * per-shard row maxima and sums rather than the gathered output.
+ * Sparsified layers evaluate their block-sparse form instead, in eager graphs only.
+ */
+// Applies the layer's activation function on node nd.
+static grph_size_t dense_layer_activate(grph_t **g, const dense_layer_t *dl, grph_size_t nd) {
   switch (dl->function_type) {
     case NDTYPE_ELEAKYRELU:
     case NDTYPE_ERELU:
@@ -144,7 +302,7 @@ grph_size_t dense_layer_passthrough(grph_t **g, dense_layer_t *dl, grph_size_t i
     case NDTYPE_ETANH:
     case NDTYPE_SOFTMAX:
       nd = grph_execute(g, nd, GRPH_NO_INPUT_ID, dl->function_type);
-      REQUIRE(nd, goto error);
+      REQUIRE(nd != GRPH_ERR_ID, goto error);
       break;
     default:
       ASSERT(false);  // Unreachable.
@@ -154,249 +312,902 @@ error:
   return GRPH_ERR_ID;
 }
 
-bool dense_layer_update(grph_t **g, dense_layer_t *dl) {
-  ASSERT(g && *g && dl);
-  ASSERT(dl->weights_id != GRPH_NO_INPUT_ID && dl->biases_id != GRPH_NO_INPUT_ID);
-  REQUIRE(dl->optimizer(g, dl), goto error);
-  return true;
+grph_size_t dense_layer_passthrough(grph_t **g, dense_layer_t *dl, grph_size_t input) {
+  ASSERT(g && *g && dl && input != GRPH_NO_INPUT_ID);
+  ASSERT(dl->shards[0].weights_id != GRPH_NO_INPUT_ID);
+
+  grph_size_t nd = GRPH_ERR_ID;
+  if (dl->sparse_weights && (*g)->mode == GRPH_MODE_EAGER) {
+    nd = dense_layer_sparse_affine(g, dl, input);
+  } else if (dl->shard_count == 1) {
+    nd = grph_execute(g, input, dl->shards[0].weights_id, NDTYPE_CONTRACT);
+    REQUIRE(nd != GRPH_ERR_ID, goto error);
+    nd = grph_execute(g, nd, dl->shards[0].biases_id, NDTYPE_EADD);
+  } else {
+    const grph_size_t ndeps = 1 + 2 * dl->shard_count;
+    grph_size_t *deps = malloc(sizeof(grph_size_t[ndeps]));
+    REQUIRE(deps, goto error);
+    deps[0] = input;
+    for (size_t s = 0; s < dl->shard_count; ++s) {
+      deps[1 + 2 * s] = dl->shards[s].weights_id;
+      deps[2 + 2 * s] = dl->shards[s].biases_id;
+    }
+    const bool softmax = dl->function_type == NDTYPE_SOFTMAX;
+    const node_type_t type = softmax ? NDTYPE_SHARDED_SOFTMAX : NDTYPE_SHARDED_AFFINE;
+    nd = grph_execute_n(g, deps, ndeps, type);
+    free(deps);
+    REQUIRE(nd != GRPH_ERR_ID, goto error);
+    if (softmax) {
+      return nd;
+    }
+  }
+  REQUIRE(nd != GRPH_ERR_ID, goto error);
+  return dense_layer_activate(g, dl, nd);
 error:
-  return false;
+  return GRPH_ERR_ID;
 }
 
-bool dense_layer_sgd_create(tnsr_size_t tnsr_shape[TNSR_MAX_RANK], void **dataptr) {
-  ASSERT(dataptr);
-  (void)tnsr_shape;
-  *dataptr = NULL;  // Stateless.
-  return true;
+tnsr_size_t conv_layer_param_count(const grph_conv_t *geometry) {
+  ASSERT(geometry);
+  const tnsr_size_t kernel = geometry->kernel_height * geometry->kernel_width;
+  return dense_layer_param_count(kernel * geometry->channels, geometry->filters);
 }
 
-bool dense_layer_sgd_momentum_create(tnsr_size_t tnsr_shape[TNSR_MAX_RANK], void **dataptr) {
-  ASSERT(dataptr);
-  momentum_data_t *data = NULL;
-  REQUIRE(*dataptr = malloc(sizeof(momentum_data_t)), goto error);
-  data = *dataptr;
-  REQUIRE(data->moment_w = tnsr_create(tnsr_shape[0], tnsr_shape[1]), goto error);
-  REQUIRE(data->moment_b = tnsr_create(1, tnsr_shape[1]), goto error);
-  return true;
+conv_layer_t *conv_layer_create(
+    const grph_conv_t *geometry,
+    initialization_t init,
+    node_type_t function,
+    optimizer_t optimizer,
+    tnsr_type_t learning_rate,
+    dense_layer_storage_t storage
+) {
+  ASSERT(geometry);
+  tnsr_size_t height = 0;
+  tnsr_size_t width = 0;
+  REQUIRE(grph_conv_output(geometry, &height, &width), return NULL);
+  conv_layer_t *layer = calloc(1, sizeof(conv_layer_t));
+  REQUIRE(layer, goto error);
+  layer->geometry = geometry;
+  const tnsr_size_t kernel = geometry->kernel_height * geometry->kernel_width;
+  layer->filters = dense_layer_create(
+      kernel * geometry->channels,
+      geometry->filters,
+      init,
+      function,
+      optimizer,
+      learning_rate,
+      1,
+      storage
+  );
+  REQUIRE(layer->filters, goto error);
+  return layer;
 error:
-  return false;
+  free(layer);
+  return NULL;
 }
 
-bool dense_layer_sgd_rms_prop_create(tnsr_size_t tnsr_shape[TNSR_MAX_RANK], void **dataptr) {
-  ASSERT(dataptr);
-  rms_prop_data_t *data = NULL;
-  REQUIRE(*dataptr = malloc(sizeof(rms_prop_data_t)), goto error);
-  data = *dataptr;
-  REQUIRE(data->moment_w = tnsr_create(tnsr_shape[0], tnsr_shape[1]), goto error);
-  REQUIRE(data->moment_b = tnsr_create(1, tnsr_shape[1]), goto error);
+void conv_layer_destroy(conv_layer_t **cl) {
+  REQUIRE(cl && *cl, return);
+  dense_layer_destroy(&(*cl)->filters);
+  free(*cl);
+  *cl = NULL;
+}
+
+bool conv_layer_add_to_graph(grph_t **g, conv_layer_t *cl) {
+  ASSERT(cl);
+  return dense_layer_add_to_graph(g, cl->filters);
+}
+
+void conv_layer_remove_from_graph(conv_layer_t *cl) {
+  ASSERT(cl);
+  dense_layer_remove_from_graph(cl->filters);
+}
+
+grph_size_t conv_layer_passthrough(grph_t **g, conv_layer_t *cl, grph_size_t input) {
+  ASSERT(g && *g && cl && input != GRPH_NO_INPUT_ID);
+  const dense_layer_t *dl = cl->filters;
+  ASSERT(dl->shard_count == 1 && dl->shards[0].weights_id != GRPH_NO_INPUT_ID);
+  const grph_size_t deps[] = {input, dl->shards[0].weights_id, dl->shards[0].biases_id};
+  grph_size_t nd = grph_execute_attr(g, deps, 3, NDTYPE_CONV, cl->geometry);
+  REQUIRE(nd != GRPH_ERR_ID, goto error);
+  return dense_layer_activate(g, dl, nd);
+error:
+  return GRPH_ERR_ID;
+}
+
+bool conv_layer_update(conv_layer_t *cl) {
+  ASSERT(cl);
+  return dense_layer_update(cl->filters);
+}
+
+embedding_layer_t *embedding_layer_create(
+    tnsr_size_t vocabulary,
+    tnsr_size_t width,
+    initialization_t init,
+    node_type_t function,
+    optimizer_t optimizer,
+    tnsr_type_t learning_rate,
+    dense_layer_storage_t storage
+) {
+  embedding_layer_t *layer = calloc(1, sizeof(embedding_layer_t));
+  REQUIRE(layer, goto error);
+  grph_embed_t *embed = &layer->embed;
+  embed->slots = malloc(sizeof(tnsr_size_t[vocabulary]));
+  embed->grads = calloc(width, sizeof(tnsr_type_t));  // Of the biases, rows are added later.
+  REQUIRE(embed->slots && embed->grads, goto error);
+  for (tnsr_size_t i = 0; i < vocabulary; ++i) {
+    embed->slots[i] = GRPH_EMBED_UNLISTED;
+  }
+  storage.grads = NULL;  // Kept sparse by embed.
+  layer->table =
+      dense_layer_create(vocabulary, width, init, function, optimizer, learning_rate, 1, storage);
+  REQUIRE(layer->table, goto error);
+  embed->table = layer->table->shards[0].weights;
+  embed->biases = layer->table->shards[0].biases;
+  omp_init_lock(&embed->lock);
+  return layer;
+error:
+  if (layer) {
+    free(layer->embed.slots);
+    free(layer->embed.grads);
+  }
+  free(layer);
+  return NULL;
+}
+
+void embedding_layer_destroy(embedding_layer_t **el) {
+  REQUIRE(el && *el, return);
+  grph_embed_t *embed = &(*el)->embed;
+  omp_destroy_lock(&embed->lock);
+  free(embed->rows);
+  free(embed->slots);
+  free(embed->grads);
+  dense_layer_destroy(&(*el)->table);
+  free(*el);
+  *el = NULL;
+}
+
+grph_size_t embedding_layer_passthrough(grph_t **g, embedding_layer_t *el, grph_size_t input) {
+  ASSERT(g && *g && el && input != GRPH_NO_INPUT_ID);
+  grph_size_t nd = grph_execute_attr(g, &input, 1, NDTYPE_EMBED, &el->embed);
+  REQUIRE(nd != GRPH_ERR_ID, goto error);
+  return dense_layer_activate(g, el->table, nd);
+error:
+  return GRPH_ERR_ID;
+}
+
+bool embedding_layer_update(embedding_layer_t *el) {
+  ASSERT(el);
+  grph_embed_t *embed = &el->embed;
+  const tnsr_size_t width = el->table->fan_out;
+  REQUIRE(
+      dense_layer_update_rows(el->table, embed->rows, embed->grads, embed->row_count),
+      goto error
+  );
+  for (tnsr_size_t i = 0; i < embed->row_count; ++i) {
+    embed->slots[embed->rows[i]] = GRPH_EMBED_UNLISTED;
+  }
+  embed->row_count = 0;
+  memset(embed->grads, 0, sizeof(tnsr_type_t[width]));
   return true;
 error:
   return false;
 }
 
-bool dense_layer_sgd_adam_create(tnsr_size_t tnsr_shape[TNSR_MAX_RANK], void **dataptr) {
-  ASSERT(dataptr);
-  adam_data_t *data = NULL;
-  REQUIRE(*dataptr = malloc(sizeof(adam_data_t)), goto error);
-  data = *dataptr;
-  REQUIRE(data->moment1_w = tnsr_create(tnsr_shape[0], tnsr_shape[1]), goto error);
-  REQUIRE(data->moment1_b = tnsr_create(1, tnsr_shape[1]), goto error);
-  REQUIRE(data->moment2_w = tnsr_create(tnsr_shape[0], tnsr_shape[1]), goto error);
-  REQUIRE(data->moment2_b = tnsr_create(1, tnsr_shape[1]), goto error);
-  data->timestamp = 0;
+// Block dimensions of the sparse form. Blocks span one input and a vector of outputs, so
+// that pruned neurons of the previous layer drop whole block rows.
+#define DENSE_LAYER_BSR_ROWS 1
+#define DENSE_LAYER_BSR_COLS 4
+
+// Zeroes the parameter at offset, and masks it if the layer is masked.
+static void dense_layer_prune_at(dense_layer_t *dl, tnsr_size_t offset) {
+  dl->params[offset] = 0;
+  if (dl->mask) {
+    dl->mask[offset] = 0;
+  }
+}
+
+static int dense_layer_compare_magnitudes(const void *a, const void *b) {
+  const tnsr_type_t x = *(const tnsr_type_t *)a;
+  const tnsr_type_t y = *(const tnsr_type_t *)b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * NOTE:
+ * Weights tied with the threshold magnitude are pruned in storage order, such that
+ * exactly the requested count is pruned.
+ */
+bool dense_layer_prune_magnitude(dense_layer_t *dl, tnsr_type_t sparsity) {
+  ASSERT(dl && sparsity >= 0 && sparsity <= 1);
+  const tnsr_size_t weights = dl->fan_in * dl->fan_out;
+  const tnsr_size_t count = (tnsr_size_t)(sparsity * weights);
+  if (!count) {
+    return true;
+  }
+  tnsr_type_t *magnitudes = malloc(sizeof(tnsr_type_t[weights]));
+  REQUIRE(magnitudes, goto error);
+  tnsr_size_t n = 0;
+  for (size_t s = 0; s < dl->shard_count; ++s) {
+    const dense_layer_shard_t *shard = &dl->shards[s];
+    for (tnsr_size_t i = 0; i < TNSR_SIZE(shard->weights); ++i) {
+      magnitudes[n++] = fabsf(dl->params[shard->offset + i]);
+    }
+  }
+  qsort(magnitudes, weights, sizeof(tnsr_type_t), dense_layer_compare_magnitudes);
+  const tnsr_type_t threshold = magnitudes[count - 1];
+  tnsr_size_t below = count;
+  while (below && magnitudes[below - 1] == threshold) {
+    --below;
+  }
+  tnsr_size_t ties = count - below;  // Weights at the threshold left to prune.
+  free(magnitudes);
+
+  for (size_t s = 0; s < dl->shard_count; ++s) {
+    const dense_layer_shard_t *shard = &dl->shards[s];
+    for (tnsr_size_t i = 0; i < TNSR_SIZE(shard->weights); ++i) {
+      const tnsr_type_t magnitude = fabsf(dl->params[shard->offset + i]);
+      if (magnitude < threshold || (magnitude == threshold && ties && ties--)) {
+        dense_layer_prune_at(dl, shard->offset + i);
+      }
+    }
+  }
   return true;
 error:
   return false;
 }
 
-bool dense_layer_sgd(grph_t **g, dense_layer_t *dl) {
-  ASSERT(g && *g && dl);
-  tnsr_t *wgrad = GRPH_NODE_GRAD(*g, dl->weights_id);
-  tnsr_t *bgrad = GRPH_NODE_GRAD(*g, dl->biases_id);
-
-  gen_ctx_t ctx = {-dl->learning_rate};
-  REQUIRE(tnsr_emap(wgrad, wgrad, tnsr_mul_n, &ctx), goto error);
-  REQUIRE(tnsr_emap(bgrad, bgrad, tnsr_mul_n, &ctx), goto error);
-  REQUIRE(tnsr_eadd(dl->weights, dl->weights, wgrad), goto error);
-  REQUIRE(tnsr_eadd(dl->biases, dl->biases, bgrad), goto error);
+bool dense_layer_prune_neurons(dense_layer_t *dl, dense_layer_t *next, tnsr_type_t threshold) {
+  ASSERT(dl && next && next->fan_in == dl->fan_out);
+  // Column j of dl lives in its shard s, at local column j - first.
+  size_t s = 0;
+  tnsr_size_t first = 0;
+  for (tnsr_size_t j = 0; j < dl->fan_out; ++j) {
+    if (j - first == TNSR_SHPE(dl->shards[s].weights, 1)) {
+      first += TNSR_SHPE(dl->shards[s++].weights, 1);
+    }
+    // Row j of next's weights, spread over its shards.
+    double norm = 0;
+    for (size_t t = 0; t < next->shard_count; ++t) {
+      const dense_layer_shard_t *shard = &next->shards[t];
+      const tnsr_size_t columns = TNSR_SHPE(shard->weights, 1);
+      for (tnsr_size_t k = 0; k < columns; ++k) {
+        norm += (double)TNSR_DATA(shard->weights, j, k) * TNSR_DATA(shard->weights, j, k);
+      }
+    }
+    if (sqrt(norm) > threshold) {
+      continue;
+    }
+    for (size_t t = 0; t < next->shard_count; ++t) {
+      const dense_layer_shard_t *shard = &next->shards[t];
+      const tnsr_size_t columns = TNSR_SHPE(shard->weights, 1);
+      for (tnsr_size_t k = 0; k < columns; ++k) {
+        dense_layer_prune_at(next, shard->offset + j * columns + k);
+      }
+    }
+    const dense_layer_shard_t *shard = &dl->shards[s];
+    const tnsr_size_t columns = TNSR_SHPE(shard->weights, 1);
+    for (tnsr_size_t i = 0; i < dl->fan_in; ++i) {
+      dense_layer_prune_at(dl, shard->offset + i * columns + j - first);
+    }
+    dense_layer_prune_at(dl, shard->offset + dl->fan_in * columns + j - first);
+  }
+  return true;
+}
+
+bool dense_layer_sparsify(dense_layer_t *dl) {
+  ASSERT(dl);
+  dense_layer_densify(dl);
+  tnsr_t *weights = NULL;
+  tnsr_type_t *params = malloc(sizeof(tnsr_type_t[dl->param_count]));
+  REQUIRE(params, goto error);
+  dense_layer_export(dl, params);
+  weights = tnsr_view(params, dl->fan_in, dl->fan_out);
+  REQUIRE(weights, goto error);
+  dl->sparse_weights = tnsr_bsr_create(weights, DENSE_LAYER_BSR_ROWS, DENSE_LAYER_BSR_COLS);
+  dl->sparse_biases = tnsr_create(1, dl->fan_out);
+  REQUIRE(dl->sparse_weights && dl->sparse_biases, goto error);
+  memcpy(
+      dl->sparse_biases->data,
+      params + dl->fan_in * dl->fan_out,
+      sizeof(tnsr_type_t[dl->fan_out])
+  );
+  tnsr_destroy(&weights);
+  free(params);
   return true;
 error:
+  dense_layer_densify(dl);
+  tnsr_destroy(&weights);
+  free(params);
   return false;
 }
 
-bool dense_layer_sgd_momentum(grph_t **g, dense_layer_t *dl) {
-  ASSERT(g && *g && dl);
-  gen_ctx_t beta = {0.9f};
-  gen_ctx_t i_beta = {0.1f};
-  gen_ctx_t lr = {-dl->learning_rate};
-  tnsr_t *wgrad = GRPH_NODE_GRAD(*g, dl->weights_id);
-  tnsr_t *bgrad = GRPH_NODE_GRAD(*g, dl->biases_id);
-  momentum_data_t *mdata = dl->optimizer_data;
-
-  REQUIRE(tnsr_emap(mdata->moment_w, mdata->moment_w, tnsr_mul_n, &beta), goto error);
-  REQUIRE(tnsr_emap(mdata->moment_b, mdata->moment_b, tnsr_mul_n, &beta), goto error);
-  REQUIRE(tnsr_emap(wgrad, wgrad, tnsr_mul_n, &i_beta), goto error);
-  REQUIRE(tnsr_emap(bgrad, bgrad, tnsr_mul_n, &i_beta), goto error);
-  REQUIRE(tnsr_eadd(mdata->moment_w, mdata->moment_w, wgrad), goto error);
-  REQUIRE(tnsr_eadd(mdata->moment_b, mdata->moment_b, bgrad), goto error);
-  REQUIRE(tnsr_emap(wgrad, mdata->moment_w, tnsr_mul_n, &lr), goto error);
-  REQUIRE(tnsr_emap(bgrad, mdata->moment_b, tnsr_mul_n, &lr), goto error);
-  REQUIRE(tnsr_eadd(dl->weights, dl->weights, wgrad), goto error);
-  REQUIRE(tnsr_eadd(dl->biases, dl->biases, bgrad), goto error);
+void dense_layer_densify(dense_layer_t *dl) {
+  ASSERT(dl);
+  tnsr_bsr_destroy(&dl->sparse_weights);
+  tnsr_destroy(&dl->sparse_biases);
+}
 
+bool dense_layer_update(dense_layer_t *dl) {
+  ASSERT(dl);
+  dense_layer_densify(dl);
+  REQUIRE(dl->optimizer(dl), goto error);
+  ++dl->step_count;
   return true;
 error:
   return false;
 }
 
+// Updates the layer through the sparse gradient scattered into a dense one, for the
+// optimizers that need every row's gradient.
+static bool dense_layer_update_scattered(
+    dense_layer_t *dl, const tnsr_size_t *rows, const tnsr_type_t *grads, tnsr_size_t count
+) {
+  tnsr_type_t *dense = calloc(dl->param_count, sizeof(tnsr_type_t));
+  REQUIRE(dense, return false);
+  const size_t width = sizeof(tnsr_type_t[dl->fan_out]);
+  for (tnsr_size_t i = 0; i < count; ++i) {
+    memcpy(dense + rows[i] * dl->fan_out, grads + (size_t)(1 + i) * dl->fan_out, width);
+  }
+  memcpy(dense + dl->fan_in * dl->fan_out, grads, width);
+  tnsr_type_t *own = dl->grads;
+  dl->grads = dense;
+  const bool status = dense_layer_update(dl);
+  dl->grads = own;
+  free(dense);
+  return status;
+}
+
+bool dense_layer_update_rows(
+    dense_layer_t *dl, const tnsr_size_t *rows, const tnsr_type_t *grads, tnsr_size_t count
+) {
+  ASSERT(dl && (rows || !count) && grads && dl->shard_count == 1);
+  const bool layer_wide = dl->optimizer == dense_layer_lars || dl->optimizer == dense_layer_lamb;
+  if (layer_wide) {
+    return dense_layer_update_scattered(dl, rows, grads, count);
+  }
+  dl->rows = rows;
+  dl->row_grads = grads;
+  dl->row_count = count;
+  const bool status = dense_layer_update(dl);
+  dl->rows = NULL;
+  dl->row_grads = NULL;
+  dl->row_count = 0;
+  return status;
+}
+
+// Optimizer hyperparameters.
+#define MOMENTUM_BETA 0.9f
+#define RMS_PROP_BETA 0.9f
+#define RMS_PROP_EPSILON 1e-8f
+#define ADAM_BETA1 0.9f
+#define ADAM_BETA2 0.999f
+#define ADAM_EPSILON 1e-8f
+#define LARS_MOMENTUM 0.9f
+#define LARS_ETA 0.001f  // Trust coefficient.
+#define LARS_WEIGHT_DECAY 5e-4f
+#define LAMB_BETA1 0.9f
+#define LAMB_BETA2 0.999f
+#define LAMB_EPSILON 1e-6f
+#define LAMB_WEIGHT_DECAY 0.01f
+
+#define OPTIMIZER_GRAIN 4096  // Parameters per chunk of an update.
+
+// Operands of an optimizer kernel, offset to the range being updated.
+typedef struct {
+  tnsr_type_t *w;
+  tnsr_type_t *m;  // First moment, if any.
+  tnsr_type_t *v;  // Second moment, if any.
+  const tnsr_type_t *g;
+  tnsr_type_t step;
+  tnsr_type_t epsilon;
+  tnsr_type_t decay;        // Weight decay.
+  tnsr_type_t correction1;  // Bias correction of the first moment.
+  tnsr_type_t correction2;  // Bias correction of the second moment.
+  const tnsr_type_t *mask;  // Pruning mask, if any.
+} optimizer_args_t;
+
 /**
+ * Fused optimizer kernels.
  * NOTE:
- * Runaway weights when loss has converged to 0.0.
+ * Each kernel makes a single pass over a layer's contiguous [W | B] storage, reading the
+ * gradient once and keeping the moments in registers. Gradients are left untouched.
  */
-bool dense_layer_sgd_rms_prop(grph_t **g, dense_layer_t *dl) {
-  ASSERT(g && *g && dl);
-  gen_ctx_t beta = {0.9f};
-  gen_ctx_t i_beta = {0.1f};
-  gen_ctx_t epsilon = {1e-8f};
-  gen_ctx_t lr = {-dl->learning_rate};
-  tnsr_t *wgrad = GRPH_NODE_GRAD(*g, dl->weights_id);
-  tnsr_t *bgrad = GRPH_NODE_GRAD(*g, dl->biases_id);
-  rms_prop_data_t *mdata = dl->optimizer_data;
-
-  gen_ctx_t pow = {2.0f};
-  tnsr_t *tmp_w = tnsr_emap(NULL, wgrad, tnsr_powf, &pow);
-  tnsr_t *tmp_b = tnsr_emap(NULL, bgrad, tnsr_powf, &pow);
-  REQUIRE(tmp_w && tmp_b, goto error);
-
-  REQUIRE(tnsr_emap(mdata->moment_w, mdata->moment_w, tnsr_mul_n, &beta), goto error);
-  REQUIRE(tnsr_emap(mdata->moment_b, mdata->moment_b, tnsr_mul_n, &beta), goto error);
-  REQUIRE(tnsr_emap(tmp_w, tmp_w, tnsr_mul_n, &i_beta), goto error);
-  REQUIRE(tnsr_emap(tmp_b, tmp_b, tnsr_mul_n, &i_beta), goto error);
-  REQUIRE(tnsr_eadd(mdata->moment_w, mdata->moment_w, tmp_w), goto error);
-  REQUIRE(tnsr_eadd(mdata->moment_b, mdata->moment_b, tmp_b), goto error);
-  REQUIRE(tnsr_emap(tmp_w, mdata->moment_w, tnsr_sqrt, NULL), goto error);
-  REQUIRE(tnsr_emap(tmp_b, mdata->moment_b, tnsr_sqrt, NULL), goto error);
-  REQUIRE(tnsr_emap(tmp_w, tmp_w, tnsr_add_n, &epsilon), goto error);
-  REQUIRE(tnsr_emap(tmp_b, tmp_b, tnsr_add_n, &epsilon), goto error);
-  REQUIRE(tnsr_emap(tmp_w, tmp_w, tnsr_as_divisor, &lr), goto error);
-  REQUIRE(tnsr_emap(tmp_b, tmp_b, tnsr_as_divisor, &lr), goto error);
-  REQUIRE(tnsr_emul(tmp_w, tmp_w, wgrad), goto error);
-  REQUIRE(tnsr_emul(tmp_b, tmp_b, bgrad), goto error);
-  REQUIRE(tnsr_eadd(dl->weights, dl->weights, tmp_w), goto error);
-  REQUIRE(tnsr_eadd(dl->biases, dl->biases, tmp_b), goto error);
-
-  tnsr_destroy(&tmp_w);
-  tnsr_destroy(&tmp_b);
-  return true;
+static void sgd_kernel(size_t begin, size_t end, void *ctx) {
+  const optimizer_args_t *args = ctx;
+  tnsr_type_t *restrict w = args->w;
+  const tnsr_type_t *restrict g = args->g;
+  const tnsr_type_t lr = args->step;
+#pragma omp simd
+  for (size_t i = begin; i < end; ++i) {
+    w[i] -= lr * g[i];
+  }
+}
+
+static void momentum_kernel(size_t begin, size_t end, void *ctx) {
+  const optimizer_args_t *args = ctx;
+  tnsr_type_t *restrict w = args->w;
+  tnsr_type_t *restrict m = args->m;
+  const tnsr_type_t *restrict g = args->g;
+  const tnsr_type_t lr = args->step;
+#pragma omp simd
+  for (size_t i = begin; i < end; ++i) {
+    const tnsr_type_t mi = MOMENTUM_BETA * m[i] + (1 - MOMENTUM_BETA) * g[i];
+    m[i] = mi;
+    w[i] -= lr * mi;
+  }
+}
+
+static void rms_prop_kernel(size_t begin, size_t end, void *ctx) {
+  const optimizer_args_t *args = ctx;
+  tnsr_type_t *restrict w = args->w;
+  tnsr_type_t *restrict v = args->v;
+  const tnsr_type_t *restrict g = args->g;
+  const tnsr_type_t lr = args->step;
+#pragma omp simd
+  for (size_t i = begin; i < end; ++i) {
+    const tnsr_type_t gi = g[i];
+    const tnsr_type_t vi = RMS_PROP_BETA * v[i] + (1 - RMS_PROP_BETA) * gi * gi;
+    v[i] = vi;
+    w[i] -= lr * gi / (sqrtf(vi) + RMS_PROP_EPSILON);
+  }
+}
+
+// Bias correction is folded into step and epsilon by the caller.
+static void adam_kernel(size_t begin, size_t end, void *ctx) {
+  const optimizer_args_t *args = ctx;
+  tnsr_type_t *restrict w = args->w;
+  tnsr_type_t *restrict m = args->m;
+  tnsr_type_t *restrict v = args->v;
+  const tnsr_type_t *restrict g = args->g;
+  const tnsr_type_t step = args->step;
+  const tnsr_type_t epsilon = args->epsilon;
+#pragma omp simd
+  for (size_t i = begin; i < end; ++i) {
+    const tnsr_type_t gi = g[i];
+    const tnsr_type_t mi = ADAM_BETA1 * m[i] + (1 - ADAM_BETA1) * gi;
+    const tnsr_type_t vi = ADAM_BETA2 * v[i] + (1 - ADAM_BETA2) * gi * gi;
+    m[i] = mi;
+    v[i] = vi;
+    w[i] -= step * mi / (sqrtf(vi) + epsilon);
+  }
+}
+
+// Heavy-ball momentum on the decayed gradient, step holds the trust-scaled learning rate.
+static void lars_kernel(size_t begin, size_t end, void *ctx) {
+  const optimizer_args_t *args = ctx;
+  tnsr_type_t *restrict w = args->w;
+  tnsr_type_t *restrict m = args->m;
+  const tnsr_type_t *restrict g = args->g;
+  const tnsr_type_t step = args->step;
+  const tnsr_type_t decay = args->decay;
+#pragma omp simd
+  for (size_t i = begin; i < end; ++i) {
+    const tnsr_type_t mi = LARS_MOMENTUM * m[i] + step * (g[i] + decay * w[i]);
+    m[i] = mi;
+    w[i] -= mi;
+  }
+}
+
+// Sums of squares of the weights and of their decayed gradient.
+static void lars_norms(const optimizer_args_t *args, size_t begin, size_t end, double sums[2]) {
+  const tnsr_type_t *restrict w = args->w;
+  const tnsr_type_t *restrict g = args->g;
+  double ww = 0;
+  double gg = 0;
+#pragma omp simd reduction(+ : ww, gg)
+  for (size_t i = begin; i < end; ++i) {
+    ww += (double)w[i] * w[i];
+    gg += (double)g[i] * g[i];
+  }
+  sums[0] = ww;
+  sums[1] = gg;
+}
+
+// LAMB's update direction, the bias-corrected Adam ratio plus weight decay.
+static inline tnsr_type_t lamb_direction(const optimizer_args_t *args, size_t i) {
+  const tnsr_type_t m = args->m[i] * args->correction1;
+  const tnsr_type_t v = args->v[i] * args->correction2;
+  return m / (sqrtf(v) + args->epsilon) + args->decay * args->w[i];
+}
+
+// Updates the moments, then sums the squares of the weights and of their update direction.
+static void lamb_norms(const optimizer_args_t *args, size_t begin, size_t end, double sums[2]) {
+  tnsr_type_t *restrict m = args->m;
+  tnsr_type_t *restrict v = args->v;
+  const tnsr_type_t *restrict w = args->w;
+  const tnsr_type_t *restrict g = args->g;
+  double ww = 0;
+  double rr = 0;
+#pragma omp simd reduction(+ : ww, rr)
+  for (size_t i = begin; i < end; ++i) {
+    const tnsr_type_t gi = g[i];
+    m[i] = LAMB_BETA1 * m[i] + (1 - LAMB_BETA1) * gi;
+    v[i] = LAMB_BETA2 * v[i] + (1 - LAMB_BETA2) * gi * gi;
+    const tnsr_type_t ri = lamb_direction(args, i);
+    ww += (double)w[i] * w[i];
+    rr += (double)ri * ri;
+  }
+  sums[0] = ww;
+  sums[1] = rr;
+}
+
+// Moments are already updated by lamb_norms, step holds the trust-scaled learning rate.
+static void lamb_kernel(size_t begin, size_t end, void *ctx) {
+  const optimizer_args_t *args = ctx;
+  tnsr_type_t *restrict w = args->w;
+  const tnsr_type_t step = args->step;
+  for (size_t i = begin; i < end; ++i) {
+    w[i] -= step * lamb_direction(args, i);
+  }
+}
+
+// Keeps pruned parameters at zero.
+static void mask_kernel(size_t begin, size_t end, void *ctx) {
+  const optimizer_args_t *args = ctx;
+  tnsr_type_t *restrict w = args->w;
+  const tnsr_type_t *restrict mask = args->mask;
+#pragma omp simd
+  for (size_t i = begin; i < end; ++i) {
+    w[i] *= mask[i];
+  }
+}
+
+// An update of a layer, applying kernel to every shard.
+// Unless bias_kernel is set, each shard's [W | B] block is updated at once.
+typedef struct {
+  dense_layer_t *dl;
+  tpool_range_t kernel;
+  optimizer_args_t args;  // Scalars of the weights' kernel, pointers are set per shard.
+  tpool_range_t bias_kernel;
+  optimizer_args_t bias_args;
+} dense_layer_update_t;
+
+static bool dense_layer_two_moments(const dense_layer_t *dl) {
+  return dl->optimizer == dense_layer_sgd_adam || dl->optimizer == dense_layer_lamb;
+}
+
+// Points the kernel arguments to the parameters [offset, ...) of the layer.
+static optimizer_args_t dense_layer_args(
+    const dense_layer_t *dl, const optimizer_args_t *scalars, tnsr_size_t offset
+) {
+  const bool two_moments = dense_layer_two_moments(dl);
+  optimizer_args_t args = *scalars;
+  args.w = dl->params + offset;
+  args.m = dl->state ? dl->state + offset : NULL;
+  args.v = dl->state ? dl->state + (two_moments ? dl->param_count : 0) + offset : NULL;
+  args.g = dl->grads ? dl->grads + offset : NULL;
+  args.mask = dl->mask ? dl->mask + offset : NULL;
+  return args;
+}
+
+/**
+ * Applies the update to the shards [begin, end).
+ * NOTE:
+ * The loop over shards has grain 1, alike the sharded nodes, so shard s is updated by
+ * the worker that evaluates it in the graph, and its parameters and optimizer state stay
+ * on that worker's node. Unsharded layers are split over the whole pool instead.
+ */
+static void dense_layer_update_shards(size_t begin, size_t end, void *ctx) {
+  const dense_layer_update_t *u = ctx;
+  dense_layer_t *dl = u->dl;
+  tpool_t *pool = tpool_global();
+  for (size_t s = begin; s < end; ++s) {
+    const dense_layer_shard_t *shard = &dl->shards[s];
+    const tnsr_size_t biases = u->bias_kernel ? TNSR_SHPE(shard->biases, 1) : 0;
+    optimizer_args_t args = dense_layer_args(dl, &u->args, shard->offset);
+    tpool_parallel_for(pool, shard->count - biases, OPTIMIZER_GRAIN, u->kernel, &args);
+    if (biases) {
+      const tnsr_size_t offset = shard->offset + shard->count - biases;
+      optimizer_args_t bias_args = dense_layer_args(dl, &u->bias_args, offset);
+      tpool_parallel_for(pool, biases, OPTIMIZER_GRAIN, u->bias_kernel, &bias_args);
+    }
+    if (dl->mask) {
+      tpool_parallel_for(pool, shard->count, OPTIMIZER_GRAIN, mask_kernel, &args);
+    }
+  }
+}
+
+// Applies the update to the rows [begin, end) of a lazy update.
+static void dense_layer_update_rows_range(size_t begin, size_t end, void *ctx) {
+  const dense_layer_update_t *u = ctx;
+  const dense_layer_t *dl = u->dl;
+  for (size_t i = begin; i < end; ++i) {
+    optimizer_args_t args = dense_layer_args(dl, &u->args, dl->rows[i] * dl->fan_out);
+    args.g = dl->row_grads + (size_t)(1 + i) * dl->fan_out;
+    u->kernel(0, dl->fan_out, &args);
+    if (dl->mask) {
+      mask_kernel(0, dl->fan_out, &args);
+    }
+  }
+}
+
+static void dense_layer_apply(dense_layer_t *dl, dense_layer_update_t *update) {
+  tpool_t *pool = tpool_global();
+  if (!dl->row_grads) {
+    tpool_parallel_for(pool, dl->shard_count, 1, dense_layer_update_shards, update);
+    return;
+  }
+  const size_t grain = max(OPTIMIZER_GRAIN / max(dl->fan_out, 1), 1);
+  tpool_parallel_for(pool, dl->row_count, grain, dense_layer_update_rows_range, update);
+  const tnsr_size_t offset = dl->fan_in * dl->fan_out;
+  const bool biased = update->bias_kernel;
+  const tpool_range_t kernel = biased ? update->bias_kernel : update->kernel;
+  optimizer_args_t args = dense_layer_args(dl, biased ? &update->bias_args : &update->args, offset);
+  args.g = dl->row_grads;  // Of the biases.
+  tpool_parallel_for(pool, dl->fan_out, OPTIMIZER_GRAIN, kernel, &args);
+  if (dl->mask) {
+    tpool_parallel_for(pool, dl->fan_out, OPTIMIZER_GRAIN, mask_kernel, &args);
+  }
+}
+
+typedef struct {
+  dense_layer_t *dl;
+  tnsr_size_t offset;  // Of the range in the layer's parameters.
+} dense_layer_zero_t;
+
+static void dense_layer_zero_range(size_t begin, size_t end, void *ctx) {
+  const dense_layer_zero_t *z = ctx;
+  dense_layer_t *dl = z->dl;
+  const size_t first = z->offset + begin;
+  const size_t size = sizeof(tnsr_type_t[end - begin]);
+  memset(dl->grads + first, 0, size);
+  if (dl->state) {
+    memset(dl->state + first, 0, size);
+    if (dense_layer_two_moments(dl)) {
+      memset(dl->state + dl->param_count + first, 0, size);
+    }
+  }
+}
+
+// Zeroes the shards [begin, end) split alike dense_layer_update_shards.
+static void dense_layer_zero_shards(size_t begin, size_t end, void *ctx) {
+  dense_layer_t *dl = ctx;
+  tpool_t *pool = tpool_global();
+  // The optimizers with a kernel of their own for the biases.
+  const bool split = dl->optimizer == dense_layer_lars || dl->optimizer == dense_layer_lamb;
+  for (size_t s = begin; s < end; ++s) {
+    const dense_layer_shard_t *shard = &dl->shards[s];
+    const tnsr_size_t biases = split ? TNSR_SHPE(shard->biases, 1) : 0;
+    dense_layer_zero_t z = {.dl = dl, .offset = shard->offset};
+    tpool_parallel_for(pool, shard->count - biases, OPTIMIZER_GRAIN, dense_layer_zero_range, &z);
+    if (biases) {
+      z.offset = shard->offset + shard->count - biases;
+      tpool_parallel_for(pool, biases, OPTIMIZER_GRAIN, dense_layer_zero_range, &z);
+    }
+  }
+}
+
+void dense_layer_zero(dense_layer_t *dl) {
+  ASSERT(dl && dl->grads);
+  tpool_parallel_for(tpool_global(), dl->shard_count, 1, dense_layer_zero_shards, dl);
+}
+
+/**
+ * Layer-wise trust ratios.
+ * NOTE:
+ * Norms are reduced from per-block partial sums, added up in block order once every
+ * shard is done, so they do not depend on the thread count or on the sharding.
+ */
+typedef void (*dense_layer_norms_t)(
+    const optimizer_args_t *args, size_t begin, size_t end, double sums[2]
+);
+
+typedef struct {
+  dense_layer_t *dl;
+  dense_layer_norms_t norms;
+  const optimizer_args_t *scalars;
+  double *partials;     // Two sums per block.
+  size_t *first_block;  // Of every shard, followed by the total block count.
+} dense_layer_norms_ctx_t;
+
+typedef struct {
+  const dense_layer_norms_ctx_t *norms;
+  optimizer_args_t args;
+  tnsr_size_t count;
+  double *partials;
+} dense_layer_blocks_ctx_t;
+
+static void dense_layer_norm_blocks(size_t begin, size_t end, void *ctx) {
+  const dense_layer_blocks_ctx_t *c = ctx;
+  for (size_t b = begin; b < end; ++b) {
+    const size_t first = b * OPTIMIZER_GRAIN;
+    const size_t last = min(first + OPTIMIZER_GRAIN, (size_t)c->count);
+    c->norms->norms(&c->args, first, last, c->partials + 2 * b);
+  }
+}
+
+static void dense_layer_norm_shards(size_t begin, size_t end, void *ctx) {
+  const dense_layer_norms_ctx_t *c = ctx;
+  for (size_t s = begin; s < end; ++s) {
+    const dense_layer_shard_t *shard = &c->dl->shards[s];
+    const size_t blocks = c->first_block[s + 1] - c->first_block[s];
+    dense_layer_blocks_ctx_t blocks_ctx = {
+        .norms = c,
+        .args = dense_layer_args(c->dl, c->scalars, shard->offset),
+        .count = shard->count - TNSR_SHPE(shard->biases, 1),
+        .partials = c->partials + 2 * c->first_block[s],
+    };
+    tpool_parallel_for(tpool_global(), blocks, 1, dense_layer_norm_blocks, &blocks_ctx);
+  }
+}
+
+/**
+ * Runs norms over the weights of every shard. Returns the trust ratio
+ * eta * ||w|| / (||u|| + decay * ||w||), or 1 when either norm is 0, NAN upon failure.
+ * NOTE:
+ * decay is only for norms whose u leaves the weight decay out, as LARS' gradient does.
+ */
+static tnsr_type_t dense_layer_trust_ratio(
+    dense_layer_t *dl,
+    dense_layer_norms_t norms,
+    const optimizer_args_t *scalars,
+    tnsr_type_t eta,
+    tnsr_type_t decay
+) {
+  size_t *first_block = malloc(sizeof(size_t[dl->shard_count + 1]));
+  double *partials = NULL;
+  REQUIRE(first_block, goto error);
+  first_block[0] = 0;
+  for (size_t s = 0; s < dl->shard_count; ++s) {
+    const tnsr_size_t weights = dl->shards[s].count - TNSR_SHPE(dl->shards[s].biases, 1);
+    first_block[s + 1] = first_block[s] + (weights + OPTIMIZER_GRAIN - 1) / OPTIMIZER_GRAIN;
+  }
+  partials = malloc(sizeof(double[2 * first_block[dl->shard_count]]));
+  REQUIRE(partials, goto error);
+
+  dense_layer_norms_ctx_t ctx = {
+      .dl = dl,
+      .norms = norms,
+      .scalars = scalars,
+      .partials = partials,
+      .first_block = first_block,
+  };
+  tpool_parallel_for(tpool_global(), dl->shard_count, 1, dense_layer_norm_shards, &ctx);
+
+  double ww = 0;
+  double uu = 0;
+  for (size_t b = 0; b < first_block[dl->shard_count]; ++b) {
+    ww += partials[2 * b];
+    uu += partials[2 * b + 1];
+  }
+  free(first_block);
+  free(partials);
+  const double w_norm = sqrt(ww);
+  const double u_norm = sqrt(uu);
+  if (w_norm == 0 || u_norm == 0) {
+    return 1;
+  }
+  return (tnsr_type_t)(eta * w_norm / (u_norm + decay * w_norm));
+
 error:
-  tnsr_destroy(&tmp_w);
-  tnsr_destroy(&tmp_b);
-  return false;
+  free(first_block);
+  free(partials);
+  return NAN;
 }
 
-bool dense_layer_sgd_adam(grph_t **g, dense_layer_t *dl) {
-  ASSERT(g && *g && dl);
-  gen_ctx_t beta1 = {0.9f};
-  gen_ctx_t i_beta1 = {0.1f};
-  gen_ctx_t beta2 = {0.999f};
-  gen_ctx_t i_beta2 = {0.001f};
-  gen_ctx_t epsilon = {1e-8f};
-  gen_ctx_t lr = {-dl->learning_rate};
-  tnsr_t *wgrad = GRPH_NODE_GRAD(*g, dl->weights_id);
-  tnsr_t *bgrad = GRPH_NODE_GRAD(*g, dl->biases_id);
-  adam_data_t *data = dl->optimizer_data;
-
-  ++data->timestamp;  // Must be incremented first to prevent div by 0.
-
-  gen_ctx_t i_beta1t = {1 - powf(beta1.n, data->timestamp)};
-  gen_ctx_t i_beta2t = {1 - powf(beta2.n, data->timestamp)};
-  gen_ctx_t sqrt_ib2t = {sqrtf(i_beta2t.n)};
-  gen_ctx_t adj_epsilon = {epsilon.n * sqrt_ib2t.n};
-  gen_ctx_t step = {lr.n * sqrt_ib2t.n / i_beta1t.n};
-
-  gen_ctx_t pow = {2.0f};
-  tnsr_t *tmp1 = tnsr_emap(NULL, wgrad, tnsr_mul_n, &i_beta1);
-  tnsr_t *tmp2 = tnsr_emap(NULL, bgrad, tnsr_mul_n, &i_beta1);
-  REQUIRE(tmp1 && tmp2, goto error);
-
-  REQUIRE(tnsr_emap(data->moment1_w, data->moment1_w, tnsr_mul_n, &beta1), goto error);
-  REQUIRE(tnsr_emap(data->moment1_b, data->moment1_b, tnsr_mul_n, &beta1), goto error);
-  REQUIRE(tnsr_eadd(data->moment1_w, data->moment1_w, tmp1), goto error);
-  REQUIRE(tnsr_eadd(data->moment1_b, data->moment1_b, tmp2), goto error);
-
-  REQUIRE(tnsr_emap(data->moment2_w, data->moment2_w, tnsr_mul_n, &beta2), goto error);
-  REQUIRE(tnsr_emap(data->moment2_b, data->moment2_b, tnsr_mul_n, &beta2), goto error);
-  REQUIRE(tnsr_emap(tmp1, wgrad, tnsr_powf, &pow), goto error);
-  REQUIRE(tnsr_emap(tmp2, bgrad, tnsr_powf, &pow), goto error);
-  REQUIRE(tnsr_emap(tmp1, tmp1, tnsr_mul_n, &i_beta2), goto error);
-  REQUIRE(tnsr_emap(tmp2, tmp2, tnsr_mul_n, &i_beta2), goto error);
-  REQUIRE(tnsr_eadd(data->moment2_w, data->moment2_w, tmp1), goto error);
-  REQUIRE(tnsr_eadd(data->moment2_b, data->moment2_b, tmp2), goto error);
-
-  REQUIRE(tnsr_emap(tmp1, data->moment2_w, tnsr_sqrt, NULL), goto error);
-  REQUIRE(tnsr_emap(tmp1, tmp1, tnsr_add_n, &adj_epsilon), goto error);
-
-  // This div-operation is non-standard. Equivalent to b = a / b. Not a /= b.
-  REQUIRE(tnsr_ediv(tmp1, data->moment1_w, tmp1), goto error);
-
-  REQUIRE(tnsr_emap(tmp1, tmp1, tnsr_mul_n, &step), goto error);
-  REQUIRE(tnsr_eadd(dl->weights, dl->weights, tmp1), goto error);
-
-  REQUIRE(tnsr_emap(tmp2, data->moment2_b, tnsr_sqrt, NULL), goto error);
-  REQUIRE(tnsr_emap(tmp2, tmp2, tnsr_add_n, &adj_epsilon), goto error);
-
-  // This div-operation is non-standard. Equivalent to b = a / b. Not a /= b.
-  REQUIRE(tnsr_ediv(tmp2, data->moment1_b, tmp2), goto error);
-  REQUIRE(tnsr_emap(tmp2, tmp2, tnsr_mul_n, &step), goto error);
-  REQUIRE(tnsr_eadd(dl->biases, dl->biases, tmp2), goto error);
-
-  tnsr_destroy(&tmp1);
-  tnsr_destroy(&tmp2);
+bool dense_layer_sgd(dense_layer_t *dl) {
+  ASSERT(dl);
+  dense_layer_update_t update = {
+      .dl = dl,
+      .kernel = sgd_kernel,
+      .args = {.step = dl->learning_rate},
+  };
+  dense_layer_apply(dl, &update);
   return true;
+}
 
-error:
-  tnsr_destroy(&tmp1);
-  tnsr_destroy(&tmp2);
-  return false;
+bool dense_layer_sgd_momentum(dense_layer_t *dl) {
+  ASSERT(dl && dl->state);
+  dense_layer_update_t update = {
+      .dl = dl,
+      .kernel = momentum_kernel,
+      .args = {.step = dl->learning_rate},
+  };
+  dense_layer_apply(dl, &update);
+  return true;
 }
 
-void dense_layer_sgd_dtor(void **dataptr) {
-  (void)dataptr;  // Stateless.
+/**
+ * NOTE:
+ * Runaway weights when loss has converged to 0.0.
+ */
+bool dense_layer_sgd_rms_prop(dense_layer_t *dl) {
+  ASSERT(dl && dl->state);
+  dense_layer_update_t update = {
+      .dl = dl,
+      .kernel = rms_prop_kernel,
+      .args = {.step = dl->learning_rate},
+  };
+  dense_layer_apply(dl, &update);
+  return true;
 }
 
-void dense_layer_sgd_momentum_dtor(void **dataptr) {
-  REQUIRE(dataptr && *dataptr, return);
-  momentum_data_t *data = *dataptr;
-  tnsr_destroy(&data->moment_w);
-  tnsr_destroy(&data->moment_b);
-  free(data);
-  *dataptr = NULL;
+bool dense_layer_sgd_adam(dense_layer_t *dl) {
+  ASSERT(dl && dl->state);
+  const tnsr_type_t timestamp = (tnsr_type_t)(dl->step_count + 1);  // Prevents div by 0.
+  const tnsr_type_t i_beta1t = 1 - powf(ADAM_BETA1, timestamp);
+  const tnsr_type_t sqrt_ib2t = sqrtf(1 - powf(ADAM_BETA2, timestamp));
+  dense_layer_update_t update = {
+      .dl = dl,
+      .kernel = adam_kernel,
+      .args = {
+          .step = dl->learning_rate * sqrt_ib2t / i_beta1t,
+          .epsilon = ADAM_EPSILON * sqrt_ib2t,
+      },
+  };
+  dense_layer_apply(dl, &update);
+  return true;
 }
 
-void dense_layer_sgd_rms_prop_dtor(void **dataptr) {
-  REQUIRE(dataptr && *dataptr, return);
-  rms_prop_data_t *data = *dataptr;
-  tnsr_destroy(&data->moment_w);
-  tnsr_destroy(&data->moment_b);
-  free(data);
-  *dataptr = NULL;
+/**
+ * NOTE:
+ * Biases are left out of the trust ratio and of weight decay, and follow plain momentum.
+ */
+bool dense_layer_lars(dense_layer_t *dl) {
+  ASSERT(dl && dl->state);
+  dense_layer_update_t update = {
+      .dl = dl,
+      .kernel = lars_kernel,
+      .args = {.decay = LARS_WEIGHT_DECAY},
+      .bias_kernel = lars_kernel,
+      .bias_args = {.step = dl->learning_rate},
+  };
+  const tnsr_type_t trust =
+      dense_layer_trust_ratio(dl, lars_norms, &update.args, LARS_ETA, LARS_WEIGHT_DECAY);
+  REQUIRE(!isnan(trust), goto error);
+  update.args.step = dl->learning_rate * trust;
+  dense_layer_apply(dl, &update);
+  return true;
+error:
+  return false;
 }
 
-void dense_layer_sgd_adam_dtor(void **dataptr) {
-  REQUIRE(dataptr && *dataptr, return);
-  adam_data_t *data = *dataptr;
-  tnsr_destroy(&data->moment1_w);
-  tnsr_destroy(&data->moment1_b);
-  tnsr_destroy(&data->moment2_w);
-  tnsr_destroy(&data->moment2_b);
-  free(data);
-  *dataptr = NULL;
+/**
+ * NOTE:
+ * Makes two passes over the weights, the first updating the moments and reducing the
+ * norms, the second applying the trust-scaled step. Biases are left out of the trust
+ * ratio and of weight decay, and follow Adam in a single pass.
+ */
+bool dense_layer_lamb(dense_layer_t *dl) {
+  ASSERT(dl && dl->state);
+  const tnsr_type_t timestamp = (tnsr_type_t)(dl->step_count + 1);  // Prevents div by 0.
+  const tnsr_type_t i_beta1t = 1 - powf(LAMB_BETA1, timestamp);
+  const tnsr_type_t i_beta2t = 1 - powf(LAMB_BETA2, timestamp);
+  dense_layer_update_t update = {
+      .dl = dl,
+      .kernel = lamb_kernel,
+      .args = {
+          .epsilon = LAMB_EPSILON,
+          .decay = LAMB_WEIGHT_DECAY,
+          .correction1 = 1 / i_beta1t,
+          .correction2 = 1 / i_beta2t,
+      },
+      .bias_kernel = adam_kernel,
+      .bias_args = {
+          .step = dl->learning_rate * sqrtf(i_beta2t) / i_beta1t,
+          .epsilon = LAMB_EPSILON * sqrtf(i_beta2t),
+      },
+  };
+  // LAMB's trust ratio has no coefficient, and its direction already holds the decay.
+  const tnsr_type_t trust = dense_layer_trust_ratio(dl, lamb_norms, &update.args, 1, 0);
+  REQUIRE(!isnan(trust), goto error);
+  update.args.step = dl->learning_rate * trust;
+  dense_layer_apply(dl, &update);
+  return true;
+error:
+  return false;
 }
 
 void dense_layer_dbgprint(dense_layer_t *dl) {
   ASSERT(dl);
-  printf("W:\n");
-  tnsr_dbgprint(dl->weights);
-  printf("B:\n");
-  tnsr_dbgprint(dl->biases);
+  for (size_t s = 0; s < dl->shard_count; ++s) {
+    if (dl->shard_count > 1) {
+      printf("SHARD %zu:\n", s);
+    }
+    printf("W:\n");
+    tnsr_dbgprint(dl->shards[s].weights);
+    printf("B:\n");
+    tnsr_dbgprint(dl->shards[s].biases);
+  }
 }
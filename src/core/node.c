@@ -7,11 +7,13 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <string.h>
 
 #include "core/graph.h"
 #include "core/node.h"
 #include "core/tensor.h"
 #include "core/tensor_functions.h"
+#include "core/thread_pool.h"
 #include "utils/utils.h"
 
 static grph_size_t input_req[] = {_GRPH_INPUT_TBLE};
@@ -32,8 +34,35 @@ static grph_size_t output_size[] = {
     [NDTYPE_CATEGORICAL_CROSS_ENTROPY_LOSS] = OUTSIZE_SCALAR,
     [NDTYPE_BINARY_CROSS_ENTROPY_LOSS] = OUTSIZE_SCALAR,
     [NDTYPE_SOFTMAX] = OUTSIZE_DEP_SAMEAS,
+    [NDTYPE_SHARDED_AFFINE] = OUTSIZE_SHARDED,
+    [NDTYPE_SHARDED_SOFTMAX] = OUTSIZE_SHARDED,
+    [NDTYPE_CONV] = OUTSIZE_CONV,
+    [NDTYPE_EMBED] = OUTSIZE_GATHERED,
 };
 
+// Lock of node n's gradient, NULL when a single consumer pushes into it.
+static omp_lock_t *_grad_lock(grph_t *g, grph_size_t n) {
+  return GRPH_NODE_CONSUMERS(g, n) > 1 ? &g->grad_locks[n % GRPH_GRAD_LOCKS] : NULL;
+}
+
+/**
+ * Adds grad into the gradient of node dst. Serialized when dst has several consumers, as
+ * those running concurrently during grph_trace may push into it at once.
+ */
+static bool _accumulate_into(grph_t *g, grph_size_t dst, const tnsr_t *grad) {
+  ASSERT(g && dst != GRPH_NO_INPUT_ID && grad);
+  tnsr_t *dst_grad = GRPH_NODE_GRAD(g, dst);
+  omp_lock_t *lock = _grad_lock(g, dst);
+  if (lock) {
+    omp_set_lock(lock);
+  }
+  const bool status = tnsr_eadd(dst_grad, dst_grad, grad);
+  if (lock) {
+    omp_unset_lock(lock);
+  }
+  return status;
+}
+
 /**
  * Handles gradient accumulation across batches.
  * NOTE:
@@ -41,12 +70,13 @@ static grph_size_t output_size[] = {
  * "undoes" the implicit broadcasting operations done by
  * the previous node.
  */
-static bool _accumulate_grad(tnsr_t *dst, tnsr_t *grad) {
-  ASSERT(dst && grad);
-  const bool match0 = TNSR_SHPE(dst, 0) == TNSR_SHPE(grad, 0);
-  const bool match1 = TNSR_SHPE(dst, 1) == TNSR_SHPE(grad, 1);
+static bool _accumulate_grad(grph_t *g, grph_size_t dst, tnsr_t *grad) {
+  ASSERT(g && dst != GRPH_NO_INPUT_ID && grad);
+  const tnsr_t *dst_grad = GRPH_NODE_GRAD(g, dst);
+  const bool match0 = TNSR_SHPE(dst_grad, 0) == TNSR_SHPE(grad, 0);
+  const bool match1 = TNSR_SHPE(dst_grad, 1) == TNSR_SHPE(grad, 1);
   if (match0 && match1) {
-    return tnsr_eadd(dst, dst, grad);
+    return _accumulate_into(g, dst, grad);
   }
   tnsr_t *rb = NULL;
   tnsr_t *acc = NULL;
@@ -64,7 +94,7 @@ static bool _accumulate_grad(tnsr_t *dst, tnsr_t *grad) {
   } else {  // Copies pointer.
     acc = rb;
   }
-  REQUIRE(tnsr_eadd(dst, dst, acc), goto error);
+  REQUIRE(_accumulate_into(g, dst, acc), goto error);
   if (!match1 && !match0) {
     tnsr_destroy(&rb);
   }
@@ -78,19 +108,35 @@ error:
   return false;
 }
 
-node_t *node_create(grph_t *g, tnsr_t *data, grph_size_t a, grph_size_t b, node_type_t type) {
-  ASSERT(g);
+static grph_size_t _node_create(
+    grph_t *g,
+    tnsr_t *data,
+    tnsr_t *grad,
+    const grph_size_t *dependencies,
+    grph_size_t ndependencies,
+    node_type_t type,
+    const void *attr
+) {
+  ASSERT(g && (!grad || output_size[type] == OUTSIZE_INDEPENDENT));
+  ASSERT(input_req[type] == GRPH_VARIADIC || input_req[type] == ndependencies);
   bool transient = false;
-  grph_size_t ndependencies = input_req[type];
+  const grph_size_t a = ndependencies > 0 ? dependencies[0] : GRPH_NO_INPUT_ID;
+  const grph_size_t b = ndependencies > 1 ? dependencies[1] : GRPH_NO_INPUT_ID;
   tnsr_t *node_data = NULL;
   tnsr_t *node_grad = NULL;
+  tnsr_t *node_aux = NULL;
 
   switch (output_size[type]) {
     case OUTSIZE_INDEPENDENT: {
       ASSERT(data && a == GRPH_NO_INPUT_ID && b == GRPH_NO_INPUT_ID);
       node_data = data;
-      node_grad = tnsr_create(TNSR_SHPE(data, 0), TNSR_SHPE(data, 1));
-      REQUIRE(node_grad, goto error);
+      if (grad && !g->forward_only) {
+        ASSERT(TNSR_SHPE(grad, 0) == TNSR_SHPE(data, 0));
+        ASSERT(TNSR_SHPE(grad, 1) == TNSR_SHPE(data, 1));
+        ASSERT(TNSR_IS_CONTIGUOUS(grad));
+        node_grad = tnsr_view(grad->data, TNSR_SHPE(data, 0), TNSR_SHPE(data, 1));
+        REQUIRE(node_grad, goto error);
+      }
       transient = false;
       break;
     }
@@ -98,16 +144,14 @@ node_t *node_create(grph_t *g, tnsr_t *data, grph_size_t a, grph_size_t b, node_
       ASSERT(!data && a != GRPH_NO_INPUT_ID && b == GRPH_NO_INPUT_ID);
       const tnsr_t *a_tnsr = GRPH_NODE_DATA(g, a);
       node_data = tnsr_create(TNSR_SHPE(a_tnsr, 1), TNSR_SHPE(a_tnsr, 0));
-      node_grad = tnsr_create(TNSR_SHPE(a_tnsr, 1), TNSR_SHPE(a_tnsr, 0));
-      REQUIRE(node_data && node_grad, goto error);
+      REQUIRE(node_data, goto error);
       transient = true;
       break;
     }
     case OUTSIZE_SCALAR: {
       ASSERT(!data);
       node_data = TNSR_SCALAR();
-      node_grad = TNSR_SCALAR();
-      REQUIRE(node_data && node_grad, goto error);
+      REQUIRE(node_data, goto error);
       transient = true;
       break;
     }
@@ -115,8 +159,11 @@ node_t *node_create(grph_t *g, tnsr_t *data, grph_size_t a, grph_size_t b, node_
       ASSERT(!data && a != GRPH_NO_INPUT_ID);
       const tnsr_t *a_tnsr = GRPH_NODE_DATA(g, a);
       node_data = tnsr_create(TNSR_SHPE(a_tnsr, 0), TNSR_SHPE(a_tnsr, 1));
-      node_grad = tnsr_create(TNSR_SHPE(a_tnsr, 0), TNSR_SHPE(a_tnsr, 1));
-      REQUIRE(node_data && node_grad, goto error);
+      REQUIRE(node_data, goto error);
+      if (type == NDTYPE_SOFTMAX) {
+        node_aux = TNSR_COLVEC(TNSR_SHPE(a_tnsr, 0));  // Row maxima, then row sums.
+        REQUIRE(node_aux, goto error);
+      }
       transient = true;
       break;
     }
@@ -125,8 +172,52 @@ node_t *node_create(grph_t *g, tnsr_t *data, grph_size_t a, grph_size_t b, node_
       const tnsr_t *a_tnsr = GRPH_NODE_DATA(g, a);
       const tnsr_t *b_tnsr = GRPH_NODE_DATA(g, b);
       node_data = tnsr_create(TNSR_SHPE(a_tnsr, 0), TNSR_SHPE(b_tnsr, 1));
-      node_grad = tnsr_create(TNSR_SHPE(a_tnsr, 0), TNSR_SHPE(b_tnsr, 1));
-      REQUIRE(node_data && node_grad, goto error);
+      REQUIRE(node_data, goto error);
+      transient = true;
+      break;
+    }
+    case OUTSIZE_SHARDED: {
+      // Inputs are X followed by a W, B pair per shard.
+      ASSERT(!data && ndependencies >= 3 && ndependencies % 2 == 1);
+      tnsr_size_t columns = 0;
+      for (grph_size_t i = 1; i < ndependencies; i += 2) {
+        columns += TNSR_SHPE(GRPH_NODE_DATA(g, dependencies[i]), 1);
+      }
+      const tnsr_t *a_tnsr = GRPH_NODE_DATA(g, a);
+      node_data = tnsr_create(TNSR_SHPE(a_tnsr, 0), columns);
+      REQUIRE(node_data, goto error);
+      transient = true;
+      break;
+    }
+    case OUTSIZE_CONV: {
+      // Inputs are X, W, B. Pooled outputs keep where their maximum was in the window.
+      ASSERT(!data && attr && ndependencies == 3);
+      const grph_conv_t *conv = attr;
+      const tnsr_t *a_tnsr = GRPH_NODE_DATA(g, a);
+      const tnsr_t *b_tnsr = GRPH_NODE_DATA(g, b);
+      ASSERT(TNSR_SHPE(a_tnsr, 1) == conv->height * conv->width * conv->channels);
+      ASSERT(TNSR_SHPE(b_tnsr, 0) == conv->kernel_height * conv->kernel_width * conv->channels);
+      ASSERT(TNSR_SHPE(b_tnsr, 1) == conv->filters);
+      tnsr_size_t height = 0;
+      tnsr_size_t width = 0;
+      const tnsr_size_t columns = grph_conv_output(conv, &height, &width);
+      REQUIRE(columns, goto error);
+      node_data = tnsr_create(TNSR_SHPE(a_tnsr, 0), columns);
+      REQUIRE(node_data, goto error);
+      if (conv->pool > 1) {
+        node_aux = tnsr_create(TNSR_SHPE(a_tnsr, 0), columns);
+        REQUIRE(node_aux, goto error);
+      }
+      transient = true;
+      break;
+    }
+    case OUTSIZE_GATHERED: {
+      ASSERT(!data && attr && a != GRPH_NO_INPUT_ID);
+      const grph_embed_t *embed = attr;
+      const tnsr_t *a_tnsr = GRPH_NODE_DATA(g, a);
+      const tnsr_size_t columns = TNSR_SHPE(a_tnsr, 1) * TNSR_SHPE(embed->table, 1);
+      node_data = tnsr_create(TNSR_SHPE(a_tnsr, 0), columns);
+      REQUIRE(node_data, goto error);
       transient = true;
       break;
     }
@@ -135,19 +226,30 @@ node_t *node_create(grph_t *g, tnsr_t *data, grph_size_t a, grph_size_t b, node_
       break;  // Unreachable.
     }
   }
-  node_t *node = malloc(sizeof(node_t) + sizeof(grph_size_t[NODE_INIT_DEP_CPCTY]));
-  REQUIRE(node, goto error);
-
-  node->n_deps_capacity = NODE_INIT_DEP_CPCTY;
-  node->n_dependencies = ndependencies;
-  node->dependencies[0] = a;
-  node->dependencies[1] = b;
-  node->data = node_data;
-  node->grad = node_grad;
-  node->type = type;
-  node->transient = transient;
+  // Gradients match their node's values, forward-only graphs have none.
+  if (!node_grad && !g->forward_only) {
+    node_grad = tnsr_create(TNSR_SHPE(node_data, 0), TNSR_SHPE(node_data, 1));
+    REQUIRE(node_grad, goto error);
+  }
+  ASSERT(GRPH_NODES(g) < GRPH_CPCTY(g));
+  ASSERT(GRPH_EDGES(g) + ndependencies <= g->edge_capacity);
+
+  const grph_size_t n = GRPH_NODES(g);
+  const size_t offset = g->edge_offsets[n];
+  for (grph_size_t i = 0; i < ndependencies; ++i) {
+    g->edges[offset + i] = dependencies[i];
+    ++GRPH_NODE_CONSUMERS(g, dependencies[i]);
+  }
+  g->edge_offsets[n + 1] = offset + ndependencies;
+  GRPH_NODE_DATA(g, n) = node_data;
+  GRPH_NODE_GRAD(g, n) = node_grad;
+  GRPH_NODE_TYPE(g, n) = type;
+  GRPH_NODE_TRANSIENT(g, n) = transient;
+  GRPH_NODE_ATTR(g, n) = attr;
+  GRPH_NODE_AUX(g, n) = node_aux;
+  ++GRPH_NODES(g);
 
-  return node;
+  return n;
 
 error:
   if (node_data && !data) {
@@ -156,297 +258,507 @@ error:
   if (node_grad) {
     free(node_grad);
   }
-  return NULL;
+  free(node_aux);
+  return GRPH_ERR_ID;
 }
 
-void node_destroy(node_t **n) {
-  REQUIRE(n && *n, return);
-  tnsr_destroy(&(*n)->data);
-  tnsr_destroy(&(*n)->grad);
-  free(*n);
-  *n = NULL;
+grph_size_t node_create(
+    grph_t *g, tnsr_t *data, tnsr_t *grad, grph_size_t a, grph_size_t b, node_type_t type
+) {
+  const grph_size_t dependencies[GRPH_MAX_DEPS] = {a, b};
+  return _node_create(g, data, grad, dependencies, input_req[type], type, NULL);
 }
 
-node_t *node_transpose(grph_t *g, grph_size_t a, grph_size_t b) {
-  ASSERT(g && a != GRPH_NO_INPUT_ID && b == GRPH_NO_INPUT_ID);
-  node_t *node = node_create(g, NULL, a, b, NDTYPE_TRANSPOSE);
-  REQUIRE(node, goto error);
-  REQUIRE(tnsr_transpose(node->data, GRPH_NODE_DATA(g, a)), goto error);
-  return node;
-error:
-  node_destroy(&node);
-  return NULL;
+grph_size_t node_create_n(
+    grph_t *g, const grph_size_t *deps, grph_size_t ndeps, node_type_t type, const void *attr
+) {
+  return _node_create(g, NULL, NULL, deps, ndeps, type, attr);
+}
+
+void node_destroy(grph_t *g, grph_size_t n) {
+  ASSERT(g && n < GRPH_NODES(g));
+  if (GRPH_NODE_TRANSIENT(g, n)) {
+    tnsr_destroy(&GRPH_NODE_DATA(g, n));
+  }
+  tnsr_destroy(&GRPH_NODE_GRAD(g, n));
+  tnsr_destroy(&GRPH_NODE_AUX(g, n));
 }
 
-node_t *node_contract(grph_t *g, grph_size_t a, grph_size_t b) {
-  ASSERT(g && a != GRPH_NO_INPUT_ID && b != GRPH_NO_INPUT_ID);
-  node_t *node = node_create(g, NULL, a, b, NDTYPE_CONTRACT);
-  REQUIRE(node, goto error);
-  REQUIRE(tnsr_contract(node->data, GRPH_NODE_DATA(g, a), GRPH_NODE_DATA(g, b)), goto error);
-  return node;
+bool node_transpose(grph_t *g, grph_size_t a) {
+  ASSERT(g && a != GRPH_NO_INPUT_ID && GRPH_NODE_TYPE(g, a) == NDTYPE_TRANSPOSE);
+  tnsr_t *data_a_dep0 = GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, a)[0]);
+  tnsr_t *data = GRPH_NODE_DATA(g, a);
+  for (tnsr_size_t i = 0; i < TNSR_SHPE(data, 0); ++i) {
+    for (tnsr_size_t j = 0; j < TNSR_SHPE(data, 1); ++j) {
+      TNSR_DATA(data, i, j) = TNSR_DATA(data_a_dep0, j, i);
+    }
+  }
+  return true;
+}
+
+bool node_contract(grph_t *g, grph_size_t a) {
+  ASSERT(g && a != GRPH_NO_INPUT_ID && GRPH_NODE_TYPE(g, a) == NDTYPE_CONTRACT);
+  tnsr_t *data_a_dep0 = GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, a)[0]);
+  tnsr_t *data_a_dep1 = GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, a)[1]);
+  tnsr_reset(GRPH_NODE_DATA(g, a));  // Contraction accumulates into its destination.
+  REQUIRE(tnsr_contract(GRPH_NODE_DATA(g, a), data_a_dep0, data_a_dep1), goto error);
+  return true;
 error:
-  node_destroy(&node);
-  return NULL;
+  return false;
 }
 
-node_t *node_eadd(grph_t *g, grph_size_t a, grph_size_t b) {
-  ASSERT(g && a != GRPH_NO_INPUT_ID && b != GRPH_NO_INPUT_ID);
-  node_t *node = node_create(g, NULL, a, b, NDTYPE_EADD);
-  REQUIRE(node, goto error);
-  REQUIRE(tnsr_eadd(node->data, GRPH_NODE_DATA(g, a), GRPH_NODE_DATA(g, b)), goto error);
-  return node;
+bool node_eadd(grph_t *g, grph_size_t a) {
+  ASSERT(g && a != GRPH_NO_INPUT_ID && GRPH_NODE_TYPE(g, a) == NDTYPE_EADD);
+  tnsr_t *data_a_dep0 = GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, a)[0]);
+  tnsr_t *data_a_dep1 = GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, a)[1]);
+  REQUIRE(tnsr_eadd(GRPH_NODE_DATA(g, a), data_a_dep0, data_a_dep1), goto error);
+  return true;
 error:
-  node_destroy(&node);
-  return NULL;
+  return false;
 }
 
-node_t *node_esub(grph_t *g, grph_size_t a, grph_size_t b) {
-  ASSERT(g && a != GRPH_NO_INPUT_ID && b != GRPH_NO_INPUT_ID);
-  node_t *node = node_create(g, NULL, a, b, NDTYPE_ESUB);
-  REQUIRE(node, goto error);
-  REQUIRE(tnsr_esub(node->data, GRPH_NODE_DATA(g, a), GRPH_NODE_DATA(g, b)), goto error);
-  return node;
+bool node_esub(grph_t *g, grph_size_t a) {
+  ASSERT(g && a != GRPH_NO_INPUT_ID && GRPH_NODE_TYPE(g, a) == NDTYPE_ESUB);
+  tnsr_t *data_a_dep0 = GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, a)[0]);
+  tnsr_t *data_a_dep1 = GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, a)[1]);
+  REQUIRE(tnsr_esub(GRPH_NODE_DATA(g, a), data_a_dep0, data_a_dep1), goto error);
+  return true;
 error:
-  node_destroy(&node);
-  return NULL;
+  return false;
 }
 
-node_t *node_emul(grph_t *g, grph_size_t a, grph_size_t b) {
-  ASSERT(g && a != GRPH_NO_INPUT_ID && b != GRPH_NO_INPUT_ID);
-  node_t *node = node_create(g, NULL, a, b, NDTYPE_EMUL);
-  REQUIRE(node, goto error);
-  REQUIRE(tnsr_emul(node->data, GRPH_NODE_DATA(g, a), GRPH_NODE_DATA(g, b)), goto error);
-  return node;
+bool node_emul(grph_t *g, grph_size_t a) {
+  ASSERT(g && a != GRPH_NO_INPUT_ID && GRPH_NODE_TYPE(g, a) == NDTYPE_EMUL);
+  tnsr_t *data_a_dep0 = GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, a)[0]);
+  tnsr_t *data_a_dep1 = GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, a)[1]);
+  REQUIRE(tnsr_emul(GRPH_NODE_DATA(g, a), data_a_dep0, data_a_dep1), goto error);
+  return true;
 error:
-  node_destroy(&node);
-  return NULL;
+  return false;
 }
 
-node_t *node_ediv(grph_t *g, grph_size_t a, grph_size_t b) {
-  ASSERT(g && a != GRPH_NO_INPUT_ID && b != GRPH_NO_INPUT_ID);
-  node_t *node = node_create(g, NULL, a, b, NDTYPE_EDIV);
-  REQUIRE(node, goto error);
-  REQUIRE(tnsr_ediv(node->data, GRPH_NODE_DATA(g, a), GRPH_NODE_DATA(g, b)), goto error);
-  return node;
+bool node_ediv(grph_t *g, grph_size_t a) {
+  ASSERT(g && a != GRPH_NO_INPUT_ID && GRPH_NODE_TYPE(g, a) == NDTYPE_EDIV);
+  tnsr_t *data_a_dep0 = GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, a)[0]);
+  tnsr_t *data_a_dep1 = GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, a)[1]);
+  REQUIRE(tnsr_ediv(GRPH_NODE_DATA(g, a), data_a_dep0, data_a_dep1), goto error);
+  return true;
 error:
-  node_destroy(&node);
-  return NULL;
+  return false;
 }
 
-node_t *node_esigmoid(grph_t *g, grph_size_t a, grph_size_t b) {
-  ASSERT(g && a != GRPH_NO_INPUT_ID && b == GRPH_NO_INPUT_ID);
-  node_t *node = node_create(g, NULL, a, b, NDTYPE_ESIGMOID);
-  REQUIRE(node, goto error);
-  REQUIRE(tnsr_emap(node->data, GRPH_NODE_DATA(g, a), tnsr_sigmoid, NULL), goto error);
-  return node;
+bool node_esigmoid(grph_t *g, grph_size_t a) {
+  ASSERT(g && a != GRPH_NO_INPUT_ID && GRPH_NODE_TYPE(g, a) == NDTYPE_ESIGMOID);
+  tnsr_t *data_a_dep0 = GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, a)[0]);
+  REQUIRE(tnsr_emap(GRPH_NODE_DATA(g, a), data_a_dep0, tnsr_sigmoid, NULL), goto error);
+  return true;
 error:
-  node_destroy(&node);
-  return NULL;
+  return false;
 }
 
-node_t *node_erelu(grph_t *g, grph_size_t a, grph_size_t b) {
-  ASSERT(g && a != GRPH_NO_INPUT_ID && b == GRPH_NO_INPUT_ID);
-  node_t *node = node_create(g, NULL, a, b, NDTYPE_ERELU);
-  REQUIRE(node, goto error);
-  REQUIRE(tnsr_emap(node->data, GRPH_NODE_DATA(g, a), tnsr_relu, NULL), goto error);
-  return node;
+bool node_erelu(grph_t *g, grph_size_t a) {
+  ASSERT(g && a != GRPH_NO_INPUT_ID && GRPH_NODE_TYPE(g, a) == NDTYPE_ERELU);
+  tnsr_t *data_a_dep0 = GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, a)[0]);
+  REQUIRE(tnsr_emap(GRPH_NODE_DATA(g, a), data_a_dep0, tnsr_relu, NULL), goto error);
+  return true;
 error:
-  node_destroy(&node);
-  return NULL;
+  return false;
 }
 
-node_t *node_eleakyrelu(grph_t *g, grph_size_t a, grph_size_t b) {
-  ASSERT(g && a != GRPH_NO_INPUT_ID && b == GRPH_NO_INPUT_ID);
-  node_t *node = node_create(g, NULL, a, b, NDTYPE_ELEAKYRELU);
-  REQUIRE(node, goto error);
+bool node_eleakyrelu(grph_t *g, grph_size_t a) {
+  ASSERT(g && a != GRPH_NO_INPUT_ID && GRPH_NODE_TYPE(g, a) == NDTYPE_ELEAKYRELU);
+  tnsr_t *data_a_dep0 = GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, a)[0]);
 
   gen_ctx_t ctx = {0.01f};  // Alpha.
-  REQUIRE(tnsr_emap(node->data, GRPH_NODE_DATA(g, a), tnsr_leaky_relu, &ctx), goto error);
-  return node;
+  REQUIRE(tnsr_emap(GRPH_NODE_DATA(g, a), data_a_dep0, tnsr_leaky_relu, &ctx), goto error);
+  return true;
 error:
-  node_destroy(&node);
-  return NULL;
+  return false;
 }
 
-node_t *node_mse(grph_t *g, grph_size_t a, grph_size_t b) {
-  ASSERT(g && a != GRPH_NO_INPUT_ID && b != GRPH_NO_INPUT_ID);
+bool node_mse(grph_t *g, grph_size_t a) {
+  ASSERT(g && a != GRPH_NO_INPUT_ID && GRPH_NODE_TYPE(g, a) == NDTYPE_MSE);
+  tnsr_t *data_a_dep0 = GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, a)[0]);
+  tnsr_t *data_a_dep1 = GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, a)[1]);
   tnsr_t *diff = NULL;
   tnsr_t *sum = NULL;
-  node_t *node = node_create(g, NULL, a, b, NDTYPE_MSE);
-  REQUIRE(node, goto error);
-  diff = tnsr_esub(NULL, GRPH_NODE_DATA(g, a), GRPH_NODE_DATA(g, b));
+  diff = tnsr_esub(NULL, data_a_dep0, data_a_dep1);
   REQUIRE(diff, goto error);
   gen_ctx_t ctx = {2.0f};  // Squared.
   REQUIRE(tnsr_emap(diff, diff, tnsr_powf, &ctx), goto error);
   sum = tnsr_sum_over_axis(NULL, diff, 1);
   REQUIRE(sum, goto error);
-  REQUIRE(tnsr_mean(node->data, sum), goto error);
+  REQUIRE(tnsr_mean(GRPH_NODE_DATA(g, a), sum), goto error);
 
   tnsr_destroy(&sum);
   tnsr_destroy(&diff);
-  return node;
+  return true;
 error:
   tnsr_destroy(&sum);
   tnsr_destroy(&diff);
-  node_destroy(&node);
-  return NULL;
+  return false;
 }
 
-node_t *node_categorical_cross_entropy_loss(grph_t *g, grph_size_t a, grph_size_t b) {
-  ASSERT(g && a != GRPH_NO_INPUT_ID && b != GRPH_NO_INPUT_ID);
+bool node_categorical_cross_entropy_loss(grph_t *g, grph_size_t a) {
+  ASSERT(g && a != GRPH_NO_INPUT_ID);
+  ASSERT(GRPH_NODE_TYPE(g, a) == NDTYPE_CATEGORICAL_CROSS_ENTROPY_LOSS);
+  tnsr_t *data_a_dep0 = GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, a)[0]);
+  tnsr_t *data_a_dep1 = GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, a)[1]);
+  tnsr_t *data = GRPH_NODE_DATA(g, a);
 
   tnsr_t *y_logp = NULL;
   tnsr_t *sum = NULL;
-  node_t *node = node_create(g, NULL, a, b, NDTYPE_CATEGORICAL_CROSS_ENTROPY_LOSS);
-  REQUIRE(node, goto error);
-  y_logp = tnsr_emap(NULL, GRPH_NODE_DATA(g, a), tnsr_ln, NULL);
+  y_logp = tnsr_emap(NULL, data_a_dep0, tnsr_ln, NULL);
   REQUIRE(y_logp, goto error);
-  REQUIRE(tnsr_emul(y_logp, y_logp, GRPH_NODE_DATA(g, b)), goto error);
+  REQUIRE(tnsr_emul(y_logp, y_logp, data_a_dep1), goto error);
   sum = tnsr_sum_over_axis(NULL, y_logp, 1);
   REQUIRE(sum, goto error);
-  REQUIRE(tnsr_mean(node->data, sum), goto error);
+  REQUIRE(tnsr_mean(data, sum), goto error);
   gen_ctx_t ctx = {-1.0f};  // Invert.
-  REQUIRE(tnsr_emap(node->data, node->data, tnsr_mul_n, &ctx), goto error);
+  REQUIRE(tnsr_emap(data, data, tnsr_mul_n, &ctx), goto error);
 
   tnsr_destroy(&y_logp);
   tnsr_destroy(&sum);
-  return node;
+  return true;
 error:
   tnsr_destroy(&y_logp);
   tnsr_destroy(&sum);
-  node_destroy(&node);
-  return NULL;
+  return false;
 }
 
-node_t *node_binary_cross_entropy_loss(grph_t *g, grph_size_t a, grph_size_t b) {
-  ASSERT(g && a != GRPH_NO_INPUT_ID && b != GRPH_NO_INPUT_ID);
+bool node_binary_cross_entropy_loss(grph_t *g, grph_size_t a) {
+  ASSERT(g && a != GRPH_NO_INPUT_ID && GRPH_NODE_TYPE(g, a) == NDTYPE_BINARY_CROSS_ENTROPY_LOSS);
+  tnsr_t *data_a_dep0 = GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, a)[0]);
+  tnsr_t *data_a_dep1 = GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, a)[1]);
+  tnsr_t *data = GRPH_NODE_DATA(g, a);
   tnsr_t *y_logp = NULL;
   tnsr_t *o_ylogp = NULL;
   tnsr_t *o_yt = NULL;
   tnsr_t *sum = NULL;
-  node_t *node = node_create(g, NULL, a, b, NDTYPE_BINARY_CROSS_ENTROPY_LOSS);
 
   gen_ctx_t ctx = {1.0f};
-  y_logp = tnsr_emap(NULL, GRPH_NODE_DATA(g, a), tnsr_ln, NULL);
-  o_ylogp = tnsr_emap(NULL, GRPH_NODE_DATA(g, a), tnsr_as_subtrahend, &ctx);
+  y_logp = tnsr_emap(NULL, data_a_dep0, tnsr_ln, NULL);
+  o_ylogp = tnsr_emap(NULL, data_a_dep0, tnsr_as_subtrahend, &ctx);
   REQUIRE(y_logp && o_ylogp, goto error);
   REQUIRE(tnsr_emap(o_ylogp, o_ylogp, tnsr_ln, NULL), goto error);
-  o_yt = tnsr_emap(NULL, GRPH_NODE_DATA(g, b), tnsr_as_subtrahend, &ctx);
+  o_yt = tnsr_emap(NULL, data_a_dep1, tnsr_as_subtrahend, &ctx);
   REQUIRE(o_yt, goto error);
 
   REQUIRE(tnsr_emul(o_ylogp, o_ylogp, o_yt), goto error);
-  REQUIRE(tnsr_emul(y_logp, y_logp, GRPH_NODE_DATA(g, b)), goto error);
+  REQUIRE(tnsr_emul(y_logp, y_logp, data_a_dep1), goto error);
 
   REQUIRE(tnsr_eadd(y_logp, y_logp, o_ylogp), goto error);
   sum = tnsr_sum_over_axis(NULL, y_logp, 1);
   REQUIRE(sum, goto error);
-  REQUIRE(tnsr_mean(node->data, sum), goto error);
+  REQUIRE(tnsr_mean(data, sum), goto error);
 
   ctx = (gen_ctx_t){-1.0f};  // Invert.
-  REQUIRE(tnsr_emap(node->data, node->data, tnsr_mul_n, &ctx), goto error);
-  REQUIRE(node, goto error);
+  REQUIRE(tnsr_emap(data, data, tnsr_mul_n, &ctx), goto error);
   tnsr_destroy(&y_logp);
   tnsr_destroy(&o_ylogp);
   tnsr_destroy(&o_yt);
   tnsr_destroy(&sum);
-  return node;
+  return true;
 error:
   tnsr_destroy(&y_logp);
   tnsr_destroy(&o_ylogp);
   tnsr_destroy(&o_yt);
   tnsr_destroy(&sum);
-  node_destroy(&node);
-  return NULL;
+  return false;
 }
 
-node_t *node_softmax(grph_t *g, grph_size_t a, grph_size_t b) {
-  ASSERT(g && a != GRPH_NO_INPUT_ID && b == GRPH_NO_INPUT_ID);
-  tnsr_t *max = NULL;
-  tnsr_t *sum = NULL;
-  node_t *node = node_create(g, NULL, a, b, NDTYPE_SOFTMAX);
-  REQUIRE(node, goto error);
+bool node_softmax(grph_t *g, grph_size_t a) {
+  ASSERT(g && a != GRPH_NO_INPUT_ID && GRPH_NODE_TYPE(g, a) == NDTYPE_SOFTMAX);
+  tnsr_t *data_a_dep0 = GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, a)[0]);
+  tnsr_t *data = GRPH_NODE_DATA(g, a);
+  tnsr_t *reduced = GRPH_NODE_AUX(g, a);
 
-  max = tnsr_max_over_axis(NULL, GRPH_NODE_DATA(g, a), 1);
-  REQUIRE(max, goto error);
-  REQUIRE(tnsr_esub(node->data, GRPH_NODE_DATA(g, a), max), goto error);
+  REQUIRE(tnsr_max_over_axis(reduced, data_a_dep0, 1), goto error);
+  REQUIRE(tnsr_esub(data, data_a_dep0, reduced), goto error);
 
-  REQUIRE(tnsr_emap(node->data, node->data, tnsr_expf, NULL), goto error);
-  sum = tnsr_sum_over_axis(NULL, node->data, 1);
-  REQUIRE(sum, goto error);
-  REQUIRE(tnsr_ediv(node->data, node->data, sum), goto error);
+  REQUIRE(tnsr_emap(data, data, tnsr_expf, NULL), goto error);
+  REQUIRE(tnsr_sum_over_axis(reduced, data, 1), goto error);
+  REQUIRE(tnsr_ediv(data, data, reduced), goto error);
+  return true;
 
-  tnsr_destroy(&max);
-  tnsr_destroy(&sum);
-  return node;
+error:
+  return false;
+}
 
+bool node_etanh(grph_t *g, grph_size_t a) {
+  ASSERT(g && a != GRPH_NO_INPUT_ID && GRPH_NODE_TYPE(g, a) == NDTYPE_ETANH);
+  tnsr_t *data_a_dep0 = GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, a)[0]);
+  REQUIRE(tnsr_emap(GRPH_NODE_DATA(g, a), data_a_dep0, tnsr_tanh, NULL), goto error);
+  return true;
 error:
-  tnsr_destroy(&sum);
-  tnsr_destroy(&max);
-  node_destroy(&node);
-  return NULL;
+  return false;
 }
 
-node_t *node_etanh(grph_t *g, grph_size_t a, grph_size_t b) {
-  ASSERT(g && a != GRPH_NO_INPUT_ID && b == GRPH_NO_INPUT_ID);
-  node_t *node = node_create(g, NULL, a, b, NDTYPE_ETANH);
-  REQUIRE(node, goto error);
-  REQUIRE(tnsr_emap(node->data, GRPH_NODE_DATA(g, a), tnsr_tanh, NULL), goto error);
-  return node;
+/**
+ * Sharded layers.
+ * NOTE:
+ * Shards are split over the pool through loops of grain 1, so shard s always runs on the
+ * same worker (the one updating its parameters), and each shard's weights are streamed by
+ * one core. Every shard writes straight into its own columns of the output, which is never
+ * gathered separately. Reductions across shards are loops over the rows of per-shard partials.
+ */
+
+#define _SHARD_GRAIN 4096  // Values per chunk of the loops reducing partials.
+
+// State shared by the phases of a sharded kernel.
+typedef struct {
+  grph_t *g;
+  const grph_size_t *deps;
+  grph_size_t shards;
+  tnsr_size_t *first;
+  const tnsr_t *x;
+  tnsr_t *data;
+  const tnsr_t *grad;
+  tnsr_t *dz;
+  tnsr_size_t rows;
+  tnsr_type_t *partial;
+  tnsr_type_t *reduced;
+} _shard_ctx_t;
+
+// Strided view of the columns [first, first + n) of t.
+static tnsr_t _column_view(const tnsr_t *t, tnsr_size_t first, tnsr_size_t n) {
+  return (tnsr_t){
+      .shape = {TNSR_SHPE(t, 0), n},
+      .stride = {TNSR_STRD(t, 0), TNSR_STRD(t, 1)},
+      .data = t->data + first * TNSR_STRD(t, 1),
+  };
+}
+
+// First output column of every shard of A, followed by the total column count.
+static void _shard_columns(grph_t *g, grph_size_t a, tnsr_size_t *first) {
+  const grph_size_t shards = (GRPH_NODE_NDEP(g, a) - 1) / 2;
+  first[0] = 0;
+  for (grph_size_t s = 0; s < shards; ++s) {
+    const tnsr_t *w = GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, a)[1 + 2 * s]);
+    first[s + 1] = first[s] + TNSR_SHPE(w, 1);
+  }
+}
+
+// Row maxima (or sums) of the shard's columns, written to partial.
+static void _shard_row_reduce(const tnsr_t *t, tnsr_type_t *partial, bool sum) {
+  for (tnsr_size_t i = 0; i < TNSR_SHPE(t, 0); ++i) {
+    tnsr_type_t acc = sum ? 0 : -INFINITY;
+    for (tnsr_size_t j = 0; j < TNSR_SHPE(t, 1); ++j) {
+      const tnsr_type_t x = TNSR_DATA(t, i, j);
+      acc = sum ? acc + x : fmaxf(acc, x);
+    }
+    partial[i] = acc;
+  }
+}
+
+// Reduces the shards' row partials into reduced, through max or sum.
+static void _rows_reduce(size_t begin, size_t end, void *ctx, bool sum) {
+  const _shard_ctx_t *c = ctx;
+  for (tnsr_size_t i = begin; i < end; ++i) {
+    tnsr_type_t acc = sum ? 0 : -INFINITY;
+    for (grph_size_t s = 0; s < c->shards; ++s) {
+      const tnsr_type_t x = c->partial[s * c->rows + i];
+      acc = sum ? acc + x : fmaxf(acc, x);
+    }
+    c->reduced[i] = acc;
+  }
+}
+
+static void _rows_max(size_t begin, size_t end, void *ctx) {
+  _rows_reduce(begin, end, ctx, false);
+}
+
+static void _rows_sum(size_t begin, size_t end, void *ctx) {
+  _rows_reduce(begin, end, ctx, true);
+}
+
+// Y_s = X . W_s + B_s, followed by the row maxima of Y_s when reducing into a softmax.
+static void _shard_affine(size_t begin, size_t end, void *ctx) {
+  const _shard_ctx_t *c = ctx;
+  for (grph_size_t s = begin; s < end; ++s) {
+    const tnsr_t *biases = GRPH_NODE_DATA(c->g, c->deps[2 + 2 * s]);
+    tnsr_t view = _column_view(c->data, c->first[s], c->first[s + 1] - c->first[s]);
+    tnsr_t *out = &view;
+    for (tnsr_size_t i = 0; i < c->rows; ++i) {
+      for (tnsr_size_t j = 0; j < TNSR_SHPE(out, 1); ++j) {
+        TNSR_DATA(out, i, j) = TNSR_DATA(biases, 0, j);
+      }
+    }
+    tnsr_contract(out, c->x, GRPH_NODE_DATA(c->g, c->deps[1 + 2 * s]));
+    if (c->partial) {
+      _shard_row_reduce(out, c->partial + s * c->rows, false);
+    }
+  }
+}
+
+// Y_s = exp(Y_s - max), followed by the row sums of Y_s.
+static void _shard_exp(size_t begin, size_t end, void *ctx) {
+  const _shard_ctx_t *c = ctx;
+  for (grph_size_t s = begin; s < end; ++s) {
+    tnsr_t view = _column_view(c->data, c->first[s], c->first[s + 1] - c->first[s]);
+    tnsr_t *out = &view;
+    for (tnsr_size_t i = 0; i < c->rows; ++i) {
+      for (tnsr_size_t j = 0; j < TNSR_SHPE(out, 1); ++j) {
+        TNSR_DATA(out, i, j) = expf(TNSR_DATA(out, i, j) - c->reduced[i]);
+      }
+    }
+    _shard_row_reduce(out, c->partial + s * c->rows, true);
+  }
+}
+
+static void _shard_normalize(size_t begin, size_t end, void *ctx) {
+  const _shard_ctx_t *c = ctx;
+  for (grph_size_t s = begin; s < end; ++s) {
+    tnsr_t view = _column_view(c->data, c->first[s], c->first[s + 1] - c->first[s]);
+    tnsr_t *out = &view;
+    for (tnsr_size_t i = 0; i < c->rows; ++i) {
+      for (tnsr_size_t j = 0; j < TNSR_SHPE(out, 1); ++j) {
+        TNSR_DATA(out, i, j) /= c->reduced[i];
+      }
+    }
+  }
+}
+
+static bool _sharded_forward(grph_t *g, grph_size_t a, bool softmax) {
+  tpool_t *pool = tpool_global();
+  _shard_ctx_t c = {
+      .g = g,
+      .deps = GRPH_NODE_DEPS(g, a),
+      .shards = (GRPH_NODE_NDEP(g, a) - 1) / 2,
+      .x = GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, a)[0]),
+      .data = GRPH_NODE_DATA(g, a),
+      .rows = TNSR_SHPE(GRPH_NODE_DATA(g, a), 0),
+  };
+  c.first = malloc(sizeof(tnsr_size_t[c.shards + 1]));
+  REQUIRE(c.first, return false);
+  _shard_columns(g, a, c.first);
+
+  // Per-shard row partials, then their reduction across shards.
+  if (softmax) {
+    c.partial = malloc(sizeof(tnsr_type_t[c.shards * c.rows]));
+    c.reduced = malloc(sizeof(tnsr_type_t[c.rows]));
+    REQUIRE(c.partial && c.reduced, goto error);
+  }
+
+  const size_t row_grain = max(_SHARD_GRAIN / c.shards, 1);
+  tpool_parallel_for(pool, c.shards, 1, _shard_affine, &c);
+  if (softmax) {
+    tpool_parallel_for(pool, c.rows, row_grain, _rows_max, &c);
+    tpool_parallel_for(pool, c.shards, 1, _shard_exp, &c);
+    tpool_parallel_for(pool, c.rows, row_grain, _rows_sum, &c);
+    tpool_parallel_for(pool, c.shards, 1, _shard_normalize, &c);
+  }
+
+  free(c.first);
+  free(c.partial);
+  free(c.reduced);
+  return true;
 error:
-  node_destroy(&node);
-  return NULL;
+  free(c.first);
+  free(c.partial);
+  free(c.reduced);
+  return false;
+}
+
+bool node_sharded_affine(grph_t *g, grph_size_t a) {
+  ASSERT(g && a != GRPH_NO_INPUT_ID && GRPH_NODE_TYPE(g, a) == NDTYPE_SHARDED_AFFINE);
+  return _sharded_forward(g, a, false);
+}
+
+bool node_sharded_softmax(grph_t *g, grph_size_t a) {
+  ASSERT(g && a != GRPH_NO_INPUT_ID && GRPH_NODE_TYPE(g, a) == NDTYPE_SHARDED_SOFTMAX);
+  return _sharded_forward(g, a, true);
 }
 
 bool node_transpose_dx(grph_t *g, grph_size_t a) {
   ASSERT(g && a != GRPH_NO_INPUT_ID && GRPH_NODE_TYPE(g, a) == NDTYPE_TRANSPOSE);
-  tnsr_t *grad_a_dep0 = GRPH_NODE_GRAD(g, GRPH_NODE_DEPS(g, a)[0]);
   tnsr_t *local_deriv = tnsr_transpose(NULL, GRPH_NODE_GRAD(g, a));
   REQUIRE(local_deriv, goto error);
-  REQUIRE(_accumulate_grad(grad_a_dep0, local_deriv), goto error);
+  REQUIRE(_accumulate_grad(g, GRPH_NODE_DEPS(g, a)[0], local_deriv), goto error);
   tnsr_destroy(&local_deriv);
   return true;
 error:
   return false;
 }
 
-bool node_contract_dx(grph_t *g, grph_size_t a) {
-  ASSERT(g && a != GRPH_NO_INPUT_ID && GRPH_NODE_TYPE(g, a) == NDTYPE_CONTRACT);
-  tnsr_t *grad_a_dep0 = GRPH_NODE_GRAD(g, GRPH_NODE_DEPS(g, a)[0]);
-  tnsr_t *grad_a_dep1 = GRPH_NODE_GRAD(g, GRPH_NODE_DEPS(g, a)[1]);
-
-  tnsr_t *grad_a0 = NULL;
-  tnsr_t *grad_a1 = NULL;
-  tnsr_t *dep0_t = tnsr_transpose(NULL, GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, a)[0]));
-  tnsr_t *dep1_t = tnsr_transpose(NULL, GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, a)[1]));
-  REQUIRE(dep0_t && dep1_t, goto error);
-
-  grad_a0 = tnsr_contract(NULL, GRPH_NODE_GRAD(g, a), dep1_t);
-  grad_a1 = tnsr_contract(NULL, dep0_t, GRPH_NODE_GRAD(g, a));
-  REQUIRE(grad_a0 && grad_a1, goto error);
+// Runs task(first) as a task of the pool and task(second) on the calling thread.
+static void _run_pair(tpool_task_t task, void *first, void *second) {
+  tpool_t *pool = tpool_global();
+  tpool_group_t group;
+  tpool_group_init(&group);
+  if (!tpool_spawn(pool, &group, task, first)) {
+    task(first);
+  }
+  task(second);
+  tpool_wait(pool, &group);
+}
 
-  REQUIRE(_accumulate_grad(grad_a_dep0, grad_a0), goto error);
-  REQUIRE(_accumulate_grad(grad_a_dep1, grad_a1), goto error);
+// One half of the derivative of a contraction, towards one of its dependencies.
+typedef struct {
+  grph_t *g;
+  grph_size_t a;
+  grph_size_t dep;  // 0 or 1.
+  tnsr_t *transposed;
+  tnsr_t *grad;
+  bool status;
+} _contract_dx_ctx_t;
+
+static void _contract_dx_half(void *arg) {
+  _contract_dx_ctx_t *c = arg;
+  grph_t *g = c->g;
+  const grph_size_t *deps = GRPH_NODE_DEPS(g, c->a);
+  tnsr_t *grad_a = GRPH_NODE_GRAD(g, c->a);
+  // dA0 = dZ . A1^T, dA1 = A0^T . dZ
+  c->transposed = tnsr_transpose(NULL, GRPH_NODE_DATA(g, deps[1 - c->dep]));
+  if (c->transposed) {
+    c->grad = c->dep ? tnsr_contract(NULL, c->transposed, grad_a)
+                     : tnsr_contract(NULL, grad_a, c->transposed);
+  }
+  c->status = c->grad && _accumulate_grad(g, deps[c->dep], c->grad);
+}
 
-  tnsr_destroy(&dep0_t);
-  tnsr_destroy(&dep1_t);
-  tnsr_destroy(&grad_a0);
-  tnsr_destroy(&grad_a1);
+/**
+ * NOTE:
+ * Both contractions and both accumulations are independent of each other, and are
+ * run as a pair of tasks so they overlap.
+ */
+bool node_contract_dx(grph_t *g, grph_size_t a) {
+  ASSERT(g && a != GRPH_NO_INPUT_ID && GRPH_NODE_TYPE(g, a) == NDTYPE_CONTRACT);
+  _contract_dx_ctx_t halves[2] = {{.g = g, .a = a, .dep = 0}, {.g = g, .a = a, .dep = 1}};
+  _run_pair(_contract_dx_half, &halves[0], &halves[1]);
+  const bool status = halves[0].status && halves[1].status;
+  for (size_t i = 0; i < 2; ++i) {
+    tnsr_destroy(&halves[i].transposed);
+    tnsr_destroy(&halves[i].grad);
+  }
+  REQUIRE(status, goto error);
   return true;
 error:
-  tnsr_destroy(&grad_a0);
-  tnsr_destroy(&grad_a1);
-  tnsr_destroy(&dep0_t);
-  tnsr_destroy(&dep1_t);
   return false;
 }
 
+// Pushes grad into one dependency.
+typedef struct {
+  grph_t *g;
+  grph_size_t dst;
+  tnsr_t *grad;
+  bool status;
+} _accumulate_ctx_t;
+
+static void _accumulate_task(void *arg) {
+  _accumulate_ctx_t *c = arg;
+  c->status = _accumulate_grad(c->g, c->dst, c->grad);
+}
+
 bool node_eadd_dx(grph_t *g, grph_size_t a) {
   ASSERT(g && a != GRPH_NO_INPUT_ID && GRPH_NODE_TYPE(g, a) == NDTYPE_EADD);
-  tnsr_t *grad_a_dep0 = GRPH_NODE_GRAD(g, GRPH_NODE_DEPS(g, a)[0]);
-  tnsr_t *grad_a_dep1 = GRPH_NODE_GRAD(g, GRPH_NODE_DEPS(g, a)[1]);
-
-  REQUIRE(_accumulate_grad(grad_a_dep0, GRPH_NODE_GRAD(g, a)), goto error);
-  REQUIRE(_accumulate_grad(grad_a_dep1, GRPH_NODE_GRAD(g, a)), goto error);
+  tnsr_t *grad_a = GRPH_NODE_GRAD(g, a);
+  _accumulate_ctx_t halves[2] = {
+      {.g = g, .dst = GRPH_NODE_DEPS(g, a)[0], .grad = grad_a},
+      {.g = g, .dst = GRPH_NODE_DEPS(g, a)[1], .grad = grad_a},
+  };
+  _run_pair(_accumulate_task, &halves[0], &halves[1]);
+  REQUIRE(halves[0].status && halves[1].status, goto error);
   return true;
 error:
   return false;
@@ -454,14 +766,12 @@ error:
 
 bool node_esub_dx(grph_t *g, grph_size_t a) {
   ASSERT(g && a != GRPH_NO_INPUT_ID && GRPH_NODE_TYPE(g, a) == NDTYPE_ESUB);
-  tnsr_t *grad_a_dep0 = GRPH_NODE_GRAD(g, GRPH_NODE_DEPS(g, a)[0]);
-  tnsr_t *grad_a_dep1 = GRPH_NODE_GRAD(g, GRPH_NODE_DEPS(g, a)[1]);
 
   gen_ctx_t ctx = {-1.0f};  // Invert.
   tnsr_t *negative = tnsr_emap(NULL, GRPH_NODE_GRAD(g, a), tnsr_mul_n, &ctx);
   REQUIRE(negative, goto error);
-  REQUIRE(_accumulate_grad(grad_a_dep0, GRPH_NODE_GRAD(g, a)), goto error);
-  REQUIRE(_accumulate_grad(grad_a_dep1, negative), goto error);
+  REQUIRE(_accumulate_grad(g, GRPH_NODE_DEPS(g, a)[0], GRPH_NODE_GRAD(g, a)), goto error);
+  REQUIRE(_accumulate_grad(g, GRPH_NODE_DEPS(g, a)[1], negative), goto error);
 
   tnsr_destroy(&negative);
   return true;
@@ -472,8 +782,6 @@ error:
 
 bool node_emul_dx(grph_t *g, grph_size_t a) {
   ASSERT(g && a != GRPH_NO_INPUT_ID && GRPH_NODE_TYPE(g, a) == NDTYPE_EMUL);
-  tnsr_t *grad_a_dep0 = GRPH_NODE_GRAD(g, GRPH_NODE_DEPS(g, a)[0]);
-  tnsr_t *grad_a_dep1 = GRPH_NODE_GRAD(g, GRPH_NODE_DEPS(g, a)[1]);
   tnsr_t *data_a_dep0 = GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, a)[0]);
   tnsr_t *data_a_dep1 = GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, a)[1]);
 
@@ -481,8 +789,8 @@ bool node_emul_dx(grph_t *g, grph_size_t a) {
   tnsr_t *dep1_inter = tnsr_emul(NULL, data_a_dep0, GRPH_NODE_GRAD(g, a));
   REQUIRE(dep0_inter && dep1_inter, goto error);
 
-  REQUIRE(_accumulate_grad(grad_a_dep0, dep0_inter), goto error);
-  REQUIRE(_accumulate_grad(grad_a_dep1, dep1_inter), goto error);
+  REQUIRE(_accumulate_grad(g, GRPH_NODE_DEPS(g, a)[0], dep0_inter), goto error);
+  REQUIRE(_accumulate_grad(g, GRPH_NODE_DEPS(g, a)[1], dep1_inter), goto error);
   tnsr_destroy(&dep0_inter);
   tnsr_destroy(&dep1_inter);
   return true;
@@ -494,8 +802,6 @@ error:
 
 bool node_ediv_dx(grph_t *g, grph_size_t a) {
   ASSERT(g && a != GRPH_NO_INPUT_ID && GRPH_NODE_TYPE(g, a) == NDTYPE_EDIV);
-  tnsr_t *grad_a_dep0 = GRPH_NODE_GRAD(g, GRPH_NODE_DEPS(g, a)[0]);
-  tnsr_t *grad_a_dep1 = GRPH_NODE_GRAD(g, GRPH_NODE_DEPS(g, a)[1]);
   tnsr_t *data_a_dep0 = GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, a)[0]);
   tnsr_t *data_a_dep1 = GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, a)[1]);
 
@@ -511,8 +817,8 @@ bool node_ediv_dx(grph_t *g, grph_size_t a) {
   REQUIRE(tnsr_emul(dep0_inter, dep0_inter, GRPH_NODE_GRAD(g, a)), goto error);
   REQUIRE(tnsr_emul(dep1_inter, dep1_inter, GRPH_NODE_GRAD(g, a)), goto error);
 
-  REQUIRE(_accumulate_grad(grad_a_dep0, dep0_inter), goto error);
-  REQUIRE(_accumulate_grad(grad_a_dep1, dep1_inter), goto error);
+  REQUIRE(_accumulate_grad(g, GRPH_NODE_DEPS(g, a)[0], dep0_inter), goto error);
+  REQUIRE(_accumulate_grad(g, GRPH_NODE_DEPS(g, a)[1], dep1_inter), goto error);
   tnsr_destroy(&dep0_inter);
   tnsr_destroy(&dep1_inter);
   return true;
@@ -524,12 +830,11 @@ error:
 
 bool node_esigmoid_dx(grph_t *g, grph_size_t a) {
   ASSERT(g && a != GRPH_NO_INPUT_ID && GRPH_NODE_TYPE(g, a) == NDTYPE_ESIGMOID);
-  tnsr_t *grad_a_dep0 = GRPH_NODE_GRAD(g, GRPH_NODE_DEPS(g, a)[0]);
 
   tnsr_t *inter = tnsr_emap(NULL, GRPH_NODE_DATA(g, a), tnsr_sigmoid_odx, NULL);
   REQUIRE(inter, goto error);
   REQUIRE(tnsr_emul(inter, inter, GRPH_NODE_GRAD(g, a)), goto error);
-  REQUIRE(_accumulate_grad(grad_a_dep0, inter), goto error);
+  REQUIRE(_accumulate_grad(g, GRPH_NODE_DEPS(g, a)[0], inter), goto error);
   tnsr_destroy(&inter);
   return true;
 error:
@@ -539,12 +844,11 @@ error:
 
 bool node_erelu_dx(grph_t *g, grph_size_t a) {
   ASSERT(g && a != GRPH_NO_INPUT_ID && GRPH_NODE_TYPE(g, a) == NDTYPE_ERELU);
-  tnsr_t *grad_a_dep0 = GRPH_NODE_GRAD(g, GRPH_NODE_DEPS(g, a)[0]);
  
   tnsr_t *inter = tnsr_emap(NULL, GRPH_NODE_DATA(g, a), tnsr_relu_dx, NULL);
   REQUIRE(inter, goto error);
   REQUIRE(tnsr_emul(inter, inter, GRPH_NODE_GRAD(g, a)), goto error);
-  REQUIRE(_accumulate_grad(grad_a_dep0, inter), goto error);
+  REQUIRE(_accumulate_grad(g, GRPH_NODE_DEPS(g, a)[0], inter), goto error);
   tnsr_destroy(&inter);
   return true;
 error:
@@ -554,13 +858,12 @@ error:
 
 bool node_eleakyrelu_dx(grph_t *g, grph_size_t a) {
   ASSERT(g && a != GRPH_NO_INPUT_ID && GRPH_NODE_TYPE(g, a) == NDTYPE_ELEAKYRELU);
-  tnsr_t *grad_a_dep0 = GRPH_NODE_GRAD(g, GRPH_NODE_DEPS(g, a)[0]);
 
   gen_ctx_t ctx = {0.01};  // Alpha.
   tnsr_t *inter = tnsr_emap(NULL, GRPH_NODE_DATA(g, a), tnsr_leaky_relu_dx, &ctx);
   REQUIRE(inter, goto error);
   REQUIRE(tnsr_emul(inter, inter, GRPH_NODE_GRAD(g, a)), goto error);
-  REQUIRE(_accumulate_grad(grad_a_dep0, inter), goto error);
+  REQUIRE(_accumulate_grad(g, GRPH_NODE_DEPS(g, a)[0], inter), goto error);
   tnsr_destroy(&inter);
   return true;
 error:
@@ -571,20 +874,19 @@ error:
 bool node_mse_dx(grph_t *g, grph_size_t a) {
   ASSERT(g && a != GRPH_NO_INPUT_ID && GRPH_NODE_TYPE(g, a) == NDTYPE_MSE);
   tnsr_t *grad_a_dep0 = GRPH_NODE_GRAD(g, GRPH_NODE_DEPS(g, a)[0]);
-  tnsr_t *grad_a_dep1 = GRPH_NODE_GRAD(g, GRPH_NODE_DEPS(g, a)[1]);
   tnsr_t *data_a_dep0 = GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, a)[0]);
   tnsr_t *data_a_dep1 = GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, a)[1]);
-  tnsr_set(GRPH_NODE_GRAD(g, a), 1);
+  tnsr_set(GRPH_NODE_GRAD(g, a), g->loss_scale);
 
   tnsr_t *diff = tnsr_esub(NULL, data_a_dep0, data_a_dep1);
   REQUIRE(diff, goto error);
 
-  gen_ctx_t ctx = {2.0f / TNSR_SHPE(grad_a_dep0, 0)};
+  gen_ctx_t ctx = {2.0f * g->loss_scale / TNSR_SHPE(grad_a_dep0, 0)};
   REQUIRE(tnsr_emap(diff, diff, tnsr_mul_n, &ctx), goto error);
-  REQUIRE(_accumulate_grad(grad_a_dep0, diff), goto error);
+  REQUIRE(_accumulate_grad(g, GRPH_NODE_DEPS(g, a)[0], diff), goto error);
   ctx.n = -1.0f;
   REQUIRE(tnsr_emap(diff, diff, tnsr_mul_n, &ctx), goto error);
-  REQUIRE(_accumulate_grad(grad_a_dep1, diff), goto error);
+  REQUIRE(_accumulate_grad(g, GRPH_NODE_DEPS(g, a)[1], diff), goto error);
 
   tnsr_destroy(&diff);
   return true;
@@ -596,23 +898,21 @@ error:
 bool node_categorical_cross_entropy_loss_dx(grph_t *g, grph_size_t a) {
   ASSERT(g && a != GRPH_NO_INPUT_ID);
   ASSERT(GRPH_NODE_TYPE(g, a) == NDTYPE_CATEGORICAL_CROSS_ENTROPY_LOSS);
-  tnsr_t *grad_a_dep0 = GRPH_NODE_GRAD(g, GRPH_NODE_DEPS(g, a)[0]);
-  tnsr_t *grad_a_dep1 = GRPH_NODE_GRAD(g, GRPH_NODE_DEPS(g, a)[1]);
   tnsr_t *data_a_dep0 = GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, a)[0]);
   tnsr_t *data_a_dep1 = GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, a)[1]);
 
-  tnsr_set(GRPH_NODE_GRAD(g, a), 1);
+  tnsr_set(GRPH_NODE_GRAD(g, a), g->loss_scale);
   tnsr_t *inter = tnsr_create(TNSR_SHPE(data_a_dep1, 0), TNSR_SHPE(data_a_dep1, 1));
   REQUIRE(inter, goto error);
 
-  gen_ctx_t ctx = {-1.0f / TNSR_SHPE(data_a_dep0, 0)};
+  gen_ctx_t ctx = {-g->loss_scale / TNSR_SHPE(data_a_dep0, 0)};
   REQUIRE(tnsr_emap(inter, data_a_dep1, tnsr_mul_n, &ctx), goto error);
   REQUIRE(tnsr_ediv(inter, inter, data_a_dep0), goto error);
-  REQUIRE(_accumulate_grad(grad_a_dep0, inter), goto error);
+  REQUIRE(_accumulate_grad(g, GRPH_NODE_DEPS(g, a)[0], inter), goto error);
 
   REQUIRE(tnsr_emap(inter, data_a_dep0, tnsr_ln, NULL), goto error);
   REQUIRE(tnsr_emap(inter, inter, tnsr_mul_n, &ctx), goto error);
-  REQUIRE(_accumulate_grad(grad_a_dep1, inter), goto error);
+  REQUIRE(_accumulate_grad(g, GRPH_NODE_DEPS(g, a)[1], inter), goto error);
 
   tnsr_destroy(&inter);
   return true;
@@ -632,7 +932,7 @@ bool node_binary_cross_entropy_loss_dx(grph_t *g, grph_size_t a) {
   tnsr_t *y_wrt_true = NULL;
   tnsr_t *inter1 = tnsr_create(TNSR_SHPE(y_pred, 0), TNSR_SHPE(y_pred, 1));
   tnsr_t *inter2 = tnsr_create(TNSR_SHPE(y_pred, 0), TNSR_SHPE(y_pred, 1));
-  tnsr_set(GRPH_NODE_GRAD(g, a), 1);
+  tnsr_set(GRPH_NODE_GRAD(g, a), g->loss_scale);  // Scales both gradients below.
 
   REQUIRE(inter1 && inter2, goto error);
 
@@ -658,8 +958,8 @@ bool node_binary_cross_entropy_loss_dx(grph_t *g, grph_size_t a) {
   REQUIRE(tnsr_emul(y_wrt_pred, y_wrt_pred, GRPH_NODE_GRAD(g, a)), goto error);
   REQUIRE(tnsr_emul(y_wrt_true, y_wrt_true, GRPH_NODE_GRAD(g, a)), goto error);
 
-  REQUIRE(_accumulate_grad(GRPH_NODE_GRAD(g, GRPH_NODE_DEPS(g, a)[0]), y_wrt_pred), goto error);
-  REQUIRE(_accumulate_grad(GRPH_NODE_GRAD(g, GRPH_NODE_DEPS(g, a)[1]), y_wrt_true), goto error);
+  REQUIRE(_accumulate_grad(g, GRPH_NODE_DEPS(g, a)[0], y_wrt_pred), goto error);
+  REQUIRE(_accumulate_grad(g, GRPH_NODE_DEPS(g, a)[1], y_wrt_true), goto error);
 
   tnsr_destroy(&inter1);
   tnsr_destroy(&inter2);
@@ -677,7 +977,6 @@ error:
 
 bool node_softmax_dx(grph_t *g, grph_size_t a) {
   ASSERT(g && a != GRPH_NO_INPUT_ID && GRPH_NODE_TYPE(g, a) == NDTYPE_SOFTMAX);
-  tnsr_t *grad_a_dep0 = GRPH_NODE_GRAD(g, GRPH_NODE_DEPS(g, a)[0]);
 
   tnsr_t *sub = NULL;
   tnsr_t *dot = NULL;
@@ -689,7 +988,7 @@ bool node_softmax_dx(grph_t *g, grph_size_t a) {
 
   REQUIRE(sub, goto error);
   REQUIRE(tnsr_emul(sub, sub, GRPH_NODE_DATA(g, a)), goto error);
-  REQUIRE(_accumulate_grad(grad_a_dep0, sub), goto error);
+  REQUIRE(_accumulate_grad(g, GRPH_NODE_DEPS(g, a)[0], sub), goto error);
 
   tnsr_destroy(&inter);
   tnsr_destroy(&dot);
@@ -704,15 +1003,563 @@ error:
 
 bool node_etanh_dx(grph_t *g, grph_size_t a) {
   ASSERT(g && a != GRPH_NO_INPUT_ID && GRPH_NODE_TYPE(g, a) == NDTYPE_ETANH);
-  tnsr_t *grad_a_dep0 = GRPH_NODE_GRAD(g, GRPH_NODE_DEPS(g, a)[0]);
 
   tnsr_t *inter = tnsr_emap(NULL, GRPH_NODE_DATA(g, a), tnsr_tanh_odx, NULL);
   REQUIRE(inter, goto error);
   REQUIRE(tnsr_emul(inter, inter, GRPH_NODE_GRAD(g, a)), goto error);
-  REQUIRE(_accumulate_grad(grad_a_dep0, inter), goto error);
+  REQUIRE(_accumulate_grad(g, GRPH_NODE_DEPS(g, a)[0], inter), goto error);
   tnsr_destroy(&inter);
   return true;
 error:
   tnsr_destroy(&inter);
   return false;
 }
+
+// dW_s = X^T . dZ_s, dB_s = sum(dZ_s), and the shard's partial dX_s = dZ_s . W_s^T.
+static void _shard_affine_dx(size_t begin, size_t end, void *ctx) {
+  const _shard_ctx_t *c = ctx;
+  const tnsr_size_t fan_in = TNSR_SHPE(c->x, 1);
+  const tnsr_t xt = {
+      .shape = {fan_in, c->rows},
+      .stride = {TNSR_STRD(c->x, 1), TNSR_STRD(c->x, 0)},
+      .data = c->x->data,
+  };
+  for (grph_size_t s = begin; s < end; ++s) {
+    const tnsr_t *w = GRPH_NODE_DATA(c->g, c->deps[1 + 2 * s]);
+    tnsr_t *grad_b = GRPH_NODE_GRAD(c->g, c->deps[2 + 2 * s]);
+    const tnsr_t view = _column_view(c->dz, c->first[s], c->first[s + 1] - c->first[s]);
+    const tnsr_t *dzs = &view;
+    const tnsr_t wt = {
+        .shape = {TNSR_SHPE(w, 1), TNSR_SHPE(w, 0)},
+        .stride = {TNSR_STRD(w, 1), TNSR_STRD(w, 0)},
+        .data = w->data,
+    };
+    tnsr_t px = {
+        .shape = {c->rows, fan_in},
+        .stride = {fan_in, 1},
+        .data = c->partial + s * c->rows * fan_in,
+    };
+
+    tnsr_contract(GRPH_NODE_GRAD(c->g, c->deps[1 + 2 * s]), &xt, dzs);
+    tnsr_contract(&px, dzs, &wt);
+    for (tnsr_size_t i = 0; i < c->rows; ++i) {
+      for (tnsr_size_t j = 0; j < TNSR_SHPE(dzs, 1); ++j) {
+        TNSR_DATA(grad_b, 0, j) += TNSR_DATA(dzs, i, j);
+      }
+    }
+  }
+}
+
+// Sums the shards' partial input gradients into the first one.
+static void _sum_partials(size_t begin, size_t end, void *ctx) {
+  const _shard_ctx_t *c = ctx;
+  const size_t count = c->rows * TNSR_SHPE(c->x, 1);
+#pragma omp simd
+  for (size_t i = begin; i < end; ++i) {
+    tnsr_type_t sum = c->partial[i];
+    for (grph_size_t s = 1; s < c->shards; ++s) {
+      sum += c->partial[s * count + i];
+    }
+    c->partial[i] = sum;
+  }
+}
+
+/**
+ * Pushes the gradient dz of the sharded product into X, and into every shard's weights
+ * and biases.
+ * NOTE:
+ * Weight and bias gradients are accumulated without locking, as each shard's parameters
+ * are only consumed by this node. The input gradient is reduced from per-shard partials.
+ */
+static bool _sharded_affine_dx(grph_t *g, grph_size_t a, tnsr_t *dz) {
+  tpool_t *pool = tpool_global();
+  tnsr_t *grad_x = NULL;
+  _shard_ctx_t c = {
+      .g = g,
+      .deps = GRPH_NODE_DEPS(g, a),
+      .shards = (GRPH_NODE_NDEP(g, a) - 1) / 2,
+      .x = GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, a)[0]),
+      .dz = dz,
+  };
+  c.rows = TNSR_SHPE(c.x, 0);
+  const tnsr_size_t fan_in = TNSR_SHPE(c.x, 1);
+  c.first = malloc(sizeof(tnsr_size_t[c.shards + 1]));
+  c.partial = calloc(c.shards, sizeof(tnsr_type_t[c.rows * fan_in]));
+  REQUIRE(c.first && c.partial, goto error);
+  _shard_columns(g, a, c.first);
+
+  tpool_parallel_for(pool, c.shards, 1, _shard_affine_dx, &c);
+  tpool_parallel_for(pool, c.rows * fan_in, _SHARD_GRAIN, _sum_partials, &c);
+
+  grad_x = tnsr_view(c.partial, c.rows, fan_in);
+  REQUIRE(grad_x, goto error);
+  REQUIRE(_accumulate_grad(g, c.deps[0], grad_x), goto error);
+  tnsr_destroy(&grad_x);
+  free(c.first);
+  free(c.partial);
+  return true;
+error:
+  tnsr_destroy(&grad_x);
+  free(c.first);
+  free(c.partial);
+  return false;
+}
+
+bool node_sharded_affine_dx(grph_t *g, grph_size_t a) {
+  ASSERT(g && a != GRPH_NO_INPUT_ID && GRPH_NODE_TYPE(g, a) == NDTYPE_SHARDED_AFFINE);
+  return _sharded_affine_dx(g, a, GRPH_NODE_GRAD(g, a));
+}
+
+// Row dot products of the shard's columns of the output and of its gradient.
+static void _shard_dot(size_t begin, size_t end, void *ctx) {
+  const _shard_ctx_t *c = ctx;
+  for (grph_size_t s = begin; s < end; ++s) {
+    for (tnsr_size_t i = 0; i < c->rows; ++i) {
+      tnsr_type_t acc = 0;
+      for (tnsr_size_t j = c->first[s]; j < c->first[s + 1]; ++j) {
+        acc += TNSR_DATA(c->grad, i, j) * TNSR_DATA(c->data, i, j);
+      }
+      c->partial[s * c->rows + i] = acc;
+    }
+  }
+}
+
+// dZ_s = Y_s * (dY_s - dot).
+static void _shard_softmax_dz(size_t begin, size_t end, void *ctx) {
+  const _shard_ctx_t *c = ctx;
+  for (grph_size_t s = begin; s < end; ++s) {
+    for (tnsr_size_t i = 0; i < c->rows; ++i) {
+      for (tnsr_size_t j = c->first[s]; j < c->first[s + 1]; ++j) {
+        const tnsr_type_t y = TNSR_DATA(c->data, i, j);
+        TNSR_DATA(c->dz, i, j) = y * (TNSR_DATA(c->grad, i, j) - c->reduced[i]);
+      }
+    }
+  }
+}
+
+// The row dot products of the softmax derivative are reduced from per-shard partials.
+bool node_sharded_softmax_dx(grph_t *g, grph_size_t a) {
+  ASSERT(g && a != GRPH_NO_INPUT_ID && GRPH_NODE_TYPE(g, a) == NDTYPE_SHARDED_SOFTMAX);
+  tpool_t *pool = tpool_global();
+  _shard_ctx_t c = {
+      .g = g,
+      .shards = (GRPH_NODE_NDEP(g, a) - 1) / 2,
+      .data = GRPH_NODE_DATA(g, a),
+      .grad = GRPH_NODE_GRAD(g, a),
+      .rows = TNSR_SHPE(GRPH_NODE_DATA(g, a), 0),
+  };
+  c.first = malloc(sizeof(tnsr_size_t[c.shards + 1]));
+  c.partial = malloc(sizeof(tnsr_type_t[c.shards * c.rows]));
+  c.reduced = malloc(sizeof(tnsr_type_t[c.rows]));
+  c.dz = tnsr_create(c.rows, TNSR_SHPE(c.data, 1));
+  REQUIRE(c.first && c.partial && c.reduced && c.dz, goto error);
+  _shard_columns(g, a, c.first);
+
+  tpool_parallel_for(pool, c.shards, 1, _shard_dot, &c);
+  tpool_parallel_for(pool, c.rows, max(_SHARD_GRAIN / c.shards, 1), _rows_sum, &c);
+  tpool_parallel_for(pool, c.shards, 1, _shard_softmax_dz, &c);
+
+  REQUIRE(_sharded_affine_dx(g, a, c.dz), goto error);
+  free(c.first);
+  free(c.partial);
+  free(c.reduced);
+  tnsr_destroy(&c.dz);
+  return true;
+error:
+  free(c.first);
+  free(c.partial);
+  free(c.reduced);
+  tnsr_destroy(&c.dz);
+  return false;
+}
+
+/**
+ * Convolutions are lowered to a contraction of the patches of the images (im2col) with the
+ * filters. Each row of the patches holds the kernel-sized window below one output position,
+ * such that the product holds the filters' responses at every position, in output layout.
+ */
+typedef struct {
+  const grph_conv_t *conv;
+  const tnsr_t *images;
+  tnsr_t *patches;      // One row per output position of every image, before pooling.
+  tnsr_t *maps;         // The filters' responses at every position, one row per position.
+  tnsr_t *pooled;       // Node data or grad, one row per image.
+  tnsr_t *windows;      // Offset of the maximum in each pooling window.
+  tnsr_t *images_grad;  // Gradient of the images, summed from their patches' gradient.
+  tnsr_size_t height;   // Of the feature maps, before pooling.
+  tnsr_size_t width;
+} _conv_ctx_t;
+
+
+#define _CONV_GRAIN 4096  // Values per chunk of the loops over patches and feature maps.
+
+// Offset in its image of the first channel below kernel position (ky, kx) of the patch of
+// output position r, TNSR_MAX_SIZE when it falls on the padding.
+static tnsr_size_t _conv_pixel(
+    const _conv_ctx_t *c, tnsr_size_t r, tnsr_size_t ky, tnsr_size_t kx
+) {
+  const grph_conv_t *conv = c->conv;
+  const tnsr_size_t stride = max(conv->stride, (tnsr_size_t)1);
+  const tnsr_size_t y = r / c->width % c->height * stride + ky;  // In the padded image.
+  const tnsr_size_t x = r % c->width * stride + kx;
+  if (y < conv->padding || y >= conv->height + conv->padding || x < conv->padding ||
+      x >= conv->width + conv->padding) {
+    return TNSR_MAX_SIZE;
+  }
+  return ((y - conv->padding) * conv->width + x - conv->padding) * conv->channels;
+}
+
+// Row of the feature maps holding position w of the pooling window (py, px) of an image.
+static tnsr_size_t _conv_window_row(
+    const _conv_ctx_t *c, tnsr_size_t image, tnsr_size_t py, tnsr_size_t px, tnsr_size_t w
+) {
+  const tnsr_size_t pool = c->conv->pool;
+  return (image * c->height + py * pool + w / pool) * c->width + px * pool + w % pool;
+}
+
+static void _conv_im2col(size_t begin, size_t end, void *ctx) {
+  const _conv_ctx_t *c = ctx;
+  const grph_conv_t *conv = c->conv;
+  const tnsr_size_t positions = c->height * c->width;
+  for (tnsr_size_t r = begin; r < end; ++r) {
+    const tnsr_size_t image = r / positions;
+    tnsr_size_t k = 0;
+    for (tnsr_size_t ky = 0; ky < conv->kernel_height; ++ky) {
+      for (tnsr_size_t kx = 0; kx < conv->kernel_width; ++kx) {
+        const tnsr_size_t pixel = _conv_pixel(c, r, ky, kx);
+        for (tnsr_size_t ch = 0; ch < conv->channels; ++ch, ++k) {
+          const tnsr_size_t j = pixel + ch;
+          TNSR_DATA(c->patches, r, k) = pixel == TNSR_MAX_SIZE ? 0 : TNSR_DATA(c->images, image, j);
+        }
+      }
+    }
+  }
+}
+
+// Sums the gradient of the patches back into their images, image by image such that no two
+// chunks write the same values.
+static void _conv_col2im(size_t begin, size_t end, void *ctx) {
+  const _conv_ctx_t *c = ctx;
+  const grph_conv_t *conv = c->conv;
+  const tnsr_size_t positions = c->height * c->width;
+  for (tnsr_size_t image = begin; image < end; ++image) {
+    for (tnsr_size_t r = image * positions; r < (image + 1) * positions; ++r) {
+      tnsr_size_t k = 0;
+      for (tnsr_size_t ky = 0; ky < conv->kernel_height; ++ky) {
+        for (tnsr_size_t kx = 0; kx < conv->kernel_width; ++kx) {
+          const tnsr_size_t pixel = _conv_pixel(c, r, ky, kx);
+          if (pixel == TNSR_MAX_SIZE) {
+            k += conv->channels;
+            continue;
+          }
+          for (tnsr_size_t ch = 0; ch < conv->channels; ++ch, ++k) {
+            const tnsr_size_t j = pixel + ch;
+            TNSR_DATA(c->images_grad, image, j) += TNSR_DATA(c->patches, r, k);
+          }
+        }
+      }
+    }
+  }
+}
+
+static void _conv_pool(size_t begin, size_t end, void *ctx) {
+  const _conv_ctx_t *c = ctx;
+  const tnsr_size_t pool = c->conv->pool;
+  const tnsr_size_t filters = c->conv->filters;
+  const tnsr_size_t pooled_width = c->width / pool;
+  for (tnsr_size_t image = begin; image < end; ++image) {
+    for (tnsr_size_t py = 0; py < c->height / pool; ++py) {
+      for (tnsr_size_t px = 0; px < pooled_width; ++px) {
+        const tnsr_size_t first = (py * pooled_width + px) * filters;
+        for (tnsr_size_t w = 0; w < pool * pool; ++w) {
+          const tnsr_size_t r = _conv_window_row(c, image, py, px, w);
+          for (tnsr_size_t f = 0; f < filters; ++f) {
+            const tnsr_size_t j = first + f;
+            const tnsr_type_t value = TNSR_DATA(c->maps, r, f);
+            if (w == 0 || value > TNSR_DATA(c->pooled, image, j)) {
+              TNSR_DATA(c->pooled, image, j) = value;
+              TNSR_DATA(c->windows, image, j) = (tnsr_type_t)w;
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+// Routes the gradient of each pooled value to the position its maximum was taken from.
+static void _conv_unpool(size_t begin, size_t end, void *ctx) {
+  const _conv_ctx_t *c = ctx;
+  const tnsr_size_t pool = c->conv->pool;
+  const tnsr_size_t filters = c->conv->filters;
+  const tnsr_size_t pooled_width = c->width / pool;
+  for (tnsr_size_t image = begin; image < end; ++image) {
+    for (tnsr_size_t py = 0; py < c->height / pool; ++py) {
+      for (tnsr_size_t px = 0; px < pooled_width; ++px) {
+        const tnsr_size_t first = (py * pooled_width + px) * filters;
+        for (tnsr_size_t f = 0; f < filters; ++f) {
+          const tnsr_size_t j = first + f;
+          const tnsr_size_t w = (tnsr_size_t)TNSR_DATA(c->windows, image, j);
+          const tnsr_size_t r = _conv_window_row(c, image, py, px, w);
+          TNSR_DATA(c->maps, r, f) = TNSR_DATA(c->pooled, image, j);
+        }
+      }
+    }
+  }
+}
+
+// Sets up the context of node a. Views its unpooled feature maps from field when unpooled.
+static bool _conv_init(grph_t *g, grph_size_t a, tnsr_t *field, _conv_ctx_t *c) {
+  const grph_conv_t *conv = GRPH_NODE_ATTR(g, a);
+  *c = (_conv_ctx_t){
+      .conv = conv,
+      .images = GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, a)[0]),
+      .pooled = field,
+      .windows = GRPH_NODE_AUX(g, a),
+  };
+  grph_conv_output(conv, &c->height, &c->width);
+  const tnsr_size_t rows = TNSR_SHPE(c->images, 0) * c->height * c->width;
+  c->maps = conv->pool > 1 ? tnsr_create(rows, conv->filters)
+                           : tnsr_view(field->data, rows, conv->filters);
+  REQUIRE(c->maps, goto error);
+  return true;
+error:
+  return false;
+}
+
+static bool _conv_patches(_conv_ctx_t *c) {
+  const tnsr_size_t rows = TNSR_SHPE(c->maps, 0);
+  const tnsr_size_t size = c->conv->kernel_height * c->conv->kernel_width * c->conv->channels;
+  c->patches = tnsr_create(rows, size);
+  REQUIRE(c->patches, goto error);
+  tpool_parallel_for(tpool_global(), rows, max(_CONV_GRAIN / size, 1), _conv_im2col, c);
+  return true;
+error:
+  return false;
+}
+
+bool node_conv(grph_t *g, grph_size_t a) {
+  ASSERT(g && a != GRPH_NO_INPUT_ID && GRPH_NODE_TYPE(g, a) == NDTYPE_CONV);
+  const grph_size_t *deps = GRPH_NODE_DEPS(g, a);
+  tnsr_t *data = GRPH_NODE_DATA(g, a);
+  _conv_ctx_t c = {0};
+  REQUIRE(_conv_init(g, a, data, &c), goto error);
+  REQUIRE(_conv_patches(&c), goto error);
+
+  // Z = P * W + B, biases are broadcast into the destination the product accumulates into.
+  tnsr_reset(c.maps);
+  REQUIRE(tnsr_eadd(c.maps, c.maps, GRPH_NODE_DATA(g, deps[2])), goto error);
+  REQUIRE(tnsr_contract(c.maps, c.patches, GRPH_NODE_DATA(g, deps[1])), goto error);
+  if (c.conv->pool > 1) {
+    tpool_parallel_for(tpool_global(), TNSR_SHPE(data, 0), 1, _conv_pool, &c);
+  }
+  tnsr_destroy(&c.patches);
+  tnsr_destroy(&c.maps);
+  return true;
+error:
+  tnsr_destroy(&c.patches);
+  tnsr_destroy(&c.maps);
+  return false;
+}
+
+// dW = P^T . dZ, dB = sum of the rows of dZ.
+static bool _conv_filters_dx(grph_t *g, grph_size_t a, _conv_ctx_t *c) {
+  const grph_size_t *deps = GRPH_NODE_DEPS(g, a);
+  tnsr_t *transposed = NULL;
+  tnsr_t *grad = NULL;
+  REQUIRE(_conv_patches(c), goto error);
+  transposed = tnsr_transpose(NULL, c->patches);
+  REQUIRE(transposed, goto error);
+  grad = tnsr_contract(NULL, transposed, c->maps);
+  REQUIRE(grad, goto error);
+  REQUIRE(_accumulate_grad(g, deps[1], grad), goto error);
+  REQUIRE(_accumulate_grad(g, deps[2], c->maps), goto error);
+  tnsr_destroy(&c->patches);
+  tnsr_destroy(&transposed);
+  tnsr_destroy(&grad);
+  return true;
+error:
+  tnsr_destroy(&c->patches);
+  tnsr_destroy(&transposed);
+  tnsr_destroy(&grad);
+  return false;
+}
+
+// dP = dZ . W^T, summed back into the images the patches were taken from.
+static bool _conv_images_dx(grph_t *g, grph_size_t a, _conv_ctx_t *c) {
+  const grph_size_t *deps = GRPH_NODE_DEPS(g, a);
+  tnsr_t *transposed = tnsr_transpose(NULL, GRPH_NODE_DATA(g, deps[1]));
+  REQUIRE(transposed, goto error);
+  c->patches = tnsr_contract(NULL, c->maps, transposed);
+  c->images_grad = tnsr_create(TNSR_SHPE(c->images, 0), TNSR_SHPE(c->images, 1));
+  REQUIRE(c->patches && c->images_grad, goto error);
+  tpool_parallel_for(tpool_global(), TNSR_SHPE(c->images, 0), 1, _conv_col2im, c);
+  REQUIRE(_accumulate_grad(g, deps[0], c->images_grad), goto error);
+  tnsr_destroy(&c->patches);
+  tnsr_destroy(&c->images_grad);
+  tnsr_destroy(&transposed);
+  return true;
+error:
+  tnsr_destroy(&c->patches);
+  tnsr_destroy(&c->images_grad);
+  tnsr_destroy(&transposed);
+  return false;
+}
+
+// One half of the derivative of a convolution, towards its images or its parameters.
+typedef struct {
+  grph_t *g;
+  grph_size_t a;
+  _conv_ctx_t c;
+  bool filters;
+  bool status;
+} _conv_dx_ctx_t;
+
+static void _conv_dx_half(void *arg) {
+  _conv_dx_ctx_t *h = arg;
+  h->status = h->filters ? _conv_filters_dx(h->g, h->a, &h->c) : _conv_images_dx(h->g, h->a, &h->c);
+}
+
+/**
+ * NOTE:
+ * The gradient of pooled outputs is first routed back into the unpooled feature maps.
+ * Both halves only read the feature maps' gradient, and run as a pair of tasks.
+ */
+bool node_conv_dx(grph_t *g, grph_size_t a) {
+  ASSERT(g && a != GRPH_NO_INPUT_ID && GRPH_NODE_TYPE(g, a) == NDTYPE_CONV);
+  tnsr_t *grad = GRPH_NODE_GRAD(g, a);
+  _conv_ctx_t c = {0};
+  REQUIRE(_conv_init(g, a, grad, &c), goto error);
+  if (c.conv->pool > 1) {
+    tpool_parallel_for(tpool_global(), TNSR_SHPE(grad, 0), 1, _conv_unpool, &c);
+  }
+  _conv_dx_ctx_t halves[2] = {
+      {.g = g, .a = a, .c = c, .filters = false},
+      {.g = g, .a = a, .c = c, .filters = true},
+  };
+  _run_pair(_conv_dx_half, &halves[0], &halves[1]);
+  REQUIRE(halves[0].status && halves[1].status, goto error);
+  tnsr_destroy(&c.maps);
+  return true;
+error:
+  tnsr_destroy(&c.maps);
+  return false;
+}
+
+#define _EMBED_GRAIN 4096  // Values per chunk of the gathers.
+
+typedef struct {
+  const tnsr_t *ids;
+  const tnsr_t *table;
+  const tnsr_t *biases;
+  tnsr_t *data;
+} _embed_ctx_t;
+
+static void _embed_rows(size_t begin, size_t end, void *ctx) {
+  const _embed_ctx_t *c = ctx;
+  const tnsr_size_t width = TNSR_SHPE(c->table, 1);
+  for (tnsr_size_t i = begin; i < end; ++i) {
+    for (tnsr_size_t k = 0; k < TNSR_SHPE(c->ids, 1); ++k) {
+      const tnsr_size_t id = (tnsr_size_t)TNSR_DATA(c->ids, i, k);
+      tnsr_type_t *restrict dst = &TNSR_DATA(c->data, i, k * width);
+      const tnsr_type_t *restrict row = &TNSR_DATA(c->table, id, 0);
+      const tnsr_type_t *restrict biases = c->biases->data;
+#pragma omp simd
+      for (tnsr_size_t j = 0; j < width; ++j) {
+        dst[j] = row[j] + biases[j];
+      }
+    }
+  }
+}
+
+bool node_embed_valid(const tnsr_t *ids, tnsr_size_t rows) {
+  ASSERT(ids);
+  for (tnsr_size_t i = 0; i < TNSR_SHPE(ids, 0); ++i) {
+    for (tnsr_size_t k = 0; k < TNSR_SHPE(ids, 1); ++k) {
+      const tnsr_type_t id = TNSR_DATA(ids, i, k);
+      if (!(id >= 0 && id < rows && id == floorf(id))) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool node_embed(grph_t *g, grph_size_t a) {
+  ASSERT(g && a != GRPH_NO_INPUT_ID && GRPH_NODE_TYPE(g, a) == NDTYPE_EMBED);
+  const grph_embed_t *embed = GRPH_NODE_ATTR(g, a);
+  _embed_ctx_t c = {
+      .ids = GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, a)[0]),
+      .table = embed->table,
+      .biases = embed->biases,
+      .data = GRPH_NODE_DATA(g, a),
+  };
+  ASSERT(TNSR_IS_CONTIGUOUS(c.table) && TNSR_IS_CONTIGUOUS(c.data));
+  REQUIRE(node_embed_valid(c.ids, TNSR_SHPE(c.table, 0)), goto error);
+  const tnsr_size_t columns = TNSR_SHPE(c.data, 1);
+  const tnsr_size_t grain = max(_EMBED_GRAIN / max(columns, 1), 1);
+  tpool_parallel_for(tpool_global(), TNSR_SHPE(c.ids, 0), grain, _embed_rows, &c);
+  return true;
+error:
+  return false;
+}
+
+// Slot of row id in the gradient of embed, listing the row if needed. Called under its lock.
+static tnsr_size_t _embed_slot(grph_embed_t *embed, tnsr_size_t id) {
+  if (embed->slots[id] != GRPH_EMBED_UNLISTED) {
+    return embed->slots[id];
+  }
+  const tnsr_size_t width = TNSR_SHPE(embed->table, 1);
+  if (embed->row_count == embed->capacity) {
+    const tnsr_size_t capacity = min(max(2 * embed->capacity, 16), TNSR_SHPE(embed->table, 0));
+    tnsr_size_t *rows = realloc(embed->rows, sizeof(tnsr_size_t[capacity]));
+    REQUIRE(rows, return GRPH_EMBED_UNLISTED);
+    embed->rows = rows;
+    tnsr_type_t *grads = realloc(embed->grads, sizeof(tnsr_type_t[(size_t)(1 + capacity) * width]));
+    REQUIRE(grads, return GRPH_EMBED_UNLISTED);
+    embed->grads = grads;
+    embed->capacity = capacity;
+  }
+  const tnsr_size_t slot = embed->row_count++;
+  embed->rows[slot] = id;
+  embed->slots[id] = slot;
+  memset(embed->grads + (size_t)(1 + slot) * width, 0, sizeof(tnsr_type_t[width]));
+  return slot;
+}
+
+/**
+ * NOTE:
+ * Only the gathered rows have a gradient, listed in the attributes, so the cost and memory
+ * are proportional to the batch rather than to the table. Rows gathered several times
+ * receive the sum of their gradients, which is added serially under the attributes' lock.
+ */
+bool node_embed_dx(grph_t *g, grph_size_t a) {
+  ASSERT(g && a != GRPH_NO_INPUT_ID && GRPH_NODE_TYPE(g, a) == NDTYPE_EMBED);
+  grph_embed_t *embed = (grph_embed_t *)GRPH_NODE_ATTR(g, a);  // Written, see grph_embed_t.
+  const tnsr_t *ids = GRPH_NODE_DATA(g, GRPH_NODE_DEPS(g, a)[0]);
+  const tnsr_t *grad = GRPH_NODE_GRAD(g, a);
+  const tnsr_size_t width = TNSR_SHPE(embed->table, 1);
+  ASSERT(TNSR_IS_CONTIGUOUS(grad));
+  bool status = true;
+
+  omp_set_lock(&embed->lock);
+  for (tnsr_size_t i = 0; i < TNSR_SHPE(ids, 0) && status; ++i) {
+    for (tnsr_size_t k = 0; k < TNSR_SHPE(ids, 1); ++k) {
+      const tnsr_size_t slot = _embed_slot(embed, (tnsr_size_t)TNSR_DATA(ids, i, k));
+      if (slot == GRPH_EMBED_UNLISTED) {
+        status = false;
+        break;
+      }
+      tnsr_type_t *restrict biases = embed->grads;
+      tnsr_type_t *restrict row = embed->grads + (size_t)(1 + slot) * width;
+      const tnsr_type_t *restrict src = &TNSR_DATA(grad, i, k * width);
+#pragma omp simd
+      for (tnsr_size_t j = 0; j < width; ++j) {
+        row[j] += src[j];
+        biases[j] += src[j];
+      }
+    }
+  }
+  omp_unset_lock(&embed->lock);
+  return status;
+}
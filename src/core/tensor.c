@@ -11,11 +11,42 @@
 #include <float.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "core/tensor.h"
+#include "core/thread_pool.h"
 #include "utils/utils.h"
 
-#define _TNSR_EIMPL(dst, a, op, b)                                                          \
+// Rows processed per chunk of a parallel kernel, such that each chunk handles at least
+// TNSR_GRAIN values. Row partitions only depend on the shape, so kernels over tensors of the
+// same shape (starting with the zeroing in tnsr_create) touch a row on the same worker.
+#define TNSR_GRAIN 4096
+#define TNSR_ROW_GRAIN(cols) max(TNSR_GRAIN / max((size_t)(cols), 1), 1)
+
+typedef struct {
+  tnsr_t *dst;
+  const tnsr_t *a;
+  const tnsr_t *b;
+  const tnsr_size_t *bstrd;
+} tnsr_eop_ctx_t;
+
+#define _TNSR_EBODY(name, op)                                                                  \
+  static void name(size_t begin, size_t end, void *ctx) {                                      \
+    const tnsr_eop_ctx_t *e = ctx;                                                             \
+    for (tnsr_size_t i = begin; i < end; ++i) {                                                \
+      for (tnsr_size_t j = 0; j < TNSR_SHPE(e->dst, 1); ++j) {                                 \
+        TNSR_DATA(e->dst, i, j) =                                                              \
+            TNSR_DATA(e->a, i, j) op e->b->data[i * e->bstrd[0] + j * e->bstrd[1]];            \
+      }                                                                                        \
+    }                                                                                          \
+  }
+
+_TNSR_EBODY(tnsr_eadd_rows, +)
+_TNSR_EBODY(tnsr_esub_rows, -)
+_TNSR_EBODY(tnsr_emul_rows, *)
+_TNSR_EBODY(tnsr_ediv_rows, /)
+
+#define _TNSR_EIMPL(dst, a, body, b)                                                        \
   do {                                                                                      \
     ASSERT(a && b);                                                                         \
                                                                                             \
@@ -29,11 +60,10 @@
     }                                                                                       \
     ASSERT(TNSR_SHPE(rloc, 0) == TNSR_SHPE(a, 0) && TNSR_SHPE(rloc, 1) == TNSR_SHPE(a, 1)); \
                                                                                             \
-    for (tnsr_size_t i = 0; i < TNSR_SHPE(rloc, 0); ++i) {                                  \
-      for (tnsr_size_t j = 0; j < TNSR_SHPE(rloc, 1); ++j) {                                \
-        TNSR_DATA(rloc, i, j) = TNSR_DATA(a, i, j) op b->data[i * bstrd[0] + j * bstrd[1]]; \
-      }                                                                                     \
-    }                                                                                       \
+    tnsr_eop_ctx_t ctx = {.dst = rloc, .a = a, .b = b, .bstrd = bstrd};                     \
+    tpool_parallel_for(                                                                     \
+        tpool_global(), TNSR_SHPE(rloc, 0), TNSR_ROW_GRAIN(TNSR_SHPE(rloc, 1)), body, &ctx  \
+    );                                                                                      \
     return rloc;                                                                            \
                                                                                             \
   error:                                                                                    \
@@ -57,16 +87,48 @@ static bool b_broadcast_to_a(const tnsr_t *a, const tnsr_t *b, tnsr_size_t nstrd
   return true;
 }
 
+static void tnsr_zero_rows(size_t begin, size_t end, void *ctx) {
+  tnsr_t *t = ctx;
+  memset(&TNSR_DATA(t, begin, 0), 0, sizeof(tnsr_type_t[(end - begin) * TNSR_SHPE(t, 1)]));
+}
+
+/**
+ * NOTE:
+ * Data is zeroed by the workers which will process its rows, so that its pages are first
+ * touched, and thus placed, on their NUMA node.
+ */
 tnsr_t *tnsr_create(tnsr_size_t m, tnsr_size_t n) {
   ASSERT(m > 0 && n > 0);
+  tnsr_t *tensor = NULL;
+  REQUIRE(n <= TNSR_MAX_SIZE / m, goto error);
+  REQUIRE(m * n <= (SIZE_MAX - sizeof(tnsr_t)) / sizeof(tnsr_type_t), goto error);
 
-  tnsr_t *tensor = calloc(1, sizeof(tnsr_t) + sizeof(tnsr_type_t[m * n]));
+  tensor = malloc(sizeof(tnsr_t) + sizeof(tnsr_type_t[m * n]));
   REQUIRE(tensor, goto error);
 
   TNSR_SHPE(tensor, 0) = m;
   TNSR_SHPE(tensor, 1) = n;
   TNSR_STRD(tensor, 0) = n;
   TNSR_STRD(tensor, 1) = 1;
+  tensor->data = (tnsr_type_t *)(tensor + 1);  // Data follows the header.
+  tpool_parallel_for(tpool_global(), m, TNSR_ROW_GRAIN(n), tnsr_zero_rows, tensor);
+
+  return tensor;
+
+error:
+  return NULL;
+}
+
+tnsr_t *tnsr_view(tnsr_type_t *data, tnsr_size_t m, tnsr_size_t n) {
+  ASSERT(data && m > 0 && n > 0);
+  tnsr_t *tensor = malloc(sizeof(tnsr_t));
+  REQUIRE(tensor, goto error);
+
+  TNSR_SHPE(tensor, 0) = m;
+  TNSR_SHPE(tensor, 1) = n;
+  TNSR_STRD(tensor, 0) = n;
+  TNSR_STRD(tensor, 1) = 1;
+  tensor->data = data;
 
   return tensor;
 
@@ -82,23 +144,90 @@ void tnsr_destroy(tnsr_t **t) {
   *t = NULL;
 }
 
-void tnsr_set(tnsr_t *t, tnsr_type_t x) {
-  ASSERT(t);
+typedef struct {
+  tnsr_t *t;
+  tnsr_type_t x;
+} tnsr_set_ctx_t;
 
-#pragma omp parallel for
-  for (tnsr_size_t i = 0; i < TNSR_SHPE(t, 0); ++i) {
+static void tnsr_set_rows(size_t begin, size_t end, void *ctx) {
+  const tnsr_set_ctx_t *set = ctx;
+  tnsr_t *t = set->t;
+  for (tnsr_size_t i = begin; i < end; ++i) {
 #pragma omp simd
     for (tnsr_size_t j = 0; j < TNSR_SHPE(t, 1); ++j) {
-      TNSR_DATA(t, i, j) = x;
+      TNSR_DATA(t, i, j) = set->x;
     }
   }
 }
 
+void tnsr_set(tnsr_t *t, tnsr_type_t x) {
+  ASSERT(t);
+  tnsr_set_ctx_t ctx = {.t = t, .x = x};
+  tpool_parallel_for(
+      tpool_global(), TNSR_SHPE(t, 0), TNSR_ROW_GRAIN(TNSR_SHPE(t, 1)), tnsr_set_rows, &ctx
+  );
+}
+
 void tnsr_reset(tnsr_t *t) {
   ASSERT(t);
   tnsr_set(t, 0);
 }
 
+typedef struct {
+  tnsr_t *t;
+  tnsr_precision_t precision;
+} tnsr_round_ctx_t;
+
+static void tnsr_round_rows(size_t begin, size_t end, void *ctx) {
+  const tnsr_round_ctx_t *r = ctx;
+  tnsr_t *t = r->t;
+  for (tnsr_size_t i = begin; i < end; ++i) {
+    if (r->precision == TNSR_FP16) {
+      for (tnsr_size_t j = 0; j < TNSR_SHPE(t, 1); ++j) {
+        TNSR_DATA(t, i, j) = tnsr_from_half(tnsr_to_half(TNSR_DATA(t, i, j)));
+      }
+    } else {
+      for (tnsr_size_t j = 0; j < TNSR_SHPE(t, 1); ++j) {
+        TNSR_DATA(t, i, j) = tnsr_from_bfloat(tnsr_to_bfloat(TNSR_DATA(t, i, j)));
+      }
+    }
+  }
+}
+
+tnsr_t *tnsr_round(tnsr_t *t, tnsr_precision_t precision) {
+  ASSERT(t);
+  if (precision == TNSR_FP32) {
+    return t;
+  }
+  tnsr_round_ctx_t ctx = {.t = t, .precision = precision};
+  tpool_parallel_for(
+      tpool_global(), TNSR_SHPE(t, 0), TNSR_ROW_GRAIN(TNSR_SHPE(t, 1)), tnsr_round_rows, &ctx
+  );
+  return t;
+}
+
+typedef struct {
+  tnsr_t *dst;
+  const tnsr_t *a;
+  const tnsr_t *b;
+} tnsr_contract_ctx_t;
+
+static void tnsr_contract_rows(size_t begin, size_t end, void *ctx) {
+  const tnsr_contract_ctx_t *c = ctx;
+  tnsr_t *restrict rloc = c->dst;
+  const tnsr_t *restrict a = c->a;
+  const tnsr_t *restrict b = c->b;
+  for (tnsr_size_t i = begin; i < end; ++i) {
+    for (tnsr_size_t k = 0; k < TNSR_SHPE(a, 1); ++k) {
+      tnsr_type_t a_ik = TNSR_DATA(a, i, k);
+#pragma omp simd
+      for (tnsr_size_t j = 0; j < TNSR_SHPE(rloc, 1); ++j) {
+        TNSR_DATA(rloc, i, j) += a_ik * TNSR_DATA(b, k, j);
+      }
+    }
+  }
+}
+
 tnsr_t *tnsr_contract(tnsr_t *restrict dst, const tnsr_t *restrict a, const tnsr_t *restrict b) {
   ASSERT(a && b);
   ASSERT(TNSR_SHPE(a, 1) == TNSR_SHPE(b, 0));
@@ -114,17 +243,161 @@ tnsr_t *tnsr_contract(tnsr_t *restrict dst, const tnsr_t *restrict a, const tnsr
     TNSR_SHPE(rloc, 1) == TNSR_SHPE(b, 1)
   );
 
-#pragma omp parallel for
-  for (tnsr_size_t i = 0; i < TNSR_SHPE(rloc, 0); ++i) {
-    for (tnsr_size_t k = 0; k < TNSR_SHPE(a, 1); ++k) {
-      tnsr_type_t a_ik = TNSR_DATA(a, i, k);
+  tnsr_contract_ctx_t ctx = {.dst = rloc, .a = a, .b = b};
+  tpool_parallel_for(
+      tpool_global(),
+      TNSR_SHPE(rloc, 0),
+      TNSR_ROW_GRAIN(TNSR_SHPE(a, 1) * TNSR_SHPE(rloc, 1)),
+      tnsr_contract_rows,
+      &ctx
+  );
+
+  return rloc;
+
+error:
+  return NULL;
+}
+
+// Whether t holds a non-zero value within [i0, i1) x [j0, j1).
+static bool tnsr_block_nonzero(
+    const tnsr_t *t, tnsr_size_t i0, tnsr_size_t i1, tnsr_size_t j0, tnsr_size_t j1
+) {
+  for (tnsr_size_t i = i0; i < i1; ++i) {
+    for (tnsr_size_t j = j0; j < j1; ++j) {
+      if (TNSR_DATA(t, i, j) != 0) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+tnsr_bsr_t *tnsr_bsr_create(const tnsr_t *t, tnsr_size_t block_rows, tnsr_size_t block_cols) {
+  ASSERT(t && block_rows > 0 && block_cols > 0);
+  const tnsr_size_t rows = (TNSR_SHPE(t, 0) + block_rows - 1) / block_rows;
+  const tnsr_size_t cols = (TNSR_SHPE(t, 1) + block_cols - 1) / block_cols;
+  const tnsr_size_t block_size = block_rows * block_cols;
+  tnsr_bsr_t *bsr = calloc(1, sizeof(tnsr_bsr_t));
+  REQUIRE(bsr, goto error);
+  TNSR_SHPE(bsr, 0) = TNSR_SHPE(t, 0);
+  TNSR_SHPE(bsr, 1) = TNSR_SHPE(t, 1);
+  bsr->block[0] = block_rows;
+  bsr->block[1] = block_cols;
+  bsr->row_offsets = malloc(sizeof(tnsr_size_t[rows + 1]));
+  REQUIRE(bsr->row_offsets, goto error);
+
+  // Counts the non-zero blocks first, so that columns and values are sized exactly.
+  bsr->row_offsets[0] = 0;
+  for (tnsr_size_t r = 0; r < rows; ++r) {
+    const tnsr_size_t i1 = min((r + 1) * block_rows, TNSR_SHPE(t, 0));
+    tnsr_size_t count = 0;
+    for (tnsr_size_t c = 0; c < cols; ++c) {
+      const tnsr_size_t j1 = min((c + 1) * block_cols, TNSR_SHPE(t, 1));
+      count += tnsr_block_nonzero(t, r * block_rows, i1, c * block_cols, j1);
+    }
+    bsr->row_offsets[r + 1] = bsr->row_offsets[r] + count;
+  }
+  const tnsr_size_t blocks = bsr->row_offsets[rows];
+  bsr->columns = malloc(sizeof(tnsr_size_t[max(blocks, 1)]));
+  bsr->values = calloc(max(blocks, 1) * block_size, sizeof(tnsr_type_t));
+  REQUIRE(bsr->columns && bsr->values, goto error);
+
+  tnsr_size_t n = 0;
+  for (tnsr_size_t r = 0; r < rows; ++r) {
+    const tnsr_size_t i1 = min((r + 1) * block_rows, TNSR_SHPE(t, 0));
+    for (tnsr_size_t c = 0; c < cols; ++c) {
+      const tnsr_size_t j1 = min((c + 1) * block_cols, TNSR_SHPE(t, 1));
+      if (!tnsr_block_nonzero(t, r * block_rows, i1, c * block_cols, j1)) {
+        continue;
+      }
+      tnsr_type_t *block = bsr->values + n * block_size;
+      for (tnsr_size_t i = r * block_rows; i < i1; ++i) {
+        for (tnsr_size_t j = c * block_cols; j < j1; ++j) {
+          block[(i - r * block_rows) * block_cols + j - c * block_cols] = TNSR_DATA(t, i, j);
+        }
+      }
+      bsr->columns[n++] = c * block_cols;
+    }
+  }
+  ASSERT(n == blocks);
+  return bsr;
+error:
+  tnsr_bsr_destroy(&bsr);
+  return NULL;
+}
+
+void tnsr_bsr_destroy(tnsr_bsr_t **t) {
+  if (!t || !*t) {
+    return;
+  }
+  free((*t)->row_offsets);
+  free((*t)->columns);
+  free((*t)->values);
+  free(*t);
+  *t = NULL;
+}
+
+tnsr_size_t tnsr_bsr_blocks(const tnsr_bsr_t *t) {
+  ASSERT(t);
+  return t->row_offsets[(TNSR_SHPE(t, 0) + t->block[0] - 1) / t->block[0]];
+}
+
+typedef struct {
+  tnsr_t *dst;
+  const tnsr_t *a;
+  const tnsr_bsr_t *b;
+} tnsr_contract_bsr_ctx_t;
+
+/**
+ * NOTE:
+ * Walks the stored blocks once per row of a, skipping whole blocks of zero weights. Each
+ * block row of b multiplies the matching block_rows values of a's row.
+ */
+static void tnsr_contract_bsr_rows(size_t begin, size_t end, void *ctx) {
+  const tnsr_contract_bsr_ctx_t *c = ctx;
+  tnsr_t *restrict rloc = c->dst;
+  const tnsr_t *restrict a = c->a;
+  const tnsr_bsr_t *b = c->b;
+  const tnsr_size_t block_rows = b->block[0];
+  const tnsr_size_t block_cols = b->block[1];
+  const tnsr_size_t rows = (TNSR_SHPE(b, 0) + block_rows - 1) / block_rows;
+  for (tnsr_size_t i = begin; i < end; ++i) {
+    for (tnsr_size_t r = 0; r < rows; ++r) {
+      const tnsr_size_t k0 = r * block_rows;
+      const tnsr_size_t height = min(block_rows, TNSR_SHPE(b, 0) - k0);
+      for (tnsr_size_t n = b->row_offsets[r]; n < b->row_offsets[r + 1]; ++n) {
+        const tnsr_size_t j0 = b->columns[n];
+        const tnsr_size_t width = min(block_cols, TNSR_SHPE(b, 1) - j0);
+        const tnsr_type_t *restrict block = b->values + n * block_rows * block_cols;
+        tnsr_type_t *restrict out = &TNSR_DATA(rloc, i, j0);
+        for (tnsr_size_t k = 0; k < height; ++k) {
+          const tnsr_type_t a_ik = TNSR_DATA(a, i, (k0 + k));
 #pragma omp simd
-      for (tnsr_size_t j = 0; j < TNSR_SHPE(rloc, 1); ++j) {
-        TNSR_DATA(rloc, i, j) += a_ik * TNSR_DATA(b, k, j);
+          for (tnsr_size_t j = 0; j < width; ++j) {
+            out[j * TNSR_STRD(rloc, 1)] += a_ik * block[k * block_cols + j];
+          }
+        }
       }
     }
   }
+}
 
+tnsr_t *tnsr_contract_bsr(tnsr_t *restrict dst, const tnsr_t *restrict a, const tnsr_bsr_t *b) {
+  ASSERT(a && b);
+  ASSERT(TNSR_SHPE(a, 1) == TNSR_SHPE(b, 0));
+
+  tnsr_t *rloc = dst;
+  if (!rloc) {
+    rloc = tnsr_create(TNSR_SHPE(a, 0), TNSR_SHPE(b, 1));
+    REQUIRE(rloc, goto error);
+  }
+  ASSERT(TNSR_SHPE(rloc, 0) == TNSR_SHPE(a, 0) && TNSR_SHPE(rloc, 1) == TNSR_SHPE(b, 1));
+
+  tnsr_contract_bsr_ctx_t ctx = {.dst = rloc, .a = a, .b = b};
+  const tnsr_size_t work = tnsr_bsr_blocks(b) * b->block[0] * b->block[1];
+  tpool_parallel_for(
+      tpool_global(), TNSR_SHPE(rloc, 0), TNSR_ROW_GRAIN(work), tnsr_contract_bsr_rows, &ctx
+  );
   return rloc;
 
 error:
@@ -132,19 +405,35 @@ error:
 }
 
 tnsr_t *tnsr_eadd(tnsr_t *dst, const tnsr_t *a, const tnsr_t *restrict b) {
-  _TNSR_EIMPL(dst, a, +, b);
+  _TNSR_EIMPL(dst, a, tnsr_eadd_rows, b);
 }
 
 tnsr_t *tnsr_esub(tnsr_t *dst, const tnsr_t *a, const tnsr_t *b) {
-  _TNSR_EIMPL(dst, a, -, b);
+  _TNSR_EIMPL(dst, a, tnsr_esub_rows, b);
 }
 
 tnsr_t *tnsr_emul(tnsr_t *dst, const tnsr_t *a, const tnsr_t *restrict b) {
-  _TNSR_EIMPL(dst, a, *, b);
+  _TNSR_EIMPL(dst, a, tnsr_emul_rows, b);
 }
 
 tnsr_t *tnsr_ediv(tnsr_t *dst, const tnsr_t *a, const tnsr_t *b) {
-  _TNSR_EIMPL(dst, a, /, b);
+  _TNSR_EIMPL(dst, a, tnsr_ediv_rows, b);
+}
+
+typedef struct {
+  tnsr_t *dst;
+  const tnsr_t *a;
+  tnsr_type_t (*f)(tnsr_type_t, void *);
+  void *ctx;
+} tnsr_emap_ctx_t;
+
+static void tnsr_emap_rows(size_t begin, size_t end, void *ctx) {
+  const tnsr_emap_ctx_t *e = ctx;
+  for (tnsr_size_t i = begin; i < end; ++i) {
+    for (tnsr_size_t j = 0; j < TNSR_SHPE(e->dst, 1); ++j) {
+      TNSR_DATA(e->dst, i, j) = e->f(TNSR_DATA(e->a, i, j), e->ctx);
+    }
+  }
 }
 
 tnsr_t *tnsr_emap(
@@ -158,18 +447,31 @@ tnsr_t *tnsr_emap(
   }
   ASSERT(TNSR_SHPE(rloc, 0) == TNSR_SHPE(a, 0) && TNSR_SHPE(rloc, 1) == TNSR_SHPE(a, 1));
 
-#pragma omp parallel for
-  for (tnsr_size_t i = 0; i < TNSR_SHPE(rloc, 0); ++i) {
-    for (tnsr_size_t j = 0; j < TNSR_SHPE(rloc, 1); ++j) {
-      TNSR_DATA(rloc, i, j) = f(TNSR_DATA(a, i, j), ctx);
-    }
-  }
+  tnsr_emap_ctx_t emap = {.dst = rloc, .a = a, .f = f, .ctx = ctx};
+  tpool_parallel_for(
+      tpool_global(), TNSR_SHPE(rloc, 0), TNSR_ROW_GRAIN(TNSR_SHPE(rloc, 1)), tnsr_emap_rows, &emap
+  );
   return rloc;
 
 error:
   return NULL;
 }
 
+typedef struct {
+  tnsr_t *dst;
+  const tnsr_t *t;
+} tnsr_unary_ctx_t;
+
+static void tnsr_transpose_rows(size_t begin, size_t end, void *ctx) {
+  const tnsr_unary_ctx_t *u = ctx;
+  for (tnsr_size_t i = begin; i < end; ++i) {
+#pragma omp simd
+    for (tnsr_size_t j = 0; j < TNSR_SHPE(u->dst, 1); ++j) {
+      TNSR_DATA(u->dst, i, j) = TNSR_DATA(u->t, j, i);
+    }
+  }
+}
+
 tnsr_t *tnsr_transpose(tnsr_t *dst, tnsr_t *t) {
   ASSERT(t);
   if (dst == t) {
@@ -185,18 +487,40 @@ tnsr_t *tnsr_transpose(tnsr_t *dst, tnsr_t *t) {
   tnsr_t *tp = tnsr_create(TNSR_SHPE(t, 1), TNSR_SHPE(t, 0));
   REQUIRE(tp, goto error);
 
-#pragma omp parallel for
-  for (tnsr_size_t i = 0; i < TNSR_SHPE(tp, 0); ++i) {
-#pragma omp simd
-    for (tnsr_size_t j = 0; j < TNSR_SHPE(tp, 1); ++j) {
-      TNSR_DATA(tp, i, j) = TNSR_DATA(t, j, i);
-    }
-  }
+  tnsr_unary_ctx_t ctx = {.dst = tp, .t = t};
+  tpool_parallel_for(
+      tpool_global(), TNSR_SHPE(tp, 0), TNSR_ROW_GRAIN(TNSR_SHPE(tp, 1)), tnsr_transpose_rows, &ctx
+  );
   return tp;
 error:
   return NULL;
 }
 
+typedef struct {
+  tnsr_t *dst;
+  const tnsr_t *t;
+  tnsr_size_t axis;
+  tnsr_size_t q;
+  bool sum;  // Reduces through max otherwise.
+} tnsr_reduce_ctx_t;
+
+static void tnsr_reduce_rows(size_t begin, size_t end, void *ctx) {
+  const tnsr_reduce_ctx_t *r = ctx;
+  const tnsr_t *t = r->t;
+  for (tnsr_size_t i = begin; i < end; ++i) {
+    tnsr_type_t acc = r->sum ? 0 : -FLT_MAX;
+    for (tnsr_size_t j = 0; j < r->q; ++j) {
+      const tnsr_type_t val = r->axis ? TNSR_DATA(t, i, j) : TNSR_DATA(t, j, i);
+      acc = r->sum ? acc + val : max(acc, val);
+    }
+    if (r->axis) {
+      TNSR_DATA(r->dst, i, 0) = acc;
+    } else {
+      TNSR_DATA(r->dst, 0, i) = acc;
+    }
+  }
+}
+
 tnsr_t *tnsr_sum_over_axis(tnsr_t *restrict dst, tnsr_t *restrict t, tnsr_size_t axis) {
   ASSERT(t && axis >= 0 && axis < TNSR_MAX_RANK);
 
@@ -212,18 +536,8 @@ tnsr_t *tnsr_sum_over_axis(tnsr_t *restrict dst, tnsr_t *restrict t, tnsr_size_t
   const tnsr_size_t p = axis ? TNSR_SHPE(t, 0) : TNSR_SHPE(t, 1);
   const tnsr_size_t q = axis ? TNSR_SHPE(t, 1) : TNSR_SHPE(t, 0);
 
-#pragma omp parallel for
-  for (tnsr_size_t i = 0; i < p; ++i) {
-    tnsr_type_t si = 0;
-    for (tnsr_size_t j = 0; j < q; ++j) {
-      si += axis ? TNSR_DATA(t, i, j) : TNSR_DATA(t, j, i);
-    }
-    if (axis) {
-      TNSR_DATA(sumloc, i, 0) = si;
-    } else {
-      TNSR_DATA(sumloc, 0, i) = si;
-    }
-  }
+  tnsr_reduce_ctx_t ctx = {.dst = sumloc, .t = t, .axis = axis, .q = q, .sum = true};
+  tpool_parallel_for(tpool_global(), p, TNSR_ROW_GRAIN(q), tnsr_reduce_rows, &ctx);
 
   return sumloc;
 error:
@@ -245,19 +559,8 @@ tnsr_t *tnsr_max_over_axis(tnsr_t *restrict dst, tnsr_t *restrict t, tnsr_size_t
   const tnsr_size_t p = axis ? TNSR_SHPE(t, 0) : TNSR_SHPE(t, 1);
   const tnsr_size_t q = axis ? TNSR_SHPE(t, 1) : TNSR_SHPE(t, 0);
 
-#pragma omp parallel for
-  for (tnsr_size_t i = 0; i < p; ++i) {
-    tnsr_type_t maxi = -FLT_MAX;
-    for (tnsr_size_t j = 0; j < q; ++j) {
-      const tnsr_type_t val = axis ? TNSR_DATA(t, i, j) : TNSR_DATA(t, j, i);
-      maxi = max(maxi, val);
-    }
-    if (axis) {
-      TNSR_DATA(maxloc, i, 0) = maxi;
-    } else {
-      TNSR_DATA(maxloc, 0, i) = maxi;
-    }
-  }
+  tnsr_reduce_ctx_t ctx = {.dst = maxloc, .t = t, .axis = axis, .q = q, .sum = false};
+  tpool_parallel_for(tpool_global(), p, TNSR_ROW_GRAIN(q), tnsr_reduce_rows, &ctx);
   return maxloc;
 error:
   return NULL;
@@ -286,6 +589,85 @@ error:
   return NULL;
 }
 
+/**
+ * NOTE:
+ * Integer-only, such that results do not depend on the floating-point environment
+ * (flush-to-zero, rounding mode).
+ */
+uint16_t tnsr_to_half(tnsr_type_t x) {
+  uint32_t f = 0;
+  memcpy(&f, &x, sizeof(f));
+  const uint16_t sign = (uint16_t)((f >> 16) & 0x8000);
+  const uint32_t magnitude = f & 0x7fffffff;
+  if (magnitude > 0x7f800000) {
+    return sign | 0x7e00;  // Quiet NaN.
+  }
+  if (magnitude >= 0x477ff000) {
+    return sign | 0x7c00;  // Rounds past 65504, the largest half.
+  }
+  if (magnitude <= 0x33000000) {
+    return sign;  // At most half of the smallest subnormal, 2^-25.
+  }
+  uint32_t h = 0;
+  uint32_t rest = 0;
+  uint32_t tie = 0;
+  if (magnitude < 0x38800000) {
+    // Subnormal half, counts units of 2^-24.
+    const uint32_t shift = 126 - (magnitude >> 23);
+    const uint32_t significand = (magnitude & 0x7fffff) | 0x800000;
+    h = significand >> shift;
+    rest = significand & ((UINT32_C(1) << shift) - 1);
+    tie = UINT32_C(1) << (shift - 1);
+  } else {
+    // Rebiases the exponent from 127 to 15, drops 13 significand bits.
+    h = (magnitude - 0x38000000) >> 13;
+    rest = magnitude & 0x1fff;
+    tie = 0x1000;
+  }
+  h += rest > tie || (rest == tie && (h & 1));  // Carries into the exponent as needed.
+  return sign | (uint16_t)h;
+}
+
+tnsr_type_t tnsr_from_half(uint16_t h) {
+  const uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+  uint32_t exponent = (h >> 10) & 0x1f;
+  uint32_t significand = h & 0x3ff;
+  uint32_t f = sign;
+  if (exponent == 0x1f) {
+    f |= 0x7f800000 | (significand << 13);
+  } else if (exponent) {
+    f |= ((exponent + 112) << 23) | (significand << 13);
+  } else if (significand) {
+    // Normalizes the subnormal.
+    exponent = 113;
+    while (!(significand & 0x400)) {
+      significand <<= 1;
+      --exponent;
+    }
+    f |= (exponent << 23) | ((significand & 0x3ff) << 13);
+  }
+  tnsr_type_t x = 0;
+  memcpy(&x, &f, sizeof(x));
+  return x;
+}
+
+uint16_t tnsr_to_bfloat(tnsr_type_t x) {
+  uint32_t f = 0;
+  memcpy(&f, &x, sizeof(f));
+  if ((f & 0x7fffffff) > 0x7f800000) {
+    return (uint16_t)((f >> 16) | 0x40);  // Quiet NaN.
+  }
+  f += 0x7fff + ((f >> 16) & 1);  // Overflows into infinity past the largest bfloat16.
+  return (uint16_t)(f >> 16);
+}
+
+tnsr_type_t tnsr_from_bfloat(uint16_t h) {
+  const uint32_t f = (uint32_t)h << 16;
+  tnsr_type_t x = 0;
+  memcpy(&x, &f, sizeof(x));
+  return x;
+}
+
 void tnsr_dbgprint(const tnsr_t *t) {
   ASSERT(t);
   for (tnsr_size_t i = 0; i < TNSR_SHPE(t, 0); ++i) {
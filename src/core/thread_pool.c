@@ -0,0 +1,644 @@
+/**
+ * thread_pool.c
+ *
+ * BRIEF:
+ * Implementation for thread_pool.h
+ *
+ * NOTE:
+ * Every worker owns a queue of jobs. Loop chunks are pushed to the queue of the worker
+ * they are assigned to and are never stolen by idle workers, only by the thread waiting
+ * on the loop once the owner has had a chance to pick them up. Tasks are spread over the
+ * queues round-robin, and idle workers steal them, from workers of their own NUMA node
+ * first. A worker finding no work for TPOOL_SPIN_ROUNDS rounds parks on its queue until
+ * a job is pushed to it. Threads foreign to the pool waiting as long on a group park on
+ * the pool until a group completes.
+ */
+
+#if defined(__linux__)
+  #define _GNU_SOURCE  // sched_setaffinity.
+#elif !defined(_WIN32)
+  #define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdint.h>
+#include <string.h>
+#include <threads.h>
+
+#ifdef _WIN32
+  #include <Windows.h>
+#else
+  #include <pthread.h>
+  #include <sched.h>
+  #include <unistd.h>
+#endif
+#ifdef __linux__
+  #include <dirent.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+  #include <immintrin.h>
+  #define TPOOL_RELAX() _mm_pause()
+#else
+  #define TPOOL_RELAX() ((void)0)
+#endif
+
+#include "core/thread_pool.h"
+#include "utils/utils.h"
+
+#define TPOOL_SPIN_ROUNDS 2048   // Unsuccessful rounds of an idle worker before parking.
+#define TPOOL_STEAL_ROUNDS 64    // Rounds a waiting thread leaves other workers' chunks to them.
+#define TPOOL_QUEUE_CAPACITY 64  // Initial jobs per queue, grown on demand.
+#define TPOOL_MAX_NODES 1024
+
+typedef struct {
+  tpool_range_t range;  // Loop chunk when set, task otherwise.
+  tpool_task_t task;
+  void *ctx;
+  size_t begin;
+  size_t end;
+  tpool_group_t *group;
+} tpool_job_t;
+
+typedef struct {
+  mtx_t lock;
+  cnd_t wake;
+  tpool_job_t *jobs;
+  atomic_size_t count;  // Written under lock, peeked at without.
+  size_t capacity;
+} tpool_queue_t;
+
+typedef struct {
+  size_t cpu;
+  size_t node;
+} tpool_place_t;
+
+typedef struct {
+  tpool_t *pool;
+  size_t id;
+  tpool_place_t place;
+  size_t *victims;  // Other workers, those of the same node first.
+  thrd_t thread;
+  tpool_queue_t queue;
+} tpool_worker_t;
+
+struct tpool {
+  size_t thread_count;
+  tpool_worker_t *workers;
+  size_t started;
+  bool pin;
+  atomic_bool stop;
+  atomic_size_t next_queue;  // Round-robin target of tasks.
+  mtx_t done_lock;
+  cnd_t done;  // Signalled when a group completes while a waiter is parked.
+  atomic_size_t parked;  // Waiters parked on done.
+};
+
+static thread_local tpool_worker_t *tpool_self = NULL;
+
+/**
+ * Queues.
+ */
+
+static bool tpool_queue_init(tpool_queue_t *q) {
+  q->jobs = malloc(sizeof(tpool_job_t[TPOOL_QUEUE_CAPACITY]));
+  REQUIRE(q->jobs, return false);
+  q->capacity = TPOOL_QUEUE_CAPACITY;
+  atomic_init(&q->count, 0);
+  if (mtx_init(&q->lock, mtx_plain) != thrd_success) {
+    free(q->jobs);
+    return false;
+  }
+  if (cnd_init(&q->wake) != thrd_success) {
+    mtx_destroy(&q->lock);
+    free(q->jobs);
+    return false;
+  }
+  return true;
+}
+
+static void tpool_queue_destroy(tpool_queue_t *q) {
+  cnd_destroy(&q->wake);
+  mtx_destroy(&q->lock);
+  free(q->jobs);
+}
+
+static bool tpool_queue_push(tpool_queue_t *q, const tpool_job_t *job) {
+  mtx_lock(&q->lock);
+  const size_t count = atomic_load_explicit(&q->count, memory_order_relaxed);
+  if (count == q->capacity) {
+    tpool_job_t *jobs = realloc(q->jobs, sizeof(tpool_job_t[2 * q->capacity]));
+    if (!jobs) {
+      mtx_unlock(&q->lock);
+      return false;
+    }
+    q->jobs = jobs;
+    q->capacity *= 2;
+  }
+  q->jobs[count] = *job;
+  atomic_store_explicit(&q->count, count + 1, memory_order_release);
+  cnd_signal(&q->wake);
+  mtx_unlock(&q->lock);
+  return true;
+}
+
+/**
+ * Removes a job from the queue. Owners take the newest job, thieves the oldest.
+ * NOTE:
+ * When group is set, only takes jobs of that group. Otherwise only takes tasks,
+ * unless the caller owns the queue.
+ */
+static bool tpool_queue_take(
+    tpool_queue_t *q, const tpool_group_t *group, bool owner, tpool_job_t *job
+) {
+  if (!atomic_load_explicit(&q->count, memory_order_relaxed)) {
+    return false;
+  }
+  mtx_lock(&q->lock);
+  const size_t count = atomic_load_explicit(&q->count, memory_order_relaxed);
+  bool found = false;
+  for (size_t k = 0; k < count && !found; ++k) {
+    const size_t i = owner ? count - 1 - k : k;
+    const tpool_job_t *candidate = &q->jobs[i];
+    if (group ? candidate->group == group : owner || !candidate->range) {
+      *job = *candidate;
+      memmove(&q->jobs[i], &q->jobs[i + 1], (count - i - 1) * sizeof(tpool_job_t));
+      atomic_store_explicit(&q->count, count - 1, memory_order_relaxed);
+      found = true;
+    }
+  }
+  mtx_unlock(&q->lock);
+  return found;
+}
+
+/**
+ * Workers.
+ */
+
+/**
+ * NOTE:
+ * The group may be released by its waiter as soon as its last job completes, so only the
+ * pool is touched afterwards. Both counters are accessed sequentially consistent, so that
+ * either the last job sees the parked waiter or the waiter sees the group completed.
+ */
+static void tpool_run(tpool_t *pool, const tpool_job_t *job) {
+  if (job->range) {
+    job->range(job->begin, job->end, job->ctx);
+  } else {
+    job->task(job->ctx);
+  }
+  if (atomic_fetch_sub(&job->group->pending, 1) == 1 && atomic_load(&pool->parked)) {
+    mtx_lock(&pool->done_lock);
+    cnd_broadcast(&pool->done);
+    mtx_unlock(&pool->done_lock);
+  }
+}
+
+// Blocks until every job of group has completed.
+static void tpool_park(tpool_t *pool, const tpool_group_t *group) {
+  mtx_lock(&pool->done_lock);
+  atomic_fetch_add(&pool->parked, 1);
+  while (atomic_load(&group->pending)) {
+    cnd_wait(&pool->done, &pool->done_lock);
+  }
+  atomic_fetch_sub(&pool->parked, 1);
+  mtx_unlock(&pool->done_lock);
+}
+
+static bool tpool_steal(
+    tpool_t *pool, const tpool_worker_t *self, const tpool_group_t *group, tpool_job_t *job
+) {
+  if (self) {
+    for (size_t k = 0; k + 1 < pool->thread_count; ++k) {
+      if (tpool_queue_take(&pool->workers[self->victims[k]].queue, group, false, job)) {
+        return true;
+      }
+    }
+    return false;
+  }
+  for (size_t w = 0; w < pool->thread_count; ++w) {
+    if (tpool_queue_take(&pool->workers[w].queue, group, false, job)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void tpool_pin(const tpool_worker_t *w) {
+#if defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(w->place.cpu, &set);
+  sched_setaffinity(0, sizeof(set), &set);  // Best effort.
+#elif defined(_WIN32)
+  if (w->place.cpu < 8 * sizeof(DWORD_PTR)) {
+    SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << w->place.cpu);
+  }
+#else
+  (void)w;  // No affinity interface.
+#endif
+}
+
+static int tpool_worker_main(void *arg) {
+  tpool_worker_t *w = arg;
+  tpool_t *pool = w->pool;
+  tpool_self = w;
+  if (pool->pin) {
+    tpool_pin(w);
+  }
+
+  size_t idle = 0;
+  for (;;) {
+    tpool_job_t job;
+    if (tpool_queue_take(&w->queue, NULL, true, &job) || tpool_steal(pool, w, NULL, &job)) {
+      tpool_run(pool, &job);
+      idle = 0;
+      continue;
+    }
+    if (++idle < TPOOL_SPIN_ROUNDS) {
+      TPOOL_RELAX();
+      continue;
+    }
+    idle = 0;
+
+    mtx_lock(&w->queue.lock);
+    while (!atomic_load_explicit(&w->queue.count, memory_order_relaxed) &&
+           !atomic_load(&pool->stop)) {
+      cnd_wait(&w->queue.wake, &w->queue.lock);
+    }
+    const bool done = !atomic_load_explicit(&w->queue.count, memory_order_relaxed);
+    mtx_unlock(&w->queue.lock);
+    if (done) {
+      return 0;  // Stopping, and drained.
+    }
+  }
+}
+
+/**
+ * Topology.
+ */
+
+static int tpool_place_compare(const void *a, const void *b) {
+  const tpool_place_t *pa = a;
+  const tpool_place_t *pb = b;
+  if (pa->node != pb->node) {
+    return pa->node < pb->node ? -1 : 1;
+  }
+  return pa->cpu < pb->cpu ? -1 : pa->cpu > pb->cpu;
+}
+
+#ifdef __linux__
+// Adds the allowed cpus of a "0-3,8,10-11" list to places.
+static void tpool_parse_cpulist(
+    FILE *f, size_t node, const cpu_set_t *allowed, tpool_place_t *places, size_t *count
+) {
+  unsigned long first = 0;
+  unsigned long last = 0;
+  int c = 0;
+  while (fscanf(f, "%lu", &first) == 1) {
+    last = first;
+    c = fgetc(f);
+    if (c == '-') {
+      REQUIRE(fscanf(f, "%lu", &last) == 1, return);
+      c = fgetc(f);
+    }
+    for (unsigned long cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, allowed)) {
+        places[(*count)++] = (tpool_place_t){.cpu = cpu, .node = node};
+      }
+    }
+    if (c != ',') {
+      return;
+    }
+  }
+}
+#endif
+
+/**
+ * Lists the cores the process may run on, ordered by NUMA node.
+ * NOTE:
+ * Falls back to a single node when the topology is not exposed.
+ */
+static size_t tpool_places(tpool_place_t **places) {
+  size_t count = 0;
+#if defined(__linux__)
+  cpu_set_t allowed;
+  REQUIRE(!sched_getaffinity(0, sizeof(allowed), &allowed), return 0);
+  *places = malloc(sizeof(tpool_place_t[CPU_SETSIZE]));
+  REQUIRE(*places, return 0);
+
+  DIR *dir = opendir("/sys/devices/system/node");
+  struct dirent *entry = NULL;
+  while (dir && (entry = readdir(dir))) {
+    size_t node = 0;
+    char tail = 0;
+    if (sscanf(entry->d_name, "node%zu%c", &node, &tail) != 1 || node >= TPOOL_MAX_NODES) {
+      continue;
+    }
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%zu/cpulist", node);
+    FILE *f = fopen(path, "r");
+    if (f) {
+      tpool_parse_cpulist(f, node, &allowed, *places, &count);
+      fclose(f);
+    }
+  }
+  if (dir) {
+    closedir(dir);
+  }
+  if (!count) {
+    for (size_t cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &allowed)) {
+        (*places)[count++] = (tpool_place_t){.cpu = cpu, .node = 0};
+      }
+    }
+  }
+#elif defined(_WIN32)
+  const size_t bits = 8 * sizeof(DWORD_PTR);
+  DWORD_PTR allowed = 0;
+  DWORD_PTR system = 0;
+  if (!GetProcessAffinityMask(GetCurrentProcess(), &allowed, &system)) {
+    allowed = ~(DWORD_PTR)0;
+  }
+  *places = malloc(sizeof(tpool_place_t[bits]));
+  REQUIRE(*places, return 0);
+
+  ULONG highest = 0;
+  if (GetNumaHighestNodeNumber(&highest)) {
+    for (ULONG node = 0; node <= highest && node < TPOOL_MAX_NODES; ++node) {
+      ULONGLONG mask = 0;
+      if (!GetNumaNodeProcessorMask((UCHAR)node, &mask)) {
+        continue;
+      }
+      for (size_t cpu = 0; cpu < bits; ++cpu) {
+        if ((mask & allowed) >> cpu & 1) {
+          (*places)[count++] = (tpool_place_t){.cpu = cpu, .node = node};
+        }
+      }
+    }
+  }
+  for (size_t cpu = 0; !count && cpu < bits; ++cpu) {
+    if (allowed >> cpu & 1) {
+      (*places)[count++] = (tpool_place_t){.cpu = cpu, .node = 0};
+    }
+  }
+#else
+  const long online = sysconf(_SC_NPROCESSORS_ONLN);
+  count = online > 0 ? (size_t)online : 1;
+  *places = malloc(sizeof(tpool_place_t[count]));
+  REQUIRE(*places, return 0);
+  for (size_t cpu = 0; cpu < count; ++cpu) {
+    (*places)[cpu] = (tpool_place_t){.cpu = cpu, .node = 0};
+  }
+#endif
+  qsort(*places, count, sizeof(tpool_place_t), tpool_place_compare);
+  return count;
+}
+
+// Orders the other workers by node, the worker's own node first, then by distance in ids.
+static void tpool_order_victims(tpool_t *pool, tpool_worker_t *w) {
+  size_t k = 0;
+  for (size_t pass = 0; pass < 2; ++pass) {
+    for (size_t d = 1; d < pool->thread_count; ++d) {
+      const size_t v = (w->id + d) % pool->thread_count;
+      const bool same_node = pool->workers[v].place.node == w->place.node;
+      if (same_node == !pass) {
+        w->victims[k++] = v;
+      }
+    }
+  }
+}
+
+/**
+ * Pool.
+ */
+
+tpool_t *tpool_create(size_t thread_count, bool pin) {
+  tpool_t *pool = NULL;
+  tpool_place_t *places = NULL;
+  bool synced = false;  // Whether done_lock and done exist.
+  const size_t place_count = tpool_places(&places);
+  REQUIRE(place_count, goto error);
+  if (!thread_count) {
+    thread_count = place_count;
+  }
+
+  pool = calloc(1, sizeof(tpool_t));
+  REQUIRE(pool, goto error);
+  pool->thread_count = thread_count;
+  pool->pin = pin;
+  atomic_init(&pool->stop, false);
+  atomic_init(&pool->next_queue, 0);
+  atomic_init(&pool->parked, 0);
+  REQUIRE(mtx_init(&pool->done_lock, mtx_plain) == thrd_success, goto error);
+  if (cnd_init(&pool->done) != thrd_success) {
+    mtx_destroy(&pool->done_lock);
+    goto error;
+  }
+  synced = true;
+  pool->workers = calloc(thread_count, sizeof(tpool_worker_t));
+  REQUIRE(pool->workers, goto error);
+
+  // Fewer workers than cores are spread evenly, so they cover every node.
+  for (size_t i = 0; i < thread_count; ++i) {
+    tpool_worker_t *w = &pool->workers[i];
+    w->pool = pool;
+    w->id = i;
+    w->place = thread_count <= place_count ? places[i * place_count / thread_count]
+                                           : places[i % place_count];
+  }
+  for (size_t i = 0; i < thread_count; ++i) {
+    tpool_worker_t *w = &pool->workers[i];
+    w->victims = malloc(sizeof(size_t[thread_count]));
+    REQUIRE(w->victims, goto error);
+    tpool_order_victims(pool, w);
+  }
+  // Queues must all exist before the first worker starts stealing.
+  for (size_t i = 0; i < thread_count; ++i) {
+    REQUIRE(tpool_queue_init(&pool->workers[i].queue), goto error);
+    ++pool->started;
+  }
+  for (size_t i = 0; i < thread_count; ++i) {
+    tpool_worker_t *w = &pool->workers[i];
+    if (thrd_create(&w->thread, tpool_worker_main, w) != thrd_success) {
+      // Joins the workers started so far, and releases every queue.
+      atomic_store(&pool->stop, true);
+      for (size_t j = 0; j < i; ++j) {
+        tpool_queue_t *q = &pool->workers[j].queue;
+        mtx_lock(&q->lock);
+        cnd_signal(&q->wake);
+        mtx_unlock(&q->lock);
+        thrd_join(pool->workers[j].thread, NULL);
+      }
+      goto error;
+    }
+  }
+
+  free(places);
+  return pool;
+
+error:
+  if (pool && pool->workers) {
+    for (size_t i = 0; i < pool->started; ++i) {
+      tpool_queue_destroy(&pool->workers[i].queue);
+    }
+    for (size_t i = 0; i < thread_count; ++i) {
+      free(pool->workers[i].victims);
+    }
+    free(pool->workers);
+  }
+  if (synced) {
+    cnd_destroy(&pool->done);
+    mtx_destroy(&pool->done_lock);
+  }
+  free(pool);
+  free(places);
+  return NULL;
+}
+
+void tpool_destroy(tpool_t **pool) {
+  if (!pool || !*pool) {
+    return;
+  }
+  tpool_t *p = *pool;
+  atomic_store(&p->stop, true);
+  for (size_t i = 0; i < p->thread_count; ++i) {
+    tpool_queue_t *q = &p->workers[i].queue;
+    mtx_lock(&q->lock);
+    cnd_signal(&q->wake);
+    mtx_unlock(&q->lock);
+  }
+  for (size_t i = 0; i < p->thread_count; ++i) {
+    thrd_join(p->workers[i].thread, NULL);
+    tpool_queue_destroy(&p->workers[i].queue);
+    free(p->workers[i].victims);
+  }
+  free(p->workers);
+  cnd_destroy(&p->done);
+  mtx_destroy(&p->done_lock);
+  free(p);
+  *pool = NULL;
+}
+
+/**
+ * NOTE:
+ * A child forked by another thread only inherits the forking thread, so the pool of the
+ * parent is abandoned (never touched) and a new one is created. The child is told by an
+ * atfork handler, which keeps the fork out of the pool's fast path.
+ */
+static atomic_flag tpool_global_lock = ATOMIC_FLAG_INIT;
+static tpool_t *_Atomic tpool_global_pool = NULL;
+
+#ifndef _WIN32
+static void tpool_global_forget(void) {
+  atomic_store_explicit(&tpool_global_pool, NULL, memory_order_relaxed);
+  atomic_flag_clear_explicit(&tpool_global_lock, memory_order_relaxed);  // Held by no thread.
+}
+#endif
+
+tpool_t *tpool_global(void) {
+  tpool_t *pool = atomic_load_explicit(&tpool_global_pool, memory_order_acquire);
+  if (pool) {
+    return pool;
+  }
+
+  while (atomic_flag_test_and_set_explicit(&tpool_global_lock, memory_order_acquire)) {
+    thrd_yield();
+  }
+  pool = atomic_load_explicit(&tpool_global_pool, memory_order_relaxed);
+  if (!pool) {
+#ifndef _WIN32
+    static bool forgets = false;  // Handlers are inherited by children, registered once.
+    if (!forgets) {
+      REQUIRE(!pthread_atfork(NULL, NULL, tpool_global_forget), abort());
+      forgets = true;
+    }
+#endif
+    const char *env = getenv(TPOOL_THREADS_ENV);
+    const size_t thread_count = env ? strtoull(env, NULL, 10) : 0;
+    pool = tpool_create(thread_count, true);
+    REQUIRE(pool, abort());
+    atomic_store_explicit(&tpool_global_pool, pool, memory_order_release);
+  }
+  atomic_flag_clear_explicit(&tpool_global_lock, memory_order_release);
+  return pool;
+}
+
+size_t tpool_thread_count(const tpool_t *pool) {
+  ASSERT(pool);
+  return pool->thread_count;
+}
+
+size_t tpool_worker_id(const tpool_t *pool) {
+  ASSERT(pool);
+  return tpool_self && tpool_self->pool == pool ? tpool_self->id : TPOOL_EXTERNAL;
+}
+
+void tpool_group_init(tpool_group_t *group) {
+  ASSERT(group);
+  atomic_init(&group->pending, 0);
+}
+
+bool tpool_spawn(tpool_t *pool, tpool_group_t *group, tpool_task_t task, void *ctx) {
+  ASSERT(pool && group && task);
+  const tpool_job_t job = {.task = task, .ctx = ctx, .group = group};
+  const size_t w = atomic_fetch_add_explicit(&pool->next_queue, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&group->pending, 1, memory_order_relaxed);
+  if (!tpool_queue_push(&pool->workers[w % pool->thread_count].queue, &job)) {
+    atomic_fetch_sub_explicit(&group->pending, 1, memory_order_relaxed);
+    return false;
+  }
+  return true;
+}
+
+void tpool_wait(tpool_t *pool, tpool_group_t *group) {
+  ASSERT(pool && group);
+  tpool_worker_t *self = tpool_self && tpool_self->pool == pool ? tpool_self : NULL;
+  size_t idle = 0;
+  while (atomic_load_explicit(&group->pending, memory_order_acquire)) {
+    tpool_job_t job;
+    // Chunks of other workers are left to them for a while, to keep their affinity.
+    if ((self && tpool_queue_take(&self->queue, group, true, &job)) ||
+        (idle >= TPOOL_STEAL_ROUNDS && tpool_steal(pool, self, group, &job))) {
+      tpool_run(pool, &job);
+      continue;
+    }
+    if (++idle < TPOOL_SPIN_ROUNDS) {
+      TPOOL_RELAX();
+    } else if (self) {
+      thrd_yield();  // Chunks of other loops may be pushed to its queue meanwhile.
+    } else {
+      tpool_park(pool, group);
+    }
+  }
+}
+
+void tpool_parallel_for(tpool_t *pool, size_t n, size_t grain, tpool_range_t body, void *ctx) {
+  ASSERT(pool && body);
+  const size_t workers = pool->thread_count;
+  size_t chunks = n / max(grain, 1);
+  chunks = min(max(chunks, 1), workers);
+  if (chunks == 1) {
+    if (n) {
+      body(0, n, ctx);
+    }
+    return;
+  }
+
+  tpool_group_t group;
+  tpool_group_init(&group);
+  atomic_store_explicit(&group.pending, chunks, memory_order_relaxed);
+  for (size_t c = 0; c < chunks; ++c) {
+    const tpool_job_t job = {
+        .range = body,
+        .ctx = ctx,
+        .begin = c * n / chunks,
+        .end = (c + 1) * n / chunks,
+        .group = &group,
+    };
+    // Fewer chunks than workers are spread evenly, alike the workers over the cores.
+    if (!tpool_queue_push(&pool->workers[c * workers / chunks].queue, &job)) {
+      tpool_run(pool, &job);
+    }
+  }
+  tpool_wait(pool, &group);
+}